@@ -0,0 +1,949 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cfloat>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <string>
+#include <thread>
+
+#include "AssetManager.h"
+#include "RayTracingScene.h"
+#include "RayTracer.h"
+#include "WavefrontPathTracer.h"
+#include "TriangleBlock.h"
+#include "RayPacket.h"
+#include "ThreadPool.h"
+#include "MathUtils.h"
+#include "MeshCache.h"
+#include "MappedFile.h"
+#include "Denoiser.h"
+#include "StaticMeshEntity.h"
+
+using namespace Cyan;
+
+/**
+* Compares the scalar Moller-Trumbore routine against the AVX2 triangle block kernel by brute force intersecting
+* random rays against a soup of random triangles, the nearest hit of every ray is checked to match between the two.
+*/
+static void benchmarkTriangleIntersection(u32 numTriangles, u32 numRays)
+{
+    std::mt19937 rng(0u);
+    std::uniform_real_distribution<f32> dist(-1.f, 1.f);
+    auto randomPoint = [&rng, &dist]() {
+        return glm::vec3(dist(rng), dist(rng), dist(rng));
+    };
+
+    std::vector<glm::vec3> positions(numTriangles * 3);
+    for (u32 tri = 0; tri < numTriangles; ++tri)
+    {
+        glm::vec3 center = randomPoint();
+        for (u32 v = 0; v < 3; ++v)
+        {
+            positions[tri * 3 + v] = center + randomPoint() * .1f;
+        }
+    }
+    std::vector<glm::vec3> rayOrigins(numRays), rayDirections(numRays);
+    for (u32 i = 0; i < numRays; ++i)
+    {
+        rayOrigins[i] = randomPoint() * 2.f;
+        rayDirections[i] = glm::normalize(randomPoint() * .5f - rayOrigins[i]);
+    }
+
+    // pack the whole soup into consecutive blocks, same layout as TriangleBlockArray builds for a leaf
+    std::vector<TriangleBlock, AlignedAllocator<TriangleBlock, 64>> blocks((numTriangles + TriangleBlock::kWidth - 1) / TriangleBlock::kWidth);
+    memset(blocks.data(), 0, blocks.size() * sizeof(TriangleBlock));
+    for (u32 tri = 0; tri < numTriangles; ++tri)
+    {
+        TriangleBlock& block = blocks[tri / TriangleBlock::kWidth];
+        u32 lane = tri % TriangleBlock::kWidth;
+        glm::vec3 edge1 = positions[tri * 3 + 1] - positions[tri * 3 + 0];
+        glm::vec3 edge2 = positions[tri * 3 + 2] - positions[tri * 3 + 0];
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            block.v0[axis][lane] = positions[tri * 3 + 0][axis];
+            block.edge1[axis][lane] = edge1[axis];
+            block.edge2[axis][lane] = edge2[axis];
+        }
+        block.triangles[lane] = tri;
+    }
+
+    std::vector<i32> scalarHits(numRays, -1), blockHits(numRays, -1);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (u32 i = 0; i < numRays; ++i)
+    {
+        f32 closestT = FLT_MAX;
+        for (u32 tri = 0; tri < numTriangles; ++tri)
+        {
+            f32 t = intersectTriangle(rayOrigins[i], rayDirections[i], positions[tri * 3 + 0], positions[tri * 3 + 1], positions[tri * 3 + 2]);
+            if (t > 0.f && t < closestT)
+            {
+                closestT = t;
+                scalarHits[i] = tri;
+            }
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    f64 scalarSeconds = std::chrono::duration<f64>(end - start).count();
+
+    bool bAVX2 = (getSIMDLevel() == SIMDLevel::kAVX2);
+    f64 blockSeconds = 0.0;
+    if (bAVX2)
+    {
+        start = std::chrono::high_resolution_clock::now();
+        for (u32 i = 0; i < numRays; ++i)
+        {
+            f32 closestT = FLT_MAX;
+            for (const auto& block : blocks)
+            {
+                u32 tri;
+                f32 t = intersectTriangleBlock(block, rayOrigins[i], rayDirections[i], closestT, tri);
+                if (t < closestT)
+                {
+                    closestT = t;
+                    blockHits[i] = tri;
+                }
+            }
+        }
+        end = std::chrono::high_resolution_clock::now();
+        blockSeconds = std::chrono::duration<f64>(end - start).count();
+    }
+
+    f64 numTests = (f64)numTriangles * numRays;
+    printf("triangle intersection: %u triangles x %u rays\n", numTriangles, numRays);
+    printf("  scalar:         %8.2f ms %8.2f Mtests/s\n", scalarSeconds * 1000.0, numTests / scalarSeconds / 1e6);
+    if (bAVX2)
+    {
+        u32 numMismatches = 0u;
+        for (u32 i = 0; i < numRays; ++i)
+        {
+            numMismatches += (scalarHits[i] != blockHits[i]) ? 1u : 0u;
+        }
+        printf("  avx2 block x%u: %8.2f ms %8.2f Mtests/s, %.2fx speedup, %u mismatches\n", TriangleBlock::kWidth, blockSeconds * 1000.0, numTests / blockSeconds / 1e6, scalarSeconds / blockSeconds, numMismatches);
+    }
+    else
+    {
+        printf("  avx2 block: skipped, cpu reports %s\n", getSIMDLevelName(getSIMDLevel()));
+    }
+}
+
+/**
+* Times building a BVH over a soup of random triangles with every build method on the shared thread pool, the thread
+* count is printed along with the timings since the linear builder scales with it
+*/
+static void benchmarkBVHBuild(u32 numTriangles)
+{
+    std::mt19937 rng(1u);
+    std::uniform_real_distribution<f32> dist(-10.f, 10.f);
+    std::vector<glm::vec3> positions(numTriangles * 3);
+    for (u32 tri = 0; tri < numTriangles; ++tri)
+    {
+        glm::vec3 center(dist(rng), dist(rng), dist(rng));
+        for (u32 v = 0; v < 3; ++v)
+        {
+            positions[tri * 3 + v] = center + glm::vec3(dist(rng), dist(rng), dist(rng)) * .005f;
+        }
+    }
+    std::vector<BVHPrimitive> primitives;
+    calcTrianglePrimitives(positions, primitives);
+
+    struct BuildConfig
+    {
+        const char* name;
+        BVHBuildMethod buildMethod;
+        u32 numTreeletPasses;
+    };
+    const BuildConfig configs[] = {
+        { "binned sah", BVHBuildMethod::kBinnedSAH, 0u },
+        { "linear", BVHBuildMethod::kLinear, 0u },
+        { "linear + 1 treelet pass", BVHBuildMethod::kLinear, 1u },
+    };
+    printf("bvh build: %u triangles on %u threads\n", numTriangles, ThreadPool::get()->getNumWorkers());
+    for (const BuildConfig& config : configs)
+    {
+        BVH bvh;
+        bvh.buildMethod = config.buildMethod;
+        bvh.numTreeletPasses = config.numTreeletPasses;
+        auto start = std::chrono::high_resolution_clock::now();
+        bvh.build(primitives);
+        f64 ms = std::chrono::duration<f64, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        printf("  %-24s %8.2f ms, sah cost %.3f\n", config.name, ms, bvh.computeSAHCost());
+    }
+}
+
+struct SceneBenchmarkSettings
+{
+    const char* scenePath = nullptr;
+    const char* jsonPath = nullptr;
+    const char* bvhCacheDirectory = nullptr;
+    glm::uvec2 resolution = glm::uvec2(640u, 360u);
+    // the scene's own camera plus views orbiting the scene bounds
+    u32 numViews = 4u;
+};
+
+struct TraversalCounters
+{
+    // internal nodes whose children were tested
+    u64 numNodes = 0u;
+    u64 numLeaves = 0u;
+    u64 numTriangleTests = 0u;
+
+    void add(const TraversalCounters& counters)
+    {
+        numNodes += counters.numNodes;
+        numLeaves += counters.numLeaves;
+        numTriangleTests += counters.numTriangleTests;
+    }
+};
+
+struct RayTypeResult
+{
+    u64 numRays = 0u;
+    f64 seconds = 0.0;
+    // only gathered for closest hit rays
+    TraversalCounters counters;
+
+    f64 getMraysPerSecond() const { return seconds > 0.0 ? (f64)numRays / seconds / 1e6 : 0.0; }
+};
+
+// whole multi bounce renders through RayTracer::RenderMode::kWavefront, rays counts every wave
+struct WavefrontResult
+{
+    RayTypeResult rays;
+    f64 sortMs = 0.0;
+    f64 traceMs = 0.0;
+    f64 shadeMs = 0.0;
+
+    void add(const WavefrontPathTracer::Stats& stats, f64 seconds)
+    {
+        rays.numRays += stats.numRays;
+        rays.seconds += seconds;
+        sortMs += stats.sortMs;
+        traceMs += stats.traceMs;
+        shadeMs += stats.shadeMs;
+    }
+};
+
+struct BVHStats
+{
+    u32 numNodes = 0u;
+    u32 numLeaves = 0u;
+    f32 sahCost = 0.f;
+    u64 memoryBytes = 0u;
+};
+
+static const u32 kRayBatchSize = 1024u;
+// offset along the normal for rays leaving a surface
+static const f32 kRayOffset = 1e-3f;
+
+static BVHStats calcBVHStats(const BVH& bvh)
+{
+    BVHStats stats;
+    for (u32 i = 0; i < bvh.numNodes; ++i)
+    {
+        // skip the padding node
+        if (i == 1)
+        {
+            continue;
+        }
+        stats.numNodes++;
+        stats.numLeaves += bvh.nodes[i].isLeaf() ? 1u : 0u;
+    }
+    stats.sahCost = bvh.computeSAHCost();
+    stats.memoryBytes = bvh.nodes.size() * sizeof(BVHNode) + (bvh.primitiveIndices.size() + bvh.parentIndices.size() + bvh.primitiveLeaves.size()) * sizeof(u32);
+    return stats;
+}
+
+static f32 intersectBox(const Ray& ray, const glm::vec3& invRd, const BVHNode& node, f32 tMax)
+{
+    glm::vec3 t0 = (node.aabbMin - ray.ro) * invRd;
+    glm::vec3 t1 = (node.aabbMax - ray.ro) * invRd;
+    glm::vec3 tNear = vec3Min(t0, t1), tFar = vec3Max(t0, t1);
+    f32 tEnter = Max(Max(tNear.x, tNear.y), tNear.z);
+    f32 tExit = Min(Min(tFar.x, tFar.y), tFar.z);
+    return (tExit >= tEnter && tExit > 0.f && tEnter < tMax) ? tEnter : FLT_MAX;
+}
+
+/**
+* Same front to back closest hit traversal as traceTLAS() / traceBLAS(), but counting the work done instead of being
+* fast. Only used for the statistics, never for the timings.
+*/
+template <typename IntersectLeaf>
+static void countTraversal(const BVH& bvh, const Ray& ray, const f32& tMax, TraversalCounters& counters, const IntersectLeaf& intersectLeaf)
+{
+    if (bvh.empty())
+    {
+        return;
+    }
+    glm::vec3 invRd = 1.f / ray.rd;
+    const BVHNode* node = &bvh.getRoot();
+    if (intersectBox(ray, invRd, *node, tMax) == FLT_MAX)
+    {
+        return;
+    }
+    const BVHNode* stack[BVH::kMaxDepth];
+    u32 stackSize = 0u;
+    while (true)
+    {
+        if (node->isLeaf())
+        {
+            counters.numLeaves++;
+            intersectLeaf(*node);
+            if (stackSize == 0)
+            {
+                break;
+            }
+            node = stack[--stackSize];
+            continue;
+        }
+        counters.numNodes++;
+        const BVHNode* nearChild = &bvh.nodes[node->leftFirst];
+        const BVHNode* farChild = nearChild + 1;
+        f32 tNear = intersectBox(ray, invRd, *nearChild, tMax);
+        f32 tFar = intersectBox(ray, invRd, *farChild, tMax);
+        if (tNear > tFar)
+        {
+            std::swap(tNear, tFar);
+            std::swap(nearChild, farChild);
+        }
+        if (tNear == FLT_MAX)
+        {
+            if (stackSize == 0)
+            {
+                break;
+            }
+            node = stack[--stackSize];
+        }
+        else
+        {
+            node = nearChild;
+            if (tFar != FLT_MAX)
+            {
+                stack[stackSize++] = farChild;
+            }
+        }
+    }
+}
+
+static void traceCounted(const RayTracingScene& rtxScene, const Ray& ray, TraversalCounters& counters)
+{
+    RayHit hit;
+    countTraversal(rtxScene.tlas, ray, hit.t, counters, [&](const BVHNode& tlasLeaf) {
+        for (u32 i = 0; i < tlasLeaf.count; ++i)
+        {
+            u32 instance = rtxScene.tlas.primitiveIndices[tlasLeaf.leftFirst + i];
+            const RayTracingMesh& mesh = rtxScene.meshes[rtxScene.meshInstances[instance].parent];
+            Ray rayOS = transformRay(rtxScene.meshInstances[instance].worldToObject, ray);
+            countTraversal(mesh.blas, rayOS, hit.t, counters, [&](const BVHNode& leaf) {
+                counters.numTriangleTests += leaf.count;
+                for (u32 p = 0; p < leaf.count; ++p)
+                {
+                    u32 tri = mesh.blas.primitiveIndices[leaf.leftFirst + p];
+                    const glm::vec3* v = &mesh.triangles.positions[tri * 3];
+                    f32 t = intersectTriangle(rayOS.ro, rayOS.rd, v[0], v[1], v[2]);
+                    if (t > 0.f && t < hit.t)
+                    {
+                        hit.t = t;
+                    }
+                }
+            });
+        }
+    });
+}
+
+// wall clock seconds for running 'trace' over all rays on the thread pool
+template <typename Trace>
+static f64 timeRays(u32 numRays, const Trace& trace)
+{
+    u32 numBatches = (numRays + kRayBatchSize - 1) / kRayBatchSize;
+    auto start = std::chrono::high_resolution_clock::now();
+    ThreadPool::get()->parallelFor(numBatches, [&](u32 batch) {
+        u32 end = Min(numRays, (batch + 1) * kRayBatchSize);
+        for (u32 i = batch * kRayBatchSize; i < end; ++i)
+        {
+            trace(i);
+        }
+    });
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration<f64>(end - start).count();
+}
+
+static TraversalCounters countRays(const RayTracingScene& rtxScene, const std::vector<Ray>& rays)
+{
+    u32 numBatches = ((u32)rays.size() + kRayBatchSize - 1) / kRayBatchSize;
+    std::vector<TraversalCounters> batchCounters(numBatches);
+    ThreadPool::get()->parallelFor(numBatches, [&](u32 batch) {
+        u32 end = Min((u32)rays.size(), (batch + 1) * kRayBatchSize);
+        for (u32 i = batch * kRayBatchSize; i < end; ++i)
+        {
+            traceCounted(rtxScene, rays[i], batchCounters[batch]);
+        }
+    });
+    TraversalCounters counters;
+    for (const auto& c : batchCounters)
+    {
+        counters.add(c);
+    }
+    return counters;
+}
+
+static void writeJsonString(FILE* file, const char* str)
+{
+    fputc('"', file);
+    for (const char* c = str; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fputc('\\', file);
+        }
+        fputc(*c, file);
+    }
+    fputc('"', file);
+}
+
+static void writeWavefrontJson(FILE* file, const char* name, const WavefrontResult& result, bool bLast)
+{
+    fprintf(file, "    \"%s\": { \"rays\": %llu, \"seconds\": %.6f, \"mraysPerSecond\": %.3f, \"sortMs\": %.3f, \"traceMs\": %.3f, \"shadeMs\": %.3f }%s\n",
+        name, (unsigned long long)result.rays.numRays, result.rays.seconds, result.rays.getMraysPerSecond(), result.sortMs, result.traceMs, result.shadeMs, bLast ? "" : ",");
+}
+
+static void writeRayTypeJson(FILE* file, const char* name, const RayTypeResult& result, bool bCounters, bool bLast)
+{
+    fprintf(file, "    \"%s\": { \"rays\": %llu, \"seconds\": %.6f, \"mraysPerSecond\": %.3f", name, (unsigned long long)result.numRays, result.seconds, result.getMraysPerSecond());
+    if (bCounters && result.numRays > 0u)
+    {
+        f64 numRays = (f64)result.numRays;
+        fprintf(file, ", \"avgNodesVisited\": %.3f, \"avgLeavesVisited\": %.3f, \"avgTriangleTests\": %.3f",
+            result.counters.numNodes / numRays, result.counters.numLeaves / numRays, result.counters.numTriangleTests / numRays);
+    }
+    fprintf(file, " }%s\n", bLast ? "" : ",");
+}
+
+/**
+* Imports a scene through AssetManager in headless mode, builds a RayTracingScene and traces primary, shadow and diffuse
+* rays for a fixed set of camera views, primary rays once one by one and once in simd packets, then renders every view in wavefront mode with and without sorting secondary
+* rays. Timings are wall clock over the whole thread pool, traversal statistics are gathered in a separate untimed pass.
+* Results are written as json to 'settings.jsonPath', or stdout.
+*/
+static bool benchmarkScene(const SceneBenchmarkSettings& settings)
+{
+    using Clock = std::chrono::high_resolution_clock;
+    f32 aspectRatio = (f32)settings.resolution.x / settings.resolution.y;
+
+    setHeadless(true);
+    AssetManager assetManager;
+    Cyan::Scene scene("Benchmark", aspectRatio);
+    auto start = Clock::now();
+    assetManager.importScene(&scene, settings.scenePath);
+    f64 importMs = std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+    scene.update();
+
+    start = Clock::now();
+    RayTracingScene rtxScene(scene, settings.bvhCacheDirectory);
+    f64 buildMs = std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+    if (rtxScene.tlas.empty())
+    {
+        fprintf(stderr, "%s has no geometry to trace\n", settings.scenePath);
+        return false;
+    }
+
+    std::vector<PerspectiveCamera> views;
+    views.push_back(rtxScene.camera);
+    views.back().aspectRatio = aspectRatio;
+    const BVHNode& sceneBounds = rtxScene.tlas.getRoot();
+    glm::vec3 center = (sceneBounds.aabbMin + sceneBounds.aabbMax) * .5f;
+    f32 radius = glm::length(sceneBounds.aabbMax - sceneBounds.aabbMin) * .5f;
+    for (u32 v = 1; v < settings.numViews; ++v)
+    {
+        f32 angle = 2.f * M_PI * (f32)(v - 1) / (f32)(settings.numViews - 1);
+        glm::vec3 position = center + glm::vec3(glm::cos(angle) * radius * 1.5f, radius * .5f, glm::sin(angle) * radius * 1.5f);
+        views.push_back(PerspectiveCamera(position, center, glm::vec3(0.f, 1.f, 0.f), 45.f, .1f, radius * 4.f, aspectRatio));
+    }
+
+    glm::vec3 lightDirection = glm::normalize(glm::vec3(.3f, 1.f, .2f));
+    u32 numPixels = settings.resolution.x * settings.resolution.y;
+    RayTypeResult primary, primaryPackets, shadow, diffuse;
+    const u32 packetWidth = getPacketWidth(getSIMDLevel());
+    RayTracer rayTracer;
+    rayTracer.renderMode = RayTracer::RenderMode::kWavefront;
+    Image wavefrontImage(settings.resolution);
+    WavefrontResult wavefrontSorted, wavefrontUnsorted;
+    for (u32 v = 0; v < (u32)views.size(); ++v)
+    {
+        std::vector<Ray> primaryRays(numPixels);
+        for (u32 y = 0; y < settings.resolution.y; ++y)
+        {
+            for (u32 x = 0; x < settings.resolution.x; ++x)
+            {
+                glm::vec2 pixelCoords = (glm::vec2(x, y) + .5f) / glm::vec2(settings.resolution);
+                primaryRays[y * settings.resolution.x + x] = generateRay(views[v], pixelCoords);
+            }
+        }
+        std::vector<RayHit> hits(numPixels);
+        primary.seconds += timeRays(numPixels, [&](u32 i) {
+            traceTLAS(rtxScene, primaryRays[i], hits[i]);
+        });
+        primary.numRays += numPixels;
+        primary.counters.add(countRays(rtxScene, primaryRays));
+
+        // the same primary rays in packets of packetWidth / 2 by 2 pixels, the blocks RayTracer::renderTilePackets traces
+        if (packetWidth > 1u)
+        {
+            const glm::uvec2 blockSize(packetWidth / 2u, 2u);
+            std::vector<Ray> packetRays;
+            std::vector<u32> packetSizes;
+            for (u32 blockY = 0; blockY < settings.resolution.y; blockY += blockSize.y)
+            {
+                for (u32 blockX = 0; blockX < settings.resolution.x; blockX += blockSize.x)
+                {
+                    u32 numRays = 0u;
+                    for (u32 y = blockY; y < Min(blockY + blockSize.y, settings.resolution.y); ++y)
+                    {
+                        for (u32 x = blockX; x < Min(blockX + blockSize.x, settings.resolution.x); ++x)
+                        {
+                            packetRays.push_back(primaryRays[y * settings.resolution.x + x]);
+                            numRays++;
+                        }
+                    }
+                    // every packet starts at a multiple of the packet width
+                    Ray padding = packetRays.back();
+                    packetRays.resize(packetRays.size() + packetWidth - numRays, padding);
+                    packetSizes.push_back(numRays);
+                }
+            }
+            std::vector<RayHit> packetHits(packetRays.size());
+            primaryPackets.seconds += timeRays((u32)packetSizes.size(), [&](u32 p) {
+                if (packetWidth == 8u)
+                {
+                    tracePacket8(rtxScene, &packetRays[p * 8u], packetSizes[p], &packetHits[p * 8u]);
+                }
+                else
+                {
+                    tracePacket4(rtxScene, &packetRays[p * 4u], packetSizes[p], &packetHits[p * 4u]);
+                }
+            });
+            primaryPackets.numRays += numPixels;
+        }
+
+        // secondary rays start at every primary hit, diffuse directions are cosine distributed from a halton sequence
+        std::vector<Ray> shadowRays, diffuseRays;
+        for (u32 i = 0; i < numPixels; ++i)
+        {
+            if (hits[i].instance < 0)
+            {
+                continue;
+            }
+            glm::vec3 n = calcHitNormal(rtxScene, hits[i]);
+            if (glm::dot(n, primaryRays[i].rd) > 0.f)
+            {
+                n = -n;
+            }
+            glm::vec3 p = primaryRays[i].ro + primaryRays[i].rd * hits[i].t + n * kRayOffset;
+            shadowRays.push_back(Ray{ p, lightDirection });
+
+            u32 sampleIndex = v * numPixels + i;
+            f32 u0 = radicalInverse(2u, sampleIndex), u1 = radicalInverse(3u, sampleIndex);
+            f32 r = sqrtf(u0), phi = 2.f * M_PI * u1;
+            glm::vec3 tangent, bitangent;
+            calcOrthonormalBasis(n, tangent, bitangent);
+            glm::vec3 rd = tangent * (r * glm::cos(phi)) + bitangent * (r * glm::sin(phi)) + n * sqrtf(Max(0.f, 1.f - u0));
+            diffuseRays.push_back(Ray{ p, glm::normalize(rd) });
+        }
+
+        std::vector<u8> occluded(shadowRays.size());
+        shadow.seconds += timeRays((u32)shadowRays.size(), [&](u32 i) {
+            occluded[i] = occludedTLAS(rtxScene, shadowRays[i], FLT_MAX) ? 1u : 0u;
+        });
+        shadow.numRays += shadowRays.size();
+
+        std::vector<RayHit> diffuseHits(diffuseRays.size());
+        diffuse.seconds += timeRays((u32)diffuseRays.size(), [&](u32 i) {
+            traceTLAS(rtxScene, diffuseRays[i], diffuseHits[i]);
+        });
+        diffuse.numRays += diffuseRays.size();
+        diffuse.counters.add(countRays(rtxScene, diffuseRays));
+
+        // the same paths with and without sorting secondary rays, which is what the wavefront tracer's coherence comes from
+        WavefrontPathTracer& wavefront = rayTracer.getWavefrontPathTracer();
+        for (u32 pass = 0; pass < 2u; ++pass)
+        {
+            wavefront.bSortRays = (pass == 0u);
+            start = Clock::now();
+            rayTracer.renderScene(rtxScene, views[v], wavefrontImage, []() { });
+            f64 seconds = std::chrono::duration<f64>(Clock::now() - start).count();
+            (wavefront.bSortRays ? wavefrontSorted : wavefrontUnsorted).add(wavefront.getStats(), seconds);
+        }
+    }
+
+    BVHStats tlasStats = calcBVHStats(rtxScene.tlas);
+    BVHStats blasStats;
+    u64 numTriangles = 0u, triangleBytes = 0u, triangleBlockBytes = 0u;
+    f64 weightedSAHCost = 0.0;
+    std::vector<BVHStats> meshStats;
+    for (const auto& mesh : rtxScene.meshes)
+    {
+        meshStats.push_back(calcBVHStats(mesh.blas));
+        const BVHStats& stats = meshStats.back();
+        blasStats.numNodes += stats.numNodes;
+        blasStats.numLeaves += stats.numLeaves;
+        blasStats.memoryBytes += stats.memoryBytes;
+        numTriangles += mesh.triangles.numTriangles();
+        weightedSAHCost += (f64)stats.sahCost * mesh.triangles.numTriangles();
+        triangleBytes += mesh.triangles.positions.size() * sizeof(glm::vec3) * 2u + mesh.triangles.tangents.size() * sizeof(glm::vec4)
+            + mesh.triangles.texCoords.size() * sizeof(glm::vec2) + mesh.submeshIndices.size() * sizeof(u32);
+        triangleBlockBytes += mesh.triangleBlocks.blocks.size() * sizeof(TriangleBlock) + mesh.triangleBlocks.leafBlocks.size() * sizeof(u32);
+    }
+    // sah costs of the blas are normalized by their own root, weigh them by triangle count to get one number for the scene
+    blasStats.sahCost = numTriangles > 0u ? (f32)(weightedSAHCost / numTriangles) : 0.f;
+
+    FILE* file = settings.jsonPath ? fopen(settings.jsonPath, "w") : stdout;
+    if (file == nullptr)
+    {
+        fprintf(stderr, "Failed to open %s for writing\n", settings.jsonPath);
+        return false;
+    }
+    fprintf(file, "{\n  \"scene\": ");
+    writeJsonString(file, settings.scenePath);
+    fprintf(file, ",\n  \"resolution\": [%u, %u],\n  \"views\": %u,\n", settings.resolution.x, settings.resolution.y, (u32)views.size());
+    fprintf(file, "  \"threads\": %u,\n  \"simd\": \"%s\",\n", ThreadPool::get()->getNumWorkers(), getSIMDLevelName(getSIMDLevel()));
+    fprintf(file, "  \"importMs\": %.3f,\n  \"buildMs\": %.3f,\n", importMs, buildMs);
+    fprintf(file, "  \"rays\": {\n");
+    writeRayTypeJson(file, "primary", primary, true, false);
+    fprintf(file, "    \"primaryPackets\": { \"width\": %u, \"rays\": %llu, \"seconds\": %.6f, \"mraysPerSecond\": %.3f, \"speedup\": %.3f },\n",
+        packetWidth, (unsigned long long)primaryPackets.numRays, primaryPackets.seconds, primaryPackets.getMraysPerSecond(),
+        primaryPackets.seconds > 0.0 ? primary.seconds / primaryPackets.seconds : 0.0);
+    writeRayTypeJson(file, "shadow", shadow, false, false);
+    writeRayTypeJson(file, "diffuse", diffuse, true, true);
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"wavefront\": {\n");
+    writeWavefrontJson(file, "sorted", wavefrontSorted, false);
+    writeWavefrontJson(file, "unsorted", wavefrontUnsorted, true);
+    fprintf(file, "  },\n");
+    fprintf(file, "  \"tlas\": { \"instances\": %u, \"nodes\": %u, \"leaves\": %u, \"sahCost\": %.4f, \"memoryBytes\": %llu },\n",
+        (u32)rtxScene.meshInstances.size(), tlasStats.numNodes, tlasStats.numLeaves, tlasStats.sahCost, (unsigned long long)tlasStats.memoryBytes);
+    fprintf(file, "  \"blas\": { \"meshes\": %u, \"triangles\": %llu, \"nodes\": %u, \"leaves\": %u, \"sahCost\": %.4f, \"memoryBytes\": %llu },\n",
+        (u32)rtxScene.meshes.size(), (unsigned long long)numTriangles, blasStats.numNodes, blasStats.numLeaves, blasStats.sahCost, (unsigned long long)blasStats.memoryBytes);
+    fprintf(file, "  \"meshes\": [\n");
+    for (u32 m = 0; m < (u32)meshStats.size(); ++m)
+    {
+        fprintf(file, "    { \"triangles\": %u, \"nodes\": %u, \"leaves\": %u, \"sahCost\": %.4f }%s\n",
+            rtxScene.meshes[m].triangles.numTriangles(), meshStats[m].numNodes, meshStats[m].numLeaves, meshStats[m].sahCost, (m + 1 < meshStats.size()) ? "," : "");
+    }
+    fprintf(file, "  ],\n");
+    fprintf(file, "  \"memoryBytes\": { \"bvh\": %llu, \"triangles\": %llu, \"triangleBlocks\": %llu }\n}\n",
+        (unsigned long long)(tlasStats.memoryBytes + blasStats.memoryBytes), (unsigned long long)triangleBytes, (unsigned long long)triangleBlockBytes);
+    if (file != stdout)
+    {
+        fclose(file);
+    }
+    return true;
+}
+
+static bool writeCheckFile(const std::string& filename, const std::vector<u8>& data)
+{
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        fprintf(stderr, "Failed to write %s\n", filename.c_str());
+        return false;
+    }
+    fwrite(data.data(), 1, data.size(), file);
+    fclose(file);
+    return true;
+}
+
+/**
+* Caches a mesh of a .gltf file pulling its geometry from a .bin buffer, then changes only the buffer and expects the
+* cached mesh to be rejected
+*/
+static bool checkMeshCacheBufferChange(const std::string& directory)
+{
+    std::string gltfFilename = directory + "check.gltf";
+    std::string bufferFilename = directory + "check.bin";
+    std::vector<u8> buffer(36u * 3u, 0u);
+    if (!writeCheckFile(gltfFilename, std::vector<u8>({ '{', '}' })) || !writeCheckFile(bufferFilename, buffer))
+    {
+        return false;
+    }
+
+    std::vector<Triangles::Vertex> vertices(3);
+    vertices[1].pos = glm::vec3(1.f, 0.f, 0.f);
+    vertices[2].pos = glm::vec3(0.f, 1.f, 0.f);
+    std::vector<ISubmesh*> submeshes = { new Mesh::Submesh<Triangles>(vertices, std::vector<u32>({ 0u, 1u, 2u })) };
+    MeshCache cache((directory + "meshes/").c_str());
+    auto releaseSubmeshes = [](std::vector<ISubmesh*>& submeshes) {
+        for (ISubmesh* submesh : submeshes)
+        {
+            delete dynamic_cast<Mesh::Submesh<Triangles>*>(submesh);
+        }
+        submeshes.clear();
+    };
+
+    bool bPassed = true;
+    {
+        MeshCache::Source source(gltfFilename.c_str(), { bufferFilename });
+        std::vector<ISubmesh*> loadedSubmeshes;
+        bPassed = cache.save(source, "mesh", submeshes) && cache.load(source, "mesh", loadedSubmeshes) && loadedSubmeshes.size() == 1u;
+        releaseSubmeshes(loadedSubmeshes);
+    }
+    // the cache only hashes files whose write time changed, so keep rewriting until the file system's clock ticks over
+    u64 writeTime = 0u, changedWriteTime = 0u;
+    bPassed = bPassed && getFileWriteTime(bufferFilename.c_str(), writeTime);
+    buffer[0] = 1u;
+    for (u32 attempt = 0; bPassed && changedWriteTime == writeTime && attempt < 100u; ++attempt)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        bPassed = writeCheckFile(bufferFilename, buffer) && getFileWriteTime(bufferFilename.c_str(), changedWriteTime);
+    }
+    if (bPassed)
+    {
+        MeshCache::Source source(gltfFilename.c_str(), { bufferFilename });
+        std::vector<ISubmesh*> loadedSubmeshes;
+        bPassed = !cache.load(source, "mesh", loadedSubmeshes);
+        releaseSubmeshes(loadedSubmeshes);
+    }
+    releaseSubmeshes(submeshes);
+    return bPassed;
+}
+
+/**
+* Denoises the same noisy image once with the simd kernels and once filtering every pixel with the scalar kernel, which
+* otherwise only handles the image borders, and expects both to weigh every tap the same
+*/
+static bool checkDenoiserKernels(const std::string& directory)
+{
+    const glm::uvec2 size(67u, 23u);
+    std::mt19937 rng(0u);
+    std::uniform_real_distribution<f32> dist(0.f, 1.f);
+    Image color(size);
+    AOVBuffer aovs(size);
+    for (u32 i = 0; i < size.x * size.y; ++i)
+    {
+        // two planes at different depths with noisy lighting and some texture
+        bool bBackground = (i % size.x) > size.x / 2u;
+        color.pixels[i] = glm::vec3(dist(rng), dist(rng), dist(rng)) * (bBackground ? 4.f : 1.f);
+        aovs.albedo[i] = glm::vec3(.25f + dist(rng) * .5f);
+        aovs.normals[i] = glm::normalize(glm::vec3(dist(rng) * .2f, bBackground ? 1.f : 0.f, bBackground ? 0.f : 1.f));
+        aovs.depth[i] = (bBackground ? 10.f : 2.f) + dist(rng) * .01f;
+    }
+
+    ATrousDenoiser denoiser;
+    Image simdImage(size), scalarImage(size);
+    denoiser.denoise(color, aovs, simdImage);
+    denoiser.settings.bSIMD = false;
+    denoiser.denoise(color, aovs, scalarImage);
+
+    f32 maxError = 0.f;
+    for (u32 i = 0; i < size.x * size.y; ++i)
+    {
+        for (i32 c = 0; c < 3; ++c)
+        {
+            f32 error = fabsf(simdImage.pixels[i][c] - scalarImage.pixels[i][c]) / Max(fabsf(scalarImage.pixels[i][c]), 1e-3f);
+            maxError = Max(maxError, error);
+        }
+    }
+    if (maxError > 1e-6f)
+    {
+        fprintf(stderr, "simd and scalar denoiser kernels differ by up to %g relative to the scalar result\n", maxError);
+        return false;
+    }
+    return true;
+}
+
+/**
+* Moves the dynamic half of a grid of cubes over a few RayTracingScene::update() calls, then checks that tracing the
+* refitted scene hits the same triangles as tracing a RayTracingScene freshly built from the moved scene.
+*/
+static bool checkRayTracingSceneUpdate(const std::string& directory)
+{
+    AssetManager assetManager;
+    Cyan::Scene scene("RayTracingSceneUpdate", 1.f);
+
+    std::vector<Triangles::Vertex> vertices(8);
+    for (u32 v = 0; v < 8u; ++v)
+    {
+        vertices[v].pos = glm::vec3((v & 1u) ? .5f : -.5f, (v & 2u) ? .5f : -.5f, (v & 4u) ? .5f : -.5f);
+    }
+    std::vector<u32> indices({
+        0, 2, 1, 1, 2, 3,
+        4, 5, 6, 5, 7, 6,
+        0, 1, 4, 1, 5, 4,
+        2, 6, 3, 3, 6, 7,
+        0, 4, 2, 2, 4, 6,
+        1, 3, 5, 3, 7, 5
+    });
+    std::vector<ISubmesh*> submeshes;
+    submeshes.push_back(AssetManager::createSubmesh<Triangles>(vertices, indices));
+    Cyan::Mesh* cube = AssetManager::createMesh("RayTracingSceneUpdateCube", submeshes);
+
+    // cells are far enough apart that no cube leaves its own cell, so that hits never tie between two instances
+    const u32 kGridSize = 4u;
+    const f32 kCellSize = 4.f;
+    std::vector<StaticMeshEntity*> dynamicEntities;
+    std::vector<glm::vec3> cellCenters;
+    for (u32 i = 0; i < kGridSize * kGridSize; ++i)
+    {
+        char name[64];
+        sprintf_s(name, "Cube%u", i);
+        glm::vec3 position((f32)(i % kGridSize) * kCellSize, 0.f, (f32)(i / kGridSize) * kCellSize);
+        bool bDynamic = (i & 1u) != 0u;
+        u32 properties = (bDynamic ? EntityFlag_kDynamic : EntityFlag_kStatic) | EntityFlag_kVisible;
+        StaticMeshEntity* entity = scene.createStaticMeshEntity(name, Transform(position), cube, nullptr, properties);
+        if (bDynamic)
+        {
+            dynamicEntities.push_back(entity);
+            cellCenters.push_back(position);
+        }
+    }
+    scene.update();
+    RayTracingScene rtxScene(scene);
+
+    std::mt19937 rng(0u);
+    std::uniform_real_distribution<f32> dist(-1.f, 1.f);
+    for (u32 step = 0; step < 3u; ++step)
+    {
+        for (u32 i = 0; i < (u32)dynamicEntities.size(); ++i)
+        {
+            glm::vec3 offset(dist(rng), dist(rng), dist(rng));
+            glm::quat rotation = glm::angleAxis(dist(rng) * (f32)M_PI, glm::normalize(glm::vec3(dist(rng), 1.f, dist(rng))));
+            dynamicEntities[i]->setLocalTransform(Transform(cellCenters[i] + offset, rotation, glm::vec3(1.f + dist(rng) * .5f)));
+        }
+        scene.update();
+        rtxScene.update();
+    }
+    RayTracingScene freshScene(scene);
+
+    u32 numRays = 0u, numHits = 0u, numMismatches = 0u;
+    const f32 kGridExtent = (f32)kGridSize * kCellSize;
+    for (u32 y = 0; y < 64u; ++y)
+    {
+        for (u32 x = 0; x < 64u; ++x)
+        {
+            glm::vec3 target(((f32)x + .5f) / 64.f * kGridExtent - kCellSize * .5f, 0.f, ((f32)y + .5f) / 64.f * kGridExtent - kCellSize * .5f);
+            glm::vec3 ro = target + glm::vec3(dist(rng) * 8.f, 10.f, dist(rng) * 8.f);
+            Ray ray{ ro, glm::normalize(target + glm::vec3(dist(rng), dist(rng), dist(rng)) - ro) };
+            RayHit updatedHit, freshHit;
+            traceTLAS(rtxScene, ray, updatedHit);
+            traceTLAS(freshScene, ray, freshHit);
+            numRays++;
+            numHits += (freshHit.instance >= 0) ? 1u : 0u;
+            if (updatedHit.instance != freshHit.instance || updatedHit.tri != freshHit.tri
+                || (freshHit.instance >= 0 && fabsf(updatedHit.t - freshHit.t) > 1e-4f * Max(freshHit.t, 1.f)))
+            {
+                numMismatches++;
+            }
+        }
+    }
+    if (numHits == 0u || numMismatches > 0u)
+    {
+        fprintf(stderr, "%u of %u rays (%u hits) traced differently through the updated scene than through a fresh build\n", numMismatches, numRays, numHits);
+        return false;
+    }
+    return true;
+}
+
+/**
+* Self checks of the engine's caches and kernels, scratch files are written to 'directory'. Returns whether every check
+* passed.
+*/
+static bool runChecks(const char* directory)
+{
+    setHeadless(true);
+    std::string scratchDirectory(directory);
+    if (scratchDirectory.back() != '/' && scratchDirectory.back() != '\\')
+    {
+        scratchDirectory.push_back('/');
+    }
+    createDirectories(scratchDirectory.c_str());
+
+    struct Check
+    {
+        const char* name;
+        bool (*run)(const std::string& directory);
+    };
+    const Check checks[] = {
+        { "mesh cache rejects changed gltf buffers", checkMeshCacheBufferChange },
+        { "denoiser simd kernels match the scalar one", checkDenoiserKernels },
+        { "ray tracing scene update matches a fresh build", checkRayTracingSceneUpdate },
+    };
+    bool bPassed = true;
+    for (const Check& check : checks)
+    {
+        bool bCheckPassed = check.run(scratchDirectory);
+        printf("%s: %s\n", bCheckPassed ? "passed" : "FAILED", check.name);
+        bPassed = bPassed && bCheckPassed;
+    }
+    return bPassed;
+}
+
+int main(int argc, char** argv)
+{
+    u32 numTriangles = 4096u;
+    u32 numRays = 4096u;
+    u32 numBVHTriangles = 0u;
+    SceneBenchmarkSettings sceneSettings;
+    const char* checkDirectory = nullptr;
+    for (i32 i = 1; i < argc - 1; ++i)
+    {
+        if (strcmp(argv[i], "--triangles") == 0)
+        {
+            numTriangles = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--rays") == 0)
+        {
+            numRays = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--bvh-triangles") == 0)
+        {
+            numBVHTriangles = (u32)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--scene") == 0)
+        {
+            sceneSettings.scenePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--json") == 0)
+        {
+            sceneSettings.jsonPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--bvh-cache") == 0)
+        {
+            sceneSettings.bvhCacheDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--width") == 0)
+        {
+            sceneSettings.resolution.x = Max((u32)atoi(argv[++i]), 1u);
+        }
+        else if (strcmp(argv[i], "--height") == 0)
+        {
+            sceneSettings.resolution.y = Max((u32)atoi(argv[++i]), 1u);
+        }
+        else if (strcmp(argv[i], "--views") == 0)
+        {
+            sceneSettings.numViews = Max((u32)atoi(argv[++i]), 1u);
+        }
+        else if (strcmp(argv[i], "--checks") == 0)
+        {
+            checkDirectory = argv[++i];
+        }
+    }
+
+    if (checkDirectory)
+    {
+        return runChecks(checkDirectory) ? 0 : 1;
+    }
+
+    // a scene switches to the headless ray tracer benchmark, otherwise only the triangle kernels are compared
+    if (sceneSettings.scenePath)
+    {
+        return benchmarkScene(sceneSettings) ? 0 : 1;
+    }
+    if (numBVHTriangles > 0u)
+    {
+        benchmarkBVHBuild(numBVHTriangles);
+        return 0;
+    }
+    benchmarkTriangleIntersection(numTriangles, numRays);
+    return 0;
+}
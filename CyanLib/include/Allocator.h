@@ -2,6 +2,7 @@
 
 #include <unordered_map>
 #include <stack>
+#include <malloc.h>
 
 #include "Common.h"
 
@@ -100,6 +101,42 @@ namespace Cyan
         std::vector<T> m_objects;
     };
 
+    /*
+    * std compatible allocator that aligns the allocated memory to 'kAlignment' bytes, mostly used to
+    * make std::vector storage start on a cache line boundary
+    */
+    template <typename T, u32 kAlignment>
+    class AlignedAllocator
+    {
+    public:
+        using value_type = T;
+
+        template <typename U>
+        struct rebind
+        {
+            using other = AlignedAllocator<U, kAlignment>;
+        };
+
+        AlignedAllocator() = default;
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, kAlignment>&) { }
+
+        T* allocate(size_t numElements)
+        {
+            return static_cast<T*>(_aligned_malloc(numElements * sizeof(T), kAlignment));
+        }
+
+        void deallocate(T* ptr, size_t numElements)
+        {
+            _aligned_free(ptr);
+        }
+
+        template <typename U>
+        bool operator==(const AlignedAllocator<U, kAlignment>&) const { return true; }
+        template <typename U>
+        bool operator!=(const AlignedAllocator<U, kAlignment>&) const { return false; }
+    };
+
     /*
     * Linear allocator that uses placement new
     */
@@ -4,6 +4,8 @@
 #include <string>
 #include <map>
 #include <algorithm>
+#include <memory>
+#include <atomic>
 
 #include "stb_image.h"
 #include "json.hpp"
@@ -15,8 +17,16 @@
 #include "Mesh.h"
 #include "Material.h"
 #include "CyanAPI.h"
+#include "TextureDecoder.h"
+#include "MeshCache.h"
+#include "TextureCache.h"
+#include "TextureStreamer.h"
+#include "MeshOptimizer.h"
+#include "ImportGraph.h"
 
 #define ASSET_PATH "C:/dev/cyanRenderEngine/asset/"
+#define MESH_CACHE_PATH ASSET_PATH "cache/mesh/"
+#define TEXTURE_CACHE_PATH ASSET_PATH "cache/texture/"
 
 namespace Cyan
 {
@@ -123,17 +133,47 @@ namespace Cyan
 
         static AssetManager* get() { return singleton; }
 
-        void importGltfNode(Scene* scene, tinygltf::Model& model, Entity* parent, tinygltf::Node& node);
-        Mesh* importGltfMesh(tinygltf::Model& model, tinygltf::Mesh& gltfMesh); 
+        /**
+        * Import tasks creating the meshes and entities of a scene file by name, for tasks added later on to depend on
+        */
+        struct SceneImportTasks
+        {
+            std::unordered_map<std::string, ImportGraph::TaskID> meshes;
+            std::unordered_map<std::string, ImportGraph::TaskID> entities;
+        };
+
         Cyan::Texture2DRenderable* importGltfTexture(const char* nodeName, tinygltf::Model& model, i32 index);
-        void importGltfTextures(const char* nodeName, tinygltf::Model& model);
+        /**
+        * Imports a gltf file the same way as a scene file, asynchronously unless that is disabled, in which case it is done
+        * by the time this returns
+        */
         static void importGltf(Scene* scene, const char* filename, const char* name=nullptr);
+        /**
+        * Adds the tasks importing a gltf file to 'graph', the file is parsed on a worker which then adds tasks for its
+        * textures, meshes and nodes. Returns the task creating the root entity named 'name', kInvalidTask without a name.
+        */
+        ImportGraph::TaskID importGltf(ImportGraph& graph, Scene* scene, const char* filename, const char* name);
         std::vector<ISubmesh*> importObj(const char* baseDir, const char* filename);
+
+        /**
+        * Imports the scene file 'file' into 'scene' through an ImportGraph. Textures are decoded and meshes are loaded on the
+        * thread pool, entities show up in 'scene' as soon as the meshes they use are created and material maps are bound as
+        * their textures are created, materials sample their constant factors until then. Unless asynchronous scene import is
+        * disabled or running headless this returns right away, leaving the rest of the import to update(), otherwise it
+        * blocks until the whole scene is imported. 'scene' has to outlive the import.
+        */
         void importScene(Scene* scene, const char* file);
-        void importEntities(Scene* scene, const nlohmann::basic_json<std::map>& entityInfoList);
-        void importTextures(const nlohmann::basic_json<std::map>& textureInfoList);
-        Mesh* importMesh(Scene* scene, std::string& path, const char* name, bool bNormalize);
-        void importMeshes(Scene* scene, const nlohmann::basic_json<std::map>& meshInfoList);
+        void importEntities(ImportGraph& graph, Scene* scene, const nlohmann::basic_json<std::map>& entityInfoList, SceneImportTasks& tasks);
+        void importTextures(ImportGraph& graph, const nlohmann::basic_json<std::map>& textureInfoList);
+        void importMesh(ImportGraph& graph, Scene* scene, const std::string& path, const char* name, bool bNormalize, SceneImportTasks& tasks);
+        void importMeshes(ImportGraph& graph, Scene* scene, const nlohmann::basic_json<std::map>& meshInfoList, SceneImportTasks& tasks);
+
+        /**
+        * Runs the tasks of asynchronous scene imports that have to be on the gl thread within a small time budget, has to be
+        * called once per frame on the thread owning the gl context
+        */
+        void update();
+        bool isImportingScene() const { return !m_importGraphs.empty(); }
 
         /**
         * Creating a texture from scratch; `name` must be unique
@@ -144,6 +184,21 @@ namespace Cyan
             {
                 outTexture = new Texture2DRenderable(name, spec, parameter);
                 singleton->addTexture(outTexture);
+                singleton->bindPendingTexture(outTexture);
+            }
+            return outTexture;
+        }
+
+        /**
+        * Creates the texture decoded for 'request' and hands it over to the TextureStreamer when it was loaded with
+        * only its mip tail
+        */
+        static Texture2DRenderable* createTexture2D(TextureDecoder::Request& request)
+        {
+            Texture2DRenderable* outTexture = createTexture2D(request.name.c_str(), request.spec, request.parameter);
+            if (outTexture && !request.streamingSource.empty())
+            {
+                TextureStreamer::get()->addTexture(outTexture, request.streamingSource.c_str());
             }
             return outTexture;
         }
@@ -181,57 +236,126 @@ namespace Cyan
         }
 
         /**
-        * Importing texture from an image file
+        * Describes decoding an image file for TextureDecoder, .hdr images are always compressed as kHDR while
+        * texture compression is enabled
         */
-        static Texture2DRenderable* importTexture2D(const char* name, const char* filename, ITextureRenderable::Spec& spec, ITextureRenderable::Parameter parameter=ITextureRenderable::Parameter{ })
+        static TextureDecoder::Request makeTextureDecodeRequest(const char* name, const char* filename, const ITextureRenderable::Spec& spec, ITextureRenderable::Parameter parameter, TextureCompressor::Role role = TextureCompressor::Role::kNone)
         {
             // todo: this is not a robust solutions to this!!! a better way maybe parse the file header to get the true file format
             // determine whether the given image is ldr or hdr based on file extension
-
             std::string path(filename);
             u32 found = path.find_last_of('.');
             std::string extension = path.substr(found, found + 1);
 
-            int width, height, numChannels;
-            stbi_set_flip_vertically_on_load(1);
-
-            if (extension == ".hdr")
+            TextureDecoder::Request request;
+            request.name = name;
+            request.filename = filename;
+            request.bHDR = (extension == ".hdr");
+            request.spec = spec;
+            request.parameter = parameter;
+            if (singleton->m_bCompressTextures)
             {
-                spec.pixelData = reinterpret_cast<u8*>(stbi_loadf(filename, &width, &height, &numChannels, 0));
-                // todo: pixel format is hard coded for now
-                if (numChannels == 3)
-                {
-                    spec.pixelFormat = ITextureRenderable::Spec::PixelFormat::RGB16F;
-                }
-                else if (numChannels == 4)
-                {
-                    spec.pixelFormat = ITextureRenderable::Spec::PixelFormat::RGBA16F;
-                }
-                spec.width = width;
-                spec.height = height;
-            }
-            else
-            {
-                spec.pixelData = reinterpret_cast<u8*>(stbi_load(filename, &width, &height, &numChannels, 0));
-                // todo: pixel format is hard coded for now
-                if (numChannels == 3)
-                {
-                    spec.pixelFormat = ITextureRenderable::Spec::PixelFormat::RGB8;
-                }
-                else if (numChannels == 4)
-                {
-                    spec.pixelFormat = ITextureRenderable::Spec::PixelFormat::RGBA8;
-                }
-                spec.width = width;
-                spec.height = height;
+                request.role = request.bHDR ? TextureCompressor::Role::kHDR : role;
+                request.cache = singleton->m_textureCache.get();
+                request.cacheKey = filename;
+                request.streamingMipTailSize = getStreamingMipTailSize(request.role);
             }
-            if (spec.pixelData)
+            return request;
+        }
+
+        /**
+        * Size of the mip tail that textures of 'role' are loaded with while texture streaming is enabled, 0 loads the
+        * whole mip chain. Hdr images aren't streamed since image based lighting is prefiltered from all of their mips.
+        * Without sparse textures the whole mip chain would be allocated anyway, so streaming wouldn't save any memory.
+        */
+        static u32 getStreamingMipTailSize(TextureCompressor::Role role)
+        {
+            bool bStreamed = (role == TextureCompressor::Role::kAlbedo || role == TextureCompressor::Role::kNormal || role == TextureCompressor::Role::kMaterial);
+            TextureStreamer* streamer = TextureStreamer::get();
+            return (singleton->m_bStreamTextures && bStreamed && streamer && GLEW_ARB_sparse_texture) ? streamer->m_settings.mipTailSize : 0u;
+        }
+
+        /**
+        * Importing texture from an image file
+        */
+        static Texture2DRenderable* importTexture2D(const char* name, const char* filename, ITextureRenderable::Spec& spec, ITextureRenderable::Parameter parameter=ITextureRenderable::Parameter{ }, TextureCompressor::Role role = TextureCompressor::Role::kNone)
+        {
+            TextureDecoder::Request request = makeTextureDecodeRequest(name, filename, spec, parameter, role);
+            bool bDecoded = TextureDecoder::decode(request);
+            spec = request.spec;
+            if (bDecoded)
             {
-                return createTexture2D(name, spec, parameter);
+                return createTexture2D(request);
             }
             return nullptr;
         }
 
+        /**
+        * Imported obj and gltf meshes are cached as .cyanmesh files in 'directory' and loaded from there as long as their
+        * source file doesn't change, null disables the cache. Defaults to MESH_CACHE_PATH.
+        */
+        static void setMeshCacheDirectory(const char* directory)
+        {
+            singleton->m_meshCache.reset(directory ? new MeshCache(directory) : nullptr);
+        }
+
+        /**
+        * Imported textures with a known role are block compressed and cached as .ktx2 files in 'directory', null only
+        * disables the cache. Defaults to TEXTURE_CACHE_PATH.
+        */
+        static void setTextureCacheDirectory(const char* directory)
+        {
+            singleton->m_textureCache.reset(directory ? new TextureCache(directory) : nullptr);
+        }
+
+        /**
+        * Disabling texture compression imports every texture uncompressed, textures already imported keep their format
+        */
+        static void setTextureCompression(bool bEnabled)
+        {
+            singleton->m_bCompressTextures = bEnabled;
+        }
+
+        /**
+        * Compressed albedo, normal and material textures backed by a KTX2 file are loaded with only their mip tail and
+        * streamed in by the TextureStreamer unless disabled here, textures already imported stay as they are
+        */
+        static void setTextureStreaming(bool bEnabled)
+        {
+            singleton->m_bStreamTextures = bEnabled;
+        }
+
+        /**
+        * Imported triangle meshes are welded, reordered and given a lod chain by the MeshOptimizer unless disabled here.
+        * Meshes loaded from the mesh cache keep the settings they were imported with.
+        */
+        static void setMeshOptimization(bool bEnabled)
+        {
+            singleton->m_bOptimizeMeshes = bEnabled;
+        }
+
+        static void setMeshOptimizerSettings(const MeshOptimizer::Settings& settings)
+        {
+            singleton->m_meshOptimizerSettings = settings;
+        }
+
+        /**
+        * Scene imports run asynchronously unless disabled here, running headless always imports synchronously
+        */
+        static void setAsyncSceneImport(bool bEnabled)
+        {
+            singleton->m_bAsyncSceneImport = bEnabled;
+        }
+
+        /**
+        * 'callback' is called on the gl thread after every texture created by importing a batch of textures, such as all
+        * the textures of a gltf file or of every import in flight, with the number of textures done so far
+        */
+        static void setTextureImportProgressCallback(const TextureDecoder::ProgressCallback& callback)
+        {
+            singleton->m_textureImportProgressCallback = callback;
+        }
+
         static Material& createMaterial(const char* name) {
             std::string key = std::string(name);
             auto entry = singleton->m_materialMap.find(key);
@@ -334,6 +458,36 @@ namespace Cyan
         }
 
     private:
+        // parsed gltf file shared by the tasks importing it
+        struct GltfImport;
+
+        Mesh::Submesh<Triangles>* createOptimizedSubmesh(const char* meshName, std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices);
+        bool loadGltfMesh(tinygltf::Model& model, tinygltf::Mesh& gltfMesh, const MeshCache::Source* source, std::vector<ISubmesh*>& outSubmeshes);
+        Entity* createGltfNodeEntity(Scene* scene, tinygltf::Model& model, Entity* parent, tinygltf::Node& node);
+        void addGltfImportTasks(ImportGraph& graph, Scene* scene, const std::shared_ptr<GltfImport>& gltf, ImportGraph::TaskID rootTask);
+
+        /**
+        * Adds a task decoding 'request' on a worker followed by one creating its texture with 'create' on the gl thread,
+        * 'encodedDataOwner' is kept alive until the request is decoded
+        */
+        ImportGraph::TaskID importTexture(ImportGraph& graph, const TextureDecoder::Request& request, Texture2DRenderable* (*create)(TextureDecoder::Request&), const std::shared_ptr<void>& encodedDataOwner = nullptr);
+        void finishImport(const ImportGraph& graph);
+
+        /**
+        * Points material maps that were left waiting for 'texture' while it was imported at it
+        */
+        void bindPendingTexture(Texture2DRenderable* texture)
+        {
+            auto entry = m_pendingTextureBindings.find(std::string(texture->name));
+            if (entry != m_pendingTextureBindings.end())
+            {
+                for (Texture2DRenderable** binding : entry->second)
+                {
+                    *binding = texture;
+                }
+                m_pendingTextureBindings.erase(entry);
+            }
+        }
 
         /**
         * Adding a texture into the asset data base
@@ -345,7 +499,17 @@ namespace Cyan
 
         void* m_objLoader;
         void* m_gltfLoader;
-        tinygltf::TinyGLTF m_gltfImporter;
+        TextureDecoder::ProgressCallback m_textureImportProgressCallback;
+        // textures of the imports in flight, for 'm_textureImportProgressCallback'
+        std::atomic<u32> m_numTexturesToImport{ 0u };
+        u32 m_numTexturesImported = 0u;
+        std::unique_ptr<MeshCache> m_meshCache;
+        std::unique_ptr<TextureCache> m_textureCache;
+        bool m_bCompressTextures = true;
+        bool m_bStreamTextures = true;
+        bool m_bOptimizeMeshes = true;
+        bool m_bAsyncSceneImport = true;
+        MeshOptimizer::Settings m_meshOptimizerSettings;
         static AssetManager* singleton;
 
         // asset arrays for efficient iterating
@@ -359,5 +523,10 @@ namespace Cyan
 
         // material instances
         std::unordered_map<std::string, Material> m_materialMap;
+        // material maps waiting for a texture that is still being imported, by texture name
+        std::unordered_map<std::string, std::vector<Texture2DRenderable**>> m_pendingTextureBindings;
+
+        // asynchronous scene imports in flight, destroyed first as their tasks use everything above
+        std::vector<std::unique_ptr<ImportGraph>> m_importGraphs;
     };
 }
\ No newline at end of file
@@ -1,57 +1,158 @@
 #pragma once
 
 #include <vector>
+#include <atomic>
 
-#include "Geometry.h"
+#include "glm.hpp"
 
-namespace Cyan 
+#include "Common.h"
+#include "Allocator.h"
+
+namespace Cyan
 {
-#if 0
-    struct BVHNode
+    /**
+    * A node is exactly 32 bytes so that two sibling nodes fill one 64 bytes cache line. For an internal node,
+    * 'leftFirst' is the index of its left child and the right child always sits right after it at 'leftFirst + 1'.
+    * For a leaf node, 'leftFirst' indexes into BVH::primitiveIndices and 'count' is the number of primitives
+    * in the leaf. The left child of a freshly built node always has the larger surface area.
+    */
+    struct alignas(32) BVHNode
+    {
+        glm::vec3 aabbMin;
+        u32 leftFirst;
+        glm::vec3 aabbMax;
+        u32 count;
+
+        bool isLeaf() const { return count > 0; }
+    };
+
+    /**
+    * Build time only description of a primitive
+    */
+    struct BVHPrimitive
     {
-        struct Mesh*    m_mesh;
-        BVHNode*        m_leftChild;
-        BVHNode*        m_rightChild;
-        BoundingBox3D   m_aabb;
-        i32             m_submeshIndex;
-        i32             m_triangleIndex;
-
-        BVHNode()
-            : m_mesh(nullptr), m_leftChild(nullptr), m_rightChild(nullptr), m_aabb{},
-            m_submeshIndex(-1), m_triangleIndex(-1)
-        { }
-
-        void bound(BVHNode* node) 
-        { 
-            m_aabb.bound(node->m_aabb);
-        }
-
-        void bound(const Triangle& tri) 
-        { 
-            m_aabb.bound(tri);
-        }
-
-        struct MeshRayHit trace(glm::vec3& ro, glm::vec3& rd);
-        bool traceVisibility(glm::vec3& ro, glm::vec3& rd);
+        glm::vec3 aabbMin;
+        glm::vec3 aabbMax;
+        glm::vec3 centroid;
     };
 
-    struct MeshBVH
+    enum class BVHBuildMethod
     {
-        MeshBVH(struct Mesh* mesh);
-
-        struct Mesh* m_owner;
-        BVHNode* root;
-        std::vector<BVHNode> leafNodes;
-        std::vector<BVHNode> nodes;
-        u32      numNodes;
-        BVHNode* allocNode();
-        void build();
-        void onBuildFinished();
-        void recursiveBuild(u32 start, u32 end, BVHNode* node);
-        MeshRayHit trace(glm::vec3& objectSpaceRo, glm::vec3& objectSpaceRd);
+        // top down binned SAH, best trees but builds serially
+        kBinnedSAH = 0,
+        // parallel morton code based build [Karras 12], an order of magnitude faster at the cost of tree quality
+        kLinear
     };
 
-    BVHNode* buildMeshBVH(struct Mesh* mesh);
-    void buildBVH(struct Mesh* mesh, std::vector<BVHNode*>& leafNodes, u32 start, u32 end, BVHNode* parent);
-#endif
-}
\ No newline at end of file
+    /**
+    * Binned SAH bvh stored as a flat node array. The root node is at index 0 and index 1 is left unused
+    * so that every pair of sibling nodes starts on a cache line boundary.
+    */
+    struct BVH
+    {
+        static const u32 kNumBins = 16u;
+        static const u32 kMaxLeafSize = 4u;
+        static const u32 kRootNodeIndex = 0u;
+        static const u32 kInvalidNodeIndex = 0xFFFFFFFF;
+        // cost of traversing a node, primitive intersection costs are relative to this
+        static constexpr f32 kTraversalCost = 1.f;
+        // max depth of the tree is bounded by this, used for sizing traversal stacks
+        static const u32 kMaxDepth = 64u;
+        // number of leaves of the treelets restructured by optimizeTreelets()
+        static const u32 kTreeletSize = 7u;
+
+        using NodeArray = std::vector<BVHNode, AlignedAllocator<BVHNode, 64>>;
+
+        /**
+        * Build over an array of triangles where every three consecutive positions form a triangle
+        */
+        void build(const std::vector<glm::vec3>& trianglePositions);
+        void build(const std::vector<BVHPrimitive>& primitives);
+
+        /**
+        * Rebuild the topology of small treelets bottom up to minimize their SAH cost [Karras & Aila 13], each pass visits
+        * every node whose subtree holds at least 'minTreeletPrimitives' primitives. Works on any tree, not only linear
+        * builds, and keeps all node bounds as they are.
+        */
+        void optimizeTreelets(u32 numPasses = 1u);
+
+        bool empty() const { return numNodes == 0; }
+        const BVHNode& getRoot() const { return nodes[kRootNodeIndex]; }
+        u32 getNumNodes() const { return numNodes; }
+
+        /**
+        * Update node bounds to enclose 'primitives' without changing the topology of the tree. 'primitives' has to be
+        * the same primitive array that the tree was built with, moved or deformed. The first version refits every node
+        * while the second one only walks up from the leaves of 'changedPrimitives' and stops as soon as a node's bounds
+        * stop changing.
+        */
+        void refit(const std::vector<BVHPrimitive>& primitives);
+        void refit(const std::vector<BVHPrimitive>& primitives, const std::vector<u32>& changedPrimitives);
+
+        /**
+        * SAH cost of the tree normalized by the surface area of the root
+        */
+        f32 computeSAHCost() const;
+
+        /**
+        * Same as computeSAHCost() but kept up to date incrementally by refits
+        */
+        f32 getSAHCost() const;
+
+        /**
+        * Ratio between the current SAH cost and the cost right after the last build, refits only ever keep the
+        * topology so this grows as primitives move away from where they were at build time
+        */
+        f32 getSAHCostGrowth() const;
+
+        /**
+        * Build parameters, leaves never hold more than 'maxLeafSize' primitives. 'intersectionCost' is the cost of 
+        * intersecting one primitive relative to kTraversalCost, lowering it favors larger leaves, which pays off when
+        * leaf primitives are intersected several at a time.
+        */
+        u32 maxLeafSize = kMaxLeafSize;
+        f32 intersectionCost = 1.f;
+        BVHBuildMethod buildMethod = BVHBuildMethod::kBinnedSAH;
+        // optimizeTreelets() passes run at the end of build(), mostly worth it to recover the quality lost by kLinear
+        u32 numTreeletPasses = 0u;
+        u32 minTreeletPrimitives = 32u;
+
+        NodeArray nodes;
+        // primitives referenced by leaf nodes are stored contiguously in this array
+        std::vector<u32> primitiveIndices;
+        // parent of every node, kInvalidNodeIndex for the root, used for walking up the tree when refitting
+        std::vector<u32> parentIndices;
+        // leaf node that references each primitive
+        std::vector<u32> primitiveLeaves;
+        u32 numNodes = 0u;
+        // unnormalized SAH cost maintained by build() and refit()
+        f32 sahCostSum = 0.f;
+        f32 builtSAHCost = 0.f;
+
+    private:
+        struct LinearBuildNode
+        {
+            u32 first;
+            u32 last;
+            u32 split;
+        };
+
+        void beginBuild(u32 numPrimitives);
+        void finishBuild();
+        void buildLinear(const std::vector<BVHPrimitive>& primitives);
+        void emitLinearSubtree(const std::vector<BVHPrimitive>& primitives, const std::vector<LinearBuildNode>& linearNodes, u32 linearNode, u32 first, u32 last, u32 nodeIndex, std::atomic<u32>& nodeCounter);
+        void optimizeSubtree(u32 nodeIndex, std::vector<f32>& subtreeCosts, const std::vector<u32>& subtreeCounts);
+        void optimizeTreelet(u32 rootIndex, std::vector<f32>& subtreeCosts);
+        u32 reorderDepthFirst();
+        void orderChildrenByArea(u32 nodeIndex);
+        f32 calcNodeCost(const BVHNode& node) const;
+        void updateNodeBounds(u32 nodeIndex, const std::vector<BVHPrimitive>& primitives);
+        void subdivide(u32 nodeIndex, const std::vector<BVHPrimitive>& primitives, u32 depth);
+        f32 findBestSplit(const BVHNode& node, const std::vector<BVHPrimitive>& primitives, i32& outAxis, f32& outSplitPos);
+    };
+
+    f32 calcSurfaceArea(const glm::vec3& aabbMin, const glm::vec3& aabbMax);
+
+    // every three consecutive positions form a triangle
+    void calcTrianglePrimitives(const std::vector<glm::vec3>& trianglePositions, std::vector<BVHPrimitive>& outPrimitives);
+}
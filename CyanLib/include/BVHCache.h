@@ -0,0 +1,60 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "BVH.h"
+
+namespace Cyan
+{
+    /**
+    * Persistent cache of built trees, one file per mesh in 'directory' named after a hash of the mesh's triangle
+    * positions. A file is a 64 bytes header followed by the raw node array and the index arrays of the tree exactly as
+    * they are laid out in memory, so loading one is a file mapping plus a bulk copy per array without any parsing.
+    * Trees are only reused when they were built with the same build parameters as the tree being loaded into.
+    */
+    class BVHCache
+    {
+    public:
+        static const u32 kFileMagic = 0x56425943u; // 'CYBV'
+        static const u32 kFileVersion = 1u;
+
+        struct FileHeader
+        {
+            u32 magic;
+            u32 version;
+            u64 geometryHash;
+            u32 numNodes;
+            u32 numPrimitives;
+            // build parameters the tree was built with
+            u32 maxLeafSize;
+            f32 intersectionCost;
+            u32 buildMethod;
+            u32 numTreeletPasses;
+            u32 minTreeletPrimitives;
+            f32 builtSAHCost;
+            f32 sahCostSum;
+            // pads the header to keep the node array that follows cache line aligned
+            u32 padding[3];
+        };
+
+        explicit BVHCache(const char* directory);
+
+        static u64 calcGeometryHash(const std::vector<glm::vec3>& trianglePositions);
+
+        /**
+        * Replaces 'outBVH' with the tree cached for 'geometryHash', fails when there is none or when it was built for a
+        * different number of primitives or with different build parameters than the ones set on 'outBVH'
+        */
+        bool load(u64 geometryHash, u32 numPrimitives, BVH& outBVH) const;
+        bool save(u64 geometryHash, const BVH& bvh) const;
+
+        std::string getFilename(u64 geometryHash) const;
+
+    private:
+        std::string m_directory;
+    };
+}
@@ -93,6 +93,13 @@ T* treeBFS(T* node, const char* name)
 
 namespace Cyan
 {
+    /**
+    * In headless mode no gpu resources are created and meshes and textures only keep their cpu side data, so that
+    * tools can import assets without a window or a GL context. Has to be set before anything is imported.
+    */
+    void setHeadless(bool bHeadless);
+    bool isHeadless();
+
     template <typename T>
     u32 sizeOfVector(const std::vector<T>& vec)
     {
@@ -305,6 +305,8 @@ namespace Cyan
             bool useBentNormal = true;
             bool bPostProcessing = true;
             bool bManyViewGIEnabled = false;
+            // pack scene geometry into PackedGeometry::QuantizedVertex instead of full precision vertices
+            bool bQuantizedVertices = true;
             u32 tonemapOperator = (u32)TonemapOperator::kReinhard;
             f32 whitePointLuminance = 100.f;
             f32 smoothstepWhitePoint = 1.f;
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "RayTracer.h"
+
+namespace Cyan
+{
+    /**
+    * Interface for denoisers of ray traced images, so that external ones such as intel's open image denoiser can be
+    * dropped in next to the built in ATrousDenoiser. Factories are registered under a name with registerDenoiser() and
+    * instances are created by name with createDenoiser().
+    */
+    class IDenoiser
+    {
+    public:
+        virtual ~IDenoiser() { }
+
+        virtual const char* getName() const = 0;
+
+        /**
+        * Denoise 'color' guided by the 'aovs' rendered along with it, 'outImage' needs the same size and may be 'color' itself
+        */
+        virtual void denoise(const Image& color, const AOVBuffer& aovs, Image& outImage) = 0;
+    };
+
+    using DenoiserFactory = std::function<std::unique_ptr<IDenoiser>()>;
+
+    // replaces the factory previously registered under 'name', if any
+    void registerDenoiser(const char* name, const DenoiserFactory& factory);
+
+    // returns null when nothing is registered under 'name', ATrousDenoiser is always registered as "atrous"
+    std::unique_ptr<IDenoiser> createDenoiser(const char* name);
+
+    /**
+    * Edge avoiding a-trous wavelet filter following SVGF (Schied et al., "Spatiotemporal Variance-Guided Filtering"),
+    * without the temporal part. The image is divided by the albedo aov so that texture detail isn't blurred, then
+    * repeatedly filtered with a 5x5 b-spline kernel whose taps are spread further apart every iteration. Taps are
+    * weighted down across depth and normal discontinuities and by their luminance difference relative to the local
+    * standard deviation of luminance, which is estimated spatially and filtered along with the color. Rows are split
+    * across the thread pool and consecutive pixels of a row are filtered together in simd lanes.
+    */
+    class ATrousDenoiser : public IDenoiser
+    {
+    public:
+        struct Settings
+        {
+            u32 numIterations = 5u;
+            // luminance differences are measured in local standard deviations
+            f32 sigmaLuminance = 4.f;
+            // exponent of the cosine between normals
+            f32 sigmaNormal = 128.f;
+            // depth differences are measured against the depth gradient times the tap distance
+            f32 sigmaDepth = 1.f;
+            // off filters one pixel at a time, only useful for comparing the simd kernels against the scalar one
+            bool bSIMD = true;
+        };
+
+        virtual const char* getName() const override { return "atrous"; }
+        virtual void denoise(const Image& color, const AOVBuffer& aovs, Image& outImage) override;
+
+        Settings settings;
+
+    private:
+        // one array per channel so that simd loads pick up consecutive pixels
+        struct Planes
+        {
+            void resize(u32 numPixels)
+            {
+                r.resize(numPixels);
+                g.resize(numPixels);
+                b.resize(numPixels);
+                variance.resize(numPixels);
+            }
+
+            std::vector<f32> r;
+            std::vector<f32> g;
+            std::vector<f32> b;
+            std::vector<f32> variance;
+        };
+
+        void prepare(const Image& color, const AOVBuffer& aovs);
+        void estimateVariance();
+        void prefilterVariance(const Planes& src);
+        void filterRow(const Planes& src, Planes& dst, u32 y, u32 step) const;
+        template <typename Float>
+        void filterSpan(const Planes& src, Planes& dst, u32 x, u32 y, u32 step) const;
+
+        glm::uvec2 m_size = glm::uvec2(0u);
+        Planes m_planes[2];
+        std::vector<f32> m_normalX;
+        std::vector<f32> m_normalY;
+        std::vector<f32> m_normalZ;
+        std::vector<f32> m_depth;
+        std::vector<f32> m_depthGradient;
+        // 3x3 gaussian blurred variance of the current iteration's input
+        std::vector<f32> m_prefilteredVariance;
+        // color was divided by this to take out texture detail, filtered results are multiplied back
+        std::vector<glm::vec3> m_demodulation;
+    };
+}
@@ -57,6 +57,16 @@ namespace Cyan
         std::vector<u32> indices;
     };
 
+    /**
+    * A simplified version of a triangle mesh, drawn with its own indices into the vertices of the full resolution mesh
+    */
+    struct MeshLod
+    {
+        std::vector<u32> indices;
+        // how far the simplified surface may deviate from the full resolution one, in object space
+        f32 error = 0.f;
+    };
+
     struct PointCloud : public Geometry
     {
         static Type getTypeEnum() { return Type::kPointCloud; }
@@ -83,6 +83,7 @@ namespace Cyan {
         void setVertexArray(VertexArray* array);
         void setPrimitiveType(PrimitiveMode type);
         void setViewport(Viewport viewport);
+        const Viewport& getViewport() const { return m_viewport; }
         void setRenderTarget(RenderTarget* renderTarget);
         void setRenderTarget(RenderTarget* rt, const std::initializer_list<RenderTargetDrawBuffer>& drawBuffers);
         void setDepthControl(DepthControl ctrl);
@@ -116,7 +117,7 @@ namespace Cyan {
 
         GLFWwindow* m_glfwWindow;
         Shader* m_shader = nullptr;
-        Viewport m_viewport;
+        Viewport m_viewport = { };
         VertexArray* m_va = nullptr;
         GLenum m_primitiveType;
     };
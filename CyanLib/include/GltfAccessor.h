@@ -0,0 +1,229 @@
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+
+#include "glm.hpp"
+#include "tiny_gltf.h"
+
+#include "Common.h"
+
+namespace Cyan
+{
+    // number of components and component type of the element types an accessor can be read as
+    template <typename T>
+    struct GltfElement;
+
+    template <> struct GltfElement<u32> { using Scalar = u32; static const u32 kNumComponents = 1u; };
+    template <> struct GltfElement<f32> { using Scalar = f32; static const u32 kNumComponents = 1u; };
+    template <> struct GltfElement<glm::vec2> { using Scalar = f32; static const u32 kNumComponents = 2u; };
+    template <> struct GltfElement<glm::vec3> { using Scalar = f32; static const u32 kNumComponents = 3u; };
+    template <> struct GltfElement<glm::vec4> { using Scalar = f32; static const u32 kNumComponents = 4u; };
+
+    /**
+    * Typed read only view of the elements of a gltf accessor. Elements are read straight out of the loaded buffer,
+    * honoring the byte stride of interleaved buffer views, and converted to T on access. Integer components are
+    * converted to float following the gltf spec, either normalized or as plain values, and any unsigned integer type
+    * can be read as u32 for indices. Sparse accessors are supported, accessors without a buffer view read as zeros.
+    *
+    * The view doesn't own anything, 'model' has to outlive it.
+    */
+    template <typename T>
+    class GltfAccessor
+    {
+    public:
+        using Scalar = typename GltfElement<T>::Scalar;
+        static const u32 kNumComponents = GltfElement<T>::kNumComponents;
+
+        GltfAccessor(const tinygltf::Model& model, const tinygltf::Accessor& accessor)
+        {
+            if (tinygltf::GetNumComponentsInType((u32)accessor.type) != (i32)kNumComponents)
+            {
+                cyanError("Gltf accessor %s has %d components per element, expected %u", accessor.name.c_str(), tinygltf::GetNumComponentsInType((u32)accessor.type), kNumComponents);
+                return;
+            }
+            m_count = (u32)accessor.count;
+            m_elements.componentType = accessor.componentType;
+            m_elements.bNormalized = accessor.normalized;
+            u32 elementSize = (u32)tinygltf::GetComponentSizeInBytes((u32)accessor.componentType) * kNumComponents;
+            if (accessor.bufferView >= 0 && !bindStream(model, accessor.bufferView, accessor.byteOffset, accessor.ByteStride(model.bufferViews[accessor.bufferView]), elementSize, m_count, m_elements))
+            {
+                cyanError("Gltf accessor %s reads past the end of its buffer", accessor.name.c_str());
+                m_count = 0u;
+                return;
+            }
+            if (accessor.sparse.isSparse)
+            {
+                m_numSparse = (u32)accessor.sparse.count;
+                m_sparseIndices.componentType = accessor.sparse.indices.componentType;
+                m_sparseValues.componentType = accessor.componentType;
+                m_sparseValues.bNormalized = accessor.normalized;
+                // sparse indices and values are always tightly packed
+                i32 indexSize = tinygltf::GetComponentSizeInBytes((u32)m_sparseIndices.componentType);
+                if (!bindStream(model, accessor.sparse.indices.bufferView, accessor.sparse.indices.byteOffset, indexSize, (u32)indexSize, m_numSparse, m_sparseIndices)
+                    || !bindStream(model, accessor.sparse.values.bufferView, accessor.sparse.values.byteOffset, (i32)elementSize, elementSize, m_numSparse, m_sparseValues))
+                {
+                    cyanError("Sparse gltf accessor %s reads past the end of its buffer", accessor.name.c_str());
+                    m_count = 0u;
+                    m_numSparse = 0u;
+                }
+            }
+        }
+
+        u32 size() const { return m_count; }
+
+        T operator[](u32 index) const
+        {
+            if (m_numSparse > 0u)
+            {
+                // sparse indices are strictly increasing
+                u32 lo = 0u, hi = m_numSparse;
+                while (lo < hi)
+                {
+                    u32 mid = (lo + hi) / 2u;
+                    u32 sparseIndex = readScalar<u32>(m_sparseIndices, mid, 0u);
+                    if (sparseIndex == index)
+                    {
+                        return readElement(m_sparseValues, mid);
+                    }
+                    if (sparseIndex < index)
+                    {
+                        lo = mid + 1u;
+                    }
+                    else
+                    {
+                        hi = mid;
+                    }
+                }
+            }
+            return readElement(m_elements, index);
+        }
+
+        /**
+        * The elements as an array when they are tightly packed and already stored as T, null otherwise
+        */
+        const T* data() const
+        {
+            bool bSameType = (m_elements.componentType == (std::is_same<Scalar, f32>::value ? TINYGLTF_COMPONENT_TYPE_FLOAT : TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT));
+            bool bAligned = (reinterpret_cast<uintptr_t>(m_elements.data) % alignof(T)) == 0u;
+            if (m_elements.data == nullptr || m_numSparse > 0u || !bSameType || m_elements.stride != sizeof(T) || !bAligned)
+            {
+                return nullptr;
+            }
+            return reinterpret_cast<const T*>(m_elements.data);
+        }
+
+        /**
+        * Writes every element to 'dst', 'dstStride' bytes apart so that a single attribute of interleaved vertices can be
+        * filled in place. Data already stored packed as T going into a packed destination is copied in one go.
+        */
+        void copyTo(T* dst, u32 dstStride = sizeof(T)) const
+        {
+            const T* src = data();
+            if (src != nullptr && dstStride == sizeof(T))
+            {
+                memcpy(dst, src, m_count * sizeof(T));
+                return;
+            }
+            u8* dstBytes = reinterpret_cast<u8*>(dst);
+            for (u32 i = 0; i < m_count; ++i)
+            {
+                *reinterpret_cast<T*>(dstBytes + (u64)i * dstStride) = readElement(m_elements, i);
+            }
+            for (u32 i = 0; i < m_numSparse; ++i)
+            {
+                u32 index = readScalar<u32>(m_sparseIndices, i, 0u);
+                if (index < m_count)
+                {
+                    *reinterpret_cast<T*>(dstBytes + (u64)index * dstStride) = readElement(m_sparseValues, i);
+                }
+            }
+        }
+
+    private:
+        struct Stream
+        {
+            const u8* data = nullptr;
+            u32 stride = 0u;
+            i32 componentType = TINYGLTF_COMPONENT_TYPE_FLOAT;
+            bool bNormalized = false;
+        };
+
+        // points 'stream' at 'count' elements 'stride' bytes apart, fails when they don't fit into the buffer view
+        static bool bindStream(const tinygltf::Model& model, i32 bufferViewIndex, u64 byteOffset, i32 stride, u32 elementSize, u32 count, Stream& stream)
+        {
+            if (bufferViewIndex < 0 || bufferViewIndex >= (i32)model.bufferViews.size() || stride <= 0 || elementSize == 0u)
+            {
+                return false;
+            }
+            const tinygltf::BufferView& bufferView = model.bufferViews[bufferViewIndex];
+            const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+            u64 begin = bufferView.byteOffset + byteOffset;
+            u64 end = (count > 0u) ? begin + (u64)(count - 1u) * (u64)stride + (u64)elementSize : begin;
+            if (end > bufferView.byteOffset + bufferView.byteLength || end > buffer.data.size())
+            {
+                return false;
+            }
+            stream.data = buffer.data.data() + begin;
+            stream.stride = (u32)stride;
+            return true;
+        }
+
+        template <typename S>
+        static S readScalar(const Stream& stream, u32 index, u32 component)
+        {
+            const u8* src = stream.data + (u64)index * stream.stride;
+            switch (stream.componentType)
+            {
+            case TINYGLTF_COMPONENT_TYPE_BYTE: return convert<S>((i8)src[component], 127.f, stream.bNormalized);
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: return convert<S>(src[component], 255.f, stream.bNormalized);
+            case TINYGLTF_COMPONENT_TYPE_SHORT: return convert<S>(load<i16>(src + component * 2u), 32767.f, stream.bNormalized);
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return convert<S>(load<u16>(src + component * 2u), 65535.f, stream.bNormalized);
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT: return convert<S>(load<u32>(src + component * 4u), 4294967295.f, stream.bNormalized);
+            case TINYGLTF_COMPONENT_TYPE_FLOAT: return (S)load<f32>(src + component * 4u);
+            default: return (S)0;
+            }
+        }
+
+        T readElement(const Stream& stream, u32 index) const
+        {
+            T element = T(0);
+            if (stream.data != nullptr)
+            {
+                for (u32 c = 0; c < kNumComponents; ++c)
+                {
+                    reinterpret_cast<Scalar*>(&element)[c] = readScalar<Scalar>(stream, index, c);
+                }
+            }
+            return element;
+        }
+
+        // buffers only guarantee alignment to the component size, going through memcpy keeps unaligned data safe as well
+        template <typename S>
+        static S load(const u8* src)
+        {
+            S value;
+            memcpy(&value, src, sizeof(S));
+            return value;
+        }
+
+        // normalized signed values are clamped so that both -128 and -127 map to -1
+        template <typename S, typename C>
+        static typename std::enable_if<std::is_same<S, f32>::value, S>::type convert(C value, f32 maxValue, bool bNormalized)
+        {
+            return bNormalized ? Max((f32)value / maxValue, -1.f) : (f32)value;
+        }
+
+        template <typename S, typename C>
+        static typename std::enable_if<std::is_same<S, u32>::value, S>::type convert(C value, f32, bool)
+        {
+            return (u32)value;
+        }
+
+        u32 m_count = 0u;
+        Stream m_elements;
+        u32 m_numSparse = 0u;
+        Stream m_sparseIndices;
+        Stream m_sparseValues;
+    };
+}
@@ -10,6 +10,7 @@
 #include "RayTracer.h"
 #include "CyanRenderer.h"
 #include "GfxContext.h"
+#include "TextureStreamer.h"
 
 namespace Cyan
 {
@@ -31,6 +32,7 @@ namespace Cyan
         Renderer* getRenderer() { return m_renderer.get(); }
         SceneManager* getSceneManager() { return m_sceneManager.get(); }
         AssetManager* getAssetManager() { return m_assetManager.get(); }
+        TextureStreamer* getTextureStreamer() { return m_textureStreamer.get(); }
 
         struct Settings {
             bool bSuperSampling = true;
@@ -39,6 +41,7 @@ namespace Cyan
     private:
         std::unique_ptr<SceneManager> m_sceneManager;
         std::unique_ptr<AssetManager> m_assetManager;
+        std::unique_ptr<TextureStreamer> m_textureStreamer;
         std::unique_ptr<Renderer> m_renderer;
         std::unique_ptr<ShaderManager> m_shaderManager;
         // LightMapManager* m_lightMapManager;
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstring>
+
+#include "Common.h"
+
+namespace Cyan
+{
+    /**
+    * pcg hash of a single word, cheap enough to derive random numbers from the indices of whatever is being sampled so
+    * that results don't depend on which thread does the sampling
+    */
+    inline u32 pcgHash(u32 x)
+    {
+        u32 state = x * 747796405u + 2891336453u;
+        u32 word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return (word >> 22u) ^ word;
+    }
+
+    /**
+    * 64 bit multiply and rotate hash over 8 byte words with murmur3's constants and finalizer, used for keying on disk
+    * caches by their source data
+    */
+    inline u64 hashBytes(const void* data, u64 numBytes)
+    {
+        const u64 kMultiplier0 = 0x87C37B91114253D5ull;
+        const u64 kMultiplier1 = 0x4CF5AD432745937Full;
+        auto rotateLeft = [](u64 x, u32 r) { return (x << r) | (x >> (64u - r)); };
+        const u8* bytes = reinterpret_cast<const u8*>(data);
+        u64 hash = numBytes;
+        auto mix = [&hash, &rotateLeft, kMultiplier0, kMultiplier1](u64 word) {
+            hash ^= rotateLeft(word * kMultiplier0, 31u) * kMultiplier1;
+            hash = rotateLeft(hash, 27u) * 5u + 0x52DCE729u;
+        };
+        u64 numWords = numBytes / 8u;
+        for (u64 i = 0; i < numWords; ++i)
+        {
+            u64 word;
+            memcpy(&word, bytes + i * 8u, 8u);
+            mix(word);
+        }
+        if (numBytes % 8u != 0u)
+        {
+            u64 word = 0u;
+            memcpy(&word, bytes + numWords * 8u, (size_t)(numBytes % 8u));
+            mix(word);
+        }
+        hash ^= hash >> 33;
+        hash *= 0xFF51AFD7ED558CCDull;
+        hash ^= hash >> 33;
+        hash *= 0xC4CEB9FE1A85EC53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+
+#include "Common.h"
+
+namespace Cyan
+{
+    /**
+    * Dependency graph of the tasks importing a scene. A task becomes ready once every task it depends on is done, ready
+    * worker tasks are run on the thread pool right away while ready main tasks, the ones touching gl or the scene, are
+    * queued up for the thread owning the gl context to run from update() or wait(). Tasks can be added at any time, also
+    * from within a running task, which is how importing a file expands into tasks for whatever the file turns out to hold.
+    * A task returning false is counted as failed, tasks depending on it still run and have to cope with whatever it didn't
+    * produce, so that a single broken asset doesn't keep the rest of a scene from showing up.
+    */
+    class ImportGraph
+    {
+    public:
+        using TaskID = u32;
+        using Task = std::function<bool()>;
+        static const TaskID kInvalidTask = 0xFFFFFFFF;
+
+        enum class Thread : u32
+        {
+            kWorker = 0,
+            kMain
+        };
+
+        explicit ImportGraph(const char* name);
+        // waits for the worker tasks in flight, tasks that haven't started yet are dropped
+        ~ImportGraph();
+
+        ImportGraph(const ImportGraph&) = delete;
+        ImportGraph& operator=(const ImportGraph&) = delete;
+
+        /**
+        * Adds a task running after every task in 'dependencies', which have to be added before it, kInvalidTask entries
+        * are ignored. Safe to call from any thread, including from within tasks of this graph.
+        */
+        TaskID addTask(const char* name, Thread thread, const Task& task, const std::vector<TaskID>& dependencies = { });
+
+        /**
+        * Runs ready main tasks on the calling thread until 'timeBudgetInMs' is used up, at least one when there is any.
+        * Returns whether the whole graph is done.
+        */
+        bool update(f32 timeBudgetInMs);
+
+        // runs main tasks on the calling thread until the whole graph is done
+        void wait();
+
+        bool isFinished() const;
+        const std::string& getName() const { return m_name; }
+        u32 getNumTasks() const;
+        u32 getNumFinishedTasks() const;
+        u32 getNumFailedTasks() const;
+        // since the graph was created
+        f32 getElapsedTimeInMs() const;
+
+    private:
+        enum class State : u32
+        {
+            kWaiting = 0,
+            kReady,
+            kSucceeded,
+            kFailed
+        };
+
+        struct Node
+        {
+            std::string name;
+            Thread thread;
+            Task task;
+            State state = State::kWaiting;
+            u32 numPendingDependencies = 0u;
+            std::vector<TaskID> dependents;
+        };
+
+        // have to be called with 'm_mutex' held
+        void schedule(TaskID id);
+        void finish(TaskID id, bool bSucceeded);
+        bool runMainTask(std::unique_lock<std::mutex>& lock);
+
+        std::string m_name;
+        std::chrono::high_resolution_clock::time_point m_start;
+        // a deque keeps nodes in place while tasks are added
+        std::deque<Node> m_nodes;
+        std::deque<TaskID> m_mainQueue;
+        u32 m_numFinished = 0u;
+        u32 m_numFailed = 0u;
+        u32 m_numRunningWorkerTasks = 0u;
+        mutable std::mutex m_mutex;
+        std::condition_variable m_condition;
+    };
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "Allocator.h"
+#include "RayTracer.h"
+
+namespace Cyan
+{
+    /**
+    * Irradiance sampled over the hemisphere at a surface point together with its rotational and translational gradients
+    * [Ward & Heckbert 92], one gradient per color channel. 'r' is the harmonic mean distance to the surfaces seen from
+    * 'position', clamped by the gradient. Records are immutable once they are published to the octree.
+    */
+    struct IrradianceRecord
+    {
+        glm::vec3 position;
+        glm::vec3 normal;
+        glm::vec3 irradiance;
+        f32 r;
+        glm::vec3 rotationalGradient[3];
+        glm::vec3 translationalGradient[3];
+        // next record stored in the same octree node
+        u32 next;
+    };
+
+    /**
+    * Fixed capacity pool that grows in chunks, allocation is a single atomic increment plus a compare and swap the first
+    * time a chunk is touched. Elements never move so indices and references stay valid while other threads allocate.
+    */
+    template <typename T, u32 kChunkSize>
+    class ChunkedPool
+    {
+    public:
+        static const u32 kInvalidIndex = 0xFFFFFFFF;
+
+        explicit ChunkedPool(u32 capacity)
+            : m_capacity(capacity), m_numChunks((capacity + kChunkSize - 1u) / kChunkSize), m_size(0u)
+        {
+            m_chunks.reset(new std::atomic<T*>[m_numChunks]);
+            for (u32 i = 0; i < m_numChunks; ++i)
+            {
+                m_chunks[i].store(nullptr);
+            }
+        }
+
+        ~ChunkedPool()
+        {
+            for (u32 i = 0; i < m_numChunks; ++i)
+            {
+                delete[] m_chunks[i].load();
+            }
+        }
+
+        ChunkedPool(const ChunkedPool&) = delete;
+        ChunkedPool& operator=(const ChunkedPool&) = delete;
+
+        // returns kInvalidIndex once the pool is full
+        u32 alloc()
+        {
+            u32 index = m_size.fetch_add(1);
+            if (index >= m_capacity)
+            {
+                return kInvalidIndex;
+            }
+            std::atomic<T*>& chunk = m_chunks[index / kChunkSize];
+            if (chunk.load() == nullptr)
+            {
+                T* newChunk = new T[kChunkSize];
+                T* expected = nullptr;
+                if (!chunk.compare_exchange_strong(expected, newChunk))
+                {
+                    // another thread won the race for this chunk
+                    delete[] newChunk;
+                }
+            }
+            return index;
+        }
+
+        // not thread safe, allocated chunks are kept around for reuse
+        void reset() { m_size.store(0u); }
+
+        T& operator[](u32 index) { return m_chunks[index / kChunkSize].load()[index % kChunkSize]; }
+        const T& operator[](u32 index) const { return m_chunks[index / kChunkSize].load()[index % kChunkSize]; }
+
+        u32 size() const { return Min(m_size.load(), m_capacity); }
+        u32 capacity() const { return m_capacity; }
+        u64 getAllocatedBytes() const
+        {
+            u64 numBytes = 0u;
+            for (u32 i = 0; i < m_numChunks; ++i)
+            {
+                numBytes += (m_chunks[i].load() != nullptr) ? sizeof(T) * kChunkSize : 0u;
+            }
+            return numBytes;
+        }
+
+    private:
+        const u32 m_capacity;
+        const u32 m_numChunks;
+        std::unique_ptr<std::atomic<T*>[]> m_chunks;
+        std::atomic<u32> m_size;
+    };
+
+    /**
+    * Irradiance cache [Ward 88] for indirect diffuse lighting, records are stored in an octree covering the scene and are
+    * interpolated at nearby shading points instead of sampling the hemisphere at every point. Lookups and insertions can
+    * run concurrently from any number of threads without locks: nodes and records come from chunked pools, each node keeps
+    * its records in a singly linked list and new records and child nodes are published with a compare and swap.
+    */
+    class IrradianceCache
+    {
+    public:
+        static const u32 kDefaultMaxNumRecords = 1024u * 1024u;
+        static const u32 kDefaultMaxNumNodes = 1024u * 1024u;
+        // the octree stops subdividing past this depth so that lookups can use a fixed size stack
+        static const u32 kMaxDepth = 32u;
+
+        struct Settings
+        {
+            // interpolation error threshold 'a' in [Ward 88], smaller means more records
+            f32 error = .2f;
+            // the error is relaxed by this factor when shading to hide the seams between records added during shading
+            f32 smoothing = 1.6f;
+            // hemisphere stratification, M x N rays are traced per record
+            u32 numThetaStrata = 16u;
+            u32 numPhiStrata = 16u;
+            // record radius limits as fractions of the scene extent
+            f32 minRadiusScale = .001f;
+            f32 maxRadiusScale = .05f;
+            // radiance coming from rays that escape the scene
+            glm::vec3 skyRadiance = glm::vec3(.2f);
+        };
+
+        struct Stats
+        {
+            u64 numLookups = 0u;
+            // lookups that were answered by interpolating existing records
+            u64 numHits = 0u;
+            u32 numRecords = 0u;
+            u32 numNodes = 0u;
+            u64 memoryBytes = 0u;
+
+            f32 getHitRate() const { return numLookups > 0u ? (f32)((f64)numHits / numLookups) : 0.f; }
+        };
+
+        IrradianceCache(u32 maxNumRecords = kDefaultMaxNumRecords, u32 maxNumNodes = kDefaultMaxNumNodes);
+
+        /**
+        * Drops all records and fits the octree root to the bounds of 'rtxScene', needs to be called again whenever
+        * the scene changes. Not thread safe.
+        */
+        void init(const RayTracingScene& rtxScene);
+
+        /**
+        * Interpolated irradiance at 'p' with normal 'n', a new record is sampled and inserted when no existing record is
+        * close enough. 'error' defaults to the settings' error threshold.
+        */
+        glm::vec3 getIrradiance(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n);
+        glm::vec3 getIrradiance(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n, f32 error);
+
+        /**
+        * Only interpolates, returns false when no record contributes to 'p'
+        */
+        bool lookup(const glm::vec3& p, const glm::vec3& n, f32 error, glm::vec3& outIrradiance) const;
+
+        // traces the hemisphere above 'p' and inserts the resulting record, returns nullptr once the cache is full
+        const IrradianceRecord* addRecord(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n);
+
+        Stats getStats() const;
+        void resetStats();
+
+        Settings settings;
+
+    private:
+        struct OctreeNode
+        {
+            glm::vec3 center;
+            f32 sideLength;
+            std::atomic<u32> children[8];
+            // head of the list of records stored in this node
+            std::atomic<u32> firstRecord;
+        };
+
+        // lookup counters are kept per worker thread so that shading threads don't contend on them
+        struct alignas(64) WorkerStats
+        {
+            std::atomic<u64> numLookups{ 0u };
+            std::atomic<u64> numHits{ 0u };
+        };
+
+        // 'seed' picks the jitter of the samples, records use their index and samples that aren't stored their position
+        void sampleHemisphere(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n, u32 seed, IrradianceRecord& outRecord) const;
+        void insertRecord(u32 recordIndex);
+        u32 allocNode(const glm::vec3& center, f32 sideLength);
+        WorkerStats& getWorkerStats();
+
+        ChunkedPool<IrradianceRecord, 4096u> m_records;
+        ChunkedPool<OctreeNode, 4096u> m_nodes;
+        u32 m_root = ChunkedPool<OctreeNode, 4096u>::kInvalidIndex;
+        f32 m_sceneExtent = 0.f;
+        std::vector<WorkerStats, AlignedAllocator<WorkerStats, 64>> m_workerStats;
+    };
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "Common.h"
+
+namespace Cyan
+{
+    /**
+    * Read only view of a whole file mapped into the address space, pages are only read from disk once they are
+    * touched. The view is page aligned and stays valid until the file is closed or the MappedFile is destroyed.
+    */
+    class MappedFile
+    {
+    public:
+        MappedFile() { }
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // fails for missing and empty files
+        bool open(const char* filename);
+        void close();
+
+        bool isOpen() const { return m_data != nullptr; }
+        const u8* getData() const { return m_data; }
+        u64 getSize() const { return m_size; }
+
+    private:
+        void* m_file = nullptr;
+        void* m_mapping = nullptr;
+        const u8* m_data = nullptr;
+        u64 m_size = 0u;
+    };
+
+    // creates every missing directory along 'path', everything after the last separator is treated as a file name
+    void createDirectories(const char* path);
+
+    // last write time of 'filename' in the platform's native ticks, fails when the file doesn't exist
+    bool getFileWriteTime(const char* filename, u64& outWriteTime);
+}
@@ -20,8 +20,12 @@ namespace Cyan {
         f32 roughness = .5f;
         f32 emissive = 1.f;
         u32 flag = 0u;
+        // TextureStreamer residency slots of albedo, normal, metallicRoughness and occlusion map
+        glm::uvec4 residencySlots = glm::uvec4(0u);
     };
 
+    static_assert(sizeof(GpuMaterial) == 80, "GpuMaterial has to match MaterialDesc in shaders");
+
     struct Material {
         enum class Flags : u32 {
             kHasAlbedoMap            = 1 << 0,
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <mutex>
+
+#include "Common.h"
+#include "Mesh.h"
+
+namespace Cyan
+{
+    /**
+    * Persistent cache of imported meshes in the native .cyanmesh format, one file per mesh in 'directory' named after a
+    * hash of the source file's path and the mesh's name within it. A file is a 64 bytes header, one 64 bytes record per
+    * submesh, one 16 bytes record per lod and then the final vertex and index arrays of every submesh, followed by the
+    * index arrays of its lods, exactly as Mesh::Submesh keeps them in memory.
+    * Loading one maps the file and fixes the records' offsets up into pointers to the arrays instead of parsing
+    * anything. A cached mesh stays valid as long as its source file and every file it references keep the same write times,
+    * or failing that, the same content hashes.
+    */
+    class MeshCache
+    {
+    public:
+        static const u32 kFileMagic = 0x534D5943u; // 'CYMS'
+        static const u32 kFileVersion = 4u;
+        static const u32 kArrayAlignment = 16u;
+
+        struct FileHeader
+        {
+            u32 magic;
+            u32 version;
+            u64 sourceWriteTime;
+            u64 sourceSize;
+            u64 sourceHash;
+            u32 numSubmeshes;
+            f32 aabbMin[3];
+            f32 aabbMax[3];
+            u32 padding;
+        };
+
+        struct SubmeshRecord
+        {
+            // Geometry::Type
+            u32 geometryType;
+            // guards against loading arrays written with a different vertex layout
+            u32 vertexSize;
+            u32 numVertices;
+            u32 numIndices;
+            // from the start of the file
+            u64 vertexOffset;
+            u64 indexOffset;
+            f32 aabbMin[3];
+            f32 aabbMax[3];
+            // lods besides the submesh itself, their records start at 'firstLod' in the lod table
+            u32 numLods;
+            u32 firstLod;
+        };
+
+        struct LodRecord
+        {
+            u64 indexOffset;
+            u32 numIndices;
+            f32 error;
+        };
+
+        /**
+        * Source file of the meshes being imported along with the files it pulls geometry from, such as the buffers of a
+        * .gltf file, created once per import and shared by every mesh loaded from the file. Its content is only hashed the
+        * first time a mesh needs it, by whichever thread gets there first, so that a file holding many meshes is read once
+        * rather than once per mesh.
+        */
+        class Source
+        {
+        public:
+            Source(const char* filename, const std::vector<std::string>& referencedFilenames = { });
+
+            const std::string& getFilename() const { return m_filename; }
+            // combined over the source and its referenced files, only meant to be compared for equality
+            bool getWriteTime(u64& outWriteTime) const;
+            bool getContentHash(u64& outSize, u64& outHash) const;
+
+        private:
+            std::string m_filename;
+            std::vector<std::string> m_referencedFilenames;
+            mutable std::once_flag m_hashFlag;
+            mutable bool m_bHashed = false;
+            mutable u64 m_size = 0u;
+            mutable u64 m_hash = 0u;
+        };
+
+        explicit MeshCache(const char* directory);
+
+        /**
+        * Creates the submeshes cached for 'meshName' imported from 'source', fails when there is no cache file or when the
+        * source changed since it was written
+        */
+        bool load(const Source& source, const char* meshName, std::vector<ISubmesh*>& outSubmeshes) const;
+
+        // only triangle and line submeshes can be cached, meshes with any other kind of submesh are skipped
+        bool save(const Source& source, const char* meshName, const std::vector<ISubmesh*>& submeshes) const;
+
+        std::string getFilename(const char* sourceFilename, const char* meshName) const;
+
+    private:
+        std::string m_directory;
+    };
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <vector>
+
+#include "Common.h"
+#include "Geometry.h"
+
+namespace Cyan
+{
+    /**
+    * Post import optimization of indexed triangle meshes. optimize() runs every stage in order:
+    *   1. welds vertices whose attributes are equal within an epsilon, dropping triangles that collapse
+    *   2. reorders triangles for the post transform vertex cache with Tipsify (Sander et al., "Fast Triangle Reordering
+    *      for Vertex Locality and Reduced Overdraw")
+    *   3. reorders the clusters Tipsify produces so that triangles facing away from the mesh's center are drawn first,
+    *      which reduces overdraw from any viewpoint at a bounded cost in vertex cache misses
+    *   4. renumbers vertices in the order the triangles first reference them for vertex fetch locality
+    * Cache efficiency is measured against a fifo cache of 'Settings::cacheSize' entries. generateLods() then builds a chain
+    * of simplified versions of the optimized mesh.
+    */
+    class MeshOptimizer
+    {
+    public:
+        struct Settings
+        {
+            // positions are welded within this fraction of the mesh's largest extent
+            f32 positionWeldEpsilon = 1e-6f;
+            // normals, tangents and texture coordinates are welded within this distance
+            f32 attributeWeldEpsilon = 1e-4f;
+            u32 cacheSize = 16u;
+            // overdraw reordering may raise the ACMR of each Tipsify cluster by at most this factor
+            f32 overdrawThreshold = 1.05f;
+            // including the full resolution mesh, 1 disables generating lods
+            u32 numLods = 4u;
+            // every lod aims for this fraction of the triangles of the previous one
+            f32 lodTriangleRatio = .5f;
+            // no lod deviates further than this fraction of the mesh's largest extent from the full resolution mesh
+            f32 maxLodError = .05f;
+        };
+
+        struct VertexCacheStatistics
+        {
+            // average cache miss ratio, vertices transformed per triangle. 3 at worst, approaching 0.5 for large grids.
+            f32 acmr = 0.f;
+            // average transform to vertex ratio, vertices transformed per referenced vertex. 1 at best.
+            f32 atvr = 0.f;
+        };
+
+        struct Report
+        {
+            u32 numVerticesBefore = 0u;
+            u32 numVerticesAfter = 0u;
+            u32 numTrianglesBefore = 0u;
+            u32 numTrianglesAfter = 0u;
+            VertexCacheStatistics before;
+            VertexCacheStatistics after;
+        };
+
+        /**
+        * Runs every stage on a triangle list, non indexed meshes get indexed first
+        */
+        static Report optimize(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices, const Settings& settings);
+
+        /**
+        * Merges vertices whose quantized attributes are equal and removes degenerate triangles, keeps the attributes of the
+        * first vertex of every merged group. Returns the number of vertices left.
+        */
+        static u32 weldVertices(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices, f32 positionEpsilon, f32 attributeEpsilon);
+
+        /**
+        * Tipsify, appends the index of the first triangle of every cluster it emits to 'outClusters' when given
+        */
+        static void optimizeVertexCache(std::vector<u32>& indices, u32 numVertices, u32 cacheSize, std::vector<u32>* outClusters = nullptr);
+
+        /**
+        * Splits the clusters returned by optimizeVertexCache() further while their ACMR stays within 'threshold' times
+        * the ACMR of the whole cluster, then sorts them by how much they face away from the mesh's center
+        */
+        static void optimizeOverdraw(std::vector<u32>& indices, const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& clusters, u32 cacheSize, f32 threshold);
+
+        /**
+        * Renumbers vertices in order of first use, unreferenced vertices are removed
+        */
+        static void optimizeVertexFetch(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices);
+
+        /**
+        * Quadric error edge collapse simplification (Garland and Heckbert, "Surface Simplification Using Quadric Error
+        * Metrics"). Vertices are only ever collapsed onto other vertices, so that 'outIndices' keep indexing 'vertices'.
+        * Collapses keep attribute seams and open borders intact and never flip triangles. Stops once 'outIndices' are down
+        * to 'targetNumIndices' or when any further collapse would move the surface by more than 'maxError'. Returns the
+        * error of the result, the root mean square distance of the planes around any collapsed vertex to its new position.
+        */
+        static f32 simplify(const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& indices, u32 targetNumIndices, f32 maxError, std::vector<u32>& outIndices);
+
+        /**
+        * Simplifies 'indices' repeatedly into up to 'settings.numLods - 1' lods, each one optimized for the vertex cache.
+        * The chain stops early once simplification can't reach the next level within 'settings.maxLodError'.
+        */
+        static std::vector<MeshLod> generateLods(const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& indices, const Settings& settings);
+
+        static VertexCacheStatistics analyzeVertexCache(const std::vector<u32>& indices, u32 numVertices, u32 cacheSize);
+    };
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Common.h"
+#include "RayTracer.h"
+
+namespace Cyan
+{
+    enum class SIMDLevel
+    {
+        kScalar = 0,
+        kSSE,
+        kAVX2
+    };
+
+    /**
+    * Widest instruction set usable for ray packets, requires support from both the cpu and the os (for saving
+    * ymm registers), detected through cpuid once and cached
+    */
+    SIMDLevel getSIMDLevel();
+    const char* getSIMDLevelName(SIMDLevel level);
+
+    // number of rays traced together at 'level', 1 means packets are not supported
+    u32 getPacketWidth(SIMDLevel level);
+
+    /**
+    * Closest hit tracing of up to 4 (SSE) or 8 (AVX2) coherent rays at once, every bvh node is tested against the whole
+    * packet in a single simd box test. Once only a few lanes are still active in a subtree, the remaining lanes finish
+    * that subtree with single ray traversal. 'numRays' can be smaller than the packet width for partial packets at
+    * image borders. Only call the AVX2 version when getSIMDLevel() reports kAVX2.
+    */
+    void tracePacket4(const RayTracingScene& rtxScene, const Ray* rays, u32 numRays, RayHit* outHits);
+    void tracePacket8(const RayTracingScene& rtxScene, const Ray* rays, u32 numRays, RayHit* outHits);
+}
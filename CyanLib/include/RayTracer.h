@@ -1,25 +1,61 @@
 #pragma once
 
 #include <functional>
+#include <atomic>
+#include <future>
+#include <memory>
 
 #include "scene.h"
 #include "RayTracingScene.h"
 
 namespace Cyan 
 {
+    class IrradianceCache;
+    class WavefrontPathTracer;
+
     struct Ray
     {
         glm::vec3 ro; 
         glm::vec3 rd;
     };
 
+    /**
+    * Offsets of the origin and the direction of a ray towards its neighbors one pixel over in x and y, describes the
+    * footprint of a pixel at a hit for picking texture mips
+    */
+    struct RayDifferential
+    {
+        glm::vec3 dodx = glm::vec3(0.f);
+        glm::vec3 dody = glm::vec3(0.f);
+        glm::vec3 dddx = glm::vec3(0.f);
+        glm::vec3 dddy = glm::vec3(0.f);
+    };
+
     struct RayHit
     {
-        f32 t;
-        i32 tri;
-        i32 material;
+        f32 t = FLT_MAX;
+        // index of the hit mesh instance, 'tri' indexes into the triangles of that instance's mesh
+        i32 instance = -1;
+        i32 tri = -1;
+        i32 material = -1;
     };
 
+    /**
+    * Transforms both origin and direction without normalizing the direction so that hit distances stay the same
+    * in the destination space
+    */
+    Ray transformRay(const glm::mat4& transform, const Ray& ray);
+
+    /**
+    * Primary ray through 'pixelCoords' in [0, 1] screen space, the direction is normalized
+    */
+    Ray generateRay(const PerspectiveCamera& camera, const glm::vec2& pixelCoords);
+
+    /**
+    * Differential of the primary ray through 'pixelCoords' for an image of 'imageSize' pixels
+    */
+    RayDifferential generateRayDifferential(const PerspectiveCamera& camera, const glm::vec2& pixelCoords, const glm::uvec2& imageSize);
+
     struct Image
     {
         Image(const glm::uvec2& inImageSize)
@@ -30,7 +66,7 @@ namespace Cyan
         }
 
         void setPixel(const glm::uvec2& coords, const glm::vec3& albedo) 
-        { 
+        {
             u32 index = coords.y * size.x + coords.x;
             if (index < pixels.size())
             {
@@ -50,6 +86,122 @@ namespace Cyan
         std::vector<glm::vec3> pixels;
     };
 
+    /**
+    * Running sum of radiance samples together with the number of samples taken for every pixel, used by progressive
+    * rendering. The sum of squared sample luminances is kept as well for estimating how converged a pixel is. Can be
+    * checkpointed to disk and loaded back later to continue a long render.
+    */
+    struct AccumulationBuffer
+    {
+        static const u32 kFileMagic = 0x43415943u; // 'CYAC'
+        static const u32 kFileVersion = 2u;
+
+        AccumulationBuffer(const glm::uvec2& inSize)
+            : size(inSize)
+        {
+            u32 numPixels = inSize.x * inSize.y;
+            radiance.resize(numPixels, glm::vec3(0.f));
+            luminanceSquared.resize(numPixels, 0.f);
+            sampleCounts.resize(numPixels, 0u);
+        }
+
+        void clear();
+        u32 getMinSampleCount() const;
+        void addSample(u32 pixelIndex, const glm::vec3& sample);
+
+        /**
+        * Standard error of the pixel's mean luminance relative to the mean, from the sample variance. Infinite while the
+        * pixel has less than 2 samples.
+        */
+        f32 getRelativeError(u32 pixelIndex) const;
+
+        /**
+        * Convergence map for display, every pixel's relative error divided by 'targetError' and clamped to 1 in grayscale,
+        * so pixels at or above the target are white
+        */
+        void resolveConvergence(Image& outImage, f32 targetError) const;
+
+        // writes the average of the accumulated samples of every pixel to 'outImage', pixels without samples are untouched
+        void resolve(Image& outImage) const;
+
+        /**
+        * Binary checkpoint of the sums and sample counts, loading fails when the file is missing, corrupted or was written
+        * for a different image size, in which case the buffer is left untouched
+        */
+        bool save(const char* filename) const;
+        bool load(const char* filename);
+
+        glm::uvec2 size;
+        std::vector<glm::vec3> radiance;
+        std::vector<f32> luminanceSquared;
+        std::vector<u32> sampleCounts;
+    };
+
+    /**
+    * Auxiliary outputs of the primary hits used to guide denoising: linear albedo, world space normal facing the camera
+    * and hit distance. Every pixel holds the running average of all the samples written to it, pixels whose rays missed
+    * everything average in zeros.
+    */
+    struct AOVBuffer
+    {
+        AOVBuffer(const glm::uvec2& inSize)
+            : size(inSize)
+        {
+            u32 numPixels = inSize.x * inSize.y;
+            albedo.resize(numPixels, glm::vec3(0.f));
+            normals.resize(numPixels, glm::vec3(0.f));
+            depth.resize(numPixels, 0.f);
+            sampleCounts.resize(numPixels, 0u);
+        }
+
+        void clear();
+        void addSample(u32 pixelIndex, const glm::vec3& inAlbedo, const glm::vec3& inNormal, f32 inDepth);
+
+        glm::uvec2 size;
+        std::vector<glm::vec3> albedo;
+        std::vector<glm::vec3> normals;
+        std::vector<f32> depth;
+        std::vector<u32> sampleCounts;
+    };
+
+    /**
+    * Single ray closest hit traversal of the tlas subtree rooted at 'rootNodeIndex', 'hit' carries the closest hit
+    * found so far in and the updated closest hit out
+    */
+    void traceTLAS(const RayTracingScene& rtxScene, const Ray& ray, RayHit& hit, u32 rootNodeIndex = BVH::kRootNodeIndex);
+
+    /**
+    * Same as above but for the blas of a single mesh instance, 'rayOS' needs to be in the instance's object space
+    */
+    void traceBLAS(const RayTracingScene& rtxScene, u32 instance, const Ray& rayOS, RayHit& hit, u32 rootNodeIndex = BVH::kRootNodeIndex);
+
+    /**
+    * Any hit versions of the above, return as soon as any triangle is hit in (0, tMax)
+    */
+    bool occludedTLAS(const RayTracingScene& rtxScene, const Ray& ray, f32 tMax, u32 rootNodeIndex = BVH::kRootNodeIndex);
+    bool occludedBLAS(const RayTracingScene& rtxScene, u32 instance, const Ray& rayOS, f32 tMax, u32 rootNodeIndex = BVH::kRootNodeIndex);
+
+    /**
+    * World space shading normal at a hit, averaged from the vertex normals of the hit triangle
+    */
+    glm::vec3 calcHitNormal(const RayTracingScene& rtxScene, const RayHit& hit);
+
+    /**
+    * Linear albedo at a hit, albedo maps are sampled trilinearly with the mip picked from the footprint of 'differential'
+    * transferred to the hit
+    */
+    glm::vec3 calcHitAlbedo(const RayTracingScene& rtxScene, const Ray& ray, const RayDifferential& differential, const RayHit& hit);
+
+    /**
+    * Same as above for rays without a known footprint such as diffuse bounces, which only see the average color of albedo maps
+    */
+    glm::vec3 calcHitAlbedo(const RayTracingScene& rtxScene, const RayHit& hit);
+
+    /**
+    * Radiance diffusely reflected at a hit from the scene's direct light only, used for the first indirect bounce
+    */
+    glm::vec3 calcDirectRadiance(const RayTracingScene& rtxScene, const RayHit& hit);
+
     glm::vec3 calcBarycentricCoords(const glm::vec3& p, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
 
     // utility functions
@@ -62,46 +214,162 @@ namespace Cyan
     class RayTracer
     {
     public:
-        struct RenderTracker
+        /**
+        * Tracks a render running on the thread pool, shared between the caller and the tile tasks
+        */
+        class RenderTracker
         {
+        public:
+            f32 getProgress() const { return numTiles > 0 ? (f32)numFinishedTiles.load() / numTiles : 0.f; }
+            bool finished() const { return numFinishedTiles.load() == numTiles; }
+            bool cancelled() const { return bCancelled.load(); }
+            // remaining tiles are skipped, the render still goes through its regular finish path
+            void cancel() { bCancelled.store(true); }
+            void wait() const { future.wait(); }
+
             const Image* outImage = nullptr;
-            f32 progress = 0.f;
 
-            void reset()
-            {
-                outImage = nullptr;
-                progress = 0.f;
-            }
+        private:
+            friend class RayTracer;
+
+            u32 numTiles = 0u;
+            std::atomic<u32> numFinishedTiles{ 0u };
+            std::atomic<bool> bCancelled{ false };
+            std::promise<void> promise;
+            std::shared_future<void> future;
+        };
+
+        static const u32 kTileSize = 16u;
+        // number of rays handled by one thread pool task in batched queries
+        static const u32 kRayBatchSize = 256u;
+
+        enum class RenderMode : u32
+        {
+            // primary hits are shaded tile by tile, indirect light comes from 'irradianceCache' or an ambient term
+            kTiled = 0,
+            // multi bounce path tracing one bounce of the whole image at a time, see WavefrontPathTracer
+            kWavefront
         };
 
-        RayTracer() { }
-        bool busy() { return isBusy; }
-        f32 getProgress() { return m_renderTracker.progress; }
+        RayTracer();
+        ~RayTracer();
+        bool busy() const { return m_renderTracker && !m_renderTracker->finished(); }
+        f32 getProgress() const { return m_renderTracker ? m_renderTracker->getProgress() : 0.f; }
 
+        /**
+        * Split the image into tiles and render them on the shared thread pool, returns immediately. 'rtxScene' and 'outImage'
+        * need to stay alive until the render finishes, 'finishCallback' runs on the worker that finishes the last tile.
+        */
+        std::shared_ptr<RenderTracker> renderSceneAsync(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const std::function<void()>& finishCallback = [](){ });
         void renderScene(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const std::function<void()>& finishCallback);
         RayHit trace(const RayTracingScene& rtxScene, const Ray& ray);
-    private:
 
-        void onRenderStart(Image& outImage) 
+        /**
+        * Visibility query for shadow / ambient occlusion rays, true if anything is hit within (0, tMax). Traversal stops
+        * at the first hit found and doesn't order children by distance.
+        */
+        bool occluded(const RayTracingScene& rtxScene, const Ray& ray, f32 tMax);
+
+        /**
+        * Batched version of the above, 'rays', 'tMax' and 'outOccluded' all hold 'numRays' elements. Large batches are
+        * split across the thread pool.
+        */
+        void occluded(const RayTracingScene& rtxScene, const Ray* rays, const f32* tMax, u32 numRays, bool* outOccluded);
+
+        /**
+        * Progressive rendering, every call to renderProgressive() adds jittered samples into 'accumulation' tile by tile on
+        * the thread pool until 'timeBudgetMs' runs out, so it can be called once per frame without stalling the ui. Each pass
+        * adds one sample to every pixel. The buffer isn't cleared here so that a render restored from a checkpoint continues
+        * where it left off, clear it whenever the camera or the scene changes. 'rtxScene' and 'accumulation' need to stay
+        * alive until the render is finished or restarted.
+        *
+        * With 'adaptiveErrorTarget' set, a tile stops being sampled once every pixel in it has a relative error below the
+        * target after at least kMinAdaptiveSamples passes. Later passes skip converged tiles, so the time they free up goes
+        * into the tiles that are still noisy.
+        */
+        void beginProgressiveRender(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, AccumulationBuffer& accumulation, u32 maxSamplesPerPixel = kMaxProgressiveSamples);
+        // returns true once every pixel has 'maxSamplesPerPixel' samples or every tile converged
+        bool renderProgressive(f32 timeBudgetMs = kProgressiveTimeBudgetMs);
+        void pauseProgressiveRender() { m_progressive.bPaused = true; }
+        void resumeProgressiveRender() { m_progressive.bPaused = false; }
+        bool isProgressiveRenderPaused() const { return m_progressive.bPaused; }
+        bool isProgressiveRenderFinished() const
         {
-            isBusy = true;
-            m_renderTracker.outImage = &outImage;
+            return m_progressive.accumulation == nullptr || m_progressive.pass >= m_progressive.maxSamplesPerPixel
+                || m_progressive.numConvergedTiles.load() == m_progressive.tileConverged.size();
         }
+        // samples per pixel in the tiles that didn't converge yet
+        u32 getProgressiveSampleCount() const { return m_progressive.pass; }
+        u32 getNumConvergedTiles() const { return m_progressive.numConvergedTiles.load(); }
 
-        void onRenderFinish(const std::function<void()>& callback) 
-        { 
-            isBusy = false;
-            m_renderTracker.reset();
-            callback();
-        }
+        static const u32 kMaxProgressiveSamples = 1024u;
+        static constexpr f32 kProgressiveTimeBudgetMs = 8.f;
+        // variance estimates from fewer samples are too unreliable to stop sampling on
+        static const u32 kMinAdaptiveSamples = 16u;
+
+        // relative standard error at which a tile counts as converged in progressive rendering, 0 disables adaptive sampling
+        f32 adaptiveErrorTarget = 0.f;
+
+        /**
+        * Prepass that seeds 'irradianceCache' from the primary hits of every 'pixelStride'th pixel in both directions on the
+        * thread pool, interpolation during shading is much smoother when most records exist before the first pixel is shaded
+        */
+        void fillIrradianceCache(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, const glm::uvec2& imageSize, u32 pixelStride = kIrradianceCacheFillStride);
+
+        static const u32 kIrradianceCacheFillStride = 2u;
 
-        RenderTracker m_renderTracker = { };
-        bool isBusy = false;
+        // indirect diffuse lighting is interpolated from this cache when set, otherwise a constant ambient term is used
+        IrradianceCache* irradianceCache = nullptr;
+        /**
+        * Filled with the primary hits of renderScene() and renderProgressive() when set, needs to match the size of the
+        * image being rendered. Clear it together with the accumulation buffer.
+        */
+        AOVBuffer* aovs = nullptr;
+        // test every triangle in the scene instead of traversing the bvh, useful for validating bvh tracing results
+        bool bBruteForceTracing = false;
+        // trace primary rays in simd packets when the cpu supports it, see RayPacket.h
+        bool bPacketTracing = true;
+
+        /**
+        * Picks the renderer behind renderScene() and renderProgressive(). A wavefront render can't be split into tiles,
+        * so it can only be cancelled before it starts and a progressive pass always covers the whole image, overshooting
+        * the time budget by up to one pass. Only one wavefront render may be in flight per RayTracer.
+        */
+        RenderMode renderMode = RenderMode::kTiled;
+        // settings and statistics of the last render in RenderMode::kWavefront
+        WavefrontPathTracer& getWavefrontPathTracer() { return *m_wavefront; }
+    private:
+        void renderWavefront(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage);
+        void renderTile(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const glm::uvec2& tileStart, const glm::uvec2& tileEnd, const RenderTracker& tracker);
+        void renderTilePackets(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const glm::uvec2& tileStart, const glm::uvec2& tileEnd, const RenderTracker& tracker, u32 packetWidth);
+        void accumulateTile(const glm::uvec2& tileStart, const glm::uvec2& tileEnd);
+        bool isTileConverged(const glm::uvec2& tileStart, const glm::uvec2& tileEnd) const;
+        // shades a primary hit and records its aovs when 'aovs' is set, misses only record empty aovs and return black
+        glm::vec3 shadePrimary(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, const glm::uvec2& imageSize, const glm::vec2& pixelCoords, const Ray& ray, const RayHit& hit, u32 pixelIndex);
+
+        struct ProgressiveRender
+        {
+            const RayTracingScene* scene = nullptr;
+            PerspectiveCamera camera;
+            AccumulationBuffer* accumulation = nullptr;
+            u32 maxSamplesPerPixel = 0u;
+            // current pass, and the next tile to claim within that pass
+            u32 pass = 0u;
+            std::atomic<u32> nextTile{ 0u };
+            bool bPaused = false;
+            // one flag per tile, only written by the worker rendering that tile and read after the pass joined
+            std::vector<u8> tileConverged;
+            std::atomic<u32> numConvergedTiles{ 0u };
+            // pixels of the tiles that didn't converge yet, traced by a pass in RenderMode::kWavefront
+            std::vector<u32> wavefrontPixels;
+        };
+
+        std::shared_ptr<RenderTracker> m_renderTracker = nullptr;
+        ProgressiveRender m_progressive;
+        std::unique_ptr<WavefrontPathTracer> m_wavefront;
     };
 
 #if 0
-    struct IrradianceRecord;
-
     glm::vec3 computeBaryCoord(Triangle& tri, glm::vec3& hitPosObjectSpace);
     glm::vec3 computeBaryCoordFromHit(RayCastInfo rayHit, glm::vec3& hitPosition);
 
@@ -131,63 +399,6 @@ namespace Cyan
         glm::vec3 flatColor;
     };
 
-    struct OctreeNode
-    {
-        glm::vec3        center;
-        f32              sideLength;
-        OctreeNode*      childs[8];
-        std::vector<u32> records;
-    };
-
-    struct Octree
-    {
-        Octree();
-        ~Octree() { }
-
-        static const u32        maxNodeCount = 1024 * 1024;
-        u32                     m_numAllocatedNodes;
-        std::vector<OctreeNode> m_nodePool;
-        OctreeNode*             m_root;
-
-        void        init(const glm::vec3& center, f32 sideLength);
-        OctreeNode* allocNode();
-        u32         getChildIndexEnclosingSurfel(OctreeNode* node, const glm::vec3& position);
-        void        traverse(const std::function<void(std::queue<OctreeNode*>&, OctreeNode*)>& callback);
-        void        insert(const IrradianceRecord& newRecord, u32 recordIndex);
-    };
-
-    /* @brief:
-    *  
-    */
-    struct IrradianceRecord
-    {
-        glm::vec3 irradiance;
-        glm::vec3 position;
-        glm::vec3 normal;
-        f32       r;
-        // a gradient vector for each albedo component R, G, B
-        glm::vec3 gradient_r[3];
-        glm::vec3 gradient_t[3];
-    };
-
-    /* @brief:
-    * todo: shared gradients
-    * todo: neighbor clamping 
-    */
-    struct IrradianceCache
-    {
-        IrradianceCache();
-        ~IrradianceCache() {}
-
-        void init(std::vector<SceneNode*>& nodes);
-        const IrradianceRecord& addIrradianceRecord(const glm::vec3& p, const glm::vec3& pn, const glm::vec3& irradiance, f32 r, const glm::vec3* rotationalGradient, const glm::vec3* translationalGradient);
-
-        static const u32 cacheSize = 1024 * 1024;
-        std::vector<IrradianceRecord> m_records;
-        u32 m_numRecords;
-        Octree* m_octree;
-    };
-
     class PathTracer
     {
     public:
@@ -1,8 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <memory>
+
 #include "Scene.h"
 #include "CyanRenderer.h"
 #include "BVH.h"
+#include "TriangleBlock.h"
+#include "RayTracingTexture.h"
 
 namespace Cyan
 {
@@ -18,29 +23,35 @@ namespace Cyan
         std::vector<glm::vec2> texCoords;
     };
 
-    struct SurfaceArray : public TriangleArray
-    {
-        std::vector<u32> materials;
-    };
-
     struct RayTracingMesh
     {
-        std::vector<TriangleArray> submeshes;
+        // triangles of all the submeshes in object space, shared by every instance of this mesh
+        TriangleArray triangles;
+        // submesh that each triangle belongs to, used for looking up an instance's material for a hit triangle
+        std::vector<u32> submeshIndices;
+        u32 numSubmeshes = 0u;
+        // bottom level acceleration structure built over 'triangles'
+        BVH blas;
+        // leaf triangles of 'blas' in simd friendly form, only built when the cpu supports AVX2
+        TriangleBlockArray triangleBlocks;
     };
 
     struct RayTracingMeshInstance
     {
         glm::mat4 worldTransform;
+        // inverse of 'worldTransform', rays are transformed into object space to trace the parent mesh's blas
+        glm::mat4 worldToObject;
         // index into the global mesh array managed by the parent scene
         u32 parent;
         // index into the global material array managed by the parent scene
         std::vector<u32> materials;
     };
 
-    // todo: support texture maps at some point ...?
     struct RayTracingMaterial
     {
         glm::vec3 albedo = glm::vec3(.94f);
+        // index into the texture array managed by the parent scene, replaces 'albedo' when set
+        i32 albedoMap = -1;
         glm::vec3 emissive = glm::vec3(1.f);
         f32 roughness = 0.8f;
         f32 metallic = 0.1f;
@@ -57,24 +68,74 @@ namespace Cyan
 
     struct RayTracingScene
     {
+        // refits are allowed to make a tlas / blas this much more expensive to trace before it gets rebuilt
+        static constexpr f32 kMaxSAHCostGrowth = 1.5f;
+        // meshes with at least this many triangles get a linear blas build followed by treelet optimization
+        static const u32 kLinearBuildMinTriangles = 64u * 1024u;
+
         /**
-        * Convert a general Cyan::Scene to Cyan::RayTracingScene
+        * Convert a general Cyan::Scene to Cyan::RayTracingScene. When 'bvhCacheDirectory' is given, blas are loaded from
+        * the BVHCache in that directory and only meshes missing from it are built and then added to it.
         */
-        RayTracingScene(const Scene& scene);
+        RayTracingScene(const Scene& scene, const char* bvhCacheDirectory = nullptr);
+
+        /**
+        * Pick up the latest transforms of entities flagged EntityFlag_kDynamic and meshes marked deformed by refitting 
+        * the tlas / blas instead of rebuilding them. Once refits degrade a tree past kMaxSAHCostGrowth, it is rebuilt on 
+        * the thread pool and swapped in by a later call. The source scene needs to outlive this RayTracingScene, and 
+        * this should not be called while a render of this scene is in flight.
+        */
+        void update();
+
+        /**
+        * Request a blas refit on the next update() after the positions of meshes[meshIndex] were modified in place
+        */
+        void markMeshDeformed(u32 meshIndex);
 
         PerspectiveCamera camera;
 
+        u32 getMaterial(u32 instance, u32 tri) const
+        {
+            const RayTracingMeshInstance& meshInst = meshInstances[instance];
+            return meshInst.materials[meshes[meshInst.parent].submeshIndices[tri]];
+        }
+
+        /**
+        * Geometry is only stored once per unique mesh, instances only add a transform and a material list on top of it
+        */
         std::vector<RayTracingMesh> meshes;
         std::vector<RayTracingMaterial> materials;
+        std::vector<RayTracingTexture> textures;
         std::vector<RayTracingMeshInstance> meshInstances;
 
-        // flattened big triangle array used to perform the actual tracing
-        SurfaceArray surfaces;
-
-        ShaderStorageBuffer<DynamicSsboData<glm::vec4>> positionBuffer;
-        ShaderStorageBuffer<DynamicSsboData<glm::vec4>> normalBuffer;
-        ShaderStorageBuffer<DynamicSsboData<GPURayTracingMaterial>> materialBuffer;
+        // top level acceleration structure built over the world space bounds of 'meshInstances'
+        BVH tlas;
 
         // todo: lights
+    private:
+        struct DynamicInstance
+        {
+            StaticMeshEntity* entity;
+            u32 instance;
+        };
+
+        /**
+        * A tree being rebuilt on the thread pool from a snapshot of the primitives
+        */
+        struct BackgroundRebuild
+        {
+            BVH bvh;
+            std::atomic<bool> bFinished{ false };
+        };
+
+        void rebuildInBackground(std::shared_ptr<BackgroundRebuild>& outRebuild, const BVH& bvh, const std::vector<BVHPrimitive>& primitives);
+        bool finishRebuild(BVH& bvh, std::shared_ptr<BackgroundRebuild>& rebuild);
+
+        std::vector<DynamicInstance> m_dynamicInstances;
+        // tlas primitives, kept around so that a refit only needs to recompute the bounds of moved instances
+        std::vector<BVHPrimitive> m_instanceBounds;
+        std::vector<bool> m_deformedMeshes;
+        std::shared_ptr<BackgroundRebuild> m_tlasRebuild;
+        std::vector<std::shared_ptr<BackgroundRebuild>> m_blasRebuilds;
     };
 }
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "Allocator.h"
+#include "Texture.h"
+
+namespace Cyan
+{
+    /**
+    * Cpu side copy of a texture for the ray tracer with a prebuilt mip chain. Texels are stored as 8 bit rgba in 4x4
+    * tiles of one cache line each, with the texels inside a tile in morton order, so that the 2x2 footprint of a bilinear
+    * lookup mostly falls into a single cache line no matter which direction the texture is traversed in. sRGB encoded
+    * textures are filtered and downsampled in linear space.
+    */
+    class RayTracingTexture
+    {
+    public:
+        enum class Filtering
+        {
+            kNearest = 0,
+            kBilinear,
+            kTrilinear
+        };
+
+        static const u32 kTileSize = 4u;
+        static const u32 kTexelsPerTile = kTileSize * kTileSize;
+
+        /**
+        * Copies and mips the cpu side pixel data of 'texture', 8 bit and 32 bit float rgb(a) formats are supported, float
+        * texels are clamped to [0, 1]. The texture is left empty for other formats or when there is no pixel data.
+        */
+        RayTracingTexture(Texture2DRenderable& texture, bool bSRGB);
+
+        bool empty() const { return m_mips.empty(); }
+        u32 getNumMips() const { return (u32)m_mips.size(); }
+        glm::uvec2 getSize() const { return empty() ? glm::uvec2(0u) : glm::uvec2(m_mips[0].width, m_mips[0].height); }
+
+        /**
+        * Mip level matching a pixel footprint given by the screen space derivatives of the texture coordinates
+        */
+        f32 calcLod(const glm::vec2& duvdx, const glm::vec2& duvdy) const;
+
+        /**
+        * Linear rgba at 'uv' from mip 'lod', trilinear filtering blends the two nearest mips of a fractional 'lod'
+        */
+        glm::vec4 sample(const glm::vec2& uv, f32 lod, Filtering filtering = Filtering::kTrilinear) const;
+        glm::vec4 sampleGrad(const glm::vec2& uv, const glm::vec2& duvdx, const glm::vec2& duvdy, Filtering filtering = Filtering::kTrilinear) const;
+
+        // average of the whole texture, taken from the last mip
+        glm::vec4 getAverage() const { return m_average; }
+
+        bool bSRGB = false;
+        bool bWrapS = true;
+        bool bWrapT = true;
+
+    private:
+        struct Mip
+        {
+            u32 width;
+            u32 height;
+            u32 numTilesX;
+            // first texel of this mip in 'm_texels'
+            u32 offset;
+        };
+
+        u32 getTexelIndex(const Mip& mip, u32 x, u32 y) const;
+        glm::vec4 decode(u32 texel) const;
+        u32 encode(const glm::vec4& color) const;
+        glm::vec4 fetch(u32 mip, i32 x, i32 y) const;
+        glm::vec4 sampleNearest(u32 mip, const glm::vec2& uv) const;
+        glm::vec4 sampleBilinear(u32 mip, const glm::vec2& uv) const;
+        void addMip(u32 width, u32 height);
+        void downsample(u32 srcMip);
+
+        std::vector<Mip> m_mips;
+        // every tile starts on a cache line
+        std::vector<u32, AlignedAllocator<u32, 64>> m_texels;
+        glm::vec4 m_average = glm::vec4(1.f);
+    };
+}
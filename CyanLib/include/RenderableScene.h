@@ -21,11 +21,29 @@ namespace Cyan
 
     struct PackedGeometry 
     {
-        PackedGeometry(const Scene& scene);
+        enum class VertexFormat : u32
+        {
+            // Vertex, 64 bytes
+            kFull = 0,
+            // QuantizedVertex, 24 bytes
+            kQuantized
+        };
+
+        explicit PackedGeometry(VertexFormat inVertexFormat);
+
+        /**
+        * Packs the meshes of 'scene' that weren't packed yet, or that got different submeshes since they were, after
+        * everything packed so far. Nothing already packed moves, so meshes showing up one at a time while a scene is
+        * imported only cost their own geometry.
+        */
+        void update(const Scene& scene);
 
         std::vector<Mesh*> meshes;
         std::unordered_map<std::string, Mesh*> meshMap;
+        // index of the LodChain of the first submesh of every mesh
         std::unordered_map<std::string, u32> submeshMap;
+        // number of submeshes every mesh had when it was packed
+        std::unordered_map<std::string, u32> numSubmeshesMap;
 
         struct Vertex
         {
@@ -34,8 +52,25 @@ namespace Cyan
             glm::vec4 tangent;
             glm::vec4 texCoord;
         };
-        // unified geometry data
-        ShaderStorageBuffer<DynamicSsboData<Vertex>> vertexBuffer;
+
+        /**
+        * Positions are 16 bit fixed point relative to the submesh's aabb, normals and tangents are octahedral encoded into
+        * two 16 bit snorms and texture coordinates are half floats. The upper half of 'posZ' keeps the tangent's handedness.
+        */
+        struct QuantizedVertex
+        {
+            u32 posXY;
+            u32 posZ;
+            u32 normal;
+            u32 tangent;
+            u32 texCoord0;
+            u32 texCoord1;
+        };
+
+        VertexFormat vertexFormat;
+        u32 numVertices = 0u;
+        // unified geometry data, vertices are stored as raw words in 'vertexFormat' and decoded by the vertex shaders
+        ShaderStorageBuffer<DynamicSsboData<u32>> vertexBuffer;
         ShaderStorageBuffer<DynamicSsboData<u32>> indexBuffer;
 
         struct SubmeshDesc
@@ -44,8 +79,34 @@ namespace Cyan
             u32 baseIndex = 0;
             u32 numVertices = 0;
             u32 numIndices = 0;
+            // quantized positions decode to positionMin + position * positionScale
+            glm::vec3 positionMin = glm::vec3(0.f);
+            u32 vertexFormat = 0;
+            glm::vec3 positionScale = glm::vec3(0.f);
+            u32 padding = 0;
         };
         ShaderStorageBuffer<DynamicSsboData<SubmeshDesc>> submeshes;
+
+        /**
+        * The lods of a submesh are consecutive SubmeshDescs sharing the same vertices, from full resolution to coarsest
+        */
+        struct LodChain
+        {
+            // SubmeshDesc of the full resolution submesh
+            u32 baseSubmesh = 0;
+            // object space bounding sphere
+            glm::vec3 center = glm::vec3(0.f);
+            f32 radius = 0.f;
+            // object space error of every lod, the full resolution one's is 0
+            std::vector<f32> errors;
+            // texture coordinate units per object space unit averaged over the full resolution surface, 0 without texture coordinates
+            f32 texCoordScale = 0.f;
+        };
+        std::vector<LodChain> lodChains;
+
+    private:
+        // appends the triangle submeshes of 'mesh' to the cpu side arrays
+        void pack(Mesh* mesh);
     };
 
     /** todo:
@@ -74,6 +135,14 @@ namespace Cyan
             u32 padding = 0;
         };
 
+        // a submesh instance before picking its lod
+        struct SubmeshInstance
+        {
+            u32 lodChain = 0;
+            u32 material = 0;
+            u32 transform = 0;
+        };
+
         using ViewBuffer = ShaderStorageBuffer<StaticSsboData<View>>;
         using TransformBuffer = ShaderStorageBuffer<DynamicSsboData<glm::mat4>>;
         using InstanceBuffer = ShaderStorageBuffer<DynamicSsboData<InstanceDesc>>;
@@ -93,10 +162,24 @@ namespace Cyan
         static void clone(RenderableScene& dst, const RenderableScene& src);
 
         /**
-        * Submit rendering data to global gpu buffers
+        * Submit rendering data to global gpu buffers, picking lods for the current camera and viewport. Set the viewport
+        * of the view being rendered before calling this.
         */
         void upload();
 
+        /**
+        * Picks the coarsest lod of every submesh instance whose error projects to at most 'maxLodScreenError' pixels
+        * on a view through 'view' and 'projection' that is 'viewportHeight' pixels tall, then rebuilds the instance and
+        * draw call buffers. Everything is drawn at full resolution when 'viewportHeight' is 0.
+        */
+        void selectLods(const glm::mat4& view, const glm::mat4& projection, f32 viewportHeight);
+
+        /**
+        * Asks the TextureStreamer for the mips the material textures of every submesh instance need to show one texel per
+        * pixel on a view through 'view' and 'projection' that is 'viewportHeight' pixels tall
+        */
+        void requestTextureMips(const glm::mat4& view, const glm::mat4& projection, f32 viewportHeight);
+
         // bounding box
         BoundingBox3D aabb;
 
@@ -116,6 +199,9 @@ namespace Cyan
 
         // mesh instances
         std::vector<MeshInstance*> meshInstances;
+        std::vector<SubmeshInstance> submeshInstances;
+        // largest error in pixels a lod may show at, 0 always draws full resolution
+        f32 maxLodScreenError = 1.f;
 
         // lights
         std::vector<DirectionalLight*> directionalLights;
@@ -132,9 +218,12 @@ namespace Cyan
         std::unique_ptr<TransformBuffer> transformBuffer = nullptr;
         std::unique_ptr<InstanceBuffer> instanceBuffer = nullptr;
         std::unique_ptr<MaterialBuffer> materialBuffer = nullptr;
+        // materials in the same order as in 'materialBuffer'
+        std::vector<Material*> materials;
         std::unique_ptr<DrawCallBuffer> drawCallBuffer = nullptr;
 
     private:
         u32 getMaterialID(MeshInstance* meshInstance, u32 submeshIndex);
+        void buildDrawCalls();
     };
 }
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+#include "Common.h"
+
+namespace Cyan
+{
+    // polynomial for 2^f with f in [0, 1), used by simdExp() below
+    static const f32 kExp2Coefficients[5] = { .6931472f, .2402265f, .05550411f, .009618129f, .001333356f };
+
+    /**
+    * Thin wrappers around sse / avx registers so that simd kernels are written only once for both widths. Comparisons
+    * return all bits set lanes that can be combined with '&' and turned into a lane bitmask with movemask().
+    */
+    struct Float4
+    {
+        static const u32 kWidth = 4u;
+
+        Float4() { }
+        Float4(__m128 inV) : v(inV) { }
+        static Float4 splat(f32 x) { return _mm_set1_ps(x); }
+        static Float4 load(const f32* src) { return _mm_loadu_ps(src); }
+        void store(f32* dst) const { _mm_storeu_ps(dst, v); }
+
+        __m128 v;
+    };
+
+    inline Float4 operator+(const Float4& a, const Float4& b) { return _mm_add_ps(a.v, b.v); }
+    inline Float4 operator-(const Float4& a, const Float4& b) { return _mm_sub_ps(a.v, b.v); }
+    inline Float4 operator*(const Float4& a, const Float4& b) { return _mm_mul_ps(a.v, b.v); }
+    inline Float4 operator/(const Float4& a, const Float4& b) { return _mm_div_ps(a.v, b.v); }
+    inline Float4 operator&(const Float4& a, const Float4& b) { return _mm_and_ps(a.v, b.v); }
+    inline Float4 simdMin(const Float4& a, const Float4& b) { return _mm_min_ps(a.v, b.v); }
+    inline Float4 simdMax(const Float4& a, const Float4& b) { return _mm_max_ps(a.v, b.v); }
+    inline Float4 simdAbs(const Float4& a) { return _mm_andnot_ps(_mm_set1_ps(-0.f), a.v); }
+    inline Float4 cmpLT(const Float4& a, const Float4& b) { return _mm_cmplt_ps(a.v, b.v); }
+    inline Float4 cmpLE(const Float4& a, const Float4& b) { return _mm_cmple_ps(a.v, b.v); }
+    inline Float4 cmpGT(const Float4& a, const Float4& b) { return _mm_cmpgt_ps(a.v, b.v); }
+    inline Float4 cmpGE(const Float4& a, const Float4& b) { return _mm_cmpge_ps(a.v, b.v); }
+    inline u32 movemask(const Float4& a) { return (u32)_mm_movemask_ps(a.v); }
+    inline Float4 simdSqrt(const Float4& a) { return _mm_sqrt_ps(a.v); }
+
+    /**
+    * e^x with about 4 correct digits, the exponent bits are set directly from the integer part of x * log2(e) and only
+    * the fractional part goes through a polynomial. Results flush to 0 below e^-87.
+    */
+    inline Float4 simdExp(const Float4& x)
+    {
+        __m128 t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(x.v, _mm_set1_ps(1.442695f)), _mm_set1_ps(-126.f)), _mm_set1_ps(126.f));
+        __m128 whole = _mm_cvtepi32_ps(_mm_cvttps_epi32(t));
+        // truncation rounds negative values up
+        whole = _mm_sub_ps(whole, _mm_and_ps(_mm_cmpgt_ps(whole, t), _mm_set1_ps(1.f)));
+        __m128 f = _mm_sub_ps(t, whole);
+        __m128 p = _mm_set1_ps(kExp2Coefficients[4]);
+        for (i32 i = 3; i >= 0; --i)
+        {
+            p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(kExp2Coefficients[i]));
+        }
+        p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(1.f));
+        __m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_cvttps_epi32(whole), _mm_set1_epi32(127)), 23));
+        return _mm_mul_ps(p, scale);
+    }
+
+    struct Float8
+    {
+        static const u32 kWidth = 8u;
+
+        Float8() { }
+        Float8(__m256 inV) : v(inV) { }
+        static Float8 splat(f32 x) { return _mm256_set1_ps(x); }
+        static Float8 load(const f32* src) { return _mm256_loadu_ps(src); }
+        void store(f32* dst) const { _mm256_storeu_ps(dst, v); }
+
+        __m256 v;
+    };
+
+    inline Float8 operator+(const Float8& a, const Float8& b) { return _mm256_add_ps(a.v, b.v); }
+    inline Float8 operator-(const Float8& a, const Float8& b) { return _mm256_sub_ps(a.v, b.v); }
+    inline Float8 operator*(const Float8& a, const Float8& b) { return _mm256_mul_ps(a.v, b.v); }
+    inline Float8 operator/(const Float8& a, const Float8& b) { return _mm256_div_ps(a.v, b.v); }
+    inline Float8 operator&(const Float8& a, const Float8& b) { return _mm256_and_ps(a.v, b.v); }
+    inline Float8 simdMin(const Float8& a, const Float8& b) { return _mm256_min_ps(a.v, b.v); }
+    inline Float8 simdMax(const Float8& a, const Float8& b) { return _mm256_max_ps(a.v, b.v); }
+    inline Float8 simdAbs(const Float8& a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v); }
+    inline Float8 cmpLT(const Float8& a, const Float8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    inline Float8 cmpLE(const Float8& a, const Float8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    inline Float8 cmpGT(const Float8& a, const Float8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    inline Float8 cmpGE(const Float8& a, const Float8& b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    inline u32 movemask(const Float8& a) { return (u32)_mm256_movemask_ps(a.v); }
+    inline Float8 simdSqrt(const Float8& a) { return _mm256_sqrt_ps(a.v); }
+
+    inline Float8 simdExp(const Float8& x)
+    {
+        __m256 t = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x.v, _mm256_set1_ps(1.442695f)), _mm256_set1_ps(-126.f)), _mm256_set1_ps(126.f));
+        __m256 whole = _mm256_floor_ps(t);
+        __m256 f = _mm256_sub_ps(t, whole);
+        __m256 p = _mm256_set1_ps(kExp2Coefficients[4]);
+        for (i32 i = 3; i >= 0; --i)
+        {
+            p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(kExp2Coefficients[i]));
+        }
+        p = _mm256_add_ps(_mm256_mul_ps(p, f), _mm256_set1_ps(1.f));
+        __m256 scale = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(whole), _mm256_set1_epi32(127)), 23));
+        return _mm256_mul_ps(p, scale);
+    }
+
+    /**
+    * Scalar stand in with the same interface, for the remainders of simd loops
+    */
+    struct Float1
+    {
+        static const u32 kWidth = 1u;
+
+        Float1() { }
+        Float1(f32 inV) : v(inV) { }
+        static Float1 splat(f32 x) { return x; }
+        static Float1 load(const f32* src) { return *src; }
+        void store(f32* dst) const { *dst = v; }
+
+        f32 v;
+    };
+
+    inline Float1 operator+(const Float1& a, const Float1& b) { return a.v + b.v; }
+    inline Float1 operator-(const Float1& a, const Float1& b) { return a.v - b.v; }
+    inline Float1 operator*(const Float1& a, const Float1& b) { return a.v * b.v; }
+    inline Float1 operator/(const Float1& a, const Float1& b) { return a.v / b.v; }
+    inline Float1 simdMin(const Float1& a, const Float1& b) { return a.v < b.v ? a.v : b.v; }
+    inline Float1 simdMax(const Float1& a, const Float1& b) { return a.v > b.v ? a.v : b.v; }
+    inline Float1 simdAbs(const Float1& a) { return fabsf(a.v); }
+    inline Float1 simdSqrt(const Float1& a) { return sqrtf(a.v); }
+
+    // the same approximation as the wide versions so that pixels filtered one at a time get the same weights
+    inline Float1 simdExp(const Float1& x)
+    {
+        f32 t = simdMin(simdMax(x.v * 1.442695f, -126.f), 126.f).v;
+        f32 whole = floorf(t);
+        f32 f = t - whole;
+        f32 p = kExp2Coefficients[4];
+        for (i32 i = 3; i >= 0; --i)
+        {
+            p = p * f + kExp2Coefficients[i];
+        }
+        p = p * f + 1.f;
+        u32 scaleBits = (u32)((i32)whole + 127) << 23;
+        f32 scale;
+        memcpy(&scale, &scaleBits, sizeof(scale));
+        return p * scale;
+    }
+}
@@ -35,6 +35,8 @@ namespace Cyan
         const Transform& getWorldTransform();
         const glm::mat4& getLocalTransformMatrix();
         const glm::mat4& getWorldTransformMatrix();
+        // takes effect on the world transform with the next Scene::update()
+        void setLocalTransform(const Transform& transform);
         SceneComponent* find(const char* name);
 
         // owner
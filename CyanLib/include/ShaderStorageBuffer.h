@@ -170,6 +170,35 @@ namespace Cyan
             }
         }
 
+        /**
+        * Uploads only the dynamic elements from 'firstElement' on, for arrays that are only ever appended to. Outgrowing the
+        * buffer reallocates it with twice the room needed and copies the elements uploaded so far over on the gpu, so that
+        * a stream of small appends neither reallocates nor uploads the whole array every time.
+        */
+        void uploadAppended(u32 firstElement)
+        {
+            u32 firstByte = data.getStaticDataSizeInBytes() + firstElement * (u32)sizeof(data.array[0]);
+            if (data.getSizeInBytes() > sizeInBytes)
+            {
+                u32 grownSizeInBytes = data.getSizeInBytes() * 2u;
+                GLuint grownObject;
+                glCreateBuffers(1, &grownObject);
+                glNamedBufferData(grownObject, grownSizeInBytes, nullptr, GL_DYNAMIC_DRAW);
+                u32 numBytesToCopy = Min(firstByte, sizeInBytes);
+                if (numBytesToCopy > 0)
+                {
+                    glCopyNamedBufferSubData(glObject, grownObject, 0, 0, numBytesToCopy);
+                }
+                glDeleteBuffers(1, &glObject);
+                glObject = grownObject;
+                sizeInBytes = grownSizeInBytes;
+            }
+            if (data.getSizeInBytes() > firstByte)
+            {
+                glNamedBufferSubData(getGpuObject(), firstByte, data.getSizeInBytes() - firstByte, &data.array[firstElement]);
+            }
+        }
+
         u32 getNumElements() { return data.getNumElements(); }
 
         template <typename T>
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Common.h"
+#include "Texture.h"
+#include "TextureCompressor.h"
+
+namespace Cyan
+{
+    /**
+    * Persistent cache of block compressed textures, one KTX2 file per imported image in 'directory' named after a hash
+    * of the image's key and the role it was compressed for. Files hold the whole mip chain without supercompression, so
+    * loading one is a copy of its levels straight into the pixel data uploaded with glCompressedTextureSubImage2D().
+    * Every file carries a "CyanSource" key/value entry describing what it was compressed from, a cached texture stays
+    * valid as long as its source keeps the same size and content hash.
+    * Rows are stored bottom up as the engine flips every image it decodes, which is written down as "ru" orientation.
+    */
+    class TextureCache
+    {
+    public:
+        static const u32 kCacheVersion = 1u;
+
+        struct SourceInfo
+        {
+            u32 version;
+            // TextureCompressor::Role
+            u32 role;
+            u64 sourceSize;
+            u64 sourceHash;
+        };
+
+        explicit TextureCache(const char* directory);
+
+        /**
+        * Fills 'outSpec' with the compressed texture cached for 'key', fails when there is no cache file or when it was
+        * compressed from a different source. See readKtx2() for 'maxMipSize'.
+        */
+        bool load(const char* key, TextureCompressor::Role role, u64 sourceSize, u64 sourceHash, ITextureRenderable::Spec& outSpec, u32 maxMipSize = 0u) const;
+        bool save(const char* key, TextureCompressor::Role role, u64 sourceSize, u64 sourceHash, const ITextureRenderable::Spec& spec) const;
+
+        std::string getFilename(const char* key, TextureCompressor::Role role) const;
+
+        /**
+        * Parses a KTX2 file holding one of the BC formats in ITextureRenderable::Spec::PixelFormat, srgb and linear
+        * variants map to the same pixel format since shaders do their own linearization. 'outSource' is filled in when
+        * the file was written by a TextureCache. Pixel data is allocated with new[] and holds every level, largest first.
+        * A non zero 'maxMipSize' only reads the mip tail, levels from findMipTail() on, leaving the rest to be streamed in.
+        */
+        static bool readKtx2(const u8* data, u64 size, ITextureRenderable::Spec& outSpec, SourceInfo* outSource = nullptr, u32 maxMipSize = 0u);
+
+        // copies the blocks of a single level of a KTX2 file that readKtx2() can load
+        static bool readKtx2Level(const u8* data, u64 size, u32 level, std::vector<u8>& outBlocks);
+
+        // first mip no larger than 'maxMipSize' texels on either side, 0 when 'maxMipSize' is 0
+        static u32 findMipTail(u32 width, u32 height, u32 numMips, u32 maxMipSize);
+
+        // 'bSRGB' only picks the vkFormat written down, the blocks are stored as they are
+        static bool writeKtx2(const char* filename, const ITextureRenderable::Spec& spec, bool bSRGB, const SourceInfo* source = nullptr);
+
+        static bool isKtx2(const u8* data, u64 size);
+
+    private:
+        std::string m_directory;
+    };
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+
+#include "Common.h"
+#include "Texture.h"
+
+namespace Cyan
+{
+    /**
+    * Cpu side block compression of imported textures. compress() builds the whole mip chain of a decoded image and
+    * encodes every mip into the block compressed format that suits how the texture is sampled:
+    *   albedo          BC1, or BC3 when any texel isn't fully opaque, mips are filtered in linear space
+    *   normal          BC5 keeping only x and y, shaders rebuild z
+    *   material        BC7 for packed occlusion, roughness and metalness
+    *   hdr             BC6H, unsigned
+    * Blocks are encoded by fitting the endpoints of a line through each block's principal axis and picking the closest
+    * palette entry for every texel. Rows of blocks are encoded in parallel on the thread pool.
+    */
+    class TextureCompressor
+    {
+    public:
+        enum class Role : u32
+        {
+            // left uncompressed
+            kNone = 0,
+            kAlbedo,
+            kNormal,
+            kMaterial,
+            kHDR,
+            kCount
+        };
+
+        using PixelFormat = ITextureRenderable::Spec::PixelFormat;
+
+        /**
+        * 'pixels' are rgba8 for ldr roles and rgb32f for kHDR. On success 'outSpec' gets the size, mip count, format
+        * and the compressed mip chain, allocated with new[] so that a texture created from it can take it over.
+        */
+        static bool compress(Role role, const void* pixels, u32 width, u32 height, ITextureRenderable::Spec& outSpec);
+
+        static PixelFormat selectFormat(Role role, const u8* rgba, u32 numPixels);
+        static u32 getNumMips(u32 width, u32 height);
+
+        /**
+        * Decodes the first mip of a texture compressed by compress() into rgba8 for cpu side consumers. BC7 blocks
+        * decode only in the mode encodeBC7() writes and BC6H isn't supported.
+        */
+        static bool decompress(PixelFormat format, const u8* blocks, u32 width, u32 height, std::vector<u8>& outRGBA);
+
+        // a block is 4x4 texels in row major order
+        static void encodeBC1(const u8 rgba[64], u8 outBlock[8]);
+        static void encodeBC3(const u8 rgba[64], u8 outBlock[16]);
+        static void encodeBC5(const u8 rgba[64], u8 outBlock[16]);
+        static void encodeBC7(const u8 rgba[64], u8 outBlock[16]);
+        static void encodeBC6H(const f32 rgb[48], u8 outBlock[16]);
+
+        static void decodeBC1(const u8 block[8], u8 outRGBA[64]);
+        static void decodeBC3(const u8 block[16], u8 outRGBA[64]);
+        static void decodeBC5(const u8 block[16], u8 outRGBA[64]);
+        static bool decodeBC7(const u8 block[16], u8 outRGBA[64]);
+    };
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "Common.h"
+#include "Texture.h"
+#include "TextureCompressor.h"
+#include "TextureCache.h"
+
+namespace Cyan
+{
+    /**
+    * Loads and decodes images into staging memory off the gl thread, scene imports run every decode as a worker task of
+    * their ImportGraph and create the texture from the decoded request on the gl thread afterwards.
+    * Requests with a role are block compressed right after decoding on the same worker, and looked up in and written to
+    * their texture cache when they have one. KTX2 files are loaded as they are without decoding anything, or only their mip
+    * tail when the request asks for one.
+    */
+    class TextureDecoder
+    {
+    public:
+        struct Request
+        {
+            std::string name;
+            // image file to load, unused when 'encodedData' is set
+            std::string filename;
+            // encoded image already in memory, has to stay alive until the request is decoded
+            const u8* encodedData = nullptr;
+            u32 encodedSize = 0u;
+            // hdr images are decoded to 32 bit floats
+            bool bHDR = false;
+            // 0 keeps the number of channels stored in the image, compressed images are always decoded to rgba8 or rgb32f
+            u32 numChannels = 0u;
+            // how the texture is sampled, picks the block compressed format, kNone leaves the image uncompressed
+            TextureCompressor::Role role = TextureCompressor::Role::kNone;
+            // compressed images are keyed by 'cacheKey' in 'cache' when it is set
+            const TextureCache* cache = nullptr;
+            std::string cacheKey;
+            /**
+            * Non zero only keeps the mips of a block compressed image that are no larger than this many texels on either
+            * side, the rest is left to be streamed in from 'streamingSource'. Images without a KTX2 file to stream from
+            * are always loaded whole.
+            */
+            u32 streamingMipTailSize = 0u;
+            // KTX2 file holding the whole mip chain, set when decoding left out some of the larger mips
+            std::string streamingSource;
+            // size, pixel format and pixel data are filled in by decoding, everything else is passed through
+            ITextureRenderable::Spec spec;
+            ITextureRenderable::Parameter parameter;
+        };
+
+        using ProgressCallback = std::function<void(u32 numFinished, u32 numTotal)>;
+
+        /**
+        * Decodes a single request on the calling thread, which can be any thread. 'request.spec.pixelData' is left null
+        * when decoding fails.
+        */
+        static bool decode(Request& request);
+
+    private:
+        static bool decodeImage(Request& request);
+    };
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+
+#include "Common.h"
+#include "Texture.h"
+#include "ShaderStorageBuffer.h"
+
+namespace Cyan
+{
+    /**
+    * Streams the larger mips of block compressed textures in from their KTX2 files. Textures are created holding only their
+    * mip tail, afterwards every frame the renderer requests the finest mip each texture needs given how many texels it
+    * covers on screen, and update() loads the missing mips one level at a time on the thread pool while keeping the
+    * resident mips of every streamed texture within a vram budget by evicting the least recently requested ones.
+    * Streamed textures are sparse so that mips are committed and released in place, bindless handles taken before any
+    * residency change stay valid. The finest resident mip of every texture is published in the "TextureResidencyBuffer"
+    * for shaders to clamp their lookups to, indexed by the texture's residency slot.
+    * Textures are only loaded with a mip tail when ARB_sparse_texture is available. One whose format turns out to have no
+    * sparse pages gets its whole mip chain allocated anyway, so it is charged against the budget in full up front, never
+    * evicted and its mips are only ever streamed in. The same goes for the sparse mip tail of every other texture, which
+    * GL commits as a whole and never releases.
+    */
+    class TextureStreamer : public Singleton<TextureStreamer>
+    {
+    public:
+        struct Settings
+        {
+            u64 budgetInBytes = 512ull * 1024ull * 1024ull;
+            // textures are loaded with their mips no larger than this many texels on either side
+            u32 mipTailSize = 128u;
+            // uploads of a frame stop once they exceed this
+            u64 maxUploadBytesPerFrame = 32ull * 1024ull * 1024ull;
+            // added to every requested mip, positive values trade sharpness for memory
+            f32 mipBias = 0.f;
+        } m_settings;
+
+        using ResidencyBuffer = ShaderStorageBuffer<DynamicSsboData<f32>>;
+
+        TextureStreamer();
+        ~TextureStreamer();
+
+        /**
+        * Starts streaming 'texture' created with a mip tail from 'sourceFilename', a KTX2 file holding its whole mip chain.
+        * Textures are expected to outlive the streamer.
+        */
+        void addTexture(Texture2DRenderable* texture, const char* sourceFilename);
+
+        /**
+        * Asks for 'mip' of 'texture' to be resident, the finest mip requested in a frame wins. Textures that aren't
+        * streamed are ignored.
+        */
+        void requestMip(Texture2DRenderable* texture, f32 mip);
+
+        /**
+        * Uploads loaded mips, evicts mips over budget and starts loading requested mips, has to be called once per frame
+        * on the thread owning the gl context before anything requests mips for that frame
+        */
+        void update();
+
+        // 0 for textures that aren't streamed, their lookups are never clamped
+        u32 getResidencySlot(Texture2DRenderable* texture) const;
+        ResidencyBuffer& getResidencyBuffer() { return *m_residencyBuffer; }
+
+        /**
+        * Blocks of 'mip' of a streamed texture whether it is resident or not, for cpu side consumers that need mips
+        * which were left out when the texture was loaded
+        */
+        bool readMip(Texture2DRenderable* texture, u32 mip, std::vector<u8>& outBlocks) const;
+
+        u32 getNumTextures() const { return (u32)m_textures.size(); }
+        u64 getResidentBytes() const { return m_residentBytes; }
+
+    private:
+        static const u32 kInvalidMip = 0xFFFFFFFF;
+
+        struct StreamedTexture
+        {
+            Texture2DRenderable* texture = nullptr;
+            std::string sourceFilename;
+            // finest mip that is resident
+            u32 residentMip = 0u;
+            // finest mip requested in 'lastRequestedFrame'
+            u32 requestedMip = 0u;
+            // mip being loaded on the thread pool, kInvalidMip when there is none
+            u32 pendingMip = kInvalidMip;
+            u64 lastRequestedFrame = 0u;
+        };
+
+        struct LoadedMip
+        {
+            u32 textureIndex;
+            u32 mip;
+            std::vector<u8> blocks;
+        };
+
+        static u64 getMipSize(const Texture2DRenderable* texture, u32 mip);
+        // what making 'mip' resident adds to the resident bytes, 0 for textures charged in full up front and for mips in the sparse mip tail
+        static u64 getChargedMipSize(const Texture2DRenderable* texture, u32 mip);
+
+        void uploadLoadedMips();
+        // releases mips finer than needed, least recently requested textures first, until 'bytesToFree' are freed
+        u64 evict(u64 bytesToFree);
+        void loadRequestedMips();
+        void setResidentMip(u32 textureIndex, u32 mip);
+
+        std::vector<StreamedTexture> m_textures;
+        std::unordered_map<Texture2DRenderable*, u32> m_textureMap;
+        std::unique_ptr<ResidencyBuffer> m_residencyBuffer;
+        bool m_bResidencyDirty = false;
+        u64 m_residentBytes = 0u;
+        // bytes of mips being loaded, accounted for against the budget up front
+        u64 m_pendingBytes = 0u;
+        u64 m_frame = 1u;
+
+        // loaded mips waiting for upload, filled in by workers
+        mutable std::mutex m_mutex;
+        std::condition_variable m_loadedCondition;
+        std::vector<LoadedMip> m_loadedMips;
+        u32 m_numPendingLoads = 0u;
+    };
+}
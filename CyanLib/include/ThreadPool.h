@@ -0,0 +1,74 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <atomic>
+#include <vector>
+#include <memory>
+
+#include "Common.h"
+
+namespace Cyan
+{
+    /**
+    * Fixed size pool of worker threads. Every worker owns a task queue, tasks submitted from outside the pool are
+    * distributed round robin while tasks submitted from a worker go to its own queue. A worker pops from the back
+    * of its own queue and steals from the front of other workers' queues once it runs out of work.
+    */
+    class ThreadPool
+    {
+    public:
+        using Task = std::function<void()>;
+        static const u32 kInvalidWorkerIndex = 0xFFFFFFFF;
+
+        /**
+        * 'numWorkers' of 0 means one worker per hardware thread
+        */
+        explicit ThreadPool(u32 numWorkers = 0u);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+        * Pool shared by the engine, sized to std::thread::hardware_concurrency()
+        */
+        static ThreadPool* get();
+
+        /**
+        * Index of the pool worker that is running the calling thread, kInvalidWorkerIndex if called from
+        * outside of a pool
+        */
+        static u32 getCurrentWorkerIndex();
+
+        u32 getNumWorkers() const { return (u32)m_workers.size(); }
+        void submit(const Task& task);
+
+        /**
+        * Run 'func' for every index in [0, count) on the pool and block until all of them finish. The calling
+        * thread participates, so this is safe to call from within a task.
+        */
+        void parallelFor(u32 count, const std::function<void(u32)>& func);
+
+    private:
+        struct WorkerQueue
+        {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+        };
+
+        void workerLoop(u32 workerIndex);
+        bool popTask(u32 workerIndex, Task& outTask);
+
+        std::vector<std::thread> m_workers;
+        std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+        std::atomic<u32> m_nextQueue;
+        std::atomic<u32> m_numPendingTasks;
+        std::mutex m_wakeMutex;
+        std::condition_variable m_wakeCondition;
+        bool m_bShutdown = false;
+    };
+}
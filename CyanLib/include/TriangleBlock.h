@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "Allocator.h"
+#include "BVH.h"
+
+namespace Cyan
+{
+    /**
+    * Leaf triangles in structure of arrays form with the Moller-Trumbore inputs precomputed, one triangle per
+    * simd lane. Unused lanes hold degenerate triangles with zero edges, which never pass the determinant test.
+    */
+    struct alignas(32) TriangleBlock
+    {
+        static const u32 kWidth = 8u;
+
+        f32 v0[3][kWidth];
+        f32 edge1[3][kWidth];
+        f32 edge2[3][kWidth];
+        // index of the triangle in each lane
+        u32 triangles[kWidth];
+    };
+
+    /**
+    * Triangle blocks for every leaf of a bvh built over triangles, the triangles of a leaf are packed into
+    * consecutive blocks starting at leafBlocks[leafNodeIndex]
+    */
+    struct TriangleBlockArray
+    {
+        void build(const BVH& bvh, const std::vector<glm::vec3>& trianglePositions);
+        void clear();
+        bool empty() const { return blocks.empty(); }
+
+        static u32 getNumBlocks(const BVHNode& leaf) { return (leaf.count + TriangleBlock::kWidth - 1u) / TriangleBlock::kWidth; }
+
+        std::vector<TriangleBlock, AlignedAllocator<TriangleBlock, 64>> blocks;
+        std::vector<u32> leafBlocks;
+    };
+
+    /**
+    * Intersect a ray against all the triangles of a block at once with AVX2, returns the nearest hit distance within
+    * (0, tMax) and writes the hit triangle to 'outTriangle', or FLT_MAX on a miss. Uses the same math and epsilons as
+    * the scalar intersectTriangle(). Only call this when getSIMDLevel() reports kAVX2.
+    */
+    f32 intersectTriangleBlock(const TriangleBlock& block, const glm::vec3& ro, const glm::vec3& rd, f32 tMax, u32& outTriangle);
+
+    /**
+    * Scalar Moller-Trumbore, returns the hit distance or -1 on a miss
+    */
+    f32 intersectTriangle(const glm::vec3& ro, const glm::vec3& rd, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2);
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <vector>
+
+#include "glm.hpp"
+
+#include "Common.h"
+#include "RayTracer.h"
+
+namespace Cyan
+{
+    /**
+    * Breadth first path tracer, instead of following one path at a time every bounce of all paths is processed as a wave
+    * [Laine et al. 13]. Ray state lives in structure of arrays queues, the rays of each secondary bounce are sorted by
+    * direction octant and origin morton code before being traced in coherent batches, and hits are grouped by material
+    * so that every shading kernel runs over a contiguous range of rays using the same material. Every stage is a flat
+    * loop over a queue, so the stages map directly onto compute dispatches.
+    */
+    class WavefrontPathTracer
+    {
+    public:
+        static const u32 kDefaultMaxBounces = 4u;
+        // number of rays handled by one thread pool task in every stage
+        static const u32 kBatchSize = 256u;
+        // number of rays counted and scattered by one thread pool task when sorting
+        static const u32 kSortChunkSize = 4096u;
+        // russian roulette starts terminating paths after this many bounces
+        static const u32 kMinBouncesBeforeRoulette = 2u;
+
+        struct Stats
+        {
+            u64 numRays = 0u;
+            u32 numWaves = 0u;
+            f64 sortMs = 0.0;
+            f64 traceMs = 0.0;
+            f64 shadeMs = 0.0;
+        };
+
+        /**
+        * Traces one jittered path per pixel and adds its radiance to 'accumulation' as one sample once the path ends,
+        * can be called repeatedly to converge. Only the pixel indices in 'pixels' are traced when it is given, each at
+        * most once. Primary hits are recorded into 'aovs' when it is given. Blocks until all waves are finished, the
+        * waves themselves run on the thread pool.
+        */
+        void render(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, AccumulationBuffer& accumulation, AOVBuffer* aovs = nullptr, const std::vector<u32>* pixels = nullptr);
+
+        // timings and ray counts of the last call to render()
+        const Stats& getStats() const { return m_stats; }
+
+        u32 maxBounces = kDefaultMaxBounces;
+        // sort secondary rays before tracing them, only useful to turn off for comparing against unsorted tracing
+        bool bSortRays = true;
+        bool bPacketTracing = true;
+        // radiance of rays escaping the scene
+        glm::vec3 skyRadiance = glm::vec3(.2f);
+
+    private:
+        struct RayQueue
+        {
+            void resize(u32 capacity);
+
+            u32 size = 0u;
+            std::vector<glm::vec3> origins;
+            std::vector<glm::vec3> directions;
+            std::vector<glm::vec3> throughputs;
+            // radiance gathered along the path so far
+            std::vector<glm::vec3> radiance;
+            std::vector<u32> pixels;
+        };
+
+        // a contiguous range of the shading order whose rays all hit the same material, kInvalidMaterial for misses
+        struct ShadingBatch
+        {
+            static const u32 kInvalidMaterial = 0xFFFFFFFF;
+
+            u32 material;
+            u32 first;
+            u32 count;
+        };
+
+        void generatePrimaryRays(const PerspectiveCamera& camera, const AccumulationBuffer& accumulation, const std::vector<u32>* pixels);
+        void sortRays(const RayTracingScene& rtxScene);
+        void traceRays(const RayTracingScene& rtxScene);
+        void sortHitsByMaterial(const RayTracingScene& rtxScene);
+        void shade(const RayTracingScene& rtxScene, AccumulationBuffer& accumulation, AOVBuffer* aovs, u32 bounce);
+        void shadeMaterial(const RayTracingScene& rtxScene, AccumulationBuffer& accumulation, AOVBuffer* aovs, const ShadingBatch& batch, u32 bounce);
+
+        // the current wave is read from m_queues[0] while continuation rays are appended to m_queues[1]
+        RayQueue m_queues[2];
+        RayQueue m_sortScratch;
+        std::atomic<u32> m_numContinuations{ 0u };
+        std::vector<RayHit> m_hits;
+        std::vector<u32> m_sortKeys;
+        std::vector<u32> m_sortIndices;
+        std::vector<u32> m_sortScratchKeys;
+        std::vector<u32> m_sortScratchIndices;
+        // per chunk bucket counts of the sorts
+        std::vector<u32> m_sortHistograms;
+        // ray indices of the current wave grouped by hit material
+        std::vector<u32> m_shadingOrder;
+        std::vector<ShadingBatch> m_shadingBatches;
+        glm::vec3 m_sceneMin;
+        glm::vec3 m_sceneMax;
+        Stats m_stats;
+    };
+}
@@ -31,6 +31,10 @@ namespace Cyan
     glm::vec3 cosineWeightedSampleHemisphere(glm::vec3& n);
     glm::vec3 stratifiedCosineWeightedSampleHemiSphere(glm::vec3& normal, f32 j, f32 k, f32 M, f32 N);
     glm::vec2 halton23(u32 index);
+    // van der corput radical inverse of 'index' in 'base', allocation free alternative to halton23()
+    f32 radicalInverse(u32 base, u32 index);
+    // tangent and bitangent completing a right handed orthonormal frame around the unit vector 'n'
+    void calcOrthonormalBasis(const glm::vec3& n, glm::vec3& outTangent, glm::vec3& outBitangent);
 
     // vector math
     inline f32 dot(const glm::vec3& v0, const glm::vec3& v1)
@@ -38,6 +42,17 @@ namespace Cyan
         return v0.x * v1.x + v0.y * v1.y + v0.z * v1.z;
     }
 
+    // component-wise min/max, can't use glm::min()/glm::max() in places where windows.h's min/max macros are visible
+    inline glm::vec3 vec3Min(const glm::vec3& v0, const glm::vec3& v1)
+    {
+        return glm::vec3(Min(v0.x, v1.x), Min(v0.y, v1.y), Min(v0.z, v1.z));
+    }
+
+    inline glm::vec3 vec3Max(const glm::vec3& v0, const glm::vec3& v1)
+    {
+        return glm::vec3(Max(v0.x, v1.x), Max(v0.y, v1.y), Max(v0.z, v1.z));
+    }
+
     struct Vec3 
     {
         f32 x, y, z;
@@ -40,6 +40,19 @@ namespace Cyan
                 init();
             }
 
+            /**
+            * Takes over vertex and index arrays whose bounds are already known, such as ones loaded from a MeshCache
+            */
+            Submesh(std::vector<typename Geometry::Vertex>&& vertices, std::vector<u32>&& indices, const glm::vec3& inMin, const glm::vec3& inMax)
+            {
+                geometry.vertices = std::move(vertices);
+                geometry.indices = std::move(indices);
+                pmin = inMin;
+                pmax = inMax;
+
+                init(false);
+            }
+
             Submesh(const Geometry& srcGeom)
             {
                 // todo: transfer geometry data
@@ -49,7 +62,18 @@ namespace Cyan
 
             virtual u32 numVertices() override { return geometry.numVertices(); }
             virtual u32 numIndices() override { return geometry.numIndices(); }
-            virtual VertexArray* getVertexArray() { return va; }
+            /**
+            * The vertex array is created on first use so that submeshes can be built off the gl thread, such as by the
+            * workers of an asynchronous scene import
+            */
+            virtual VertexArray* getVertexArray()
+            {
+                if (!va && !isHeadless())
+                {
+                    initVertexArray();
+                }
+                return va;
+            }
             const std::vector<typename Geometry::Vertex>& getVertices() { return geometry.vertices; }
             const std::vector<u32>& getIndices() { return geometry.indices; }
             void setGeometryData(std::vector<typename Geometry::Vertex>& vertices, const std::vector<u32>& indices)
@@ -57,25 +81,47 @@ namespace Cyan
                 geometry.vertices = vertices;
                 geometry.indices = indices;
 
-                // release old resources if it exists
+                // release old resources if it exists, new ones are created on next use
                 if (va)
                 {
                     va->release();
                     delete va;
+                    va = nullptr;
                 }
 
-                // upload gpu data
                 init();
             }
 
             virtual glm::vec3 getMin() override { return pmin; }
             virtual glm::vec3 getMax() override { return pmax; }
 
+            /**
+            * Simplified versions of this submesh sharing its vertices, ordered from fine to coarse. Lod 0 is the submesh itself.
+            */
+            u32 numLods() { return (u32)lods.size() + 1u; }
+            const std::vector<u32>& getLodIndices(u32 lod) { return (lod == 0u) ? geometry.indices : lods[lod - 1u].indices; }
+            f32 getLodError(u32 lod) { return (lod == 0u) ? 0.f : lods[lod - 1u].error; }
+            void setLods(std::vector<MeshLod>&& inLods) { lods = std::move(inLods); }
+
         private:
+            void init(bool bCalcBounds = true)
+            {
+                for (u32 i = 0; bCalcBounds && i < numVertices(); ++i)
+                {
+                    pmin.x = Min(pmin.x, geometry.vertices[i].pos.x);
+                    pmin.y = Min(pmin.y, geometry.vertices[i].pos.y);
+                    pmin.z = Min(pmin.z, geometry.vertices[i].pos.z);
+
+                    pmax.x = Max(pmax.x, geometry.vertices[i].pos.x);
+                    pmax.y = Max(pmax.y, geometry.vertices[i].pos.y);
+                    pmax.z = Max(pmax.z, geometry.vertices[i].pos.z);
+                }
+            }
+
             /*
             * init vertex buffer and vertex array
             */
-            void init()
+            void initVertexArray()
             {
                 VertexSpec vertexSpec;
 
@@ -102,21 +148,11 @@ namespace Cyan
                 }
                 auto vb = createVertexBuffer(geometry.vertices.data(), sizeof(Geometry::Vertex) * geometry.vertices.size(), std::move(vertexSpec));
                 va = createVertexArray(vb, &geometry.indices);
-
-                for (u32 i = 0; i < numVertices(); ++i)
-                {
-                    pmin.x = Min(pmin.x, geometry.vertices[i].pos.x);
-                    pmin.y = Min(pmin.y, geometry.vertices[i].pos.y);
-                    pmin.z = Min(pmin.z, geometry.vertices[i].pos.z);
-
-                    pmax.x = Max(pmax.x, geometry.vertices[i].pos.x);
-                    pmax.y = Max(pmax.y, geometry.vertices[i].pos.y);
-                    pmax.z = Max(pmax.z, geometry.vertices[i].pos.z);
-                }
             }
 
             Geometry geometry;
-            VertexArray* va;
+            std::vector<MeshLod> lods;
+            VertexArray* va = nullptr;
             glm::vec3 pmin = glm::vec3(FLT_MAX);
             glm::vec3 pmax = glm::vec3(-FLT_MAX);
         };
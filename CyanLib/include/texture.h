@@ -68,6 +68,12 @@ namespace Cyan
                 RGBA8,
                 RGBA16F,
                 RGBA32F,
+                // block compressed, every 4x4 block of texels takes 8 bytes for BC1 and 16 bytes for everything else
+                BC1,
+                BC3,
+                BC5,
+                BC6H,
+                BC7,
                 kInvalid
             };
 
@@ -83,6 +89,8 @@ namespace Cyan
             Type type = Type::kCount;
             PixelFormat pixelFormat = PixelFormat::kInvalid;
             u8* pixelData = nullptr;
+            // first mip in 'pixelData', block compressed textures streamed by TextureStreamer leave out their larger mips
+            u32 firstMip = 0;
         };
 
         struct Parameter
@@ -208,12 +216,51 @@ namespace Cyan
                 glPixelFormat.format = GL_RGBA;
                 glPixelFormat.type = GL_FLOAT;
                 break;
+            case Spec::PixelFormat::BC1:
+                glPixelFormat.internalFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+                break;
+            case Spec::PixelFormat::BC3:
+                glPixelFormat.internalFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+                break;
+            case Spec::PixelFormat::BC5:
+                glPixelFormat.internalFormat = GL_COMPRESSED_RG_RGTC2;
+                break;
+            case Spec::PixelFormat::BC6H:
+                glPixelFormat.internalFormat = GL_COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT;
+                break;
+            case Spec::PixelFormat::BC7:
+                glPixelFormat.internalFormat = GL_COMPRESSED_RGBA_BPTC_UNORM;
+                break;
             default:
                 break;
             }
             return glPixelFormat;
         }
 
+        static bool isBlockCompressed(const Spec::PixelFormat& inPixelFormat)
+        {
+            switch (inPixelFormat)
+            {
+            case Spec::PixelFormat::BC1:
+            case Spec::PixelFormat::BC3:
+            case Spec::PixelFormat::BC5:
+            case Spec::PixelFormat::BC6H:
+            case Spec::PixelFormat::BC7:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        /**
+        * Size in bytes of one mip of a block compressed texture, mips smaller than a block still take a whole block
+        */
+        static u32 getBlockCompressedSize(const Spec::PixelFormat& inPixelFormat, u32 width, u32 height)
+        {
+            u32 blockSize = (inPixelFormat == Spec::PixelFormat::BC1) ? 8u : 16u;
+            return ((width + 3u) / 4u) * ((height + 3u) / 4u) * blockSize;
+        }
+
         static void initializeTextureParameters(GLuint textureObject, const Parameter& parameter)
         {
             auto translateFiltering = [](const Parameter::Filtering filtering) {
@@ -284,19 +331,64 @@ namespace Cyan
         Texture2DRenderable(const char* inName, const Spec& inSpec, Parameter inParams = Parameter{ })
             : ITextureRenderable(inName, inSpec, inParams),
             width(inSpec.width),
-            height(inSpec.height)
+            height(inSpec.height),
+            firstMip(inSpec.firstMip)
         {
+            if (isHeadless())
+            {
+                return;
+            }
             glCreateTextures(GL_TEXTURE_2D, 1, &glObject);
-            glBindTexture(GL_TEXTURE_2D, getGpuObject());
             auto glPixelFormat = translatePixelFormat(pixelFormat);
-            glTexImage2D(GL_TEXTURE_2D, 0, glPixelFormat.internalFormat, width, height, 0, glPixelFormat.format, glPixelFormat.type, pixelData);
-            glBindTexture(GL_TEXTURE_2D, 0);
-
-            initializeTextureParameters(getGpuObject(), parameter);
+            if (isBlockCompressed(pixelFormat))
+            {
+                // streamed textures only commit memory for the mips that are resident, which keeps their bindless handle
+                // valid across residency changes as opposed to recreating the texture
+                if (firstMip > 0u && GLEW_ARB_sparse_texture)
+                {
+                    GLint numPageSizes = 0;
+                    glGetInternalformativ(GL_TEXTURE_2D, glPixelFormat.internalFormat, GL_NUM_VIRTUAL_PAGE_SIZES_ARB, 1, &numPageSizes);
+                    bSparse = (numPageSizes > 0);
+                }
+                if (bSparse)
+                {
+                    glTextureParameteri(getGpuObject(), GL_TEXTURE_SPARSE_ARB, GL_TRUE);
+                }
+                glTextureStorage2D(getGpuObject(), numMips, glPixelFormat.internalFormat, width, height);
+                if (bSparse)
+                {
+                    GLint numSparseLevels = 0;
+                    glGetTextureParameteriv(getGpuObject(), GL_NUM_SPARSE_LEVELS_ARB, &numSparseLevels);
+                    sparseMipTail = Min((u32)numSparseLevels, numMips);
+                    // the sparse mip tail can only be committed as a whole, so it stays committed for good
+                    if (sparseMipTail < numMips)
+                    {
+                        commitMip(sparseMipTail, true);
+                    }
+                }
 
-            if (numMips > 1u)
+                // compressed pixel data comes with its mip chain from 'firstMip' on, one mip after another starting from the largest
+                const u8* mipData = pixelData;
+                for (u32 mip = firstMip; mip < numMips && mipData; ++mip)
+                {
+                    commitMip(mip, true);
+                    uploadMip(mip, mipData);
+                    mipData += getBlockCompressedSize(pixelFormat, getMipWidth(mip), getMipHeight(mip));
+                }
+                initializeTextureParameters(getGpuObject(), parameter);
+            }
+            else
             {
-                glGenerateTextureMipmap(getGpuObject());
+                glBindTexture(GL_TEXTURE_2D, getGpuObject());
+                glTexImage2D(GL_TEXTURE_2D, 0, glPixelFormat.internalFormat, width, height, 0, glPixelFormat.format, glPixelFormat.type, pixelData);
+                glBindTexture(GL_TEXTURE_2D, 0);
+
+                initializeTextureParameters(getGpuObject(), parameter);
+
+                if (numMips > 1u)
+                {
+                    glGenerateTextureMipmap(getGpuObject());
+                }
             }
 
 #if BINDLESS_TEXTURE
@@ -309,8 +401,39 @@ namespace Cyan
             ITextureRenderable::~ITextureRenderable();
         }
 
+        u32 getMipWidth(u32 mip) const { return Max(width >> mip, 1u); }
+        u32 getMipHeight(u32 mip) const { return Max(height >> mip, 1u); }
+
+        /**
+        * Commits or releases the memory backing 'mip' of a sparse texture, does nothing for any other texture and for
+        * mips in the sparse mip tail
+        */
+        void commitMip(u32 mip, bool bCommit)
+        {
+            if (!bSparse || (mip > sparseMipTail) || (mip == sparseMipTail && !bCommit))
+            {
+                return;
+            }
+            glBindTexture(GL_TEXTURE_2D, getGpuObject());
+            glTexPageCommitmentARB(GL_TEXTURE_2D, mip, 0, 0, 0, getMipWidth(mip), getMipHeight(mip), 1, bCommit ? GL_TRUE : GL_FALSE);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+
+        // 'mipData' holds the blocks of a whole mip of a block compressed texture
+        void uploadMip(u32 mip, const u8* mipData)
+        {
+            auto glPixelFormat = translatePixelFormat(pixelFormat);
+            u32 mipWidth = getMipWidth(mip), mipHeight = getMipHeight(mip);
+            glCompressedTextureSubImage2D(getGpuObject(), mip, 0, 0, mipWidth, mipHeight, glPixelFormat.internalFormat, getBlockCompressedSize(pixelFormat, mipWidth, mipHeight), mipData);
+        }
+
         u32 width;
         u32 height;
+        // first mip kept in 'pixelData'
+        u32 firstMip = 0;
+        bool bSparse = false;
+        // first mip of the sparse mip tail, meaningful only for sparse textures
+        u32 sparseMipTail = 0;
     };
 
     struct DepthTexture2D : public Texture2DRenderable
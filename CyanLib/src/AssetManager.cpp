@@ -6,6 +6,8 @@
 // #include "xatlas.h"
 
 #include "AssetManager.h"
+#include "GltfAccessor.h"
+#include "Hash.h"
 #include "Texture.h"
 #include "CyanAPI.h"
 
@@ -15,11 +17,14 @@ namespace std {
     {
         size_t operator()(const Cyan::Triangles::Vertex& vertex) const 
         {
-            size_t a = hash<glm::vec3>()(vertex.pos); 
-            size_t b = hash<glm::vec3>()(vertex.normal); 
-            size_t c = hash<glm::vec2>()(vertex.texCoord0);
-            size_t d = hash<glm::vec2>()(vertex.texCoord1); 
-            return (a ^ (b << 1)) ^ (c << 1);
+            // hashes every member operator==() compares, adding 0 turns -0 into 0 as they compare equal
+            f32 key[12] = {
+                vertex.pos.x + 0.f, vertex.pos.y + 0.f, vertex.pos.z + 0.f,
+                vertex.normal.x + 0.f, vertex.normal.y + 0.f, vertex.normal.z + 0.f,
+                vertex.tangent.x + 0.f, vertex.tangent.y + 0.f, vertex.tangent.z + 0.f, vertex.tangent.w + 0.f,
+                vertex.texCoord0.x + 0.f, vertex.texCoord0.y + 0.f
+            };
+            return (size_t)Cyan::hashBytes(key, sizeof(key));
         }
     };
 }
@@ -56,25 +61,64 @@ namespace Cyan {
             && (lhs.texCoord0 == rhs.texCoord0);
     }
 
+    /**
+    * Image loader for tinygltf that only keeps the encoded image, decoding is left to TextureDecoder so that it
+    * can run on the thread pool
+    */
+    static bool keepEncodedGltfImage(tinygltf::Image* image, const int, std::string*, std::string*, int, int, const unsigned char* bytes, int size, void*)
+    {
+        image->image.assign(bytes, bytes + size);
+        image->as_is = true;
+        return true;
+    }
+
     AssetManager* AssetManager::singleton = nullptr;
     AssetManager::AssetManager() {
         if (!singleton) {
             singleton = this;
         }
+        m_meshCache.reset(new MeshCache(MESH_CACHE_PATH));
+        m_textureCache.reset(new TextureCache(TEXTURE_CACHE_PATH));
     }
 
-    void AssetManager::importTextures(const nlohmann::basic_json<std::map>& textureInfoList) {
-        using Cyan::Texture2DRenderable;
-        for (auto textureInfo : textureInfoList) {
+    // texture roles as named in scene files
+    static TextureCompressor::Role parseTextureRole(const std::string& role)
+    {
+        if (role == "albedo")
+        {
+            return TextureCompressor::Role::kAlbedo;
+        }
+        if (role == "normal")
+        {
+            return TextureCompressor::Role::kNormal;
+        }
+        if (role == "material")
+        {
+            return TextureCompressor::Role::kMaterial;
+        }
+        if (role == "hdr")
+        {
+            return TextureCompressor::Role::kHDR;
+        }
+        if (role != "none")
+        {
+            cyanError("Unknown texture role %s", role.c_str());
+        }
+        return TextureCompressor::Role::kNone;
+    }
+
+    void AssetManager::importTextures(ImportGraph& graph, const nlohmann::basic_json<std::map>& textureInfoList) {
+        for (const auto& textureInfo : textureInfoList) {
             std::string filename = textureInfo.at("path").get<std::string>();
             std::string name     = textureInfo.at("name").get<std::string>();
             std::string dynamicRange = textureInfo.at("dynamic_range").get<std::string>();
             u32 numMips = textureInfo.at("numMips").get<u32>();
+            auto roleEntry = textureInfo.find("role");
+            TextureCompressor::Role role = (roleEntry != textureInfo.end()) ? parseTextureRole(roleEntry->get<std::string>()) : TextureCompressor::Role::kNone;
             
             ITextureRenderable::Spec spec = { };
             spec.numMips = numMips;
-            Texture2DRenderable* texture = nullptr;
-            texture = importTexture2D(
+            TextureDecoder::Request request = makeTextureDecodeRequest(
                 name.c_str(), 
                 filename.c_str(), 
                 spec,
@@ -84,10 +128,34 @@ namespace Cyan {
                     ITextureRenderable::Parameter::WrapMode::WRAP,
                     ITextureRenderable::Parameter::WrapMode::WRAP,
                     ITextureRenderable::Parameter::WrapMode::WRAP
-                });
+                },
+                role);
+            importTexture(graph, request, [](TextureDecoder::Request& decoded) { return createTexture2D(decoded); });
         }
     }
 
+    ImportGraph::TaskID AssetManager::importTexture(ImportGraph& graph, const TextureDecoder::Request& request, Texture2DRenderable* (*create)(TextureDecoder::Request&), const std::shared_ptr<void>& encodedDataOwner)
+    {
+        auto decoded = std::make_shared<TextureDecoder::Request>(request);
+        m_numTexturesToImport++;
+        ImportGraph::TaskID decodeTask = graph.addTask(("decode " + request.name).c_str(), ImportGraph::Thread::kWorker, [decoded, encodedDataOwner]() {
+            return TextureDecoder::decode(*decoded);
+        });
+        return graph.addTask(("create " + request.name).c_str(), ImportGraph::Thread::kMain, [this, decoded, create]() {
+            // failed decodes are reported by their decode task
+            if (decoded->spec.pixelData)
+            {
+                create(*decoded);
+            }
+            m_numTexturesImported++;
+            if (m_textureImportProgressCallback)
+            {
+                m_textureImportProgressCallback(m_numTexturesImported, m_numTexturesToImport);
+            }
+            return true;
+        }, { decodeTask });
+    }
+
     void calculateTangent(std::vector<Triangles::Vertex>& vertices, u32 face[3])
     {
         auto& v0 = vertices[face[0]];
@@ -107,6 +175,32 @@ namespace Cyan {
         v2.tangent = glm::vec4(tangent, 1.f);
     }
 
+    /**
+    * Runs the MeshOptimizer over a freshly imported triangle mesh and generates its lods, logging how much it helped
+    */
+    Mesh::Submesh<Triangles>* AssetManager::createOptimizedSubmesh(const char* meshName, std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices)
+    {
+        if (!m_bOptimizeMeshes)
+        {
+            return createSubmesh<Triangles>(vertices, indices);
+        }
+        MeshOptimizer::Report report = MeshOptimizer::optimize(vertices, indices, m_meshOptimizerSettings);
+        if (report.numTrianglesBefore > 0u)
+        {
+            cyanInfo("Optimized mesh %s: %u -> %u vertices, %u -> %u triangles, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", meshName,
+                report.numVerticesBefore, report.numVerticesAfter, report.numTrianglesBefore, report.numTrianglesAfter,
+                report.before.acmr, report.after.acmr, report.before.atvr, report.after.atvr);
+        }
+        auto submesh = createSubmesh<Triangles>(vertices, indices);
+        std::vector<MeshLod> lods = MeshOptimizer::generateLods(vertices, indices, m_meshOptimizerSettings);
+        for (u32 l = 0; l < (u32)lods.size(); ++l)
+        {
+            cyanInfo("Mesh %s lod %u: %u triangles, error %f", meshName, l + 1u, (u32)lods[l].indices.size() / 3u, lods[l].error);
+        }
+        submesh->setLods(std::move(lods));
+        return submesh;
+    }
+
     // treat all the meshes inside one obj file as submeshes
     std::vector<ISubmesh*> AssetManager::importObj(const char* baseDir, const char* filename) {
         tinyobj::attrib_t attrib;
@@ -196,7 +290,7 @@ namespace Cyan {
                     calculateTangent(vertices, face);
                 }
 
-                submeshes.push_back(createSubmesh<Triangles>(vertices, indices));
+                submeshes.push_back(createOptimizedSubmesh(shapes[s].name.c_str(), vertices, indices));
             } 
             // load lines
             else if (shapes[s].lines.indices.size() > 0)
@@ -239,41 +333,76 @@ namespace Cyan {
 #endif
     }
 
-    Mesh* AssetManager::importMesh(Scene* scene, std::string& path, const char* name, bool normalize) {
-        Cyan::ScopedTimer meshTimer(name, true);
+    // main thread time spent on asynchronous scene imports every frame
+    static const f32 kSceneImportTimeBudgetInMs = 4.f;
 
+    static ImportGraph::TaskID findImportTask(const std::unordered_map<std::string, ImportGraph::TaskID>& tasks, const std::string& name)
+    {
+        auto entry = tasks.find(name);
+        return (entry != tasks.end()) ? entry->second : ImportGraph::kInvalidTask;
+    }
+
+    /**
+    * Adds a task creating the mesh 'name' out of the submeshes filled in by 'loadTask', meshes are created on the gl thread
+    * as that is where the asset tables are used
+    */
+    static ImportGraph::TaskID addCreateMeshTask(ImportGraph& graph, const std::string& name, const std::shared_ptr<std::vector<ISubmesh*>>& submeshes, ImportGraph::TaskID loadTask)
+    {
+        return graph.addTask(("create " + name).c_str(), ImportGraph::Thread::kMain, [name, submeshes]() {
+            // failed loads are reported by their load task
+            if (!submeshes->empty())
+            {
+                AssetManager::createMesh(name.c_str(), *submeshes);
+            }
+            return true;
+        }, { loadTask });
+    }
+
+    void AssetManager::importMesh(ImportGraph& graph, Scene* scene, const std::string& path, const char* name, bool normalize, SceneImportTasks& tasks) {
         // get extension from mesh path
         u32 found = path.find_last_of('.');
         std::string extension = path.substr(found, found + 1);
         found = path.find_last_of('/');
         std::string baseDir = path.substr(0, found);
 
-        Mesh* parent = nullptr;
         if (extension == ".obj")
         {
-            cyanInfo("Importing .obj file %s", path.c_str());
-            std::vector<ISubmesh*> submeshes = std::move(importObj(baseDir.c_str(), path.c_str()));
-            parent = createMesh(name, submeshes);
-        }
-        else if (extension == ".gltf")
-        {
-            cyanInfo("Importing .gltf file %s", path.c_str());
-            importGltf(scene, path.c_str(), name);
+            std::string meshName(name);
+            auto submeshes = std::make_shared<std::vector<ISubmesh*>>();
+            ImportGraph::TaskID loadTask = graph.addTask(("load " + meshName).c_str(), ImportGraph::Thread::kWorker, [this, path, baseDir, meshName, submeshes]() {
+                Cyan::ScopedTimer meshTimer(meshName.c_str(), true);
+                MeshCache::Source source(path.c_str());
+                if (m_meshCache && m_meshCache->load(source, meshName.c_str(), *submeshes))
+                {
+                    cyanInfo("Loaded cached mesh of .obj file %s", path.c_str());
+                }
+                else
+                {
+                    cyanInfo("Importing .obj file %s", path.c_str());
+                    *submeshes = std::move(importObj(baseDir.c_str(), path.c_str()));
+                    if (m_meshCache)
+                    {
+                        m_meshCache->save(source, meshName.c_str(), *submeshes);
+                    }
+                }
+                return !submeshes->empty();
+            });
+            tasks.meshes[meshName] = addCreateMeshTask(graph, meshName, submeshes, loadTask);
         }
-        else if (extension == ".glb")
+        else if (extension == ".gltf" || extension == ".glb")
         {
-            cyanInfo("Importing .glb file %s", path.c_str());
-            importGltf(scene, path.c_str(), name);
+            cyanInfo("Importing %s file %s", extension.c_str(), path.c_str());
+            // the file's nodes are bundled under an entity named after the mesh, which other entities can refer to
+            tasks.entities[std::string(name)] = importGltf(graph, scene, path.c_str(), name);
         }
         else
             cyanError("Unsupported mesh file format %s", extension.c_str());
 
         // todo: (handle converting mesh data from raster pipeline to ray tracing pipeline)
         // mesh->m_bvh  = nullptr;
-        return parent;
     }
 
-    void AssetManager::importMeshes(Scene* scene, const nlohmann::basic_json<std::map>& meshInfoList) {
+    void AssetManager::importMeshes(ImportGraph& graph, Scene* scene, const nlohmann::basic_json<std::map>& meshInfoList, SceneImportTasks& tasks) {
         for (auto meshInfo : meshInfoList) 
         {
             std::string path, name;
@@ -283,13 +412,12 @@ namespace Cyan {
             meshInfo.at("normalize").get_to(normalize);
             meshInfo.at("generateLightMapUv").get_to(generateLightMapUv);
 
-            importMesh(scene, path, name.c_str(), normalize);
+            importMesh(graph, scene, path, name.c_str(), normalize, tasks);
         }
     }
 
-    void AssetManager::importEntities(Scene* scene, const nlohmann::basic_json<std::map>& entityInfoList)
+    void AssetManager::importEntities(ImportGraph& graph, Scene* scene, const nlohmann::basic_json<std::map>& entityInfoList, SceneImportTasks& tasks)
     {
-        Cyan::ScopedTimer timer("importEntities()", true);
         for (auto entityInfo : entityInfoList)
         {
             // name
@@ -315,33 +443,44 @@ namespace Cyan {
             meshInfo.get_to(meshName);
             if (meshName != "None")
             {
-                Mesh* mesh = getAsset<Mesh>(meshName.c_str());
-                if (mesh)
-                {
+                // shows up as soon as its mesh is created
+                tasks.entities[entityName] = graph.addTask(entityName.c_str(), ImportGraph::Thread::kMain, [scene, entityName, xform, meshName, properties]() {
+                    Mesh* mesh = getAsset<Mesh>(meshName.c_str());
+                    if (!mesh)
+                    {
+                        cyanError("Mesh with name %s does not exist", meshName.c_str());
+                        return false;
+                    }
                     scene->createStaticMeshEntity(entityName.c_str(), xform, mesh, nullptr, properties);
-                }
-                else
-                {
-                    cyanError("Mesh with name %s does not exist", meshName.c_str());
-                }
+                    return true;
+                }, { findImportTask(tasks.meshes, meshName) });
             }
             else
             {
-                Entity* entity = scene->createEntity(entityName.c_str(), xform, nullptr, properties);
+                // children have to exist before they can be attached
+                std::vector<std::string> childNames;
+                std::vector<ImportGraph::TaskID> childTasks;
                 const auto& childInfoList = entityInfo.at("childs");
                 for (const auto& childInfo : childInfoList)
                 {
-                    std::string childName;
-                    childInfo.get_to(childName);
-                    if (Entity* child = scene->getEntity(childName.c_str()))
-                    {
-                        entity->attachChild(child);
-                    }
-                    else
+                    childNames.push_back(childInfo.get<std::string>());
+                    childTasks.push_back(findImportTask(tasks.entities, childNames.back()));
+                }
+                tasks.entities[entityName] = graph.addTask(entityName.c_str(), ImportGraph::Thread::kMain, [scene, entityName, xform, properties, childNames]() {
+                    Entity* entity = scene->createEntity(entityName.c_str(), xform, nullptr, properties);
+                    for (const auto& childName : childNames)
                     {
-                        cyanError("Entity with name %s does not exist", childName.c_str());
+                        if (Entity* child = scene->getEntity(childName.c_str()))
+                        {
+                            entity->attachChild(child);
+                        }
+                        else
+                        {
+                            cyanError("Entity with name %s does not exist", childName.c_str());
+                        }
                     }
-                }
+                    return true;
+                }, childTasks);
             }
         }
     }
@@ -360,9 +499,181 @@ namespace Cyan {
         const auto& textureInfoList = sceneJson["textures"];
         const auto& entities = sceneJson["entities"];
 
-        importTextures(textureInfoList);
-        importMeshes(scene, meshInfoList);
-        importEntities(scene, entities);
+        std::unique_ptr<ImportGraph> graph = std::make_unique<ImportGraph>(file);
+        SceneImportTasks tasks;
+        importTextures(*graph, textureInfoList);
+        importMeshes(*graph, scene, meshInfoList, tasks);
+        importEntities(*graph, scene, entities, tasks);
+
+        if (m_bAsyncSceneImport && !isHeadless())
+        {
+            cyanInfo("Importing scene %s asynchronously, %u tasks to start with", file, graph->getNumTasks());
+            m_importGraphs.push_back(std::move(graph));
+            return;
+        }
+        graph->wait();
+        finishImport(*graph);
+    }
+
+    void AssetManager::update()
+    {
+        for (auto itr = m_importGraphs.begin(); itr != m_importGraphs.end();)
+        {
+            if ((*itr)->update(kSceneImportTimeBudgetInMs))
+            {
+                std::unique_ptr<ImportGraph> graph = std::move(*itr);
+                itr = m_importGraphs.erase(itr);
+                finishImport(*graph);
+            }
+            else
+            {
+                ++itr;
+            }
+        }
+    }
+
+    void AssetManager::finishImport(const ImportGraph& graph)
+    {
+        cyanInfo("Imported %s in %.2f ms, %u of %u import tasks failed", graph.getName().c_str(), graph.getElapsedTimeInMs(), graph.getNumFailedTasks(), graph.getNumTasks());
+        if (m_importGraphs.empty())
+        {
+            // textures that never showed up aren't coming anymore
+            m_pendingTextureBindings.clear();
+            m_numTexturesToImport = 0u;
+            m_numTexturesImported = 0u;
+        }
+    }
+
+    /**
+    * Gltf textures are named after their image, or its uri when the image has no name
+    */
+    static std::string getGltfTextureName(const tinygltf::Image& image)
+    {
+        const u32 kMaxNameLength = 256;
+        // use image name as texture name
+        if (!image.name.empty())
+        {
+            u32 nameLen = (u32)strlen(image.name.c_str());
+            CYAN_ASSERT(nameLen < kMaxNameLength, "Texture filename too long!");
+            return image.name;
+        }
+        // use uri as texture name since image name is empty
+        else
+        {
+            u32 nameLen = (u32)strlen(image.uri.c_str());
+            CYAN_ASSERT(nameLen < kMaxNameLength, "Texture filename too long!");
+            return image.uri;
+        }
+    }
+
+    static ITextureRenderable::Parameter getGltfTextureParameter(const tinygltf::Model& model, const tinygltf::Texture& gltfTexture)
+    {
+        ITextureRenderable::Parameter parameter = { };
+        if (gltfTexture.sampler >= 0)
+        {
+            const auto& sampler = model.samplers[gltfTexture.sampler];
+            switch (sampler.minFilter)
+            {
+            case TINYGLTF_TEXTURE_FILTER_LINEAR:
+                parameter.minificationFilter = FM_BILINEAR;
+                break;
+            case TINYGLTF_TEXTURE_FILTER_NEAREST:
+                parameter.minificationFilter = FM_POINT;
+                break;
+            case TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR:
+                parameter.minificationFilter = FM_TRILINEAR;
+                break;
+            default:
+                break;
+            }
+            switch (sampler.magFilter)
+            {
+            case TINYGLTF_TEXTURE_FILTER_LINEAR:
+                parameter.magnificationFilter = FM_BILINEAR;
+                break;
+            case TINYGLTF_TEXTURE_FILTER_NEAREST:
+                parameter.magnificationFilter = FM_POINT;
+                break;
+            default:
+                break;
+            }
+            switch (sampler.wrapS)
+            {
+            case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:
+                parameter.wrap_s = WM_CLAMP;
+                break;
+            case TINYGLTF_TEXTURE_WRAP_REPEAT:
+                parameter.wrap_s = WM_WRAP;
+                break;
+            default:
+                break;
+            }
+            switch (sampler.wrapT)
+            {
+            case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:
+                parameter.wrap_t = WM_CLAMP;
+                break;
+            case TINYGLTF_TEXTURE_WRAP_REPEAT:
+                parameter.wrap_t = WM_WRAP;
+                break;
+            default:
+                break;
+            }
+        }
+        return parameter;
+    }
+
+    /**
+    * Roles of a gltf file's textures going by the material slots referencing them. A texture shared between slots
+    * with different roles falls back to kMaterial, which keeps every channel.
+    */
+    static void findGltfTextureRoles(const tinygltf::Model& model, std::vector<TextureCompressor::Role>& outRoles)
+    {
+        using Role = TextureCompressor::Role;
+        outRoles.assign(model.textures.size(), Role::kNone);
+        auto assignRole = [&outRoles](i32 index, Role role) {
+            if (index < 0 || index >= (i32)outRoles.size())
+            {
+                return;
+            }
+            outRoles[index] = (outRoles[index] == Role::kNone || outRoles[index] == role) ? role : Role::kMaterial;
+        };
+        for (const auto& material : model.materials)
+        {
+            assignRole(material.pbrMetallicRoughness.baseColorTexture.index, Role::kAlbedo);
+            assignRole(material.emissiveTexture.index, Role::kAlbedo);
+            assignRole(material.normalTexture.index, Role::kNormal);
+            assignRole(material.pbrMetallicRoughness.metallicRoughnessTexture.index, Role::kMaterial);
+            assignRole(material.occlusionTexture.index, Role::kMaterial);
+        }
+    }
+
+    static TextureDecoder::Request makeGltfTextureDecodeRequest(const tinygltf::Model& model, i32 index)
+    {
+        const auto& gltfTexture = model.textures[index];
+        const auto& image = model.images[gltfTexture.source];
+        TextureDecoder::Request request;
+        request.name = getGltfTextureName(image);
+        request.encodedData = image.image.data();
+        request.encodedSize = (u32)image.image.size();
+        // matches the rgba8 that tinygltf's own loader produces
+        request.numChannels = 4u;
+        request.parameter = getGltfTextureParameter(model, gltfTexture);
+        return request;
+    }
+
+    static Texture2DRenderable* createGltfTexture(TextureDecoder::Request& request)
+    {
+        if (request.spec.pixelData == nullptr)
+        {
+            return nullptr;
+        }
+        // compressed textures come with their own mip chain
+        if (!ITextureRenderable::isBlockCompressed(request.spec.pixelFormat))
+        {
+            request.spec.numMips = (u32)std::log2(min(request.spec.width, request.spec.height)) + 1;
+        }
+        return AssetManager::createTexture2D(request);
     }
 
     Cyan::Texture2DRenderable* AssetManager::importGltfTexture(const char* nodeName, tinygltf::Model& model, i32 index) {
@@ -370,7 +681,13 @@ namespace Cyan {
         Texture2DRenderable* texture = nullptr;
         if (index > -1) {
             const auto& gltfTexture = model.textures[index];
-            auto image = model.images[gltfTexture.source];
+            const auto& image = model.images[gltfTexture.source];
+            if (image.as_is)
+            {
+                TextureDecoder::Request request = makeGltfTextureDecodeRequest(model, index);
+                TextureDecoder::decode(request);
+                return createGltfTexture(request);
+            }
             u32 sizeInBytes = image.image.size();
             Cyan::ITextureRenderable::Spec spec = { };
             spec.width = image.width;
@@ -414,83 +731,20 @@ namespace Cyan {
                 }
             }
             spec.numMips = std::log2(min(image.width, image.height)) + 1;
-            spec.pixelData = reinterpret_cast<u8*>(image.image.data());
-            const u32 kMaxNameLength = 256;
-            char textureName[kMaxNameLength];
-            // use image name as texture name
-            if (!image.name.empty())
-            {
-                u32 nameLen = (u32)strlen(image.name.c_str());
-                CYAN_ASSERT(nameLen < kMaxNameLength, "Texture filename too long!");
-                sprintf(textureName, "%s", image.name.c_str());
-            }
-            // use uri as texture name since image name is empty
-            else
-            {
-                u32 nameLen = (u32)strlen(image.uri.c_str());
-                CYAN_ASSERT(nameLen < kMaxNameLength, "Texture filename too long!");
-                sprintf(textureName, "%s", image.uri.c_str());
-            }
-            ITextureRenderable::Parameter parameter = { };
-            if (gltfTexture.sampler >= 0)
-            {
-                const auto& sampler = model.samplers[gltfTexture.sampler];
-                switch (sampler.minFilter)
-                {
-                case TINYGLTF_TEXTURE_FILTER_LINEAR:
-                    parameter.minificationFilter = FM_BILINEAR;
-                    break;
-                case TINYGLTF_TEXTURE_FILTER_NEAREST:
-                    parameter.minificationFilter = FM_POINT;
-                    break;
-                case TINYGLTF_TEXTURE_FILTER_LINEAR_MIPMAP_LINEAR:
-                    parameter.minificationFilter = FM_TRILINEAR;
-                    break;
-                default:
-                    break;
-                }
-                switch (sampler.magFilter)
-                {
-                case TINYGLTF_TEXTURE_FILTER_LINEAR:
-                    parameter.magnificationFilter = FM_BILINEAR;
-                    break;
-                case TINYGLTF_TEXTURE_FILTER_NEAREST:
-                    parameter.magnificationFilter = FM_POINT;
-                    break;
-                default:
-                    break;
-                }
-                switch (sampler.wrapS)
-                {
-                case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:
-                    parameter.wrap_s = WM_CLAMP;
-                    break;
-                case TINYGLTF_TEXTURE_WRAP_REPEAT:
-                    parameter.wrap_s = WM_WRAP;
-                    break;
-                default:
-                    break;
-                }
-                switch (sampler.wrapT)
-                {
-                case TINYGLTF_TEXTURE_WRAP_CLAMP_TO_EDGE:
-                    parameter.wrap_t = WM_CLAMP;
-                    break;
-                case TINYGLTF_TEXTURE_WRAP_REPEAT:
-                    parameter.wrap_t = WM_WRAP;
-                    break;
-                default:
-                    break;
-                }
-            }
-            texture = createTexture2D(textureName, spec, parameter);
+            // the texture owns its pixel data and keeps it around for cpu side access, 'image' goes away with the model
+            spec.pixelData = new u8[sizeInBytes];
+            memcpy(spec.pixelData, image.image.data(), sizeInBytes);
+            texture = createTexture2D(getGltfTextureName(image).c_str(), spec, getGltfTextureParameter(model, gltfTexture));
         }
         return texture;
     }
 
-    void AssetManager::importGltfNode(Scene* scene, tinygltf::Model& model, Entity* parent, tinygltf::Node& node) 
+    /**
+    * Creates the entity of a single gltf node, materials get their textures bound once they are imported when they don't
+    * exist yet
+    */
+    Entity* AssetManager::createGltfNodeEntity(Scene* scene, tinygltf::Model& model, Entity* parent, tinygltf::Node& node)
     {
-        auto sceneManager = SceneManager::get();
         bool isCamera = (node.camera > -1);
         bool hasMesh = (node.mesh > -1);
         bool hasSkin = (node.skin > -1);
@@ -554,8 +808,7 @@ namespace Cyan {
             }
 #endif
         }
-        else if (hasMesh) {
-            Mesh* mesh = getAsset<Mesh>(meshName);
+        else if (Mesh* mesh = hasMesh ? getAsset<Mesh>(meshName) : nullptr) {
             auto staticMeshEntity = scene->createStaticMeshEntity(node.name.c_str(), localTransform, mesh, parent);
             entity = staticMeshEntity;
 
@@ -566,19 +819,19 @@ namespace Cyan {
 
                 auto& primitive = gltfMesh.primitives[sm];
                 if (primitive.material > -1) {
-                    auto getTexture = [&](i32 imageIndex) 
+                    auto bindTexture = [&](Texture2DRenderable*& map, i32 imageIndex) 
                     {
-                        Cyan::Texture2DRenderable* texture = nullptr;
+                        map = nullptr;
                         if (imageIndex > -1 && imageIndex < model.images.size()) 
                         {
-                            auto& image = model.images[imageIndex];
-                            texture = getAsset<Texture2DRenderable>(image.name.c_str());
-                            if (!texture)
+                            std::string textureName = getGltfTextureName(model.images[imageIndex]);
+                            map = getAsset<Texture2DRenderable>(textureName.c_str());
+                            if (!map)
                             {
-                                texture = getAsset<Texture2DRenderable>(image.uri.c_str());
+                                // still being imported, the material goes without until the texture is created
+                                m_pendingTextureBindings[textureName].push_back(&map);
                             }
                         }
-                        return texture;
                     };
 
                     auto& gltfMaterial = model.materials[primitive.material];
@@ -590,10 +843,10 @@ namespace Cyan {
                         matlName = gltfMaterial.name;
                     }
                     Material& matl = createMaterial(matlName.c_str());
-                    matl.albedoMap = getTexture(pbr.baseColorTexture.index);
-                    matl.normalMap = getTexture(gltfMaterial.normalTexture.index);
-                    matl.metallicRoughnessMap = getTexture(pbr.metallicRoughnessTexture.index);
-                    matl.occlusionMap = getTexture(gltfMaterial.occlusionTexture.index);
+                    bindTexture(matl.albedoMap, pbr.baseColorTexture.index);
+                    bindTexture(matl.normalMap, gltfMaterial.normalTexture.index);
+                    bindTexture(matl.metallicRoughnessMap, pbr.metallicRoughnessTexture.index);
+                    bindTexture(matl.occlusionMap, gltfMaterial.occlusionTexture.index);
                     matl.albedo = glm::vec4(pbr.baseColorFactor[0], pbr.baseColorFactor[1], pbr.baseColorFactor[2], pbr.baseColorFactor[3]);
                     matl.roughness = pbr.roughnessFactor;
                     matl.metallic = pbr.metallicFactor;
@@ -611,82 +864,64 @@ namespace Cyan {
         {
             entity = scene->createEntity(entityName, localTransform, parent);
         }
-        // recurse to load all the children
-        for (auto& child : node.children)
-        {
-            importGltfNode(scene, model, entity, model.nodes[child]);
-        }
+        return entity;
     }
 
-    template <typename T>
-    void loadVerticesAndIndices(const tinygltf::Model& model, const tinygltf::Primitive& primitive, std::vector<typename T::Vertex>& vertices, std::vector<u32>& indices) {
-         vertices.resize(model.accessors[primitive.attributes.begin()->second].count);
+    /**
+    * Fills 'vertices' and 'indices' of a triangle list primitive, attributes are read through GltfAccessor views
+    * straight out of the model's buffers
+    */
+    static void loadVerticesAndIndices(const tinygltf::Model& model, const tinygltf::Primitive& primitive, std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices)
+    {
+        if (primitive.attributes.empty())
+        {
+            return;
+        }
+        vertices.resize(model.accessors[primitive.attributes.begin()->second].count);
+        if (vertices.empty())
+        {
+            return;
+        }
+        const u32 stride = sizeof(Triangles::Vertex);
 
         // fill vertices
         for (auto itr = primitive.attributes.begin(); itr != primitive.attributes.end(); ++itr)
         {
-            tinygltf::Accessor accessor = model.accessors[itr->second];
-            tinygltf::BufferView bufferView = model.bufferViews[accessor.bufferView];
-            tinygltf::Buffer buffer = model.buffers[bufferView.buffer];
+            const tinygltf::Accessor& accessor = model.accessors[itr->second];
+            CYAN_ASSERT(accessor.count == vertices.size(), "Vertex attributes of a primitive have different counts")
 
-            if (itr->first.compare("POSITION") == 0 && (T::Vertex::getFlags() && VertexAttribFlag_kPosition != 0))
+            if (itr->first.compare("POSITION") == 0)
             {
-                // sanity checks (assume that position can only be vec3)
-                CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC3, "Position attributes in format other than Vec3 is not allowed")
-
-                for (u32 v = 0; v < vertices.size(); ++v)
-                {
-                    f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                    vertices[v].pos = glm::vec3(src[v * 3], src[v * 3 + 1], src[v * 3 + 2]);
-                }
+                GltfAccessor<glm::vec3>(model, accessor).copyTo(&vertices[0].pos, stride);
             }
-            else if (itr->first.compare("NORMAL") == 0 && (T::Vertex::getFlags() && VertexAttribFlag_kNormal != 0))
+            else if (itr->first.compare("NORMAL") == 0)
             {
-                // sanity checks (assume that normal can only be vec3)
-                CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC3, "Normal attributes in format other than Vec3 is not allowed")
-
-                for (u32 v = 0; v < vertices.size(); ++v)
-                {
-                    f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                    vertices[v].normal = glm::vec3(src[v * 3], src[v * 3 + 1], src[v * 3 + 2]);
-                }
+                GltfAccessor<glm::vec3>(model, accessor).copyTo(&vertices[0].normal, stride);
             }
-            else if (itr->first.compare("TANGENT") == 0 && (T::Vertex::getFlags() && VertexAttribFlag_kTangent != 0))
+            else if (itr->first.compare("TANGENT") == 0)
             {
-                // sanity checks (assume that tangent can only be in vec4)
-                CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC4, "Position attributes in format other than Vec4 is not allowed")
-
-                for (u32 v = 0; v < vertices.size(); ++v)
-                {
-                    f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                    vertices[v].tangent = glm::vec4(src[v * 4], src[v * 4 + 1], src[v * 4 + 2], src[v * 4 + 3]);
-                }
+                GltfAccessor<glm::vec4>(model, accessor).copyTo(&vertices[0].tangent, stride);
             }
-            else if (itr->first.find("TEXCOORD") == 0 && (T::Vertex::getFlags() && VertexAttribFlag_kTexCoord0 != 0))
+            else if (itr->first.find("TEXCOORD") == 0)
             {
-                // sanity checks (assume that texcoord can only be in vec2)
-                CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC2, "TexCoord attributes in format other than Vec2 is not allowed")
                 u32 texCoordIndex = 0;
                 sscanf_s(itr->first.c_str(), "TEXCOORD_%u", &texCoordIndex);
                 switch (texCoordIndex)
                 {
                 case 0:
                 {
-                    for (u32 v = 0; v < vertices.size(); ++v)
+                    GltfAccessor<glm::vec2>(model, accessor).copyTo(&vertices[0].texCoord0, stride);
+                    /** note:
+                    * textureUv.y is filped here
+                    */
+                    for (auto& vertex : vertices)
                     {
-                        f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                        vertices[v].texCoord0 = glm::vec2(src[v * 2], src[v * 2 + 1]);
+                        vertex.texCoord0.y = 1.f - vertex.texCoord0.y;
                     }
                 } break;
                 case 1:
-                {
-
-                    for (u32 v = 0; v < vertices.size(); ++v)
-                    {
-                        f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                        vertices[v].texCoord1 = glm::vec2(src[v * 2], src[v * 2 + 1]);
-                    }
-                } break;
+                    GltfAccessor<glm::vec2>(model, accessor).copyTo(&vertices[0].texCoord1, stride);
+                    break;
                 default:
                     break;
                 }
@@ -696,59 +931,35 @@ namespace Cyan {
         // fill indices 
         if (primitive.indices >= 0)
         {
-            auto& accessor = model.accessors[primitive.indices];
-            u32 numIndices = accessor.count;
-            CYAN_ASSERT(numIndices % 3 == 0, "Invalid index count for triangle mesh")
-            indices.resize(numIndices);
-            tinygltf::BufferView bufferView = model.bufferViews[accessor.bufferView];
-            tinygltf::Buffer buffer = model.buffers[bufferView.buffer];
-            u32 srcIndexSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
-            switch (srcIndexSize)
-            {
-            case 1:
-                for (u32 i = 0; i < numIndices; ++i)
-                {
-                    u8 index = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i];
-                    indices.push_back(index);
-                }
-                break;
-            case 2:
-                for (u32 i = 0; i < numIndices; ++i)
-                {
-                    u8 byte0 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 0];
-                    u8 byte1 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 1];
-                    u32 index = (byte1 << 8) | byte0;
-                    indices.push_back(index);
-                }
-                break;
-            case 4:
-                for (u32 i = 0; i < numIndices; ++i)
-                {
-                    u8 byte0 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 0];
-                    u8 byte1 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 1];
-                    u8 byte2 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 2];
-                    u8 byte3 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 3];
-                    u32 index = (byte3 << 24) | (byte2 << 16) | (byte1 << 8) | byte0;
-                    indices.push_back(index);
-                }
-                break;
-            default:
-                break;
-            }
+            GltfAccessor<u32> indexAccessor(model, model.accessors[primitive.indices]);
+            CYAN_ASSERT(indexAccessor.size() % 3 == 0, "Invalid index count for triangle mesh")
+            indices.resize(indexAccessor.size());
+            indexAccessor.copyTo(indices.data());
         }
     }
 
-    Cyan::Mesh* AssetManager::importGltfMesh(tinygltf::Model& model, tinygltf::Mesh& gltfMesh) 
+    /**
+    * Loads the submeshes of 'gltfMesh' from the mesh cache or builds them from the model's buffers, doesn't touch gl or
+    * the asset tables so that it can run on a worker
+    */
+    bool AssetManager::loadGltfMesh(tinygltf::Model& model, tinygltf::Mesh& gltfMesh, const MeshCache::Source* source, std::vector<ISubmesh*>& submeshes)
     {
         char timerName[64] = { };
         sprintf_s(timerName, "importing mesh %s", gltfMesh.name.c_str());
         ScopedTimer timer(timerName, true);
-        std::vector<ISubmesh*> submeshes;
+
+        // mesh names aren't required to be unique within a gltf file, so cached meshes are keyed by index as well
+        char cacheKey[256] = { };
+        sprintf_s(cacheKey, "%u_%s", (u32)(&gltfMesh - model.meshes.data()), gltfMesh.name.c_str());
+        if (source && m_meshCache && m_meshCache->load(*source, cacheKey, submeshes))
+        {
+            return true;
+        }
 
         // primitives (submeshes)
         for (u32 i = 0u; i < (u32)gltfMesh.primitives.size(); ++i)
         {
-            tinygltf::Primitive primitive = gltfMesh.primitives[i];
+            const tinygltf::Primitive& primitive = gltfMesh.primitives[i];
 
             switch (primitive.mode)
             {
@@ -756,128 +967,8 @@ namespace Cyan {
             {
                 std::vector<Triangles::Vertex> vertices;
                 std::vector<u32> indices;
-                vertices.resize(model.accessors[primitive.attributes.begin()->second].count);
-
-                // fill vertices
-                for (auto itr = primitive.attributes.begin(); itr != primitive.attributes.end(); ++itr)
-                {
-                    tinygltf::Accessor accessor = model.accessors[itr->second];
-                    tinygltf::BufferView bufferView = model.bufferViews[accessor.bufferView];
-                    tinygltf::Buffer buffer = model.buffers[bufferView.buffer];
-
-                    if (itr->first.compare("POSITION") == 0)
-                    {
-                        // sanity checks (assume that position can only be vec3)
-                        CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC3, "Position attributes in format other than Vec3 is not allowed")
-
-                        for (u32 v = 0; v < vertices.size(); ++v)
-                        {
-                            f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                            vertices[v].pos = glm::vec3(src[v * 3], src[v * 3 + 1], src[v * 3 + 2]);
-                        }
-                    }
-                    else if (itr->first.compare("NORMAL") == 0)
-                    {
-                        // sanity checks (assume that normal can only be vec3)
-                        CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC3, "Normal attributes in format other than Vec3 is not allowed")
-
-                        for (u32 v = 0; v < vertices.size(); ++v)
-                        {
-                            f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                            vertices[v].normal = glm::vec3(src[v * 3], src[v * 3 + 1], src[v * 3 + 2]);
-                        }
-                    }
-                    else if (itr->first.compare("TANGENT") == 0)
-                    {
-                        // sanity checks (assume that tangent can only be in vec4)
-                        CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC4, "Tangent attributes in format other than Vec4 is not allowed")
-
-                        for (u32 v = 0; v < vertices.size(); ++v)
-                        {
-                            f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                            vertices[v].tangent = glm::vec4(src[v * 4], src[v * 4 + 1], src[v * 4 + 2], src[v * 4 + 3]);
-                        }
-                    }
-                    else if (itr->first.find("TEXCOORD") == 0)
-                    {
-                        // sanity checks (assume that texcoord can only be in vec2)
-                        CYAN_ASSERT(accessor.type == TINYGLTF_TYPE_VEC2, "TexCoord attributes in format other than Vec2 is not allowed")
-                        u32 texCoordIndex = 0;
-                        sscanf_s(itr->first.c_str(), "TEXCOORD_%u", &texCoordIndex);
-                        switch (texCoordIndex)
-                        {
-                        case 0:
-                        {
-                            for (u32 v = 0; v < vertices.size(); ++v)
-                            {
-                                f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                                /** note:
-                                * textureUv.y is filped here
-                                */
-                                vertices[v].texCoord0 = glm::vec2(src[v * 2], 1.0 - src[v * 2 + 1]);
-                            }
-                        } break;
-                        case 1:
-                        {
-
-                            for (u32 v = 0; v < vertices.size(); ++v)
-                            {
-                                f32* src = reinterpret_cast<f32*>(buffer.data.data() + (accessor.byteOffset + bufferView.byteOffset));
-                                vertices[v].texCoord1 = glm::vec2(src[v * 2], src[v * 2 + 1]);
-                            }
-                        } break;
-                        default:
-                            break;
-                        }
-                    }
-                }
-
-                // fill indices 
-                if (primitive.indices >= 0)
-                {
-                    auto& accessor = model.accessors[primitive.indices];
-                    u32 numIndices = accessor.count;
-                    CYAN_ASSERT(numIndices % 3 == 0, "Invalid index count for triangle mesh")
-                    indices.resize(numIndices);
-                    tinygltf::BufferView bufferView = model.bufferViews[accessor.bufferView];
-                    tinygltf::Buffer buffer = model.buffers[bufferView.buffer];
-
-                    u32 srcIndexSize = tinygltf::GetComponentSizeInBytes(accessor.componentType);
-                    switch (srcIndexSize)
-                    {
-                    case 1:
-                        for (u32 i = 0; i < numIndices; ++i)
-                        {
-                            u8 index = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i];
-                            indices[i] = index;
-                        }
-                        break;
-                    case 2:
-                        for (u32 i = 0; i < numIndices; ++i)
-                        {
-                            u8 byte0 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 0];
-                            u8 byte1 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 1];
-                            u32 index = (byte1 << 8) | byte0;
-                            indices[i] = index;
-                        }
-                        break;
-                    case 4:
-                        for (u32 i = 0; i < numIndices; ++i)
-                        {
-                            u8 byte0 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 0];
-                            u8 byte1 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 1];
-                            u8 byte2 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 2];
-                            u8 byte3 = buffer.data[accessor.byteOffset + bufferView.byteOffset + srcIndexSize * i + 3];
-                            u32 index = (byte3 << 24) | (byte2 << 16) | (byte1 << 8) | byte0;
-                            indices[i] = index;
-                        }
-                        break;
-                    default:
-                        break;
-                    }
-                }
-
-                submeshes.push_back(createSubmesh<Triangles>(vertices, indices));
+                loadVerticesAndIndices(model, primitive, vertices, indices);
+                submeshes.push_back(createOptimizedSubmesh(gltfMesh.name.c_str(), vertices, indices));
             } break;
             case TINYGLTF_MODE_LINE:
             case TINYGLTF_MODE_POINTS:
@@ -888,71 +979,183 @@ namespace Cyan {
             }
         } // primitive (submesh)
 
-        Mesh* parent = createMesh(gltfMesh.name.c_str(), submeshes);
-        return parent;
-    }
-
-    void AssetManager::importGltfTextures(const char* nodeName, tinygltf::Model& model) {
-        for (u32 t = 0u; t < model.textures.size(); ++t) {
-            importGltfTexture(nodeName, model, t);
+        if (source && m_meshCache)
+        {
+            m_meshCache->save(*source, cacheKey, submeshes);
         }
+        return !submeshes.empty();
     }
 
-    void AssetManager::importGltf(Scene* scene, const char* filename, const char* name)
+    struct AssetManager::GltfImport
     {
-        u32 filenameLength = strlen(filename) + strlen("Importing gltf ");
-        u32 bufferSize = filenameLength + 1;
-        char* timerName = static_cast<char*>(alloca(bufferSize));
-        sprintf_s(timerName, bufferSize, "Importing gltf %s", filename);
-        ScopedTimer timer(timerName, true);
-
+        std::string filename;
         tinygltf::Model model;
-        std::string warn, err;
-        auto sceneManager = SceneManager::get();
+        // shared by the file's meshes so that the file is hashed at most once for the mesh cache
+        std::unique_ptr<MeshCache::Source> meshSource;
+        Entity* rootEntity = nullptr;
+        // entity created for every node, filled in by the node tasks
+        std::vector<Entity*> nodeEntities;
+    };
 
-        std::string path(filename);
-        u32 found = path.find_last_of('.');
-        std::string extension = path.substr(found, found + 1);
-        found = path.find_last_of('/');
-        std::string baseDir = path.substr(0, found);
+    /**
+    * Parses a .gltf or .glb file keeping its images encoded, every call uses its own importer so that files can be
+    * parsed on several workers at once
+    */
+    static bool loadGltfModel(const std::string& filename, tinygltf::Model& model)
+    {
+        char timerName[256] = { };
+        sprintf_s(timerName, "Parsing gltf %s", filename.c_str());
+        ScopedTimer timer(timerName, true);
 
+        tinygltf::TinyGLTF importer;
+        importer.SetImageLoader(keepEncodedGltfImage, nullptr);
+        std::string warn, err;
+        bool bLoaded = false;
+        u32 found = filename.find_last_of('.');
+        std::string extension = filename.substr(found, found + 1);
         if (extension == ".gltf")
         {
-            if (!singleton->m_gltfImporter.LoadASCIIFromFile(&model, &err, &warn, std::string(filename)))
-            {
-                std::cout << warn << std::endl;
-                std::cout << err << std::endl;
-            }
+            bLoaded = importer.LoadASCIIFromFile(&model, &err, &warn, filename);
         }
         else if (extension == ".glb")
         {
-            ScopedTimer timer("Import .glb timer", true);
-            if (!singleton->m_gltfImporter.LoadBinaryFromFile(&model, &err, &warn, std::string(filename)))
+            bLoaded = importer.LoadBinaryFromFile(&model, &err, &warn, filename);
+        }
+        if (!bLoaded)
+        {
+            cyanError("Failed to load gltf file %s", filename.c_str());
+            cyanError("Warnings: %s", warn.c_str());
+            cyanError("Errors:   %s", err.c_str());
+        }
+        return bLoaded;
+    }
+
+    // external buffer files of a .gltf file that mesh data is read from, .glb files and data uris have none
+    static std::vector<std::string> getGltfBufferFilenames(const std::string& filename, const tinygltf::Model& model)
+    {
+        std::vector<std::string> bufferFilenames;
+        size_t found = filename.find_last_of("/\\");
+        std::string baseDir = (found != std::string::npos) ? filename.substr(0, found + 1) : std::string();
+        for (const tinygltf::Buffer& buffer : model.buffers)
+        {
+            if (!buffer.uri.empty() && !tinygltf::IsDataURI(buffer.uri))
             {
-                std::cout << warn << std::endl;
-                std::cout << err << std::endl;
+                bufferFilenames.push_back(baseDir + buffer.uri);
             }
         }
+        return bufferFilenames;
+    }
 
-        tinygltf::Scene& gltfScene = model.scenes[model.defaultScene];
-        // import textures
-        singleton->importGltfTextures(name, model);
-        // import meshes
-        for (auto& gltfMesh : model.meshes)
+    void AssetManager::importGltf(Scene* scene, const char* filename, const char* name)
+    {
+        std::unique_ptr<ImportGraph> graph = std::make_unique<ImportGraph>(filename);
+        singleton->importGltf(*graph, scene, filename, name);
+        if (singleton->m_bAsyncSceneImport && !isHeadless())
         {
-            singleton->importGltfMesh(model, gltfMesh);
+            cyanInfo("Importing %s asynchronously", filename);
+            singleton->m_importGraphs.push_back(std::move(graph));
+            return;
         }
+        graph->wait();
+        singleton->finishImport(*graph);
+    }
+
+    ImportGraph::TaskID AssetManager::importGltf(ImportGraph& graph, Scene* scene, const char* filename, const char* name)
+    {
+        auto gltf = std::make_shared<GltfImport>();
+        gltf->filename = filename;
 
-        Entity* rootEntity = nullptr;
         // if a input 'name' is provided, that means all the nodes imported from this gltf file should be bundled by this 'rootEntity'
+        ImportGraph::TaskID rootTask = ImportGraph::kInvalidTask;
         if (name)
         {
-            rootEntity = scene->createEntity(name, Transform());
+            std::string rootName(name);
+            rootTask = graph.addTask(name, ImportGraph::Thread::kMain, [scene, gltf, rootName]() {
+                gltf->rootEntity = scene->createEntity(rootName.c_str(), Transform());
+                return true;
+            });
         }
+        ImportGraph* graphPtr = &graph;
+        graph.addTask(("parse " + gltf->filename).c_str(), ImportGraph::Thread::kWorker, [this, graphPtr, scene, gltf, rootTask]() {
+            if (!loadGltfModel(gltf->filename, gltf->model))
+            {
+                return false;
+            }
+            gltf->meshSource.reset(new MeshCache::Source(gltf->filename.c_str(), getGltfBufferFilenames(gltf->filename, gltf->model)));
+            addGltfImportTasks(*graphPtr, scene, gltf, rootTask);
+            return true;
+        });
+        return rootTask;
+    }
+
+    /**
+    * Adds tasks for every texture, mesh and node of a parsed gltf file. Nodes are created after their parent and after
+    * their mesh, so that parts of the file show up in the scene while the rest is still loading.
+    */
+    void AssetManager::addGltfImportTasks(ImportGraph& graph, Scene* scene, const std::shared_ptr<GltfImport>& gltf, ImportGraph::TaskID rootTask)
+    {
+        tinygltf::Model& model = gltf->model;
+
+        // import textures, still encoded images are decoded on workers
+        std::vector<TextureCompressor::Role> roles;
+        findGltfTextureRoles(model, roles);
+        for (u32 t = 0u; t < model.textures.size(); ++t)
+        {
+            if (model.images[model.textures[t].source].as_is)
+            {
+                TextureDecoder::Request request = makeGltfTextureDecodeRequest(model, t);
+                if (m_bCompressTextures)
+                {
+                    request.role = roles[t];
+                    request.cache = m_textureCache.get();
+                    request.cacheKey = gltf->filename + '#' + std::to_string(t) + '_' + request.name;
+                    request.streamingMipTailSize = getStreamingMipTailSize(request.role);
+                }
+                // the encoded image lives in the model
+                importTexture(graph, request, createGltfTexture, gltf);
+            }
+            else
+            {
+                graph.addTask("import gltf texture", ImportGraph::Thread::kMain, [this, gltf, t]() {
+                    return importGltfTexture(nullptr, gltf->model, t) != nullptr;
+                });
+            }
+        }
+
+        // import meshes
+        std::vector<ImportGraph::TaskID> meshTasks(model.meshes.size());
+        for (u32 m = 0u; m < model.meshes.size(); ++m)
+        {
+            auto submeshes = std::make_shared<std::vector<ISubmesh*>>();
+            ImportGraph::TaskID loadTask = graph.addTask(("load " + model.meshes[m].name).c_str(), ImportGraph::Thread::kWorker, [this, gltf, m, submeshes]() {
+                return loadGltfMesh(gltf->model, gltf->model.meshes[m], gltf->meshSource.get(), *submeshes);
+            });
+            meshTasks[m] = addCreateMeshTask(graph, model.meshes[m].name, submeshes, loadTask);
+        }
+
         // import gltf nodes
+        if (model.scenes.empty())
+        {
+            return;
+        }
+        gltf->nodeEntities.resize(model.nodes.size(), nullptr);
+        std::function<void(i32, i32, ImportGraph::TaskID)> addNodeTask = [&](i32 nodeIndex, i32 parentIndex, ImportGraph::TaskID parentTask) {
+            const tinygltf::Node& node = model.nodes[nodeIndex];
+            ImportGraph::TaskID meshTask = (node.mesh > -1) ? meshTasks[node.mesh] : ImportGraph::kInvalidTask;
+            ImportGraph::TaskID nodeTask = graph.addTask(node.name.c_str(), ImportGraph::Thread::kMain, [this, scene, gltf, nodeIndex, parentIndex]() {
+                Entity* parent = (parentIndex > -1) ? gltf->nodeEntities[parentIndex] : gltf->rootEntity;
+                gltf->nodeEntities[nodeIndex] = createGltfNodeEntity(scene, gltf->model, parent, gltf->model.nodes[nodeIndex]);
+                return true;
+            }, { parentTask, meshTask });
+            for (i32 child : node.children)
+            {
+                addNodeTask(child, nodeIndex, nodeTask);
+            }
+        };
+        const tinygltf::Scene& gltfScene = model.scenes[Max(model.defaultScene, 0)];
         for (u32 i = 0; i < gltfScene.nodes.size(); ++i)
         {
-            singleton->importGltfNode(scene, model, rootEntity, model.nodes[gltfScene.nodes[i]]);
+            addNodeTask(gltfScene.nodes[i], -1, rootTask);
         }
     }
-}
\ No newline at end of file
+}
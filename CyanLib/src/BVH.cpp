@@ -1,273 +1,886 @@
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
 #include "BVH.h"
-#include "Mesh.h"
-#include "CyanAPI.h"
+#include "MathUtils.h"
+#include "ThreadPool.h"
 
 namespace Cyan
 {
-#if 0
-    MeshBVH::MeshBVH(Mesh* mesh) 
-        : m_owner(mesh), root(nullptr), numNodes(0)
-    { 
-        u32 totalNumTriangles = 0u;
-        for (u32 sm = 0; sm < mesh->m_subMeshes.size(); ++sm)
-        {
-            auto subMesh = mesh->m_subMeshes[sm];
-            totalNumTriangles += subMesh->m_triangles.m_numVerts / 3;
-        }
-        // will this overflow because number of triangles is too big ...?
-        u32 maxNumNodes = 2u * totalNumTriangles - 1;
-        nodes.resize(maxNumNodes);
-        leafNodes.resize(totalNumTriangles);
-
-        // initialize leaf nodes
-        u32 triangleCounter = 0u;
-        for (u32 sm = 0; sm < mesh->m_subMeshes.size(); ++sm)
-        {
-            auto subMesh = mesh->m_subMeshes[sm];
-            u32 numTriangles = subMesh->m_triangles.m_numVerts / 3;
-            for (u32 f = 0; f < numTriangles; ++f)
-            {
-                leafNodes[triangleCounter].bound(mesh->getTriangle(sm, f));
-                leafNodes[triangleCounter].m_submeshIndex = sm;
-                leafNodes[triangleCounter++].m_triangleIndex = f;
-            }
+    f32 calcSurfaceArea(const glm::vec3& aabbMin, const glm::vec3& aabbMax)
+    {
+        glm::vec3 extent = aabbMax - aabbMin;
+        if (extent.x < 0.f || extent.y < 0.f || extent.z < 0.f)
+        {
+            return 0.f;
         }
+        return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
     }
 
-    BVHNode* MeshBVH::allocNode()
+    struct BVHBin
+    {
+        glm::vec3 aabbMin = glm::vec3(FLT_MAX);
+        glm::vec3 aabbMax = glm::vec3(-FLT_MAX);
+        u32 count = 0u;
+    };
+
+    void calcTrianglePrimitives(const std::vector<glm::vec3>& trianglePositions, std::vector<BVHPrimitive>& outPrimitives)
     {
-        CYAN_ASSERT(numNodes < nodes.size(), "Too many BVHNode allocated! \n");
-        return &nodes[numNodes++];
+        u32 numTriangles = (u32)trianglePositions.size() / 3;
+        outPrimitives.resize(numTriangles);
+        for (u32 tri = 0; tri < numTriangles; ++tri)
+        {
+            const glm::vec3& v0 = trianglePositions[tri * 3 + 0];
+            const glm::vec3& v1 = trianglePositions[tri * 3 + 1];
+            const glm::vec3& v2 = trianglePositions[tri * 3 + 2];
+            outPrimitives[tri].aabbMin = vec3Min(v0, vec3Min(v1, v2));
+            outPrimitives[tri].aabbMax = vec3Max(v0, vec3Max(v1, v2));
+            outPrimitives[tri].centroid = (v0 + v1 + v2) / 3.f;
+        }
     }
 
-    void MeshBVH::onBuildFinished()
+    void BVH::build(const std::vector<glm::vec3>& trianglePositions)
     {
-        // shrink the node array
-        nodes.resize(numNodes);
+        std::vector<BVHPrimitive> primitives;
+        calcTrianglePrimitives(trianglePositions, primitives);
+        build(primitives);
     }
 
-    // TODO: improve the tree by not choosing the split axis randomly 
-    void MeshBVH::build()
+    void BVH::build(const std::vector<BVHPrimitive>& primitives)
     {
-        Toolkit::ScopedTimer timer("MeshBVH::build()", true);
-        cyanInfo("Building bvh for %s mesh", m_owner->m_name.c_str());
-        root = allocNode(); 
+        u32 numPrimitives = (u32)primitives.size();
+        beginBuild(numPrimitives);
+        if (numPrimitives == 0)
+        {
+            return;
+        }
 
-        // fix rand() seed
-        srand(1);
-        recursiveBuild(0, (u32)leafNodes.size(), root);
+        if (buildMethod == BVHBuildMethod::kLinear)
+        {
+            buildLinear(primitives);
+        }
+        else
+        {
+            updateNodeBounds(kRootNodeIndex, primitives);
+            subdivide(kRootNodeIndex, primitives, 0u);
+        }
+        finishBuild();
+
+        if (numTreeletPasses > 0u)
+        {
+            optimizeTreelets(numTreeletPasses);
+        }
     }
 
-    i32 sortAlongX(const void* a,  const void* b)
+    void BVH::beginBuild(u32 numPrimitives)
     {
-        auto nodeA = static_cast<const BVHNode*>(a);
-        auto nodeB = static_cast<const BVHNode*>(b);
-        f32 centerA = (nodeA->m_aabb.pmin.x + nodeA->m_aabb.pmax.x) * .5f;
-        f32 centerB = (nodeB->m_aabb.pmin.x + nodeB->m_aabb.pmax.x) * .5f;
-        return centerA < centerB ? -1 : 1;
+        nodes.clear();
+        parentIndices.clear();
+        primitiveLeaves.clear();
+        sahCostSum = 0.f;
+        builtSAHCost = 0.f;
+        primitiveIndices.resize(numPrimitives);
+        for (u32 i = 0; i < numPrimitives; ++i)
+        {
+            primitiveIndices[i] = i;
+        }
+        numNodes = 0u;
+        if (numPrimitives == 0)
+        {
+            return;
+        }
+
+        // a binary tree with n leaves has 2n - 1 nodes, plus one padding node after the root
+        nodes.resize(numPrimitives * 2u);
+        parentIndices.resize(numPrimitives * 2u, (u32)kInvalidNodeIndex);
+        BVHNode& root = nodes[kRootNodeIndex];
+        root.leftFirst = 0u;
+        root.count = numPrimitives;
+        // skip index 1 so that sibling nodes are always cache line aligned
+        numNodes = 2u;
     }
 
-    i32 sortAlongY(const void* a,  const void* b)
+    void BVH::finishBuild()
     {
-        auto nodeA = static_cast<const BVHNode*>(a);
-        auto nodeB = static_cast<const BVHNode*>(b);
-        f32 centerA = (nodeA->m_aabb.pmin.y + nodeA->m_aabb.pmax.y) * .5f;
-        f32 centerB = (nodeB->m_aabb.pmin.y + nodeB->m_aabb.pmax.y) * .5f;
-        return centerA < centerB ? -1 : 1;
+        nodes.resize(numNodes);
+        parentIndices.resize(numNodes);
+        primitiveLeaves.resize(primitiveIndices.size());
+        for (u32 i = 0; i < numNodes; ++i)
+        {
+            if (i != 1 && nodes[i].isLeaf())
+            {
+                for (u32 p = 0; p < nodes[i].count; ++p)
+                {
+                    primitiveLeaves[primitiveIndices[nodes[i].leftFirst + p]] = i;
+                }
+            }
+        }
+        builtSAHCost = computeSAHCost();
+        sahCostSum = builtSAHCost * calcSurfaceArea(getRoot().aabbMin, getRoot().aabbMax);
+    }
+
+    // number of primitives handled by one thread pool task in every stage of the linear build
+    static const u32 kLinearBuildChunkSize = 16u * 1024u;
+    // subtrees with at least this many primitives are emitted / optimized with their two children in parallel
+    static const u32 kParallelSubtreeSize = 4096u;
+    static const u32 kMortonBitsPerAxis = 10u;
+    static const u32 kRadixBits = 10u;
+    static const u32 kRadixSize = 1u << kRadixBits;
+
+    // inserts two zero bits in front of each of the lower 10 bits of 'v'
+    static u32 expandBits(u32 v)
+    {
+        v = (v * 0x00010001u) & 0xFF0000FFu;
+        v = (v * 0x00000101u) & 0x0F00F00Fu;
+        v = (v * 0x00000011u) & 0xC30C30C3u;
+        v = (v * 0x00000005u) & 0x49249249u;
+        return v;
     }
 
-    i32 sortAlongZ(const void* a,  const void* b)
+    // 30 bit morton code of a point in the unit cube
+    static u32 calcMortonCode(const glm::vec3& p)
     {
-        auto nodeA = static_cast<const BVHNode*>(a);
-        auto nodeB = static_cast<const BVHNode*>(b);
-        f32 centerA = (nodeA->m_aabb.pmin.z + nodeA->m_aabb.pmax.z) * .5f;
-        f32 centerB = (nodeB->m_aabb.pmin.z + nodeB->m_aabb.pmax.z) * .5f;
-        return centerA < centerB ? -1 : 1;
+        const f32 kGridSize = (f32)(1u << kMortonBitsPerAxis);
+        u32 x = (u32)Min(Max(p.x * kGridSize, 0.f), kGridSize - 1.f);
+        u32 y = (u32)Min(Max(p.y * kGridSize, 0.f), kGridSize - 1.f);
+        u32 z = (u32)Min(Max(p.z * kGridSize, 0.f), kGridSize - 1.f);
+        return (expandBits(x) << 2) | (expandBits(y) << 1) | expandBits(z);
+    }
+
+    static i32 countLeadingZeros(u32 v)
+    {
+        unsigned long index;
+        return _BitScanReverse(&index, v) ? 31 - (i32)index : 32;
+    }
+
+    void BVH::buildLinear(const std::vector<BVHPrimitive>& primitives)
+    {
+        ThreadPool* threadPool = ThreadPool::get();
+        u32 numPrimitives = (u32)primitives.size();
+        u32 numChunks = (numPrimitives + kLinearBuildChunkSize - 1) / kLinearBuildChunkSize;
+
+        // quantize within the centroid bounds so that no morton code bits are wasted on empty space
+        std::vector<glm::vec3> chunkMins(numChunks), chunkMaxs(numChunks);
+        threadPool->parallelFor(numChunks, [&](u32 chunk) {
+            glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+            u32 end = Min(numPrimitives, (chunk + 1) * kLinearBuildChunkSize);
+            for (u32 i = chunk * kLinearBuildChunkSize; i < end; ++i)
+            {
+                centroidMin = vec3Min(centroidMin, primitives[i].centroid);
+                centroidMax = vec3Max(centroidMax, primitives[i].centroid);
+            }
+            chunkMins[chunk] = centroidMin;
+            chunkMaxs[chunk] = centroidMax;
+        });
+        glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (u32 chunk = 0; chunk < numChunks; ++chunk)
+        {
+            centroidMin = vec3Min(centroidMin, chunkMins[chunk]);
+            centroidMax = vec3Max(centroidMax, chunkMaxs[chunk]);
+        }
+        glm::vec3 extent = centroidMax - centroidMin;
+        glm::vec3 scale(extent.x > 0.f ? 1.f / extent.x : 0.f, extent.y > 0.f ? 1.f / extent.y : 0.f, extent.z > 0.f ? 1.f / extent.z : 0.f);
+
+        std::vector<u32> mortonCodes(numPrimitives), scratchCodes(numPrimitives), scratchIndices(numPrimitives);
+        threadPool->parallelFor(numChunks, [&](u32 chunk) {
+            u32 end = Min(numPrimitives, (chunk + 1) * kLinearBuildChunkSize);
+            for (u32 i = chunk * kLinearBuildChunkSize; i < end; ++i)
+            {
+                mortonCodes[i] = calcMortonCode((primitives[i].centroid - centroidMin) * scale);
+            }
+        });
+
+        /**
+        * lsd radix sort of the codes together with primitiveIndices. Every chunk counts its digits into its own histogram,
+        * the histograms are prefix summed digit major so that each chunk scatters into its own sub range of every digit,
+        * which keeps the sort stable without any synchronization between chunks.
+        */
+        std::vector<u32> histograms(numChunks * kRadixSize);
+        for (u32 shift = 0; shift < kMortonBitsPerAxis * 3u; shift += kRadixBits)
+        {
+            threadPool->parallelFor(numChunks, [&](u32 chunk) {
+                u32* histogram = &histograms[chunk * kRadixSize];
+                memset(histogram, 0, sizeof(u32) * kRadixSize);
+                u32 end = Min(numPrimitives, (chunk + 1) * kLinearBuildChunkSize);
+                for (u32 i = chunk * kLinearBuildChunkSize; i < end; ++i)
+                {
+                    histogram[(mortonCodes[i] >> shift) & (kRadixSize - 1)]++;
+                }
+            });
+            u32 offset = 0u;
+            for (u32 digit = 0; digit < kRadixSize; ++digit)
+            {
+                for (u32 chunk = 0; chunk < numChunks; ++chunk)
+                {
+                    u32 count = histograms[chunk * kRadixSize + digit];
+                    histograms[chunk * kRadixSize + digit] = offset;
+                    offset += count;
+                }
+            }
+            threadPool->parallelFor(numChunks, [&](u32 chunk) {
+                u32* offsets = &histograms[chunk * kRadixSize];
+                u32 end = Min(numPrimitives, (chunk + 1) * kLinearBuildChunkSize);
+                for (u32 i = chunk * kLinearBuildChunkSize; i < end; ++i)
+                {
+                    u32 dst = offsets[(mortonCodes[i] >> shift) & (kRadixSize - 1)]++;
+                    scratchCodes[dst] = mortonCodes[i];
+                    scratchIndices[dst] = primitiveIndices[i];
+                }
+            });
+            mortonCodes.swap(scratchCodes);
+            primitiveIndices.swap(scratchIndices);
+        }
+
+        /**
+        * Every internal node of the radix tree over the sorted codes is found independently [Karras 12]. Internal node i
+        * covers a range with one end at i, its other end and split are found by binary searching for the longest common
+        * prefix. Duplicate codes are told apart by appending the primitive's position in the sorted array to the code.
+        */
+        i32 numCodes = (i32)numPrimitives;
+        auto delta = [&mortonCodes, numCodes](i32 i, i32 j) {
+            if (j < 0 || j >= numCodes)
+            {
+                return -1;
+            }
+            u32 a = mortonCodes[i], b = mortonCodes[j];
+            return (a != b) ? countLeadingZeros(a ^ b) : 32 + countLeadingZeros((u32)i ^ (u32)j);
+        };
+        std::vector<LinearBuildNode> linearNodes(numPrimitives - 1);
+        u32 numInternalChunks = (numPrimitives - 1 + kLinearBuildChunkSize - 1) / kLinearBuildChunkSize;
+        threadPool->parallelFor(numInternalChunks, [&](u32 chunk) {
+            i32 end = (i32)Min(numPrimitives - 1, (chunk + 1) * kLinearBuildChunkSize);
+            for (i32 i = (i32)(chunk * kLinearBuildChunkSize); i < end; ++i)
+            {
+                // direction of the range, it extends towards the neighbor sharing the longer prefix
+                i32 d = (delta(i, i + 1) - delta(i, i - 1)) > 0 ? 1 : -1;
+                i32 minDelta = delta(i, i - d);
+                i32 maxLength = 2;
+                while (delta(i, i + maxLength * d) > minDelta)
+                {
+                    maxLength *= 2;
+                }
+                i32 length = 0;
+                for (i32 t = maxLength / 2; t >= 1; t /= 2)
+                {
+                    if (delta(i, i + (length + t) * d) > minDelta)
+                    {
+                        length += t;
+                    }
+                }
+                i32 j = i + length * d;
+                i32 nodeDelta = delta(i, j);
+                i32 splitOffset = 0;
+                for (i32 divisor = 2; ; divisor *= 2)
+                {
+                    i32 t = (length + divisor - 1) / divisor;
+                    if (delta(i, i + (splitOffset + t) * d) > nodeDelta)
+                    {
+                        splitOffset += t;
+                    }
+                    if (t == 1)
+                    {
+                        break;
+                    }
+                }
+                LinearBuildNode& linearNode = linearNodes[i];
+                linearNode.first = (u32)Min(i, j);
+                linearNode.last = (u32)Max(i, j);
+                linearNode.split = (u32)(i + splitOffset * d + Min(d, 0));
+            }
+        });
+
+        std::atomic<u32> nodeCounter(numNodes);
+        emitLinearSubtree(primitives, linearNodes, 0u, 0u, numPrimitives - 1, kRootNodeIndex, nodeCounter);
+        numNodes = nodeCounter.load();
     }
 
-    void MeshBVH::recursiveBuild(u32 start, u32 end, BVHNode* node)
+    void BVH::emitLinearSubtree(const std::vector<BVHPrimitive>& primitives, const std::vector<LinearBuildNode>& linearNodes, u32 linearNode, u32 first, u32 last, u32 nodeIndex, std::atomic<u32>& nodeCounter)
     {
-        // terminate when we arrive at a leaf node where there is only single triangle
-        if (end - start <= 1)
+        BVHNode& node = nodes[nodeIndex];
+        u32 count = last - first + 1;
+        // the radix tree has single primitive leaves, collapse its subtrees into leaves as soon as they are small enough
+        if (count <= Max(maxLeafSize, 1u))
         {
-            node->m_mesh = m_owner;
-            node->m_aabb = leafNodes[start].m_aabb;
-            node->m_submeshIndex = leafNodes[start].m_submeshIndex;
-            node->m_triangleIndex = leafNodes[start].m_triangleIndex;
+            node.leftFirst = first;
+            node.count = count;
+            updateNodeBounds(nodeIndex, primitives);
             return;
         }
-        u32 axis = rand() % 3u;
-        if (axis == 0)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode), sortAlongX);
-        else if (axis == 1)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode), sortAlongY);
-        else if (axis == 2)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode), sortAlongZ);
 
-        u32 split = (start + end) / 2u;
+        // nodes are only ever allocated after their parent, which keeps children at higher indices than their parent
+        u32 leftChild = nodeCounter.fetch_add(2);
+        node.leftFirst = leftChild;
+        node.count = 0u;
+        parentIndices[leftChild] = nodeIndex;
+        parentIndices[leftChild + 1] = nodeIndex;
 
-        node->m_leftChild = allocNode(); 
-        recursiveBuild(start, split, node->m_leftChild);
-        node->bound(node->m_leftChild);
+        // a child covering more than one primitive is the radix tree node at the end of its range adjacent to the split
+        u32 split = linearNodes[linearNode].split;
+        auto emitChild = [&](u32 child) {
+            if (child == 0)
+            {
+                emitLinearSubtree(primitives, linearNodes, split, first, split, leftChild, nodeCounter);
+            }
+            else
+            {
+                emitLinearSubtree(primitives, linearNodes, split + 1, split + 1, last, leftChild + 1, nodeCounter);
+            }
+        };
+        if (count >= kParallelSubtreeSize)
+        {
+            ThreadPool::get()->parallelFor(2u, emitChild);
+        }
+        else
+        {
+            emitChild(0u);
+            emitChild(1u);
+        }
 
-        node->m_rightChild = allocNode(); 
-        recursiveBuild(split, end, node->m_rightChild);
-        node->bound(node->m_rightChild);
+        node.aabbMin = vec3Min(nodes[leftChild].aabbMin, nodes[leftChild + 1].aabbMin);
+        node.aabbMax = vec3Max(nodes[leftChild].aabbMax, nodes[leftChild + 1].aabbMax);
+        orderChildrenByArea(nodeIndex);
     }
 
-    MeshRayHit MeshBVH::trace(glm::vec3& objectSpaceRo, glm::vec3& objectSpaceRd)
+    void BVH::orderChildrenByArea(u32 nodeIndex)
     {
-        return root->trace(objectSpaceRo, objectSpaceRd);
+        u32 leftChild = nodes[nodeIndex].leftFirst;
+        if (calcSurfaceArea(nodes[leftChild + 1].aabbMin, nodes[leftChild + 1].aabbMax) > calcSurfaceArea(nodes[leftChild].aabbMin, nodes[leftChild].aabbMax))
+        {
+            std::swap(nodes[leftChild], nodes[leftChild + 1]);
+            // the grandchildren have to follow their parents to their new slots
+            for (u32 child = leftChild; child < leftChild + 2; ++child)
+            {
+                if (!nodes[child].isLeaf())
+                {
+                    parentIndices[nodes[child].leftFirst] = child;
+                    parentIndices[nodes[child].leftFirst + 1] = child;
+                }
+            }
+        }
     }
 
-    BVHNode* buildMeshBVH(Mesh* mesh)
+    void BVH::optimizeTreelets(u32 numPasses)
     {
-        BVHNode* root = new BVHNode();
-        u32 totalNumTriangles = 0u;
-        for (u32 sm = 0; sm < mesh->m_subMeshes.size(); ++sm)
+        if (empty() || getRoot().isLeaf())
         {
-            auto subMesh = mesh->m_subMeshes[sm];
-            totalNumTriangles += subMesh->m_triangles.m_numVerts / 3;
+            return;
         }
 
-        // initialize leaf nodes
-        std::vector<BVHNode*> leafNodes(totalNumTriangles);
-        u32 triangleCounter = 0u;
-        for (u32 sm = 0; sm < mesh->m_subMeshes.size(); ++sm)
+        std::vector<f32> subtreeCosts(numNodes);
+        std::vector<u32> subtreeCounts(numNodes);
+        for (u32 pass = 0; pass < numPasses; ++pass)
         {
-            auto subMesh = mesh->m_subMeshes[sm];
-            u32 numTriangles = subMesh->m_triangles.m_numVerts / 3;
-            for (u32 f = 0; f < numTriangles; ++f)
+            for (i32 i = (i32)numNodes - 1; i >= 0; --i)
+            {
+                if (i == 1)
+                {
+                    continue;
+                }
+                const BVHNode& node = nodes[i];
+                subtreeCosts[i] = calcNodeCost(node);
+                subtreeCounts[i] = node.count;
+                if (!node.isLeaf())
+                {
+                    subtreeCosts[i] += subtreeCosts[node.leftFirst] + subtreeCosts[node.leftFirst + 1];
+                    subtreeCounts[i] = subtreeCounts[node.leftFirst] + subtreeCounts[node.leftFirst + 1];
+                }
+            }
+
+            NodeArray previousNodes = nodes;
+            std::vector<u32> previousParentIndices = parentIndices;
+            optimizeSubtree(kRootNodeIndex, subtreeCosts, subtreeCounts);
+            // restructuring can deepen the tree, give up on the pass if it no longer fits the traversal stacks
+            if (reorderDepthFirst() >= kMaxDepth)
             {
-                leafNodes[triangleCounter]= new BVHNode();
-                leafNodes[triangleCounter]->bound(mesh->getTriangle(sm, f));
-                leafNodes[triangleCounter]->m_submeshIndex = sm;
-                leafNodes[triangleCounter++]->m_triangleIndex = f;
+                nodes.swap(previousNodes);
+                parentIndices.swap(previousParentIndices);
+                break;
             }
         }
+        finishBuild();
+    }
 
-        // fix rand() seed
-        srand(1);
-        buildBVH(mesh, leafNodes, 0, (u32)leafNodes.size(), root);
-        return root;
+    void BVH::optimizeSubtree(u32 nodeIndex, std::vector<f32>& subtreeCosts, const std::vector<u32>& subtreeCounts)
+    {
+        if (nodes[nodeIndex].isLeaf() || subtreeCounts[nodeIndex] < minTreeletPrimitives)
+        {
+            return;
+        }
+
+        // bottom up so that every treelet is formed out of already optimized subtrees, sibling subtrees never overlap
+        u32 leftChild = nodes[nodeIndex].leftFirst;
+        auto optimizeChild = [&](u32 child) {
+            optimizeSubtree(leftChild + child, subtreeCosts, subtreeCounts);
+        };
+        if (subtreeCounts[nodeIndex] >= kParallelSubtreeSize)
+        {
+            ThreadPool::get()->parallelFor(2u, optimizeChild);
+        }
+        else
+        {
+            optimizeChild(0u);
+            optimizeChild(1u);
+        }
+        optimizeTreelet(nodeIndex, subtreeCosts);
     }
 
-    void buildBVH(Cyan::Mesh* mesh, std::vector<BVHNode*>& leafNodes, u32 start, u32 end, BVHNode* parent)
+    void BVH::optimizeTreelet(u32 rootIndex, std::vector<f32>& subtreeCosts)
     {
-        // terminate when we arive at a leaf node where there is only single triangle
-        if (end - start <= 1)
+        // grow the treelet by repeatedly expanding its largest internal leaf, those gain the most from restructuring
+        u32 leaves[kTreeletSize];
+        u32 internals[kTreeletSize - 1];
+        u32 numLeaves = 2u, numInternals = 1u;
+        internals[0] = rootIndex;
+        leaves[0] = nodes[rootIndex].leftFirst;
+        leaves[1] = nodes[rootIndex].leftFirst + 1;
+        while (numLeaves < kTreeletSize)
+        {
+            i32 expanded = -1;
+            f32 maxArea = -1.f;
+            for (u32 i = 0; i < numLeaves; ++i)
+            {
+                const BVHNode& leaf = nodes[leaves[i]];
+                f32 area = calcSurfaceArea(leaf.aabbMin, leaf.aabbMax);
+                if (!leaf.isLeaf() && area > maxArea)
+                {
+                    expanded = (i32)i;
+                    maxArea = area;
+                }
+            }
+            if (expanded < 0)
+            {
+                break;
+            }
+            u32 leftChild = nodes[leaves[expanded]].leftFirst;
+            internals[numInternals++] = leaves[expanded];
+            leaves[expanded] = leftChild;
+            leaves[numLeaves++] = leftChild + 1;
+        }
+        if (numLeaves < 3)
         {
-            parent->m_mesh = mesh;
-            parent->m_aabb = leafNodes[start]->m_aabb;
-            parent->m_submeshIndex = leafNodes[start]->m_submeshIndex;
-            parent->m_triangleIndex = leafNodes[start]->m_triangleIndex;
             return;
         }
 
-        // sort sub triangle groups and divide evenly
-        auto sortAlongX = [](const void* a,  const void* b)
+        /**
+        * Optimal topology by dynamic programming over every subset of the treelet leaves, subsets are visited in
+        * increasing order so that all their partitions are already solved. Only partitions keeping the lowest leaf
+        * on the left are enumerated as the two halves are interchangeable.
+        */
+        const u32 kMaxSubsets = 1u << kTreeletSize;
+        glm::vec3 subsetMins[kMaxSubsets], subsetMaxs[kMaxSubsets];
+        f32 subsetCosts[kMaxSubsets];
+        u32 partitions[kMaxSubsets];
+        u32 numSubsets = 1u << numLeaves;
+        for (u32 subset = 1; subset < numSubsets; ++subset)
         {
-            auto nodeA = static_cast<const BVHNode*>(a);
-            auto nodeB = static_cast<const BVHNode*>(b);
-            f32 centerA = (nodeA->m_aabb.pmin.x + nodeA->m_aabb.pmax.x) * .5f;
-            f32 centerB = (nodeA->m_aabb.pmin.x + nodeA->m_aabb.pmax.x) * .5f;
-            if (centerA < centerB)
-                return -1;
-            else
-                return 1; 
-        };
+            u32 lowestBit = subset & (0u - subset);
+            if (subset == lowestBit)
+            {
+                unsigned long leaf;
+                _BitScanForward(&leaf, subset);
+                subsetMins[subset] = nodes[leaves[leaf]].aabbMin;
+                subsetMaxs[subset] = nodes[leaves[leaf]].aabbMax;
+                subsetCosts[subset] = subtreeCosts[leaves[leaf]];
+                continue;
+            }
+            subsetMins[subset] = vec3Min(subsetMins[lowestBit], subsetMins[subset ^ lowestBit]);
+            subsetMaxs[subset] = vec3Max(subsetMaxs[lowestBit], subsetMaxs[subset ^ lowestBit]);
+
+            u32 rest = subset ^ lowestBit;
+            f32 bestCost = FLT_MAX;
+            u32 bestPartition = lowestBit;
+            for (u32 left = (rest - 1) & rest; ; left = (left - 1) & rest)
+            {
+                f32 cost = subsetCosts[left | lowestBit] + subsetCosts[rest ^ left];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestPartition = left | lowestBit;
+                }
+                if (left == 0)
+                {
+                    break;
+                }
+            }
+            subsetCosts[subset] = calcSurfaceArea(subsetMins[subset], subsetMaxs[subset]) * kTraversalCost + bestCost;
+            partitions[subset] = bestPartition;
+        }
 
-        auto sortAlongY = [](const void* a,  const void* b)
+        // ignore gains that are within float noise, they would only reshuffle nodes
+        u32 fullSet = numSubsets - 1;
+        if (subsetCosts[fullSet] >= subtreeCosts[rootIndex] * .999f)
         {
-            auto nodeA = static_cast<const BVHNode*>(a);
-            auto nodeB = static_cast<const BVHNode*>(b);
-            f32 centerA = (nodeA->m_aabb.pmin.x + nodeA->m_aabb.pmax.y) * .5f;
-            f32 centerB = (nodeA->m_aabb.pmin.x + nodeA->m_aabb.pmax.y) * .5f;
-            if (centerA < centerB)
-                return -1;
-            else
-                return 1; 
+            return;
+        }
+
+        /**
+        * The restructured treelet reuses the child pairs of the old internal nodes. Leaves are saved first as their
+        * slots may be handed out to other nodes, and are then moved to the slots the new topology puts them in.
+        */
+        BVHNode savedLeaves[kTreeletSize];
+        f32 savedCosts[kTreeletSize];
+        for (u32 i = 0; i < numLeaves; ++i)
+        {
+            savedLeaves[i] = nodes[leaves[i]];
+            savedCosts[i] = subtreeCosts[leaves[i]];
+        }
+        u32 pairs[kTreeletSize - 1];
+        for (u32 i = 0; i < numInternals; ++i)
+        {
+            pairs[i] = nodes[internals[i]].leftFirst;
+        }
+        std::sort(pairs, pairs + numInternals);
+
+        struct TreeletNode
+        {
+            u32 nodeIndex;
+            u32 subset;
         };
+        TreeletNode queue[kTreeletSize - 1];
+        u32 queueHead = 0u, queueTail = 0u, numPairsUsed = 0u;
+        queue[queueTail++] = { rootIndex, fullSet };
+        while (queueHead < queueTail)
+        {
+            TreeletNode treeletNode = queue[queueHead++];
+            u32 childSubsets[2] = { partitions[treeletNode.subset], treeletNode.subset ^ partitions[treeletNode.subset] };
+            if (calcSurfaceArea(subsetMins[childSubsets[1]], subsetMaxs[childSubsets[1]]) > calcSurfaceArea(subsetMins[childSubsets[0]], subsetMaxs[childSubsets[0]]))
+            {
+                std::swap(childSubsets[0], childSubsets[1]);
+            }
 
-        auto sortAlongZ = [](const void* a,  const void* b)
+            u32 leftChild = pairs[numPairsUsed++];
+            BVHNode& node = nodes[treeletNode.nodeIndex];
+            node.aabbMin = subsetMins[treeletNode.subset];
+            node.aabbMax = subsetMaxs[treeletNode.subset];
+            node.leftFirst = leftChild;
+            node.count = 0u;
+            subtreeCosts[treeletNode.nodeIndex] = subsetCosts[treeletNode.subset];
+            for (u32 child = 0; child < 2; ++child)
+            {
+                u32 childIndex = leftChild + child;
+                u32 subset = childSubsets[child];
+                parentIndices[childIndex] = treeletNode.nodeIndex;
+                if ((subset & (subset - 1)) != 0)
+                {
+                    queue[queueTail++] = { childIndex, subset };
+                    continue;
+                }
+                unsigned long leaf;
+                _BitScanForward(&leaf, subset);
+                nodes[childIndex] = savedLeaves[leaf];
+                subtreeCosts[childIndex] = savedCosts[leaf];
+                if (!nodes[childIndex].isLeaf())
+                {
+                    parentIndices[nodes[childIndex].leftFirst] = childIndex;
+                    parentIndices[nodes[childIndex].leftFirst + 1] = childIndex;
+                }
+            }
+        }
+    }
+
+    u32 BVH::reorderDepthFirst()
+    {
+        /**
+        * Lay the tree out again in depth first order, which brings back the invariant that children have higher
+        * indices than their parent that refit() relies on. Returns the depth of the tree.
+        */
+        struct StackEntry
         {
-            auto nodeA = static_cast<const BVHNode*>(a);
-            auto nodeB = static_cast<const BVHNode*>(b);
-            f32 centerA = (nodeA->m_aabb.pmin.z + nodeA->m_aabb.pmax.z) * .5f;
-            f32 centerB = (nodeA->m_aabb.pmin.z + nodeA->m_aabb.pmax.z) * .5f;
-            if (centerA < centerB)
-                return -1;
-            else
-                return 1; 
+            u32 oldIndex;
+            u32 newIndex;
+            u32 depth;
         };
+        NodeArray reordered(numNodes);
+        std::vector<u32> reorderedParentIndices(numNodes, (u32)kInvalidNodeIndex);
+        reordered[kRootNodeIndex] = nodes[kRootNodeIndex];
+        u32 numReordered = 2u, maxDepth = 0u;
+        std::vector<StackEntry> stack;
+        stack.push_back({ kRootNodeIndex, kRootNodeIndex, 0u });
+        while (!stack.empty())
+        {
+            StackEntry entry = stack.back();
+            stack.pop_back();
+            maxDepth = Max(maxDepth, entry.depth);
+            const BVHNode& node = nodes[entry.oldIndex];
+            if (node.isLeaf())
+            {
+                continue;
+            }
+            u32 leftChild = numReordered;
+            numReordered += 2;
+            reordered[entry.newIndex].leftFirst = leftChild;
+            reordered[leftChild] = nodes[node.leftFirst];
+            reordered[leftChild + 1] = nodes[node.leftFirst + 1];
+            reorderedParentIndices[leftChild] = entry.newIndex;
+            reorderedParentIndices[leftChild + 1] = entry.newIndex;
+            stack.push_back({ node.leftFirst + 1, leftChild + 1, entry.depth + 1 });
+            stack.push_back({ node.leftFirst, leftChild, entry.depth + 1 });
+        }
+        nodes.swap(reordered);
+        parentIndices.swap(reorderedParentIndices);
+        return maxDepth;
+    }
 
-        u32 axis = rand() % 3u;
-        if (axis == 0)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode*), sortAlongX);
-        else if (axis == 1)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode*), sortAlongY);
-        else if (axis == 2)
-            std::qsort(leafNodes.data(), end - start, sizeof(BVHNode*), sortAlongZ);
+    f32 BVH::calcNodeCost(const BVHNode& node) const
+    {
+        return calcSurfaceArea(node.aabbMin, node.aabbMax) * (node.isLeaf() ? (f32)node.count * intersectionCost : kTraversalCost);
+    }
+
+    void BVH::refit(const std::vector<BVHPrimitive>& primitives)
+    {
+        if (empty())
+        {
+            return;
+        }
+        // children are always allocated after their parent, so a reverse sweep visits children before parents
+        for (i32 i = (i32)numNodes - 1; i >= 0; --i)
+        {
+            if (i == 1)
+            {
+                continue;
+            }
+            BVHNode& node = nodes[i];
+            if (node.isLeaf())
+            {
+                updateNodeBounds(i, primitives);
+            }
+            else
+            {
+                node.aabbMin = vec3Min(nodes[node.leftFirst].aabbMin, nodes[node.leftFirst + 1].aabbMin);
+                node.aabbMax = vec3Max(nodes[node.leftFirst].aabbMax, nodes[node.leftFirst + 1].aabbMax);
+            }
+        }
+        sahCostSum = computeSAHCost() * calcSurfaceArea(getRoot().aabbMin, getRoot().aabbMax);
+    }
 
-        u32 split = (start + end) / 2u;
+    void BVH::refit(const std::vector<BVHPrimitive>& primitives, const std::vector<u32>& changedPrimitives)
+    {
+        if (empty())
+        {
+            return;
+        }
+        for (u32 primitive : changedPrimitives)
+        {
+            u32 nodeIndex = primitiveLeaves[primitive];
+            sahCostSum -= calcNodeCost(nodes[nodeIndex]);
+            updateNodeBounds(nodeIndex, primitives);
+            sahCostSum += calcNodeCost(nodes[nodeIndex]);
 
-        
-        parent->m_leftChild = new BVHNode(); 
-        buildBVH(mesh, leafNodes, start, split, parent->m_leftChild);
-        parent->bound(parent->m_leftChild);
+            // ancestors whose bounds didn't change can't affect anything further up either
+            nodeIndex = parentIndices[nodeIndex];
+            while (nodeIndex != kInvalidNodeIndex)
+            {
+                BVHNode& node = nodes[nodeIndex];
+                glm::vec3 aabbMin = vec3Min(nodes[node.leftFirst].aabbMin, nodes[node.leftFirst + 1].aabbMin);
+                glm::vec3 aabbMax = vec3Max(nodes[node.leftFirst].aabbMax, nodes[node.leftFirst + 1].aabbMax);
+                if (aabbMin == node.aabbMin && aabbMax == node.aabbMax)
+                {
+                    break;
+                }
+                sahCostSum -= calcNodeCost(node);
+                node.aabbMin = aabbMin;
+                node.aabbMax = aabbMax;
+                sahCostSum += calcNodeCost(node);
+                nodeIndex = parentIndices[nodeIndex];
+            }
+        }
+    }
 
-        parent->m_rightChild = new BVHNode(); 
-        buildBVH(mesh, leafNodes, split, end, parent->m_rightChild);
-        parent->bound(parent->m_rightChild);
+    void BVH::updateNodeBounds(u32 nodeIndex, const std::vector<BVHPrimitive>& primitives)
+    {
+        BVHNode& node = nodes[nodeIndex];
+        node.aabbMin = glm::vec3(FLT_MAX);
+        node.aabbMax = glm::vec3(-FLT_MAX);
+        for (u32 i = 0; i < node.count; ++i)
+        {
+            const BVHPrimitive& primitive = primitives[primitiveIndices[node.leftFirst + i]];
+            node.aabbMin = vec3Min(node.aabbMin, primitive.aabbMin);
+            node.aabbMax = vec3Max(node.aabbMax, primitive.aabbMax);
+        }
     }
 
-    MeshRayHit BVHNode::trace(glm::vec3& ro, glm::vec3& rd)
+    f32 BVH::findBestSplit(const BVHNode& node, const std::vector<BVHPrimitive>& primitives, i32& outAxis, f32& outSplitPos)
     {
-        MeshRayHit meshRayHit;
-        if (m_aabb.intersectRay(ro, rd) > 0.f)
+        f32 bestCost = FLT_MAX;
+
+        // bin based on centroid bounds instead of node bounds to avoid wasting bins on empty space
+        glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+        for (u32 i = 0; i < node.count; ++i)
         {
-            // leaf node
-            if (m_submeshIndex >= 0 && m_triangleIndex >= 0)
+            const BVHPrimitive& primitive = primitives[primitiveIndices[node.leftFirst + i]];
+            centroidMin = vec3Min(centroidMin, primitive.centroid);
+            centroidMax = vec3Max(centroidMax, primitive.centroid);
+        }
+
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            f32 boundsMin = centroidMin[axis], boundsMax = centroidMax[axis];
+            if (boundsMin == boundsMax)
             {
-                auto tri = m_mesh->getTriangle(m_submeshIndex, m_triangleIndex);
-                f32 t = tri.intersectRay(ro, rd);
-                if (t > 0.f)
+                continue;
+            }
+
+            BVHBin bins[kNumBins];
+            f32 scale = (f32)kNumBins / (boundsMax - boundsMin);
+            for (u32 i = 0; i < node.count; ++i)
+            {
+                const BVHPrimitive& primitive = primitives[primitiveIndices[node.leftFirst + i]];
+                u32 binIndex = Min(kNumBins - 1u, (u32)((primitive.centroid[axis] - boundsMin) * scale));
+                bins[binIndex].count++;
+                bins[binIndex].aabbMin = vec3Min(bins[binIndex].aabbMin, primitive.aabbMin);
+                bins[binIndex].aabbMax = vec3Max(bins[binIndex].aabbMax, primitive.aabbMax);
+            }
+
+            // sweep from both sides to gather the area and count on each side of every bin plane
+            f32 leftArea[kNumBins - 1], rightArea[kNumBins - 1];
+            u32 leftCount[kNumBins - 1], rightCount[kNumBins - 1];
+            glm::vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX), rightMin(FLT_MAX), rightMax(-FLT_MAX);
+            u32 leftSum = 0u, rightSum = 0u;
+            for (u32 i = 0; i < kNumBins - 1; ++i)
+            {
+                leftSum += bins[i].count;
+                leftCount[i] = leftSum;
+                leftMin = vec3Min(leftMin, bins[i].aabbMin);
+                leftMax = vec3Max(leftMax, bins[i].aabbMax);
+                leftArea[i] = calcSurfaceArea(leftMin, leftMax);
+
+                rightSum += bins[kNumBins - 1 - i].count;
+                rightCount[kNumBins - 2 - i] = rightSum;
+                rightMin = vec3Min(rightMin, bins[kNumBins - 1 - i].aabbMin);
+                rightMax = vec3Max(rightMax, bins[kNumBins - 1 - i].aabbMax);
+                rightArea[kNumBins - 2 - i] = calcSurfaceArea(rightMin, rightMax);
+            }
+
+            f32 binWidth = (boundsMax - boundsMin) / (f32)kNumBins;
+            for (u32 i = 0; i < kNumBins - 1; ++i)
+            {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                {
+                    continue;
+                }
+                f32 cost = leftCount[i] * leftArea[i] + rightCount[i] * rightArea[i];
+                if (cost < bestCost)
                 {
-                    meshRayHit.mesh = m_mesh;
-                    meshRayHit.t = t;
-                    meshRayHit.smIndex = this->m_submeshIndex;
-                    meshRayHit.triangleIndex = this->m_triangleIndex;
+                    bestCost = cost;
+                    outAxis = axis;
+                    outSplitPos = boundsMin + binWidth * (f32)(i + 1);
                 }
-                return meshRayHit;
             }
+        }
+        return bestCost;
+    }
 
-            // interior node
-            auto hitLeft = m_leftChild->trace(ro, rd);
-            auto hitRight = m_rightChild->trace(ro, rd);
-            if (hitLeft.t < hitRight.t)
-                meshRayHit = hitLeft;
-            else
-                meshRayHit = hitRight;
+    void BVH::subdivide(u32 nodeIndex, const std::vector<BVHPrimitive>& primitives, u32 depth)
+    {
+        BVHNode& node = nodes[nodeIndex];
+        if (node.count <= 1)
+        {
+            return;
+        }
+
+        i32 axis = -1;
+        f32 splitPos = 0.f;
+        f32 splitCost = FLT_MAX;
+        u32 first = node.leftFirst;
+        u32 last = first + node.count;
+        u32 mid = first;
+        if (depth >= kMaxDepth / 2)
+        {
+            /** 
+            * sah splits can be arbitrarily unbalanced, switch to object median splits when the tree gets too deep 
+            * so that the depth stays within what the fixed size traversal stacks can handle
+            */
+            if (node.count <= maxLeafSize)
+            {
+                return;
+            }
+            glm::vec3 extent = node.aabbMax - node.aabbMin;
+            i32 medianAxis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+            mid = first + node.count / 2;
+            std::nth_element(primitiveIndices.begin() + first, primitiveIndices.begin() + mid, primitiveIndices.begin() + last, [&primitives, medianAxis](u32 a, u32 b) {
+                return primitives[a].centroid[medianAxis] < primitives[b].centroid[medianAxis];
+            });
+        }
+        else if ((splitCost = findBestSplit(node, primitives, axis, splitPos)) < FLT_MAX)
+        {
+            // normalize to the same unit as the leaf cost, which is the number of primitives in the node
+            f32 area = calcSurfaceArea(node.aabbMin, node.aabbMax);
+            splitCost = kTraversalCost + intersectionCost * (area > 0.f ? splitCost / area : 0.f);
+            if (splitCost >= (f32)node.count * intersectionCost && node.count <= maxLeafSize)
+            {
+                return;
+            }
+            auto it = std::partition(primitiveIndices.begin() + first, primitiveIndices.begin() + last, [&primitives, axis, splitPos](u32 primitive) {
+                return primitives[primitive].centroid[axis] < splitPos;
+            });
+            mid = (u32)(it - primitiveIndices.begin());
+        }
+
+        if (mid == first || mid == last)
+        {
+            // all centroids are coincident, split in the middle of the range if the node is too large
+            if (node.count <= maxLeafSize)
+            {
+                return;
+            }
+            mid = first + node.count / 2;
+        }
+
+        u32 leftChild = numNodes;
+        numNodes += 2;
+        nodes[leftChild].leftFirst = first;
+        nodes[leftChild].count = mid - first;
+        nodes[leftChild + 1].leftFirst = mid;
+        nodes[leftChild + 1].count = last - mid;
+        node.leftFirst = leftChild;
+        node.count = 0u;
+        parentIndices[leftChild] = nodeIndex;
+        parentIndices[leftChild + 1] = nodeIndex;
+
+        updateNodeBounds(leftChild, primitives);
+        updateNodeBounds(leftChild + 1, primitives);
+        // any hit traversal visits the left child first, so put the child that is more likely to be hit there
+        if (calcSurfaceArea(nodes[leftChild + 1].aabbMin, nodes[leftChild + 1].aabbMax) > calcSurfaceArea(nodes[leftChild].aabbMin, nodes[leftChild].aabbMax))
+        {
+            std::swap(nodes[leftChild], nodes[leftChild + 1]);
         }
-        return meshRayHit;
+        subdivide(leftChild, primitives, depth + 1);
+        subdivide(leftChild + 1, primitives, depth + 1);
     }
 
-    bool BVHNode::traceVisibility(glm::vec3& ro, glm::vec3& rd)
+    f32 BVH::computeSAHCost() const
     {
-        if (m_aabb.intersectRay(ro, rd) > 0.f)
+        if (empty())
+        {
+            return 0.f;
+        }
+        f32 cost = 0.f;
+        for (u32 i = 0; i < numNodes; ++i)
         {
-            // leaf node
-            if (m_submeshIndex >= 0 && m_triangleIndex >= 0)
+            // skip the padding node
+            if (i == 1)
             {
-                auto tri = m_mesh->getTriangle(m_submeshIndex, m_triangleIndex);
-                f32 t = tri.intersectRay(ro, rd);
-                if (t > 0.f)
-                    return true;
-                return false;
+                continue;
             }
-            return m_leftChild->traceVisibility(ro, rd) || m_rightChild->traceVisibility(ro, rd);
+            cost += calcNodeCost(nodes[i]);
         }
-        return false;
+        f32 rootArea = calcSurfaceArea(getRoot().aabbMin, getRoot().aabbMax);
+        return rootArea > 0.f ? cost / rootArea : 0.f;
+    }
+
+    f32 BVH::getSAHCost() const
+    {
+        if (empty())
+        {
+            return 0.f;
+        }
+        f32 rootArea = calcSurfaceArea(getRoot().aabbMin, getRoot().aabbMax);
+        return rootArea > 0.f ? sahCostSum / rootArea : 0.f;
+    }
+
+    f32 BVH::getSAHCostGrowth() const
+    {
+        return builtSAHCost > 0.f ? getSAHCost() / builtSAHCost : 1.f;
     }
-#endif
-}
\ No newline at end of file
+}
@@ -0,0 +1,161 @@
+#include <cstdio>
+#include <fstream>
+
+#include "BVHCache.h"
+#include "Hash.h"
+#include "MappedFile.h"
+
+namespace Cyan
+{
+    static_assert(sizeof(BVHCache::FileHeader) == 64, "BVH cache header has to keep the node array cache line aligned");
+
+    BVHCache::BVHCache(const char* directory)
+        : m_directory(directory)
+    {
+        if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+        {
+            m_directory.push_back('/');
+        }
+    }
+
+    u64 BVHCache::calcGeometryHash(const std::vector<glm::vec3>& trianglePositions)
+    {
+        return hashBytes(trianglePositions.data(), trianglePositions.size() * sizeof(glm::vec3));
+    }
+
+    std::string BVHCache::getFilename(u64 geometryHash) const
+    {
+        char name[32];
+        sprintf_s(name, "%016llx.cybvh", (unsigned long long)geometryHash);
+        return m_directory + name;
+    }
+
+    /**
+    * A cache file of the right size can still be stale or corrupted, so check that traversal and refitting stay within
+    * the arrays before trusting it. The tree is walked from the root since the padding node after it is never linked.
+    */
+    static bool validateTree(const BVHNode* nodes, const u32* parentIndices, const u32* primitiveIndices, const u32* primitiveLeaves, u32 numNodes, u32 numPrimitives)
+    {
+        if (numNodes == 0u)
+        {
+            return numPrimitives == 0u;
+        }
+        for (u32 i = 0; i < numPrimitives; ++i)
+        {
+            if (primitiveIndices[i] >= numPrimitives || primitiveLeaves[i] >= numNodes || !nodes[primitiveLeaves[i]].isLeaf())
+            {
+                return false;
+            }
+        }
+        if (parentIndices[BVH::kRootNodeIndex] != BVH::kInvalidNodeIndex)
+        {
+            return false;
+        }
+        // every child has to name its parent, so no node is reachable twice and the walk can't loop
+        std::vector<u32> stack(1, (u32)BVH::kRootNodeIndex);
+        while (!stack.empty())
+        {
+            u32 nodeIndex = stack.back();
+            stack.pop_back();
+            const BVHNode& node = nodes[nodeIndex];
+            if (node.isLeaf())
+            {
+                if ((u64)node.leftFirst + node.count > numPrimitives)
+                {
+                    return false;
+                }
+                continue;
+            }
+            u32 leftChild = node.leftFirst;
+            if (leftChild == BVH::kRootNodeIndex || (u64)leftChild + 1u >= numNodes
+                || parentIndices[leftChild] != nodeIndex || parentIndices[leftChild + 1u] != nodeIndex)
+            {
+                return false;
+            }
+            stack.push_back(leftChild);
+            stack.push_back(leftChild + 1u);
+        }
+        return true;
+    }
+
+    bool BVHCache::load(u64 geometryHash, u32 numPrimitives, BVH& outBVH) const
+    {
+        std::string filename = getFilename(geometryHash);
+        MappedFile file;
+        if (!file.open(filename.c_str()) || file.getSize() < sizeof(FileHeader))
+        {
+            return false;
+        }
+        const FileHeader& header = *reinterpret_cast<const FileHeader*>(file.getData());
+        if (header.magic != kFileMagic || header.version != kFileVersion || header.geometryHash != geometryHash || header.numPrimitives != numPrimitives)
+        {
+            return false;
+        }
+        // stale trees built with other parameters are simply rebuilt and overwritten
+        if (header.maxLeafSize != outBVH.maxLeafSize || header.intersectionCost != outBVH.intersectionCost || header.buildMethod != (u32)outBVH.buildMethod
+            || header.numTreeletPasses != outBVH.numTreeletPasses || header.minTreeletPrimitives != outBVH.minTreeletPrimitives)
+        {
+            return false;
+        }
+        u64 expectedSize = sizeof(FileHeader) + (u64)header.numNodes * (sizeof(BVHNode) + sizeof(u32)) + (u64)header.numPrimitives * 2u * sizeof(u32);
+        if (file.getSize() != expectedSize)
+        {
+            cyanError("BVH cache file %s is truncated", filename.c_str());
+            return false;
+        }
+
+        const BVHNode* nodes = reinterpret_cast<const BVHNode*>(file.getData() + sizeof(FileHeader));
+        const u32* parentIndices = reinterpret_cast<const u32*>(nodes + header.numNodes);
+        const u32* primitiveIndices = parentIndices + header.numNodes;
+        const u32* primitiveLeaves = primitiveIndices + header.numPrimitives;
+        if (!validateTree(nodes, parentIndices, primitiveIndices, primitiveLeaves, header.numNodes, header.numPrimitives))
+        {
+            cyanError("BVH cache file %s holds an invalid tree", filename.c_str());
+            return false;
+        }
+        outBVH.nodes.assign(nodes, nodes + header.numNodes);
+        outBVH.parentIndices.assign(parentIndices, parentIndices + header.numNodes);
+        outBVH.primitiveIndices.assign(primitiveIndices, primitiveIndices + header.numPrimitives);
+        outBVH.primitiveLeaves.assign(primitiveLeaves, primitiveLeaves + header.numPrimitives);
+        outBVH.numNodes = header.numNodes;
+        outBVH.builtSAHCost = header.builtSAHCost;
+        outBVH.sahCostSum = header.sahCostSum;
+        return true;
+    }
+
+    bool BVHCache::save(u64 geometryHash, const BVH& bvh) const
+    {
+        if (bvh.empty())
+        {
+            return false;
+        }
+        createDirectories(m_directory.c_str());
+        std::string filename = getFilename(geometryHash);
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            cyanError("Failed to open %s for writing BVH cache", filename.c_str());
+            return false;
+        }
+
+        FileHeader header = { };
+        header.magic = kFileMagic;
+        header.version = kFileVersion;
+        header.geometryHash = geometryHash;
+        header.numNodes = bvh.numNodes;
+        header.numPrimitives = (u32)bvh.primitiveIndices.size();
+        header.maxLeafSize = bvh.maxLeafSize;
+        header.intersectionCost = bvh.intersectionCost;
+        header.buildMethod = (u32)bvh.buildMethod;
+        header.numTreeletPasses = bvh.numTreeletPasses;
+        header.minTreeletPrimitives = bvh.minTreeletPrimitives;
+        header.builtSAHCost = bvh.builtSAHCost;
+        header.sahCostSum = bvh.sahCostSum;
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(bvh.nodes.data()), bvh.numNodes * sizeof(BVHNode));
+        file.write(reinterpret_cast<const char*>(bvh.parentIndices.data()), bvh.numNodes * sizeof(u32));
+        file.write(reinterpret_cast<const char*>(bvh.primitiveIndices.data()), bvh.primitiveIndices.size() * sizeof(u32));
+        file.write(reinterpret_cast<const char*>(bvh.primitiveLeaves.data()), bvh.primitiveLeaves.size() * sizeof(u32));
+        return file.good();
+    }
+}
@@ -30,11 +30,22 @@ namespace Cyan
     static Shader* m_shaders[kMaxNumShaders];
 
     static u32 m_numSceneNodes = 0u;
+    static bool s_bHeadless = false;
 
     void init() {
 
     }
 
+    void setHeadless(bool bHeadless)
+    {
+        s_bHeadless = bHeadless;
+    }
+
+    bool isHeadless()
+    {
+        return s_bHeadless;
+    }
+
     VertexBuffer* createVertexBuffer(void* data, u32 sizeInBytes, VertexSpec&& vertexSpec)
     {
         VertexBuffer* vb = new VertexBuffer(data, sizeInBytes, std::move(vertexSpec));
@@ -0,0 +1,310 @@
+#include <cfloat>
+#include <cmath>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "Denoiser.h"
+#include "RayPacket.h"
+#include "SIMD.h"
+#include "ThreadPool.h"
+
+namespace Cyan
+{
+    struct DenoiserRegistry
+    {
+        DenoiserRegistry()
+        {
+            factories["atrous"] = []() { return std::unique_ptr<IDenoiser>(new ATrousDenoiser()); };
+        }
+
+        std::mutex mutex;
+        std::unordered_map<std::string, DenoiserFactory> factories;
+    };
+
+    static DenoiserRegistry& getDenoiserRegistry()
+    {
+        static DenoiserRegistry registry;
+        return registry;
+    }
+
+    void registerDenoiser(const char* name, const DenoiserFactory& factory)
+    {
+        DenoiserRegistry& registry = getDenoiserRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.factories[name] = factory;
+    }
+
+    std::unique_ptr<IDenoiser> createDenoiser(const char* name)
+    {
+        DenoiserRegistry& registry = getDenoiserRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        auto entry = registry.factories.find(name);
+        if (entry == registry.factories.end())
+        {
+            cyanError("No denoiser registered as %s", name);
+            return nullptr;
+        }
+        return entry->second();
+    }
+
+    // 1D weights of the 5x5 b-spline kernel, the full kernel is their outer product
+    static const f32 kKernel[5] = { 1.f / 16.f, 1.f / 4.f, 3.f / 8.f, 1.f / 4.f, 1.f / 16.f };
+    // albedo channels below this are left in the image instead of being divided out
+    static const f32 kMinDemodulationAlbedo = 1e-3f;
+    static const f32 kDepthEpsilon = 1e-3f;
+    static const f32 kLuminanceEpsilon = 1e-4f;
+
+    static f32 luminance(const glm::vec3& color)
+    {
+        return .2126f * color.r + .7152f * color.g + .0722f * color.b;
+    }
+
+    template <typename Float>
+    static Float luminance(const Float& r, const Float& g, const Float& b)
+    {
+        return Float::splat(.2126f) * r + Float::splat(.7152f) * g + Float::splat(.0722f) * b;
+    }
+
+    void ATrousDenoiser::denoise(const Image& color, const AOVBuffer& aovs, Image& outImage)
+    {
+        if (color.size != aovs.size || color.size != outImage.size)
+        {
+            cyanError("Denoiser inputs don't match in size");
+            return;
+        }
+        if (color.size.x == 0u || color.size.y == 0u)
+        {
+            return;
+        }
+
+        prepare(color, aovs);
+        estimateVariance();
+        ThreadPool* threadPool = ThreadPool::get();
+        u32 src = 0u;
+        for (u32 i = 0; i < settings.numIterations; ++i)
+        {
+            u32 step = 1u << i;
+            prefilterVariance(m_planes[src]);
+            const Planes& srcPlanes = m_planes[src];
+            Planes& dstPlanes = m_planes[src ^ 1u];
+            threadPool->parallelFor(m_size.y, [this, &srcPlanes, &dstPlanes, step](u32 y) {
+                filterRow(srcPlanes, dstPlanes, y, step);
+            });
+            src ^= 1u;
+        }
+
+        const Planes& result = m_planes[src];
+        for (u32 i = 0; i < (u32)outImage.pixels.size(); ++i)
+        {
+            outImage.pixels[i] = glm::vec3(result.r[i], result.g[i], result.b[i]) * m_demodulation[i];
+        }
+    }
+
+    void ATrousDenoiser::prepare(const Image& color, const AOVBuffer& aovs)
+    {
+        m_size = color.size;
+        u32 numPixels = m_size.x * m_size.y;
+        m_planes[0].resize(numPixels);
+        m_planes[1].resize(numPixels);
+        m_normalX.resize(numPixels);
+        m_normalY.resize(numPixels);
+        m_normalZ.resize(numPixels);
+        m_depth.resize(numPixels);
+        m_depthGradient.resize(numPixels);
+        m_prefilteredVariance.resize(numPixels);
+        m_demodulation.resize(numPixels);
+
+        Planes& planes = m_planes[0];
+        for (u32 i = 0; i < numPixels; ++i)
+        {
+            const glm::vec3& albedo = aovs.albedo[i];
+            for (i32 c = 0; c < 3; ++c)
+            {
+                m_demodulation[i][c] = (albedo[c] > kMinDemodulationAlbedo) ? albedo[c] : 1.f;
+            }
+            glm::vec3 irradiance = color.pixels[i] / m_demodulation[i];
+            planes.r[i] = irradiance.r;
+            planes.g[i] = irradiance.g;
+            planes.b[i] = irradiance.b;
+            // averaged normals of pixels covering an edge are shorter than 1, which weakens their normal weights as intended
+            m_normalX[i] = aovs.normals[i].x;
+            m_normalY[i] = aovs.normals[i].y;
+            m_normalZ[i] = aovs.normals[i].z;
+            m_depth[i] = aovs.depth[i];
+        }
+
+        // the smaller one sided difference per axis, so that pixels next to a depth discontinuity still see their own surface's gradient
+        for (u32 y = 0; y < m_size.y; ++y)
+        {
+            for (u32 x = 0; x < m_size.x; ++x)
+            {
+                u32 i = y * m_size.x + x;
+                f32 z = m_depth[i];
+                f32 left = (x > 0u) ? fabsf(z - m_depth[i - 1u]) : FLT_MAX;
+                f32 right = (x + 1u < m_size.x) ? fabsf(z - m_depth[i + 1u]) : FLT_MAX;
+                f32 up = (y > 0u) ? fabsf(z - m_depth[i - m_size.x]) : FLT_MAX;
+                f32 down = (y + 1u < m_size.y) ? fabsf(z - m_depth[i + m_size.x]) : FLT_MAX;
+                f32 dx = Min(left, right), dy = Min(up, down);
+                dx = (dx == FLT_MAX) ? 0.f : dx;
+                dy = (dy == FLT_MAX) ? 0.f : dy;
+                m_depthGradient[i] = Max(dx, dy);
+            }
+        }
+    }
+
+    /**
+    * Without multiple frames to accumulate moments over, the luminance variance of every pixel is estimated from its
+    * 3x3 neighborhood
+    */
+    void ATrousDenoiser::estimateVariance()
+    {
+        Planes& planes = m_planes[0];
+        ThreadPool::get()->parallelFor(m_size.y, [this, &planes](u32 y) {
+            for (u32 x = 0; x < m_size.x; ++x)
+            {
+                f32 sum = 0.f, sumSquared = 0.f;
+                u32 count = 0u;
+                for (u32 qy = (y > 0u ? y - 1u : 0u); qy <= Min(y + 1u, m_size.y - 1u); ++qy)
+                {
+                    for (u32 qx = (x > 0u ? x - 1u : 0u); qx <= Min(x + 1u, m_size.x - 1u); ++qx)
+                    {
+                        u32 q = qy * m_size.x + qx;
+                        f32 l = luminance(glm::vec3(planes.r[q], planes.g[q], planes.b[q]));
+                        sum += l;
+                        sumSquared += l * l;
+                        count++;
+                    }
+                }
+                f32 mean = sum / count;
+                planes.variance[y * m_size.x + x] = Max(sumSquared / count - mean * mean, 0.f);
+            }
+        });
+    }
+
+    void ATrousDenoiser::prefilterVariance(const Planes& src)
+    {
+        static const f32 kGaussian[2] = { 1.f / 2.f, 1.f / 4.f };
+        ThreadPool::get()->parallelFor(m_size.y, [this, &src](u32 y) {
+            for (u32 x = 0; x < m_size.x; ++x)
+            {
+                f32 sum = 0.f, sumWeights = 0.f;
+                for (i32 dy = -1; dy <= 1; ++dy)
+                {
+                    for (i32 dx = -1; dx <= 1; ++dx)
+                    {
+                        i32 qx = (i32)x + dx, qy = (i32)y + dy;
+                        if (qx < 0 || qy < 0 || qx >= (i32)m_size.x || qy >= (i32)m_size.y)
+                        {
+                            continue;
+                        }
+                        f32 w = kGaussian[dx != 0 ? 1 : 0] * kGaussian[dy != 0 ? 1 : 0];
+                        sum += src.variance[qy * m_size.x + qx] * w;
+                        sumWeights += w;
+                    }
+                }
+                m_prefilteredVariance[y * m_size.x + x] = sum / sumWeights;
+            }
+        });
+    }
+
+    /**
+    * Pixels whose taps all fall inside the row are filtered 'Float::kWidth' at a time, the ones close to the left and
+    * right border one at a time with out of bounds taps skipped
+    */
+    void ATrousDenoiser::filterRow(const Planes& src, Planes& dst, u32 y, u32 step) const
+    {
+        u32 x = 0u;
+        u32 border = 2u * step;
+        for (; x < Min(border, m_size.x); ++x)
+        {
+            filterSpan<Float1>(src, dst, x, y, step);
+        }
+        switch (settings.bSIMD ? getSIMDLevel() : SIMDLevel::kScalar)
+        {
+        case SIMDLevel::kAVX2:
+            for (; x + Float8::kWidth + border <= m_size.x; x += Float8::kWidth)
+            {
+                filterSpan<Float8>(src, dst, x, y, step);
+            }
+            break;
+        case SIMDLevel::kSSE:
+            for (; x + Float4::kWidth + border <= m_size.x; x += Float4::kWidth)
+            {
+                filterSpan<Float4>(src, dst, x, y, step);
+            }
+            break;
+        default:
+            break;
+        }
+        for (; x < m_size.x; ++x)
+        {
+            filterSpan<Float1>(src, dst, x, y, step);
+        }
+    }
+
+    template <typename Float>
+    void ATrousDenoiser::filterSpan(const Planes& src, Planes& dst, u32 x, u32 y, u32 step) const
+    {
+        const i32 width = (i32)m_size.x, height = (i32)m_size.y;
+        const u32 p = y * m_size.x + x;
+        const Float one = Float::splat(1.f), zero = Float::splat(0.f);
+
+        Float r = Float::load(&src.r[p]), g = Float::load(&src.g[p]), b = Float::load(&src.b[p]);
+        Float lumP = luminance(r, g, b);
+        Float nx = Float::load(&m_normalX[p]), ny = Float::load(&m_normalY[p]), nz = Float::load(&m_normalZ[p]);
+        Float zP = Float::load(&m_depth[p]);
+        Float depthScale = Float::load(&m_depthGradient[p]) * Float::splat(settings.sigmaDepth * step);
+        // taps are 1 to 4 steps away in manhattan distance, divide once per distance instead of once per tap
+        Float invDepthTolerance[5];
+        for (u32 d = 1; d <= 4; ++d)
+        {
+            invDepthTolerance[d] = one / (depthScale * Float::splat((f32)d) + Float::splat(kDepthEpsilon));
+        }
+        Float invSigmaL = one / (Float::splat(settings.sigmaLuminance) * simdSqrt(Float::load(&m_prefilteredVariance[p])) + Float::splat(kLuminanceEpsilon));
+        Float sigmaN = Float::splat(settings.sigmaNormal);
+
+        // the center tap always gets its full weight so that isolated pixels such as background keep their color
+        Float sumWeights = Float::splat(kKernel[2] * kKernel[2]);
+        Float sumR = r * sumWeights, sumG = g * sumWeights, sumB = b * sumWeights;
+        Float sumVariance = Float::load(&src.variance[p]) * sumWeights * sumWeights;
+
+        for (i32 ty = -2; ty <= 2; ++ty)
+        {
+            i32 qy = (i32)y + ty * (i32)step;
+            if (qy < 0 || qy >= height)
+            {
+                continue;
+            }
+            for (i32 tx = -2; tx <= 2; ++tx)
+            {
+                i32 qx = (i32)x + tx * (i32)step;
+                if ((tx == 0 && ty == 0) || qx < 0 || qx + (i32)Float::kWidth > width)
+                {
+                    continue;
+                }
+                u32 q = (u32)(qy * width + qx);
+                Float rq = Float::load(&src.r[q]), gq = Float::load(&src.g[q]), bq = Float::load(&src.b[q]);
+                Float cosine = nx * Float::load(&m_normalX[q]) + ny * Float::load(&m_normalY[q]) + nz * Float::load(&m_normalZ[q]);
+
+                // all three edge stopping functions share one exp, the normal term approximates cosine^sigmaN near 1
+                Float exponent = simdAbs(zP - Float::load(&m_depth[q])) * invDepthTolerance[abs(tx) + abs(ty)]
+                    + simdAbs(lumP - luminance(rq, gq, bq)) * invSigmaL
+                    + sigmaN * simdMax(one - cosine, zero);
+                Float w = Float::splat(kKernel[tx + 2] * kKernel[ty + 2]) * simdExp(zero - exponent);
+
+                sumWeights = sumWeights + w;
+                sumR = sumR + rq * w;
+                sumG = sumG + gq * w;
+                sumB = sumB + bq * w;
+                sumVariance = sumVariance + Float::load(&src.variance[q]) * w * w;
+            }
+        }
+
+        Float invSumWeights = one / sumWeights;
+        (sumR * invSumWeights).store(&dst.r[p]);
+        (sumG * invSumWeights).store(&dst.g[p]);
+        (sumB * invSumWeights).store(&dst.b[p]);
+        (sumVariance * invSumWeights * invSumWeights).store(&dst.variance[p]);
+    }
+}
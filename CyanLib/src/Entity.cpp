@@ -147,7 +147,7 @@ namespace Cyan
 
     void Entity::setLocalTransform(const Transform& transform)
     {
-        rootSceneComponent->m_localTransform = transform;
+        rootSceneComponent->setLocalTransform(transform);
     }
 
     void Entity::setMaterial(const char* meshComponentName, i32 submeshIndex, Cyan::Material* matl)
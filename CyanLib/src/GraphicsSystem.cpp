@@ -158,6 +158,7 @@ namespace Cyan
 
         m_ctx = std::make_unique<GfxContext>(m_glfwWindow);
         m_sceneManager = std::make_unique<SceneManager>();
+        m_textureStreamer = std::make_unique<TextureStreamer>();
         m_assetManager = std::make_unique<AssetManager>();
         m_shaderManager = std::make_unique<ShaderManager>();
         m_renderer = std::make_unique<Renderer>(m_ctx.get(), windowWidth, windowHeight);
@@ -191,6 +192,12 @@ namespace Cyan
 
     void GraphicsSystem::render() {
         if (m_scene) {
+            // assets and entities of scenes being imported that are ready for the gl thread
+            m_assetManager->update();
+
+            // mips requested while rendering last frame
+            m_textureStreamer->update();
+
             // clear default render target
             m_ctx->setRenderTarget(nullptr, { });
             m_ctx->clear();
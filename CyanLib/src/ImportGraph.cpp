@@ -0,0 +1,171 @@
+#include "ImportGraph.h"
+#include "ThreadPool.h"
+
+namespace Cyan
+{
+    ImportGraph::ImportGraph(const char* name)
+        : m_name(name), m_start(std::chrono::high_resolution_clock::now())
+    {
+    }
+
+    ImportGraph::~ImportGraph()
+    {
+        // worker tasks finish by touching the graph, so it has to outlive them
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this]() { return m_numRunningWorkerTasks == 0u; });
+    }
+
+    ImportGraph::TaskID ImportGraph::addTask(const char* name, Thread thread, const Task& task, const std::vector<TaskID>& dependencies)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        TaskID id = (TaskID)m_nodes.size();
+        m_nodes.emplace_back();
+        Node& node = m_nodes.back();
+        node.name = name;
+        node.thread = thread;
+        node.task = task;
+        for (TaskID dependency : dependencies)
+        {
+            if (dependency == kInvalidTask)
+            {
+                continue;
+            }
+            CYAN_ASSERT(dependency < id, "Import task %s depends on a task that doesn't exist", name)
+            Node& dependencyNode = m_nodes[dependency];
+            if (dependencyNode.state == State::kSucceeded || dependencyNode.state == State::kFailed)
+            {
+                continue;
+            }
+            dependencyNode.dependents.push_back(id);
+            node.numPendingDependencies++;
+        }
+        if (node.numPendingDependencies == 0u)
+        {
+            schedule(id);
+        }
+        return id;
+    }
+
+    void ImportGraph::schedule(TaskID id)
+    {
+        Node& node = m_nodes[id];
+        node.state = State::kReady;
+        if (node.thread == Thread::kMain)
+        {
+            m_mainQueue.push_back(id);
+            m_condition.notify_all();
+            return;
+        }
+        m_numRunningWorkerTasks++;
+        Node* workerNode = &node;
+        ThreadPool::get()->submit([this, id, workerNode]() {
+            bool bSucceeded = workerNode->task ? workerNode->task() : true;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            finish(id, bSucceeded);
+            m_numRunningWorkerTasks--;
+            // notifying under the lock keeps the graph alive until this task is done touching it
+            m_condition.notify_all();
+        });
+    }
+
+    void ImportGraph::finish(TaskID id, bool bSucceeded)
+    {
+        Node& node = m_nodes[id];
+        node.state = bSucceeded ? State::kSucceeded : State::kFailed;
+        // the task may hold on to resources, such as a parsed file, that are only needed until it is done
+        node.task = nullptr;
+        m_numFinished++;
+        if (!bSucceeded)
+        {
+            cyanError("Import task %s of %s failed", node.name.c_str(), m_name.c_str());
+            m_numFailed++;
+        }
+        std::vector<TaskID> dependents;
+        dependents.swap(node.dependents);
+        for (TaskID dependent : dependents)
+        {
+            Node& dependentNode = m_nodes[dependent];
+            if (--dependentNode.numPendingDependencies == 0u)
+            {
+                schedule(dependent);
+            }
+        }
+        if (m_numFinished == (u32)m_nodes.size())
+        {
+            m_condition.notify_all();
+        }
+    }
+
+    bool ImportGraph::runMainTask(std::unique_lock<std::mutex>& lock)
+    {
+        if (m_mainQueue.empty())
+        {
+            return false;
+        }
+        TaskID id = m_mainQueue.front();
+        m_mainQueue.pop_front();
+        Task task = m_nodes[id].task;
+        lock.unlock();
+        bool bSucceeded = task ? task() : true;
+        lock.lock();
+        finish(id, bSucceeded);
+        return true;
+    }
+
+    bool ImportGraph::update(f32 timeBudgetInMs)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (runMainTask(lock))
+        {
+            std::chrono::duration<f32, std::milli> elapsed = std::chrono::high_resolution_clock::now() - begin;
+            if (elapsed.count() >= timeBudgetInMs)
+            {
+                break;
+            }
+        }
+        return m_numFinished == (u32)m_nodes.size();
+    }
+
+    void ImportGraph::wait()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (m_numFinished < (u32)m_nodes.size())
+        {
+            if (!runMainTask(lock))
+            {
+                m_condition.wait(lock, [this]() { return !m_mainQueue.empty() || m_numFinished == (u32)m_nodes.size(); });
+            }
+        }
+    }
+
+    bool ImportGraph::isFinished() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numFinished == (u32)m_nodes.size();
+    }
+
+    u32 ImportGraph::getNumTasks() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return (u32)m_nodes.size();
+    }
+
+    u32 ImportGraph::getNumFinishedTasks() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numFinished;
+    }
+
+    u32 ImportGraph::getNumFailedTasks() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_numFailed;
+    }
+
+    f32 ImportGraph::getElapsedTimeInMs() const
+    {
+        std::chrono::duration<f32, std::milli> elapsed = std::chrono::high_resolution_clock::now() - m_start;
+        return elapsed.count();
+    }
+}
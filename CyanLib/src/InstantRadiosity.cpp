@@ -109,7 +109,6 @@ namespace Cyan {
         renderTarget->clear({ { 0 } });
 
         auto gfxc = renderer->getGfxCtx();
-        renderableScene.upload();
 
         VertexShader* vs = ShaderManager::createShader<VertexShader>("VPLGenerationVS", SHADER_SOURCE_PATH "generate_vpl_v.glsl");
         PixelShader* ps = ShaderManager::createShader<PixelShader>("VPLGenerationPS", SHADER_SOURCE_PATH "generate_vpl_p.glsl");
@@ -123,6 +122,8 @@ namespace Cyan {
         gfxc->setRenderTarget(renderTarget.get(), { { 0 } });
         gfxc->setViewport({ 0, 0, renderTarget->width, renderTarget->height });
         gfxc->setDepthControl(DepthControl::kEnable);
+        // lods are picked for the viewport being rendered
+        renderableScene.upload();
 
         // bind VPL atomic counter
         numGeneratedVPLs = 0;
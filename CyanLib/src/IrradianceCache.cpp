@@ -0,0 +1,404 @@
+#include <cfloat>
+
+#include "IrradianceCache.h"
+#include "MathUtils.h"
+#include "ThreadPool.h"
+#include "Hash.h"
+
+namespace Cyan
+{
+    static const u32 kInvalidIndex = 0xFFFFFFFF;
+
+    // offset applied to the origin of hemisphere rays along the normal, relative to the scene extent
+    static const f32 kRayOffsetScale = 1e-4f;
+
+    static const glm::vec3 kChildOffsets[8] = {
+        glm::vec3(-.5f, -.5f, -.5f),
+        glm::vec3( .5f, -.5f, -.5f),
+        glm::vec3(-.5f,  .5f, -.5f),
+        glm::vec3( .5f,  .5f, -.5f),
+        glm::vec3(-.5f, -.5f,  .5f),
+        glm::vec3( .5f, -.5f,  .5f),
+        glm::vec3(-.5f,  .5f,  .5f),
+        glm::vec3( .5f,  .5f,  .5f),
+    };
+
+    // jitter of a hemisphere sample derived from (record, sample, dimension), so that workers don't share a random state
+    static f32 random(u32 seed, u32 sample, u32 dimension)
+    {
+        u32 hash = pcgHash(seed ^ pcgHash(sample * 2u + dimension));
+        return (hash >> 8) * (1.f / 16777216.f);
+    }
+
+    static u32 getChildIndex(const glm::vec3& center, const glm::vec3& position)
+    {
+        return (position.x >= center.x ? 1u : 0u) | (position.y >= center.y ? 2u : 0u) | (position.z >= center.z ? 4u : 0u);
+    }
+
+    /**
+    * Weight of a record at 'p' from [Ward 88], records with a non positive weight don't contribute
+    */
+    static f32 calcRecordWeight(const IrradianceRecord& record, const glm::vec3& p, const glm::vec3& n, f32 error)
+    {
+        f32 distance = glm::length(p - record.position);
+        f32 e = distance / record.r + sqrt(Max(0.f, 1.f - glm::dot(n, record.normal)));
+        return 1.f / Max(e, 1e-6f) - 1.f / error;
+    }
+
+    IrradianceCache::IrradianceCache(u32 maxNumRecords, u32 maxNumNodes)
+        : m_records(maxNumRecords), m_nodes(maxNumNodes), m_workerStats(ThreadPool::get()->getNumWorkers() + 1u)
+    {
+
+    }
+
+    void IrradianceCache::init(const RayTracingScene& rtxScene)
+    {
+        glm::vec3 aabbMin(0.f), aabbMax(0.f);
+        if (!rtxScene.tlas.empty())
+        {
+            aabbMin = rtxScene.tlas.getRoot().aabbMin;
+            aabbMax = rtxScene.tlas.getRoot().aabbMax;
+        }
+        glm::vec3 extent = aabbMax - aabbMin;
+        // pad the root a little so that records right on the scene bounds still fall inside
+        m_sceneExtent = Max(Max(Max(extent.x, extent.y), extent.z), 1e-3f) * 1.01f;
+
+        m_records.reset();
+        m_nodes.reset();
+        m_root = allocNode((aabbMin + aabbMax) * .5f, m_sceneExtent);
+        resetStats();
+    }
+
+    u32 IrradianceCache::allocNode(const glm::vec3& center, f32 sideLength)
+    {
+        u32 nodeIndex = m_nodes.alloc();
+        if (nodeIndex != kInvalidIndex)
+        {
+            // the node is only published through a compare and swap afterwards, so plain initialization is fine here
+            OctreeNode& node = m_nodes[nodeIndex];
+            node.center = center;
+            node.sideLength = sideLength;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                node.children[i].store(kInvalidIndex, std::memory_order_relaxed);
+            }
+            node.firstRecord.store(kInvalidIndex, std::memory_order_relaxed);
+        }
+        return nodeIndex;
+    }
+
+    IrradianceCache::WorkerStats& IrradianceCache::getWorkerStats()
+    {
+        // threads outside of the pool share the last slot
+        u32 workerIndex = ThreadPool::getCurrentWorkerIndex();
+        u32 numSlots = (u32)m_workerStats.size();
+        return m_workerStats[(workerIndex < numSlots - 1u) ? workerIndex : numSlots - 1u];
+    }
+
+    glm::vec3 IrradianceCache::getIrradiance(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n)
+    {
+        return getIrradiance(rtxScene, p, n, settings.error);
+    }
+
+    glm::vec3 IrradianceCache::getIrradiance(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n, f32 error)
+    {
+        WorkerStats& stats = getWorkerStats();
+        stats.numLookups.fetch_add(1, std::memory_order_relaxed);
+
+        glm::vec3 irradiance;
+        if (lookup(p, n, error, irradiance))
+        {
+            stats.numHits.fetch_add(1, std::memory_order_relaxed);
+            return irradiance;
+        }
+
+        const IrradianceRecord* record = addRecord(rtxScene, p, n);
+        if (record)
+        {
+            return record->irradiance;
+        }
+        // the cache is full, fall back to sampling without storing the result
+        IrradianceRecord newRecord;
+        u32 seed = pcgHash(glm::floatBitsToUint(p.x) ^ pcgHash(glm::floatBitsToUint(p.y) ^ pcgHash(glm::floatBitsToUint(p.z))));
+        sampleHemisphere(rtxScene, p, n, seed, newRecord);
+        return newRecord.irradiance;
+    }
+
+    bool IrradianceCache::lookup(const glm::vec3& p, const glm::vec3& n, f32 error, glm::vec3& outIrradiance) const
+    {
+        if (m_root == kInvalidIndex)
+        {
+            return false;
+        }
+
+        glm::vec3 irradianceSum(0.f);
+        f32 weightSum = 0.f;
+
+        // the octree is at most kMaxDepth levels deep and every visited node pushes up to 8 children
+        u32 stack[(kMaxDepth + 1u) * 8u];
+        u32 stackSize = 0u;
+        stack[stackSize++] = m_root;
+        while (stackSize > 0u)
+        {
+            const OctreeNode& node = m_nodes[stack[--stackSize]];
+
+            for (u32 recordIndex = node.firstRecord.load(std::memory_order_acquire); recordIndex != kInvalidIndex; recordIndex = m_records[recordIndex].next)
+            {
+                const IrradianceRecord& record = m_records[recordIndex];
+                f32 weight = calcRecordWeight(record, p, n, error);
+                if (weight <= 0.f)
+                {
+                    continue;
+                }
+                // skip records in front of 'p', they see a different part of the scene
+                glm::vec3 offset = p - record.position;
+                if (glm::dot(offset, (record.normal + n) * .5f) < -.01f * record.r)
+                {
+                    continue;
+                }
+                // first order extrapolation using the gradients [Ward & Heckbert 92]
+                glm::vec3 rotation = glm::cross(record.normal, n);
+                glm::vec3 irradiance = record.irradiance;
+                for (u32 channel = 0; channel < 3; ++channel)
+                {
+                    irradiance[channel] += glm::dot(rotation, record.rotationalGradient[channel]) + glm::dot(offset, record.translationalGradient[channel]);
+                }
+                irradianceSum += weight * vec3Max(irradiance, glm::vec3(0.f));
+                weightSum += weight;
+            }
+
+            /**
+            * Records in a node have a radius of at most half the node size and only reach 'error' times their radius, so
+            * only children closer than that to 'p' can hold contributing records
+            */
+            for (u32 i = 0; i < 8; ++i)
+            {
+                u32 childIndex = node.children[i].load(std::memory_order_acquire);
+                if (childIndex == kInvalidIndex)
+                {
+                    continue;
+                }
+                const OctreeNode& child = m_nodes[childIndex];
+                f32 reach = .5f * child.sideLength * (1.f + error);
+                glm::vec3 d = p - child.center;
+                if (fabs(d.x) < reach && fabs(d.y) < reach && fabs(d.z) < reach)
+                {
+                    stack[stackSize++] = childIndex;
+                }
+            }
+        }
+
+        if (weightSum > 0.f)
+        {
+            outIrradiance = irradianceSum / weightSum;
+            return true;
+        }
+        return false;
+    }
+
+    const IrradianceRecord* IrradianceCache::addRecord(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n)
+    {
+        if (m_root == kInvalidIndex)
+        {
+            return nullptr;
+        }
+        u32 recordIndex = m_records.alloc();
+        if (recordIndex == kInvalidIndex)
+        {
+            return nullptr;
+        }
+        IrradianceRecord& record = m_records[recordIndex];
+        sampleHemisphere(rtxScene, p, n, recordIndex, record);
+        insertRecord(recordIndex);
+        return &record;
+    }
+
+    /**
+    * Stratified cosine weighted sampling of the hemisphere with M x N cells, the irradiance is stored divided by pi so that
+    * multiplying it with the albedo gives the reflected radiance. Gradients follow [Ward & Heckbert 92] and the radius
+    * is limited by the translational gradient [Krivanek et al. 05]. Cells are jittered by hashing 'seed' with the cell's
+    * index.
+    */
+    void IrradianceCache::sampleHemisphere(const RayTracingScene& rtxScene, const glm::vec3& p, const glm::vec3& n, u32 seed, IrradianceRecord& outRecord) const
+    {
+        const u32 M = Max(settings.numThetaStrata, 1u);
+        const u32 N = Max(settings.numPhiStrata, 1u);
+        struct Cell
+        {
+            glm::vec3 radiance;
+            f32 distance;
+        };
+        std::vector<Cell> cells(M * N);
+
+        glm::vec3 tangent, bitangent;
+        calcOrthonormalBasis(n, tangent, bitangent);
+        glm::vec3 ro = p + n * (kRayOffsetScale * m_sceneExtent);
+
+        glm::vec3 irradiance(0.f);
+        f32 invDistanceSum = 0.f;
+        u32 numHits = 0u;
+        for (u32 k = 0; k < N; ++k)
+        {
+            for (u32 j = 0; j < M; ++j)
+            {
+                u32 sample = k * M + j;
+                f32 sinTheta = sqrt(((f32)j + random(seed, sample, 0u)) / M);
+                f32 cosTheta = sqrt(Max(0.f, 1.f - sinTheta * sinTheta));
+                f32 phi = 2.f * M_PI * ((f32)k + random(seed, sample, 1u)) / N;
+                glm::vec3 rd = (tangent * glm::cos(phi) + bitangent * glm::sin(phi)) * sinTheta + n * cosTheta;
+
+                Ray ray{ ro, rd };
+                RayHit hit;
+                traceTLAS(rtxScene, ray, hit);
+
+                Cell& cell = cells[k * M + j];
+                if (hit.tri >= 0)
+                {
+                    cell.radiance = calcDirectRadiance(rtxScene, hit);
+                    cell.distance = hit.t;
+                    invDistanceSum += 1.f / Max(hit.t, 1e-6f);
+                    numHits++;
+                }
+                else
+                {
+                    cell.radiance = settings.skyRadiance;
+                    cell.distance = FLT_MAX;
+                }
+                irradiance += cell.radiance;
+            }
+        }
+        irradiance /= (f32)(M * N);
+
+        glm::vec3 rotationalGradient[3] = { glm::vec3(0.f), glm::vec3(0.f), glm::vec3(0.f) };
+        glm::vec3 translationalGradient[3] = { glm::vec3(0.f), glm::vec3(0.f), glm::vec3(0.f) };
+        for (u32 k = 0; k < N; ++k)
+        {
+            u32 prevK = (k + N - 1u) % N;
+            f32 phiCenter = 2.f * M_PI * ((f32)k + .5f) / N;
+            f32 phiMinus = 2.f * M_PI * (f32)k / N;
+            glm::vec3 uk = tangent * glm::cos(phiCenter) + bitangent * glm::sin(phiCenter);
+            glm::vec3 vk = -tangent * glm::sin(phiCenter) + bitangent * glm::cos(phiCenter);
+            glm::vec3 vkMinus = -tangent * glm::sin(phiMinus) + bitangent * glm::cos(phiMinus);
+
+            glm::vec3 rotational(0.f), thetaChange(0.f), phiChange(0.f);
+            for (u32 j = 0; j < M; ++j)
+            {
+                const Cell& cell = cells[k * M + j];
+                f32 sinThetaCenter = sqrt(((f32)j + .5f) / M);
+                f32 tanThetaCenter = sinThetaCenter / sqrt(Max(1.f - sinThetaCenter * sinThetaCenter, 1e-6f));
+                rotational -= tanThetaCenter * cell.radiance;
+
+                f32 sinThetaMinus = sqrt((f32)j / M);
+                f32 sinThetaPlus = sqrt(((f32)j + 1.f) / M);
+                if (j > 0)
+                {
+                    const Cell& below = cells[k * M + j - 1];
+                    f32 distance = Min(cell.distance, below.distance);
+                    thetaChange += sinThetaMinus * (1.f - sinThetaMinus * sinThetaMinus) * (cell.radiance - below.radiance) / distance;
+                }
+                const Cell& prev = cells[prevK * M + j];
+                f32 distance = Min(cell.distance, prev.distance);
+                phiChange += (sinThetaPlus - sinThetaMinus) * (cell.radiance - prev.radiance) / distance;
+            }
+
+            for (u32 channel = 0; channel < 3; ++channel)
+            {
+                rotationalGradient[channel] += vk * rotational[channel];
+                translationalGradient[channel] += uk * (thetaChange[channel] * 2.f * M_PI / N) + vkMinus * phiChange[channel];
+            }
+        }
+
+        // harmonic mean distance to the visible surfaces, limited so that the gradient can't extrapolate to negative values
+        f32 minRadius = settings.minRadiusScale * m_sceneExtent;
+        f32 maxRadius = settings.maxRadiusScale * m_sceneExtent;
+        f32 r = numHits > 0u ? (f32)numHits / invDistanceSum : maxRadius;
+        for (u32 channel = 0; channel < 3; ++channel)
+        {
+            rotationalGradient[channel] /= (f32)(M * N);
+            translationalGradient[channel] *= INV_PI;
+            f32 gradientLength = glm::length(translationalGradient[channel]);
+            if (gradientLength > 0.f)
+            {
+                r = Min(r, irradiance[channel] / gradientLength);
+            }
+        }
+
+        outRecord.position = p;
+        outRecord.normal = n;
+        outRecord.irradiance = irradiance;
+        outRecord.r = glm::clamp(r, minRadius, maxRadius);
+        for (u32 channel = 0; channel < 3; ++channel)
+        {
+            outRecord.rotationalGradient[channel] = rotationalGradient[channel];
+            outRecord.translationalGradient[channel] = translationalGradient[channel];
+        }
+        outRecord.next = kInvalidIndex;
+    }
+
+    /**
+    * Descends until the node size is within 2 to 4 times the record radius [Ward 88], missing children are created on
+    * the way. Records outside of the root stay at the root, which is always visited by lookups.
+    */
+    void IrradianceCache::insertRecord(u32 recordIndex)
+    {
+        IrradianceRecord& record = m_records[recordIndex];
+        OctreeNode* node = &m_nodes[m_root];
+        glm::vec3 d = record.position - node->center;
+        f32 halfSize = node->sideLength * .5f;
+        bool bInsideRoot = fabs(d.x) <= halfSize && fabs(d.y) <= halfSize && fabs(d.z) <= halfSize;
+
+        for (u32 depth = 0; bInsideRoot && depth < kMaxDepth && node->sideLength > 4.f * record.r; ++depth)
+        {
+            u32 childSlot = getChildIndex(node->center, record.position);
+            u32 childIndex = node->children[childSlot].load(std::memory_order_acquire);
+            if (childIndex == kInvalidIndex)
+            {
+                f32 childSize = node->sideLength * .5f;
+                u32 newChild = allocNode(node->center + kChildOffsets[childSlot] * childSize, childSize);
+                if (newChild == kInvalidIndex)
+                {
+                    // out of nodes, keep the record at the current level
+                    break;
+                }
+                // on a lost race the other thread's child is used and the new node is simply left unused
+                childIndex = newChild;
+                u32 expected = kInvalidIndex;
+                if (!node->children[childSlot].compare_exchange_strong(expected, newChild, std::memory_order_acq_rel))
+                {
+                    childIndex = expected;
+                }
+            }
+            node = &m_nodes[childIndex];
+        }
+
+        // push onto the node's record list, publishing the fully written record
+        u32 head = node->firstRecord.load(std::memory_order_relaxed);
+        do
+        {
+            record.next = head;
+        } while (!node->firstRecord.compare_exchange_weak(head, recordIndex, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    IrradianceCache::Stats IrradianceCache::getStats() const
+    {
+        Stats stats;
+        for (const auto& workerStats : m_workerStats)
+        {
+            stats.numLookups += workerStats.numLookups.load(std::memory_order_relaxed);
+            stats.numHits += workerStats.numHits.load(std::memory_order_relaxed);
+        }
+        stats.numRecords = m_records.size();
+        stats.numNodes = m_nodes.size();
+        stats.memoryBytes = m_records.getAllocatedBytes() + m_nodes.getAllocatedBytes();
+        return stats;
+    }
+
+    void IrradianceCache::resetStats()
+    {
+        for (auto& workerStats : m_workerStats)
+        {
+            workerStats.numLookups.store(0u);
+            workerStats.numHits.store(0u);
+        }
+    }
+}
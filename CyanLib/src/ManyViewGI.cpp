@@ -130,8 +130,6 @@ namespace Cyan {
     void ManyViewGI::Image::generateHemicubes(Texture2DRenderable* depthBuffer, Texture2DRenderable* normalBuffer) {
         auto renderer = Renderer::get();
 
-        scene->upload();
-
         auto renderTarget = std::unique_ptr<RenderTarget>(createRenderTarget(irradianceRes.x, irradianceRes.y));
         renderTarget->setColorBuffer(position, 0);
         renderTarget->setColorBuffer(normal, 1);
@@ -151,6 +149,8 @@ namespace Cyan {
             gfxc->setDepthControl(DepthControl::kEnable);
             gfxc->setRenderTarget(renderTarget.get());
             gfxc->setViewport({ 0, 0, renderTarget->width, renderTarget->height });
+            // lods are picked for the viewport being rendered
+            scene->upload();
             gfxc->setPixelPipeline(pipeline, [](VertexShader* vs, PixelShader* ps) {
             });
             renderer->submitSceneMultiDrawIndirect(*scene);
@@ -0,0 +1,83 @@
+#include <Windows.h>
+#include <string>
+
+#include "MappedFile.h"
+
+namespace Cyan
+{
+    MappedFile::~MappedFile()
+    {
+        close();
+    }
+
+    bool MappedFile::open(const char* filename)
+    {
+        close();
+        HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            return false;
+        }
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping == nullptr)
+        {
+            CloseHandle(file);
+            return false;
+        }
+        void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if (view == nullptr)
+        {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+        m_file = file;
+        m_mapping = mapping;
+        m_data = reinterpret_cast<const u8*>(view);
+        m_size = (u64)fileSize.QuadPart;
+        return true;
+    }
+
+    void MappedFile::close()
+    {
+        if (m_data != nullptr)
+        {
+            UnmapViewOfFile(m_data);
+            CloseHandle(m_mapping);
+            CloseHandle(m_file);
+        }
+        m_file = nullptr;
+        m_mapping = nullptr;
+        m_data = nullptr;
+        m_size = 0u;
+    }
+
+    void createDirectories(const char* path)
+    {
+        std::string directory(path);
+        for (u32 i = 1; i < directory.size(); ++i)
+        {
+            if (directory[i] == '/' || directory[i] == '\\')
+            {
+                CreateDirectoryA(directory.substr(0, i).c_str(), nullptr);
+            }
+        }
+    }
+
+    bool getFileWriteTime(const char* filename, u64& outWriteTime)
+    {
+        WIN32_FILE_ATTRIBUTE_DATA attributes;
+        if (!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes))
+        {
+            return false;
+        }
+        outWriteTime = ((u64)attributes.ftLastWriteTime.dwHighDateTime << 32) | (u64)attributes.ftLastWriteTime.dwLowDateTime;
+        return true;
+    }
+}
@@ -2,6 +2,7 @@
 #include "CyanAPI.h"
 #include "Material.h"
 #include "AssetManager.h"
+#include "TextureStreamer.h"
 
 namespace Cyan {
     void Material::renderUI() {
@@ -38,6 +39,15 @@ namespace Cyan {
                 glMakeTextureHandleResidentARB(matl.occlusionMap);
             }
         }
+        // streamed textures keep their handles, their lookups are clamped to whatever mips are resident
+        if (TextureStreamer* streamer = TextureStreamer::get()) {
+            matl.residencySlots = glm::uvec4(
+                streamer->getResidencySlot(albedoMap),
+                streamer->getResidencySlot(normalMap),
+                streamer->getResidencySlot(metallicRoughnessMap),
+                streamer->getResidencySlot(occlusionMap)
+            );
+        }
         matl.albedo = albedo;
         matl.metallic = metallic;
         matl.roughness = roughness;
@@ -0,0 +1,304 @@
+#include <fstream>
+
+#include "MeshCache.h"
+#include "Hash.h"
+#include "MappedFile.h"
+#include "MathUtils.h"
+
+namespace Cyan
+{
+    static_assert(sizeof(MeshCache::FileHeader) == 64, "Mesh cache header has to be 64 bytes");
+    static_assert(sizeof(MeshCache::SubmeshRecord) == 64, "Mesh cache submesh records have to be 64 bytes");
+    static_assert(sizeof(MeshCache::LodRecord) == 16, "Mesh cache lod records have to be 16 bytes");
+
+    // arrays of one submesh to write out, pointing into the submesh
+    struct SubmeshArrays
+    {
+        const void* vertices = nullptr;
+        const void* indices = nullptr;
+        std::vector<const std::vector<u32>*> lodIndices;
+        std::vector<f32> lodErrors;
+    };
+
+    static u64 alignOffset(u64 offset)
+    {
+        return (offset + MeshCache::kArrayAlignment - 1u) & ~(u64)(MeshCache::kArrayAlignment - 1u);
+    }
+
+    template <typename Geometry>
+    static ISubmesh* loadSubmesh(const u8* fileData, const MeshCache::SubmeshRecord& record, const MeshCache::LodRecord* lodTable)
+    {
+        using Vertex = typename Geometry::Vertex;
+        const Vertex* vertices = reinterpret_cast<const Vertex*>(fileData + record.vertexOffset);
+        const u32* indices = reinterpret_cast<const u32*>(fileData + record.indexOffset);
+        auto submesh = new Mesh::Submesh<Geometry>(
+            std::vector<Vertex>(vertices, vertices + record.numVertices),
+            std::vector<u32>(indices, indices + record.numIndices),
+            glm::vec3(record.aabbMin[0], record.aabbMin[1], record.aabbMin[2]),
+            glm::vec3(record.aabbMax[0], record.aabbMax[1], record.aabbMax[2])
+        );
+        std::vector<MeshLod> lods(record.numLods);
+        for (u32 l = 0; l < record.numLods; ++l)
+        {
+            const MeshCache::LodRecord& lodRecord = lodTable[record.firstLod + l];
+            const u32* lodIndices = reinterpret_cast<const u32*>(fileData + lodRecord.indexOffset);
+            lods[l].indices.assign(lodIndices, lodIndices + lodRecord.numIndices);
+            lods[l].error = lodRecord.error;
+        }
+        submesh->setLods(std::move(lods));
+        return submesh;
+    }
+
+    // fills in everything but the offsets, returns the submesh's arrays
+    template <typename Geometry>
+    static bool describeSubmesh(ISubmesh* submesh, MeshCache::SubmeshRecord& outRecord, SubmeshArrays& outArrays)
+    {
+        auto typedSubmesh = dynamic_cast<Mesh::Submesh<Geometry>*>(submesh);
+        if (typedSubmesh == nullptr)
+        {
+            return false;
+        }
+        glm::vec3 pmin = typedSubmesh->getMin(), pmax = typedSubmesh->getMax();
+        outRecord.geometryType = (u32)Geometry::getTypeEnum();
+        outRecord.vertexSize = sizeof(typename Geometry::Vertex);
+        outRecord.numVertices = typedSubmesh->numVertices();
+        outRecord.numIndices = typedSubmesh->numIndices();
+        for (u32 i = 0; i < 3; ++i)
+        {
+            outRecord.aabbMin[i] = pmin[i];
+            outRecord.aabbMax[i] = pmax[i];
+        }
+        outRecord.numLods = typedSubmesh->numLods() - 1u;
+        outArrays.vertices = typedSubmesh->getVertices().data();
+        outArrays.indices = typedSubmesh->getIndices().data();
+        for (u32 l = 1u; l < typedSubmesh->numLods(); ++l)
+        {
+            outArrays.lodIndices.push_back(&typedSubmesh->getLodIndices(l));
+            outArrays.lodErrors.push_back(typedSubmesh->getLodError(l));
+        }
+        return true;
+    }
+
+    MeshCache::Source::Source(const char* filename, const std::vector<std::string>& referencedFilenames)
+        : m_filename(filename), m_referencedFilenames(referencedFilenames)
+    {
+    }
+
+    bool MeshCache::Source::getWriteTime(u64& outWriteTime) const
+    {
+        std::vector<u64> writeTimes(1u + m_referencedFilenames.size());
+        if (!getFileWriteTime(m_filename.c_str(), writeTimes[0]))
+        {
+            return false;
+        }
+        for (u32 i = 0; i < m_referencedFilenames.size(); ++i)
+        {
+            if (!getFileWriteTime(m_referencedFilenames[i].c_str(), writeTimes[i + 1u]))
+            {
+                return false;
+            }
+        }
+        outWriteTime = (writeTimes.size() > 1u) ? hashBytes(writeTimes.data(), writeTimes.size() * sizeof(u64)) : writeTimes[0];
+        return true;
+    }
+
+    bool MeshCache::Source::getContentHash(u64& outSize, u64& outHash) const
+    {
+        std::call_once(m_hashFlag, [this]() {
+            // size and hash of every file in turn, hashed together
+            std::vector<u64> fileHashes;
+            std::vector<const std::string*> filenames = { &m_filename };
+            for (const std::string& referencedFilename : m_referencedFilenames)
+            {
+                filenames.push_back(&referencedFilename);
+            }
+            u64 size = 0u;
+            for (const std::string* filename : filenames)
+            {
+                MappedFile file;
+                if (!file.open(filename->c_str()))
+                {
+                    return;
+                }
+                size += file.getSize();
+                fileHashes.push_back(file.getSize());
+                fileHashes.push_back(hashBytes(file.getData(), file.getSize()));
+            }
+            m_size = size;
+            m_hash = (fileHashes.size() > 2u) ? hashBytes(fileHashes.data(), fileHashes.size() * sizeof(u64)) : fileHashes[1];
+            m_bHashed = true;
+        });
+        outSize = m_size;
+        outHash = m_hash;
+        return m_bHashed;
+    }
+
+    MeshCache::MeshCache(const char* directory)
+        : m_directory(directory)
+    {
+        if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+        {
+            m_directory.push_back('/');
+        }
+    }
+
+    std::string MeshCache::getFilename(const char* sourceFilename, const char* meshName) const
+    {
+        std::string key = std::string(sourceFilename) + '#' + meshName;
+        char name[32];
+        sprintf_s(name, "%016llx.cyanmesh", (unsigned long long)hashBytes(key.data(), key.size()));
+        return m_directory + name;
+    }
+
+    bool MeshCache::load(const Source& source, const char* meshName, std::vector<ISubmesh*>& outSubmeshes) const
+    {
+        std::string filename = getFilename(source.getFilename().c_str(), meshName);
+        MappedFile file;
+        if (!file.open(filename.c_str()) || file.getSize() < sizeof(FileHeader))
+        {
+            return false;
+        }
+        const FileHeader& header = *reinterpret_cast<const FileHeader*>(file.getData());
+        if (header.magic != kFileMagic || header.version != kFileVersion)
+        {
+            return false;
+        }
+        u64 sourceWriteTime = 0u;
+        if (!source.getWriteTime(sourceWriteTime))
+        {
+            return false;
+        }
+        // a touched or freshly checked out source with the same content doesn't need to be imported again
+        if (sourceWriteTime != header.sourceWriteTime)
+        {
+            u64 sourceSize = 0u, sourceHash = 0u;
+            if (!source.getContentHash(sourceSize, sourceHash) || sourceSize != header.sourceSize || sourceHash != header.sourceHash)
+            {
+                return false;
+            }
+        }
+
+        const SubmeshRecord* records = reinterpret_cast<const SubmeshRecord*>(file.getData() + sizeof(FileHeader));
+        const LodRecord* lodTable = reinterpret_cast<const LodRecord*>(records + header.numSubmeshes);
+        u64 lodTableOffset = sizeof(FileHeader) + (u64)header.numSubmeshes * sizeof(SubmeshRecord);
+        if (file.getSize() < lodTableOffset)
+        {
+            cyanError("Mesh cache file %s is truncated", filename.c_str());
+            return false;
+        }
+        for (u32 i = 0; i < header.numSubmeshes; ++i)
+        {
+            const SubmeshRecord& record = records[i];
+            bool bInBounds = record.vertexOffset + (u64)record.numVertices * record.vertexSize <= file.getSize()
+                && record.indexOffset + (u64)record.numIndices * sizeof(u32) <= file.getSize()
+                && lodTableOffset + ((u64)record.firstLod + record.numLods) * sizeof(LodRecord) <= file.getSize();
+            for (u32 l = 0; bInBounds && l < record.numLods; ++l)
+            {
+                const LodRecord& lodRecord = lodTable[record.firstLod + l];
+                bInBounds = lodRecord.indexOffset + (u64)lodRecord.numIndices * sizeof(u32) <= file.getSize();
+            }
+            bool bTriangles = record.geometryType == (u32)Triangles::getTypeEnum() && record.vertexSize == sizeof(Triangles::Vertex);
+            bool bLines = record.geometryType == (u32)Lines::getTypeEnum() && record.vertexSize == sizeof(Lines::Vertex);
+            if (!bInBounds || !(bTriangles || bLines))
+            {
+                cyanError("Mesh cache file %s is corrupted", filename.c_str());
+                return false;
+            }
+        }
+
+        outSubmeshes.clear();
+        for (u32 i = 0; i < header.numSubmeshes; ++i)
+        {
+            if (records[i].geometryType == (u32)Triangles::getTypeEnum())
+            {
+                outSubmeshes.push_back(loadSubmesh<Triangles>(file.getData(), records[i], lodTable));
+            }
+            else
+            {
+                outSubmeshes.push_back(loadSubmesh<Lines>(file.getData(), records[i], lodTable));
+            }
+        }
+        return true;
+    }
+
+    bool MeshCache::save(const Source& source, const char* meshName, const std::vector<ISubmesh*>& submeshes) const
+    {
+        FileHeader header = { };
+        header.magic = kFileMagic;
+        header.version = kFileVersion;
+        header.numSubmeshes = (u32)submeshes.size();
+        if (!source.getWriteTime(header.sourceWriteTime) || !source.getContentHash(header.sourceSize, header.sourceHash))
+        {
+            return false;
+        }
+
+        std::vector<SubmeshRecord> records(submeshes.size());
+        std::vector<SubmeshArrays> arrays(submeshes.size());
+        std::vector<LodRecord> lodTable;
+        glm::vec3 aabbMin(FLT_MAX), aabbMax(-FLT_MAX);
+        for (u32 i = 0; i < submeshes.size(); ++i)
+        {
+            SubmeshRecord& record = records[i];
+            record = { };
+            if (!describeSubmesh<Triangles>(submeshes[i], record, arrays[i]) && !describeSubmesh<Lines>(submeshes[i], record, arrays[i]))
+            {
+                return false;
+            }
+            record.firstLod = (u32)lodTable.size();
+            lodTable.resize(lodTable.size() + record.numLods);
+        }
+        u64 offset = sizeof(FileHeader) + records.size() * sizeof(SubmeshRecord) + lodTable.size() * sizeof(LodRecord);
+        for (u32 i = 0; i < submeshes.size(); ++i)
+        {
+            SubmeshRecord& record = records[i];
+            record.vertexOffset = alignOffset(offset);
+            record.indexOffset = alignOffset(record.vertexOffset + (u64)record.numVertices * record.vertexSize);
+            offset = record.indexOffset + (u64)record.numIndices * sizeof(u32);
+            for (u32 l = 0; l < record.numLods; ++l)
+            {
+                LodRecord& lodRecord = lodTable[record.firstLod + l];
+                lodRecord.indexOffset = alignOffset(offset);
+                lodRecord.numIndices = (u32)arrays[i].lodIndices[l]->size();
+                lodRecord.error = arrays[i].lodErrors[l];
+                offset = lodRecord.indexOffset + (u64)lodRecord.numIndices * sizeof(u32);
+            }
+            aabbMin = vec3Min(aabbMin, submeshes[i]->getMin());
+            aabbMax = vec3Max(aabbMax, submeshes[i]->getMax());
+        }
+        for (u32 i = 0; i < 3; ++i)
+        {
+            header.aabbMin[i] = aabbMin[i];
+            header.aabbMax[i] = aabbMax[i];
+        }
+
+        createDirectories(m_directory.c_str());
+        std::string filename = getFilename(source.getFilename().c_str(), meshName);
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            cyanError("Failed to open %s for writing mesh cache", filename.c_str());
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(SubmeshRecord));
+        file.write(reinterpret_cast<const char*>(lodTable.data()), lodTable.size() * sizeof(LodRecord));
+        const char padding[kArrayAlignment] = { };
+        u64 written = sizeof(FileHeader) + records.size() * sizeof(SubmeshRecord) + lodTable.size() * sizeof(LodRecord);
+        auto writeArray = [&file, &padding, &written](u64 offset, const void* data, u64 numBytes) {
+            file.write(padding, offset - written);
+            file.write(reinterpret_cast<const char*>(data), numBytes);
+            written = offset + numBytes;
+        };
+        for (u32 i = 0; i < records.size(); ++i)
+        {
+            writeArray(records[i].vertexOffset, arrays[i].vertices, (u64)records[i].numVertices * records[i].vertexSize);
+            writeArray(records[i].indexOffset, arrays[i].indices, (u64)records[i].numIndices * sizeof(u32));
+            for (u32 l = 0; l < records[i].numLods; ++l)
+            {
+                const LodRecord& lodRecord = lodTable[records[i].firstLod + l];
+                writeArray(lodRecord.indexOffset, arrays[i].lodIndices[l]->data(), (u64)lodRecord.numIndices * sizeof(u32));
+            }
+        }
+        return file.good();
+    }
+}
@@ -0,0 +1,931 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+#include "MeshOptimizer.h"
+#include "Hash.h"
+#include "MathUtils.h"
+
+namespace Cyan
+{
+    /**
+    * Fifo vertex cache simulated with timestamps, a vertex stays cached until 'cacheSize' other vertices missed after it
+    */
+    class VertexCacheSimulator
+    {
+    public:
+        VertexCacheSimulator(u32 numVertices, u32 cacheSize)
+            : m_timestamps(numVertices, 0u), m_time(cacheSize + 1u), m_cacheSize(cacheSize)
+        {
+        }
+
+        // returns the number of vertices of the triangle that had to be transformed
+        u32 accessTriangle(const u32* triangle)
+        {
+            u32 numMisses = 0u;
+            for (u32 i = 0; i < 3; ++i)
+            {
+                if (m_time - m_timestamps[triangle[i]] > m_cacheSize)
+                {
+                    m_timestamps[triangle[i]] = m_time++;
+                    numMisses++;
+                }
+            }
+            return numMisses;
+        }
+
+        void flush()
+        {
+            m_time += m_cacheSize + 1u;
+        }
+
+    private:
+        std::vector<u32> m_timestamps;
+        u32 m_time;
+        u32 m_cacheSize;
+    };
+
+    struct WeldKey
+    {
+        // position, normal, tangent, texCoord0 and texCoord1
+        i32 values[14];
+
+        bool operator==(const WeldKey& rhs) const
+        {
+            return memcmp(values, rhs.values, sizeof(values)) == 0;
+        }
+    };
+
+    struct WeldKeyHash
+    {
+        size_t operator()(const WeldKey& key) const
+        {
+            return (size_t)hashBytes(key.values, sizeof(key.values));
+        }
+    };
+
+    struct PositionKey
+    {
+        u32 bits[3];
+
+        // adding 0 turns -0 into 0 so that both end up with the same key
+        explicit PositionKey(const glm::vec3& position)
+        {
+            glm::vec3 p = position + glm::vec3(0.f);
+            memcpy(bits, &p.x, sizeof(bits));
+        }
+
+        bool operator==(const PositionKey& rhs) const
+        {
+            return memcmp(bits, rhs.bits, sizeof(bits)) == 0;
+        }
+    };
+
+    struct PositionKeyHash
+    {
+        size_t operator()(const PositionKey& key) const
+        {
+            return (size_t)hashBytes(key.bits, sizeof(key.bits));
+        }
+    };
+
+    /**
+    * Sum of squared distances to a set of weighted planes, stored as the upper half of a symmetric 4x4 matrix
+    */
+    struct Quadric
+    {
+        f32 a2 = 0.f, b2 = 0.f, c2 = 0.f, d2 = 0.f;
+        f32 ab = 0.f, ac = 0.f, ad = 0.f, bc = 0.f, bd = 0.f, cd = 0.f;
+        f32 weight = 0.f;
+
+        void addPlane(const glm::vec3& normal, f32 d, f32 inWeight)
+        {
+            a2 += normal.x * normal.x * inWeight;
+            b2 += normal.y * normal.y * inWeight;
+            c2 += normal.z * normal.z * inWeight;
+            d2 += d * d * inWeight;
+            ab += normal.x * normal.y * inWeight;
+            ac += normal.x * normal.z * inWeight;
+            ad += normal.x * d * inWeight;
+            bc += normal.y * normal.z * inWeight;
+            bd += normal.y * d * inWeight;
+            cd += normal.z * d * inWeight;
+            weight += inWeight;
+        }
+
+        void add(const Quadric& rhs)
+        {
+            a2 += rhs.a2; b2 += rhs.b2; c2 += rhs.c2; d2 += rhs.d2;
+            ab += rhs.ab; ac += rhs.ac; ad += rhs.ad; bc += rhs.bc; bd += rhs.bd; cd += rhs.cd;
+            weight += rhs.weight;
+        }
+
+        // weighted mean of the squared distances from 'p' to every plane
+        f32 evaluate(const glm::vec3& p) const
+        {
+            f32 error = a2 * p.x * p.x + b2 * p.y * p.y + c2 * p.z * p.z + d2
+                + 2.f * (ab * p.x * p.y + ac * p.x * p.z + ad * p.x + bc * p.y * p.z + bd * p.y + cd * p.z);
+            return (weight > 0.f) ? fabsf(error) / weight : 0.f;
+        }
+    };
+
+    // an edge between two vertex groups and one of the triangles it belongs to
+    struct MeshEdge
+    {
+        u64 key;
+        u32 triangle;
+
+        bool operator<(const MeshEdge& rhs) const { return key < rhs.key; }
+    };
+
+    static u64 makeEdgeKey(u32 a, u32 b)
+    {
+        return (a < b) ? (((u64)a << 32) | b) : (((u64)b << 32) | a);
+    }
+
+    /**
+    * Collects every edge of the triangles in 'indices' between the vertex groups their corners belong to, sorted so that
+    * the triangles sharing an edge are adjacent
+    */
+    static void collectEdges(const std::vector<u32>& indices, const std::vector<u32>& groups, std::vector<MeshEdge>& outEdges)
+    {
+        outEdges.resize(indices.size());
+        for (u32 t = 0; t < (u32)indices.size() / 3u; ++t)
+        {
+            for (u32 i = 0; i < 3; ++i)
+            {
+                u32 a = groups[indices[t * 3u + i]], b = groups[indices[t * 3u + (i + 1u) % 3u]];
+                outEdges[t * 3u + i] = { makeEdgeKey(a, b), t };
+            }
+        }
+        std::sort(outEdges.begin(), outEdges.end());
+    }
+
+    enum class VertexKind : u8
+    {
+        kManifold = 0,
+        // on exactly one open border, may only slide along it
+        kBorder,
+        // on a non manifold edge or on more than one border, never moves
+        kLocked
+    };
+
+    static i32 quantize(f32 value, f32 invEpsilon)
+    {
+        // clamped to the largest floats that still fit into an i32
+        f32 quantized = floorf(value * invEpsilon + .5f);
+        quantized = Max(quantized, -2147483520.f);
+        quantized = Min(quantized, 2147483520.f);
+        return (i32)quantized;
+    }
+
+    MeshOptimizer::Report MeshOptimizer::optimize(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices, const Settings& settings)
+    {
+        Report report = { };
+        if (indices.empty() && vertices.size() % 3 == 0)
+        {
+            indices.resize(vertices.size());
+            for (u32 i = 0; i < (u32)indices.size(); ++i)
+            {
+                indices[i] = i;
+            }
+        }
+        if (vertices.empty() || indices.empty() || indices.size() % 3 != 0)
+        {
+            return report;
+        }
+        for (u32 index : indices)
+        {
+            if (index >= (u32)vertices.size())
+            {
+                cyanError("Mesh references vertex %u out of %u, skipped optimizing it", index, (u32)vertices.size());
+                return report;
+            }
+        }
+        report.numVerticesBefore = (u32)vertices.size();
+        report.numTrianglesBefore = (u32)indices.size() / 3u;
+        report.before = analyzeVertexCache(indices, (u32)vertices.size(), settings.cacheSize);
+
+        weldVertices(vertices, indices, settings.positionWeldEpsilon, settings.attributeWeldEpsilon);
+        std::vector<u32> clusters;
+        optimizeVertexCache(indices, (u32)vertices.size(), settings.cacheSize, &clusters);
+        optimizeOverdraw(indices, vertices, clusters, settings.cacheSize, settings.overdrawThreshold);
+        optimizeVertexFetch(vertices, indices);
+
+        report.numVerticesAfter = (u32)vertices.size();
+        report.numTrianglesAfter = (u32)indices.size() / 3u;
+        report.after = analyzeVertexCache(indices, (u32)vertices.size(), settings.cacheSize);
+        return report;
+    }
+
+    u32 MeshOptimizer::weldVertices(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices, f32 positionEpsilon, f32 attributeEpsilon)
+    {
+        if (vertices.empty())
+        {
+            return 0u;
+        }
+        glm::vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+        for (const auto& vertex : vertices)
+        {
+            pmin = vec3Min(pmin, vertex.pos);
+            pmax = vec3Max(pmax, vertex.pos);
+        }
+        glm::vec3 extent = pmax - pmin;
+        f32 maxExtent = Max(Max(extent.x, extent.y), extent.z);
+        // positions are quantized relative to the mesh's corner so that meshes far away from the origin don't overflow
+        f32 invPositionEpsilon = 1.f / Max(positionEpsilon * maxExtent, FLT_MIN);
+        f32 invAttributeEpsilon = 1.f / attributeEpsilon;
+
+        std::unordered_map<WeldKey, u32, WeldKeyHash> weldedVertices;
+        weldedVertices.reserve(vertices.size());
+        std::vector<u32> remap(vertices.size());
+        u32 numWelded = 0u;
+        for (u32 v = 0; v < (u32)vertices.size(); ++v)
+        {
+            const Triangles::Vertex& vertex = vertices[v];
+            glm::vec3 pos = vertex.pos - pmin;
+            WeldKey key = {
+                quantize(pos.x, invPositionEpsilon), quantize(pos.y, invPositionEpsilon), quantize(pos.z, invPositionEpsilon),
+                quantize(vertex.normal.x, invAttributeEpsilon), quantize(vertex.normal.y, invAttributeEpsilon), quantize(vertex.normal.z, invAttributeEpsilon),
+                quantize(vertex.tangent.x, invAttributeEpsilon), quantize(vertex.tangent.y, invAttributeEpsilon), quantize(vertex.tangent.z, invAttributeEpsilon), quantize(vertex.tangent.w, invAttributeEpsilon),
+                quantize(vertex.texCoord0.x, invAttributeEpsilon), quantize(vertex.texCoord0.y, invAttributeEpsilon),
+                quantize(vertex.texCoord1.x, invAttributeEpsilon), quantize(vertex.texCoord1.y, invAttributeEpsilon)
+            };
+            auto entry = weldedVertices.insert({ key, numWelded });
+            if (entry.second)
+            {
+                // compacting in place is safe as welded vertices never get ahead of the vertices read
+                vertices[numWelded++] = vertex;
+            }
+            remap[v] = entry.first->second;
+        }
+        vertices.resize(numWelded);
+
+        // drop triangles that collapsed
+        u32 numIndices = 0u;
+        for (u32 i = 0; i + 2u < (u32)indices.size(); i += 3u)
+        {
+            u32 a = remap[indices[i]], b = remap[indices[i + 1u]], c = remap[indices[i + 2u]];
+            if (a != b && b != c && a != c)
+            {
+                indices[numIndices++] = a;
+                indices[numIndices++] = b;
+                indices[numIndices++] = c;
+            }
+        }
+        indices.resize(numIndices);
+        return numWelded;
+    }
+
+    void MeshOptimizer::optimizeVertexCache(std::vector<u32>& indices, u32 numVertices, u32 cacheSize, std::vector<u32>* outClusters)
+    {
+        u32 numTriangles = (u32)indices.size() / 3u;
+        if (numTriangles == 0u)
+        {
+            return;
+        }
+
+        // triangles adjacent to every vertex packed into one array
+        std::vector<u32> adjacencyOffsets(numVertices + 1u, 0u);
+        for (u32 index : indices)
+        {
+            adjacencyOffsets[index + 1u]++;
+        }
+        for (u32 v = 0; v < numVertices; ++v)
+        {
+            adjacencyOffsets[v + 1u] += adjacencyOffsets[v];
+        }
+        std::vector<u32> adjacency(numTriangles * 3u);
+        std::vector<u32> fillOffsets(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (u32 t = 0; t < numTriangles; ++t)
+        {
+            for (u32 i = 0; i < 3; ++i)
+            {
+                adjacency[fillOffsets[indices[t * 3u + i]]++] = t;
+            }
+        }
+
+        std::vector<u32> numLiveTriangles(numVertices);
+        for (u32 v = 0; v < numVertices; ++v)
+        {
+            numLiveTriangles[v] = adjacencyOffsets[v + 1u] - adjacencyOffsets[v];
+        }
+        std::vector<u32> cacheTimestamps(numVertices, 0u);
+        std::vector<u8> emitted(numTriangles, 0u);
+        std::vector<u32> deadEnds;
+        std::vector<u32> candidates;
+        std::vector<u32> output;
+        output.reserve(indices.size());
+        u32 time = cacheSize + 1u;
+        u32 scanCursor = 0u;
+
+        // the most recently emitted vertex that still has triangles left, or else the next one in input order
+        auto skipDeadEnd = [&]() -> i32 {
+            while (!deadEnds.empty())
+            {
+                u32 vertex = deadEnds.back();
+                deadEnds.pop_back();
+                if (numLiveTriangles[vertex] > 0u)
+                {
+                    return (i32)vertex;
+                }
+            }
+            for (; scanCursor < numVertices; ++scanCursor)
+            {
+                if (numLiveTriangles[scanCursor] > 0u)
+                {
+                    return (i32)scanCursor;
+                }
+            }
+            return -1;
+        };
+
+        i32 fanningVertex = skipDeadEnd();
+        bool bNewCluster = true;
+        while (fanningVertex >= 0)
+        {
+            if (bNewCluster && outClusters)
+            {
+                outClusters->push_back((u32)output.size() / 3u);
+            }
+
+            // emit every triangle left around the fanning vertex
+            candidates.clear();
+            for (u32 a = adjacencyOffsets[fanningVertex]; a < adjacencyOffsets[fanningVertex + 1]; ++a)
+            {
+                u32 t = adjacency[a];
+                if (emitted[t])
+                {
+                    continue;
+                }
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    u32 vertex = indices[t * 3u + i];
+                    output.push_back(vertex);
+                    deadEnds.push_back(vertex);
+                    candidates.push_back(vertex);
+                    numLiveTriangles[vertex]--;
+                    if (time - cacheTimestamps[vertex] > cacheSize)
+                    {
+                        cacheTimestamps[vertex] = time++;
+                    }
+                }
+                emitted[t] = 1u;
+            }
+
+            // continue with the oldest candidate that would still be cached after fanning around it
+            i32 nextVertex = -1;
+            i32 bestPriority = -1;
+            for (u32 vertex : candidates)
+            {
+                if (numLiveTriangles[vertex] == 0u)
+                {
+                    continue;
+                }
+                i32 priority = 0;
+                if (time - cacheTimestamps[vertex] + 2u * numLiveTriangles[vertex] <= cacheSize)
+                {
+                    priority = (i32)(time - cacheTimestamps[vertex]);
+                }
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    nextVertex = (i32)vertex;
+                }
+            }
+            bNewCluster = (nextVertex < 0);
+            fanningVertex = bNewCluster ? skipDeadEnd() : nextVertex;
+        }
+        indices.swap(output);
+    }
+
+    void MeshOptimizer::optimizeOverdraw(std::vector<u32>& indices, const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& clusters, u32 cacheSize, f32 threshold)
+    {
+        u32 numTriangles = (u32)indices.size() / 3u;
+        if (numTriangles == 0u || clusters.empty())
+        {
+            return;
+        }
+
+        // split clusters where the cache efficiency is already close to the one of the whole cluster
+        std::vector<u32> softClusters;
+        VertexCacheSimulator cache((u32)vertices.size(), cacheSize);
+        for (u32 c = 0; c < (u32)clusters.size(); ++c)
+        {
+            u32 begin = clusters[c];
+            u32 end = (c + 1u < (u32)clusters.size()) ? clusters[c + 1u] : numTriangles;
+            cache.flush();
+            u32 numClusterMisses = 0u;
+            for (u32 t = begin; t < end; ++t)
+            {
+                numClusterMisses += cache.accessTriangle(&indices[t * 3u]);
+            }
+            f32 maxACMR = (f32)numClusterMisses / (f32)(end - begin) * threshold;
+
+            cache.flush();
+            softClusters.push_back(begin);
+            u32 start = begin, numMisses = 0u;
+            for (u32 t = begin; t + 1u < end; ++t)
+            {
+                numMisses += cache.accessTriangle(&indices[t * 3u]);
+                if ((f32)numMisses <= maxACMR * (f32)(t + 1u - start))
+                {
+                    start = t + 1u;
+                    numMisses = 0u;
+                    softClusters.push_back(start);
+                    cache.flush();
+                }
+            }
+        }
+
+        // area weighted centroid and normal of every cluster
+        u32 numClusters = (u32)softClusters.size();
+        std::vector<glm::vec3> centroids(numClusters, glm::vec3(0.f));
+        std::vector<glm::vec3> normals(numClusters, glm::vec3(0.f));
+        glm::vec3 meshCentroid(0.f);
+        f32 meshArea = 0.f;
+        for (u32 c = 0; c < numClusters; ++c)
+        {
+            u32 end = (c + 1u < numClusters) ? softClusters[c + 1u] : numTriangles;
+            f32 area = 0.f;
+            for (u32 t = softClusters[c]; t < end; ++t)
+            {
+                const glm::vec3& p0 = vertices[indices[t * 3u]].pos;
+                const glm::vec3& p1 = vertices[indices[t * 3u + 1u]].pos;
+                const glm::vec3& p2 = vertices[indices[t * 3u + 2u]].pos;
+                glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+                f32 triangleArea = glm::length(normal);
+                centroids[c] += (p0 + p1 + p2) * (triangleArea / 3.f);
+                normals[c] += normal;
+                area += triangleArea;
+            }
+            meshCentroid += centroids[c];
+            meshArea += area;
+            centroids[c] = (area > 0.f) ? centroids[c] / area : vertices[indices[softClusters[c] * 3u]].pos;
+        }
+        meshCentroid = (meshArea > 0.f) ? meshCentroid / meshArea : meshCentroid;
+
+        // clusters facing away from the center are likely to occlude the rest from any viewpoint
+        std::vector<f32> sortKeys(numClusters, 0.f);
+        for (u32 c = 0; c < numClusters; ++c)
+        {
+            f32 normalLength = glm::length(normals[c]);
+            if (normalLength > 0.f)
+            {
+                sortKeys[c] = glm::dot(centroids[c] - meshCentroid, normals[c] / normalLength);
+            }
+        }
+        std::vector<u32> order(numClusters);
+        for (u32 c = 0; c < numClusters; ++c)
+        {
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&sortKeys](u32 lhs, u32 rhs) { return sortKeys[lhs] > sortKeys[rhs]; });
+
+        std::vector<u32> output;
+        output.reserve(indices.size());
+        for (u32 c : order)
+        {
+            u32 end = (c + 1u < numClusters) ? softClusters[c + 1u] : numTriangles;
+            output.insert(output.end(), indices.begin() + softClusters[c] * 3u, indices.begin() + end * 3u);
+        }
+        indices.swap(output);
+    }
+
+    void MeshOptimizer::optimizeVertexFetch(std::vector<Triangles::Vertex>& vertices, std::vector<u32>& indices)
+    {
+        const u32 kUnassigned = ~0u;
+        std::vector<u32> remap(vertices.size(), kUnassigned);
+        std::vector<Triangles::Vertex> reordered;
+        reordered.reserve(vertices.size());
+        for (u32& index : indices)
+        {
+            if (remap[index] == kUnassigned)
+            {
+                remap[index] = (u32)reordered.size();
+                reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(reordered);
+    }
+
+    f32 MeshOptimizer::simplify(const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& indices, u32 targetNumIndices, f32 maxError, std::vector<u32>& outIndices)
+    {
+        const f32 kBorderWeight = 10.f;
+        const u32 kMaxNumPasses = 128u;
+        outIndices = indices;
+        u32 numVertices = (u32)vertices.size();
+        if (outIndices.size() <= targetNumIndices || numVertices == 0u)
+        {
+            return 0.f;
+        }
+
+        // vertices at the same position are only split by attribute seams, such a group collapses as a whole
+        std::vector<u32> groups(numVertices);
+        {
+            std::unordered_map<PositionKey, u32, PositionKeyHash> positionGroups;
+            positionGroups.reserve(numVertices);
+            for (u32 v = 0; v < numVertices; ++v)
+            {
+                groups[v] = positionGroups.insert({ PositionKey(vertices[v].pos), v }).first->second;
+            }
+        }
+        // positions relative to the mesh's center keep the quadrics precise
+        glm::vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+        for (const auto& vertex : vertices)
+        {
+            pmin = vec3Min(pmin, vertex.pos);
+            pmax = vec3Max(pmax, vertex.pos);
+        }
+        glm::vec3 center = (pmin + pmax) * .5f;
+        std::vector<glm::vec3> positions(numVertices);
+        for (u32 v = 0; v < numVertices; ++v)
+        {
+            positions[v] = vertices[v].pos - center;
+        }
+
+        auto removeDegenerateTriangles = [&groups](std::vector<u32>& triangles) {
+            u32 numIndices = 0u;
+            for (u32 i = 0; i + 2u < (u32)triangles.size(); i += 3u)
+            {
+                u32 a = triangles[i], b = triangles[i + 1u], c = triangles[i + 2u];
+                if (groups[a] != groups[b] && groups[b] != groups[c] && groups[a] != groups[c])
+                {
+                    triangles[numIndices++] = a;
+                    triangles[numIndices++] = b;
+                    triangles[numIndices++] = c;
+                }
+            }
+            triangles.resize(numIndices);
+        };
+        auto calcTriangleNormal = [&positions, &outIndices](u32 t) {
+            const glm::vec3& p0 = positions[outIndices[t * 3u]];
+            return glm::cross(positions[outIndices[t * 3u + 1u]] - p0, positions[outIndices[t * 3u + 2u]] - p0);
+        };
+        removeDegenerateTriangles(outIndices);
+
+        // quadrics of the planes of the triangles around every group, area weighted, plus planes perpendicular to open
+        // borders that keep borders from shrinking
+        std::vector<Quadric> quadrics(numVertices);
+        std::vector<MeshEdge> edges;
+        for (u32 t = 0; t < (u32)outIndices.size() / 3u; ++t)
+        {
+            glm::vec3 normal = calcTriangleNormal(t);
+            f32 length = glm::length(normal);
+            if (length > 0.f)
+            {
+                normal /= length;
+                f32 d = -glm::dot(normal, positions[outIndices[t * 3u]]);
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    quadrics[groups[outIndices[t * 3u + i]]].addPlane(normal, d, length * .5f);
+                }
+            }
+        }
+        collectEdges(outIndices, groups, edges);
+        for (u32 e = 0; e < (u32)edges.size(); )
+        {
+            u32 end = e + 1u;
+            for (; end < (u32)edges.size() && edges[end].key == edges[e].key; ++end) { }
+            if (end - e == 1u)
+            {
+                u32 a = (u32)(edges[e].key >> 32), b = (u32)(edges[e].key & 0xFFFFFFFFu);
+                glm::vec3 edge = positions[b] - positions[a];
+                glm::vec3 normal = glm::cross(edge, calcTriangleNormal(edges[e].triangle));
+                f32 length = glm::length(normal);
+                if (length > 0.f)
+                {
+                    normal /= length;
+                    f32 d = -glm::dot(normal, positions[a]);
+                    quadrics[a].addPlane(normal, d, glm::dot(edge, edge) * kBorderWeight);
+                    quadrics[b].addPlane(normal, d, glm::dot(edge, edge) * kBorderWeight);
+                }
+            }
+            e = end;
+        }
+
+        struct Collapse
+        {
+            u32 from;
+            u32 to;
+            f32 cost;
+        };
+        std::vector<Collapse> collapses;
+        std::vector<u32> adjacencyOffsets, adjacency, fillOffsets;
+        std::vector<VertexKind> kinds(numVertices);
+        std::vector<u32> numBorderEdges(numVertices);
+        std::vector<u8> groupLocked(numVertices);
+        std::vector<u32> wedgeRemap(numVertices);
+        std::vector<u32> remappedWedges, fromNeighbors, toNeighbors;
+        f32 maxCost = maxError * maxError;
+        f32 resultCost = 0.f;
+
+        /**
+        * Checks whether 'from' can collapse onto 'to' and if so, remaps every wedge of 'from' to the wedge of 'to' it shares
+        * a removed triangle with
+        */
+        auto tryCollapse = [&](u32 from, u32 to, u32& outNumRemoved) {
+            remappedWedges.clear();
+            fromNeighbors.clear();
+            toNeighbors.clear();
+            outNumRemoved = 0u;
+            bool bValid = true;
+            for (u32 a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1u] && bValid; ++a)
+            {
+                u32 t = adjacency[a];
+                u32 fromCorner = 0u, toCorner = 3u;
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    u32 group = groups[outIndices[t * 3u + i]];
+                    if (group == from)
+                    {
+                        fromCorner = i;
+                    }
+                    else if (group == to)
+                    {
+                        toCorner = i;
+                    }
+                    else
+                    {
+                        fromNeighbors.push_back(group);
+                    }
+                }
+                if (toCorner < 3u)
+                {
+                    u32 wedge = outIndices[t * 3u + fromCorner], partner = outIndices[t * 3u + toCorner];
+                    if (wedgeRemap[wedge] == wedge)
+                    {
+                        wedgeRemap[wedge] = partner;
+                        remappedWedges.push_back(wedge);
+                    }
+                    // the same wedge continuing as two different ones of 'to' would need a seam that isn't there
+                    bValid = (wedgeRemap[wedge] == partner);
+                    outNumRemoved++;
+                }
+                else
+                {
+                    glm::vec3 p[3] = { positions[outIndices[t * 3u]], positions[outIndices[t * 3u + 1u]], positions[outIndices[t * 3u + 2u]] };
+                    glm::vec3 normalBefore = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    p[fromCorner] = positions[to];
+                    glm::vec3 normalAfter = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    bValid = (glm::dot(normalBefore, normalAfter) > 0.f || glm::dot(normalBefore, normalBefore) == 0.f);
+                }
+            }
+            // every wedge of 'from' has to continue as a wedge of 'to', otherwise the collapse would tear a seam open
+            for (u32 a = adjacencyOffsets[from]; a < adjacencyOffsets[from + 1u] && bValid; ++a)
+            {
+                u32 t = adjacency[a];
+                for (u32 i = 0; i < 3; ++i)
+                {
+                    u32 wedge = outIndices[t * 3u + i];
+                    bValid = bValid && (groups[wedge] != from || wedgeRemap[wedge] != wedge);
+                }
+            }
+            // link condition, the only neighbors both share may be the ones opposite the edge, or else the collapse
+            // would fold the surface onto itself
+            if (bValid)
+            {
+                for (u32 a = adjacencyOffsets[to]; a < adjacencyOffsets[to + 1u]; ++a)
+                {
+                    for (u32 i = 0; i < 3; ++i)
+                    {
+                        u32 group = groups[outIndices[adjacency[a] * 3u + i]];
+                        if (group != to && group != from)
+                        {
+                            toNeighbors.push_back(group);
+                        }
+                    }
+                }
+                std::sort(fromNeighbors.begin(), fromNeighbors.end());
+                fromNeighbors.erase(std::unique(fromNeighbors.begin(), fromNeighbors.end()), fromNeighbors.end());
+                std::sort(toNeighbors.begin(), toNeighbors.end());
+                toNeighbors.erase(std::unique(toNeighbors.begin(), toNeighbors.end()), toNeighbors.end());
+                u32 numShared = 0u;
+                for (u32 i = 0u, j = 0u; i < (u32)fromNeighbors.size() && j < (u32)toNeighbors.size(); )
+                {
+                    if (fromNeighbors[i] == toNeighbors[j])
+                    {
+                        numShared++;
+                        i++;
+                        j++;
+                    }
+                    else if (fromNeighbors[i] < toNeighbors[j])
+                    {
+                        i++;
+                    }
+                    else
+                    {
+                        j++;
+                    }
+                }
+                bValid = (numShared <= outNumRemoved);
+            }
+            if (!bValid)
+            {
+                for (u32 wedge : remappedWedges)
+                {
+                    wedgeRemap[wedge] = wedge;
+                }
+            }
+            return bValid;
+        };
+
+        for (u32 pass = 0; pass < kMaxNumPasses && outIndices.size() > targetNumIndices; ++pass)
+        {
+            u32 numTriangles = (u32)outIndices.size() / 3u;
+
+            // triangles around every group
+            adjacencyOffsets.assign(numVertices + 1u, 0u);
+            for (u32 index : outIndices)
+            {
+                adjacencyOffsets[groups[index] + 1u]++;
+            }
+            for (u32 v = 0; v < numVertices; ++v)
+            {
+                adjacencyOffsets[v + 1u] += adjacencyOffsets[v];
+            }
+            adjacency.resize(outIndices.size());
+            fillOffsets.assign(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (u32 i = 0; i < (u32)outIndices.size(); ++i)
+            {
+                adjacency[fillOffsets[groups[outIndices[i]]]++] = i / 3u;
+            }
+
+            // classify groups by the edges around them
+            collectEdges(outIndices, groups, edges);
+            std::fill(kinds.begin(), kinds.end(), VertexKind::kManifold);
+            std::fill(numBorderEdges.begin(), numBorderEdges.end(), 0u);
+            for (u32 e = 0; e < (u32)edges.size(); )
+            {
+                u32 end = e + 1u;
+                for (; end < (u32)edges.size() && edges[end].key == edges[e].key; ++end) { }
+                u32 a = (u32)(edges[e].key >> 32), b = (u32)(edges[e].key & 0xFFFFFFFFu);
+                if (end - e == 1u)
+                {
+                    numBorderEdges[a]++;
+                    numBorderEdges[b]++;
+                }
+                else if (end - e > 2u)
+                {
+                    kinds[a] = VertexKind::kLocked;
+                    kinds[b] = VertexKind::kLocked;
+                }
+                e = end;
+            }
+            for (u32 v = 0; v < numVertices; ++v)
+            {
+                if (kinds[v] == VertexKind::kManifold && numBorderEdges[v] > 0u)
+                {
+                    kinds[v] = (numBorderEdges[v] == 2u) ? VertexKind::kBorder : VertexKind::kLocked;
+                }
+            }
+
+            // the cheaper direction of every edge that can collapse at all
+            collapses.clear();
+            for (u32 e = 0; e < (u32)edges.size(); )
+            {
+                u32 end = e + 1u;
+                for (; end < (u32)edges.size() && edges[end].key == edges[e].key; ++end) { }
+                bool bBorderEdge = (end - e == 1u);
+                u32 a = (u32)(edges[e].key >> 32), b = (u32)(edges[e].key & 0xFFFFFFFFu);
+                Collapse best = { 0u, 0u, FLT_MAX };
+                for (u32 direction = 0; direction < 2u && end - e <= 2u; ++direction)
+                {
+                    u32 from = (direction == 0u) ? a : b, to = (direction == 0u) ? b : a;
+                    // border vertices may only slide along their border
+                    if (kinds[from] == VertexKind::kLocked || (kinds[from] == VertexKind::kBorder && !bBorderEdge))
+                    {
+                        continue;
+                    }
+                    Quadric quadric = quadrics[from];
+                    quadric.add(quadrics[to]);
+                    f32 cost = quadric.evaluate(positions[to]);
+                    if (cost < best.cost)
+                    {
+                        best = { from, to, cost };
+                    }
+                }
+                if (best.cost <= maxCost)
+                {
+                    collapses.push_back(best);
+                }
+                e = end;
+            }
+            if (collapses.empty())
+            {
+                break;
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& lhs, const Collapse& rhs) { return lhs.cost < rhs.cost; });
+
+            // cheapest collapses first, skipping any that touches a triangle another one of this pass already changed
+            std::fill(groupLocked.begin(), groupLocked.end(), 0u);
+            for (u32 v = 0; v < numVertices; ++v)
+            {
+                wedgeRemap[v] = v;
+            }
+            u32 numRemaining = numTriangles, numApplied = 0u;
+            for (const Collapse& collapse : collapses)
+            {
+                if (numRemaining * 3u <= targetNumIndices)
+                {
+                    break;
+                }
+                u32 numRemoved = 0u;
+                if (groupLocked[collapse.from] || groupLocked[collapse.to] || !tryCollapse(collapse.from, collapse.to, numRemoved))
+                {
+                    continue;
+                }
+                groupLocked[collapse.from] = 1u;
+                groupLocked[collapse.to] = 1u;
+                for (u32 neighbor : fromNeighbors)
+                {
+                    groupLocked[neighbor] = 1u;
+                }
+                quadrics[collapse.to].add(quadrics[collapse.from]);
+                resultCost = Max(resultCost, collapse.cost);
+                numRemaining -= numRemoved;
+                numApplied++;
+            }
+            if (numApplied == 0u)
+            {
+                break;
+            }
+            for (u32& index : outIndices)
+            {
+                index = wedgeRemap[index];
+            }
+            removeDegenerateTriangles(outIndices);
+        }
+        return sqrtf(resultCost);
+    }
+
+    std::vector<MeshLod> MeshOptimizer::generateLods(const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& indices, const Settings& settings)
+    {
+        const u32 kMinNumLodTriangles = 16u;
+        std::vector<MeshLod> lods;
+        if (settings.numLods <= 1u || vertices.empty() || indices.empty())
+        {
+            return lods;
+        }
+        glm::vec3 pmin(FLT_MAX), pmax(-FLT_MAX);
+        for (const auto& vertex : vertices)
+        {
+            pmin = vec3Min(pmin, vertex.pos);
+            pmax = vec3Max(pmax, vertex.pos);
+        }
+        glm::vec3 extent = pmax - pmin;
+        f32 maxError = settings.maxLodError * Max(Max(extent.x, extent.y), extent.z);
+
+        // every lod is simplified from the previous one, so their errors add up
+        lods.reserve(settings.numLods - 1u);
+        f32 error = 0.f;
+        for (u32 l = 1u; l < settings.numLods; ++l)
+        {
+            const std::vector<u32>& source = (l == 1u) ? indices : lods.back().indices;
+            u32 targetNumIndices = (u32)((f32)(source.size() / 3u) * settings.lodTriangleRatio) * 3u;
+            if (targetNumIndices < kMinNumLodTriangles * 3u)
+            {
+                break;
+            }
+            MeshLod lod;
+            f32 lodError = simplify(vertices, source, targetNumIndices, maxError - error, lod.indices);
+            // a lod that only gets half way to its target isn't worth switching to
+            if ((f32)lod.indices.size() > (f32)source.size() * (1.f + settings.lodTriangleRatio) * .5f)
+            {
+                break;
+            }
+            error += lodError;
+            lod.error = error;
+            optimizeVertexCache(lod.indices, (u32)vertices.size(), settings.cacheSize);
+            lods.push_back(std::move(lod));
+        }
+        return lods;
+    }
+
+    MeshOptimizer::VertexCacheStatistics MeshOptimizer::analyzeVertexCache(const std::vector<u32>& indices, u32 numVertices, u32 cacheSize)
+    {
+        VertexCacheStatistics statistics;
+        u32 numTriangles = (u32)indices.size() / 3u;
+        if (numTriangles == 0u)
+        {
+            return statistics;
+        }
+        VertexCacheSimulator cache(numVertices, cacheSize);
+        std::vector<u8> referenced(numVertices, 0u);
+        u32 numMisses = 0u, numReferenced = 0u;
+        for (u32 t = 0; t < numTriangles; ++t)
+        {
+            numMisses += cache.accessTriangle(&indices[t * 3u]);
+            for (u32 i = 0; i < 3; ++i)
+            {
+                numReferenced += referenced[indices[t * 3u + i]] ? 0u : 1u;
+                referenced[indices[t * 3u + i]] = 1u;
+            }
+        }
+        statistics.acmr = (f32)numMisses / (f32)numTriangles;
+        statistics.atvr = (f32)numMisses / (f32)numReferenced;
+        return statistics;
+    }
+}
@@ -0,0 +1,373 @@
+#include <cfloat>
+#include <immintrin.h>
+
+#include "RayPacket.h"
+#include "SIMD.h"
+#include "BVH.h"
+
+namespace Cyan
+{
+    static SIMDLevel detectSIMDLevel()
+    {
+        i32 cpuInfo[4] = { };
+        __cpuid(cpuInfo, 0);
+        i32 maxFunctionId = cpuInfo[0];
+
+        // sse2 is part of the x64 baseline
+        SIMDLevel level = SIMDLevel::kSSE;
+        if (maxFunctionId < 7)
+        {
+            return level;
+        }
+
+        __cpuid(cpuInfo, 1);
+        bool bOSXSAVE = (cpuInfo[2] & (1 << 27)) != 0;
+        bool bAVX = (cpuInfo[2] & (1 << 28)) != 0;
+        if (!bOSXSAVE || !bAVX)
+        {
+            return level;
+        }
+        // make sure the os saves both xmm and ymm registers on context switches
+        u64 xcr0 = _xgetbv(0);
+        if ((xcr0 & 0x6) != 0x6)
+        {
+            return level;
+        }
+
+        __cpuidex(cpuInfo, 7, 0);
+        bool bAVX2 = (cpuInfo[1] & (1 << 5)) != 0;
+        if (bAVX2)
+        {
+            level = SIMDLevel::kAVX2;
+        }
+        return level;
+    }
+
+    SIMDLevel getSIMDLevel()
+    {
+        static SIMDLevel level = detectSIMDLevel();
+        return level;
+    }
+
+    const char* getSIMDLevelName(SIMDLevel level)
+    {
+        switch (level)
+        {
+        case SIMDLevel::kSSE: return "SSE";
+        case SIMDLevel::kAVX2: return "AVX2";
+        default: return "Scalar";
+        }
+    }
+
+    u32 getPacketWidth(SIMDLevel level)
+    {
+        switch (level)
+        {
+        case SIMDLevel::kSSE: return 4u;
+        case SIMDLevel::kAVX2: return 8u;
+        default: return 1u;
+        }
+    }
+
+    static u32 countActiveLanes(u32 mask)
+    {
+        u32 count = 0u;
+        for (; mask != 0u; mask &= mask - 1u)
+        {
+            count++;
+        }
+        return count;
+    }
+
+    static u32 firstActiveLane(u32 mask)
+    {
+        u32 lane = 0u;
+        while ((mask & (1u << lane)) == 0u)
+        {
+            lane++;
+        }
+        return lane;
+    }
+
+    /**
+    * Rays stored in structure of arrays form, one ray per simd lane
+    */
+    template <typename Float>
+    struct RayPacket
+    {
+        // 'rays' needs to hold one ray for every lane
+        explicit RayPacket(const Ray* rays)
+        {
+            static const u32 W = Float::kWidth;
+            f32 lanes[9][W];
+            for (u32 lane = 0; lane < W; ++lane)
+            {
+                const Ray& ray = rays[lane];
+                glm::vec3 invRd = 1.f / ray.rd;
+                for (i32 axis = 0; axis < 3; ++axis)
+                {
+                    lanes[axis][lane] = ray.ro[axis];
+                    lanes[axis + 3][lane] = ray.rd[axis];
+                    lanes[axis + 6][lane] = invRd[axis];
+                }
+            }
+            for (i32 axis = 0; axis < 3; ++axis)
+            {
+                ro[axis] = Float::load(lanes[axis]);
+                rd[axis] = Float::load(lanes[axis + 3]);
+                invRd[axis] = Float::load(lanes[axis + 6]);
+            }
+            tMax = Float::splat(FLT_MAX);
+        }
+
+        Float ro[3];
+        Float rd[3];
+        Float invRd[3];
+        // distance to the closest hit found so far for every lane
+        Float tMax;
+    };
+
+    /**
+    * Slab test of all the lanes in 'activeMask' against a single box, returns the lanes that hit the box
+    * before their current closest hit
+    */
+    template <typename Float>
+    static u32 intersectBox(const RayPacket<Float>& packet, const BVHNode& node, u32 activeMask)
+    {
+        Float tEnter = Float::splat(-FLT_MAX);
+        Float tExit = Float::splat(FLT_MAX);
+        for (i32 axis = 0; axis < 3; ++axis)
+        {
+            Float t0 = (Float::splat(node.aabbMin[axis]) - packet.ro[axis]) * packet.invRd[axis];
+            Float t1 = (Float::splat(node.aabbMax[axis]) - packet.ro[axis]) * packet.invRd[axis];
+            tEnter = simdMax(tEnter, simdMin(t0, t1));
+            tExit = simdMin(tExit, simdMax(t0, t1));
+        }
+        Float hit = cmpGE(tExit, tEnter) & cmpGT(tExit, Float::splat(0.f)) & cmpLT(tEnter, packet.tMax);
+        return movemask(hit) & activeMask;
+    }
+
+    /**
+    * Moller-Trumbore of all the lanes in 'activeMask' against a single triangle, same math and epsilons as the
+    * scalar intersectTriangle() so that packets and single rays agree on every hit
+    */
+    template <typename Float>
+    static void intersectPacketTriangle(RayPacket<Float>& packet, u32 activeMask, const RayTracingScene& rtxScene, u32 instance, const TriangleArray& triangles, u32 tri, RayHit* outHits)
+    {
+        static const u32 W = Float::kWidth;
+        const f32 EPSILON = 0.0000001f;
+
+        const glm::vec3& v0 = triangles.positions[tri * 3 + 0];
+        glm::vec3 edge1 = triangles.positions[tri * 3 + 1] - v0;
+        glm::vec3 edge2 = triangles.positions[tri * 3 + 2] - v0;
+        Float e1[3] = { Float::splat(edge1.x), Float::splat(edge1.y), Float::splat(edge1.z) };
+        Float e2[3] = { Float::splat(edge2.x), Float::splat(edge2.y), Float::splat(edge2.z) };
+
+        const Float* d = packet.rd;
+        Float h[3] = {
+            d[1] * e2[2] - d[2] * e2[1],
+            d[2] * e2[0] - d[0] * e2[2],
+            d[0] * e2[1] - d[1] * e2[0]
+        };
+        Float a = e1[0] * h[0] + e1[1] * h[1] + e1[2] * h[2];
+        Float f = Float::splat(1.f) / a;
+        Float s[3] = {
+            packet.ro[0] - Float::splat(v0.x),
+            packet.ro[1] - Float::splat(v0.y),
+            packet.ro[2] - Float::splat(v0.z)
+        };
+        Float u = f * (s[0] * h[0] + s[1] * h[1] + s[2] * h[2]);
+        Float q[3] = {
+            s[1] * e1[2] - s[2] * e1[1],
+            s[2] * e1[0] - s[0] * e1[2],
+            s[0] * e1[1] - s[1] * e1[0]
+        };
+        Float v = f * (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]);
+        Float t = f * (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]);
+
+        Float zero = Float::splat(0.f), one = Float::splat(1.f);
+        Float hit = cmpGE(simdAbs(a), Float::splat(EPSILON))
+            & cmpGE(u, zero) & cmpLE(u, one)
+            & cmpGE(v, zero) & cmpLE(u + v, one)
+            & cmpGT(t, Float::splat(EPSILON)) & cmpLT(t, packet.tMax);
+        u32 hitMask = movemask(hit) & activeMask;
+        if (hitMask == 0u)
+        {
+            return;
+        }
+
+        // hits are rare compared to tests, so updating the closest hits lane by lane is fine
+        f32 ts[W], tMax[W];
+        t.store(ts);
+        packet.tMax.store(tMax);
+        for (u32 lane = 0; lane < W; ++lane)
+        {
+            if (hitMask & (1u << lane))
+            {
+                tMax[lane] = ts[lane];
+                outHits[lane].t = ts[lane];
+                outHits[lane].instance = instance;
+                outHits[lane].tri = tri;
+                outHits[lane].material = rtxScene.getMaterial(instance, tri);
+            }
+        }
+        packet.tMax = Float::load(tMax);
+    }
+
+    /**
+    * Packet traversal shared by the tlas and blas. 'rays' are the packet's rays in the space of 'bvh' and are only used
+    * for child ordering and for the single ray fallback. 'intersectLeaf(node, activeMask)' tests the lanes in 
+    * 'activeMask' against a leaf and shrinks 'packet.tMax' on closer hits, 'traceSingleRay(lane, nodeIndex)' finishes 
+    * the subtree rooted at 'nodeIndex' for one lane and returns that lane's new closest hit distance.
+    */
+    template <typename Float, typename IntersectLeaf, typename TraceSingleRay>
+    static void traversePacket(const BVH& bvh, RayPacket<Float>& packet, const Ray* rays, u32 validMask, const IntersectLeaf& intersectLeaf, const TraceSingleRay& traceSingleRay)
+    {
+        static const u32 W = Float::kWidth;
+        // subtrees reached by fewer lanes than this are cheaper to finish with single rays
+        static const u32 kMinCoherentLanes = W / 4u + 1u;
+
+        if (bvh.empty())
+        {
+            return;
+        }
+
+        struct StackEntry
+        {
+            u32 nodeIndex;
+            u32 activeMask;
+        };
+        // both children are pushed for every internal node, so the stack can grow by one entry per level
+        StackEntry stack[BVH::kMaxDepth + 1];
+        u32 stackSize = 0u;
+        stack[stackSize++] = { BVH::kRootNodeIndex, validMask };
+
+        while (stackSize > 0u)
+        {
+            StackEntry entry = stack[--stackSize];
+            const BVHNode& node = bvh.nodes[entry.nodeIndex];
+            // re-testing here rather than at push time lets lanes that found a closer hit in the meanwhile drop out
+            u32 activeMask = intersectBox(packet, node, entry.activeMask);
+            if (activeMask == 0u)
+            {
+                continue;
+            }
+
+            if (countActiveLanes(activeMask) < kMinCoherentLanes)
+            {
+                // the packet diverged, finish this subtree with single rays
+                f32 tMax[W];
+                packet.tMax.store(tMax);
+                for (u32 lane = 0; lane < W; ++lane)
+                {
+                    if (activeMask & (1u << lane))
+                    {
+                        tMax[lane] = traceSingleRay(lane, entry.nodeIndex);
+                    }
+                }
+                packet.tMax = Float::load(tMax);
+                continue;
+            }
+
+            if (node.isLeaf())
+            {
+                intersectLeaf(node, activeMask);
+                continue;
+            }
+
+            /**
+            * order children using the direction of the first active lane along the axis that separates the two children
+            * the most, for a coherent packet this is the near child for most of the lanes
+            */
+            const BVHNode& left = bvh.nodes[node.leftFirst];
+            const BVHNode& right = bvh.nodes[node.leftFirst + 1];
+            glm::vec3 delta = (right.aabbMin + right.aabbMax) - (left.aabbMin + left.aabbMax);
+            glm::vec3 absDelta = glm::abs(delta);
+            i32 axis = (absDelta.x > absDelta.y && absDelta.x > absDelta.z) ? 0 : (absDelta.y > absDelta.z ? 1 : 2);
+            bool bLeftFirst = rays[firstActiveLane(activeMask)].rd[axis] * delta[axis] >= 0.f;
+            u32 nearChild = bLeftFirst ? node.leftFirst : node.leftFirst + 1;
+            u32 farChild = bLeftFirst ? node.leftFirst + 1 : node.leftFirst;
+            stack[stackSize++] = { farChild, activeMask };
+            stack[stackSize++] = { nearChild, activeMask };
+        }
+    }
+
+    template <typename Float>
+    static void tracePacket(const RayTracingScene& rtxScene, const Ray* rays, u32 numRays, RayHit* outHits)
+    {
+        static const u32 W = Float::kWidth;
+
+        for (u32 i = 0; i < numRays; ++i)
+        {
+            outHits[i] = RayHit{ };
+        }
+        numRays = Min(numRays, W);
+        if (rtxScene.tlas.empty() || numRays == 0u)
+        {
+            return;
+        }
+
+        // pad partial packets with copies of the first ray, the padding lanes are never active
+        Ray paddedRays[W];
+        for (u32 lane = 0; lane < W; ++lane)
+        {
+            paddedRays[lane] = rays[lane < numRays ? lane : 0u];
+        }
+        RayPacket<Float> packet(paddedRays);
+        RayHit hits[W];
+
+        auto intersectInstances = [&](const BVHNode& tlasNode, u32 activeMask) {
+            for (u32 i = 0; i < tlasNode.count; ++i)
+            {
+                u32 instance = rtxScene.tlas.primitiveIndices[tlasNode.leftFirst + i];
+                const RayTracingMeshInstance& meshInst = rtxScene.meshInstances[instance];
+                const RayTracingMesh& mesh = rtxScene.meshes[meshInst.parent];
+
+                // directions are not normalized after the transform, so distances carry over between the two spaces
+                Ray raysOS[W];
+                for (u32 lane = 0; lane < W; ++lane)
+                {
+                    raysOS[lane] = transformRay(meshInst.worldToObject, paddedRays[lane]);
+                }
+                RayPacket<Float> packetOS(raysOS);
+                packetOS.tMax = packet.tMax;
+
+                traversePacket(mesh.blas, packetOS, raysOS, activeMask, 
+                    [&](const BVHNode& blasNode, u32 blasActiveMask) {
+                        for (u32 j = 0; j < blasNode.count; ++j)
+                        {
+                            intersectPacketTriangle(packetOS, blasActiveMask, rtxScene, instance, mesh.triangles, mesh.blas.primitiveIndices[blasNode.leftFirst + j], hits);
+                        }
+                    },
+                    [&](u32 lane, u32 nodeIndex) {
+                        traceBLAS(rtxScene, instance, raysOS[lane], hits[lane], nodeIndex);
+                        return hits[lane].t;
+                    }
+                );
+                packet.tMax = packetOS.tMax;
+            }
+        };
+
+        traversePacket(rtxScene.tlas, packet, paddedRays, (1u << numRays) - 1u, intersectInstances,
+            [&](u32 lane, u32 nodeIndex) {
+                traceTLAS(rtxScene, paddedRays[lane], hits[lane], nodeIndex);
+                return hits[lane].t;
+            }
+        );
+
+        for (u32 i = 0; i < numRays; ++i)
+        {
+            outHits[i] = hits[i];
+        }
+    }
+
+    void tracePacket4(const RayTracingScene& rtxScene, const Ray* rays, u32 numRays, RayHit* outHits)
+    {
+        tracePacket<Float4>(rtxScene, rays, numRays, outHits);
+    }
+
+    void tracePacket8(const RayTracingScene& rtxScene, const Ray* rays, u32 numRays, RayHit* outHits)
+    {
+        tracePacket<Float8>(rtxScene, rays, numRays, outHits);
+    }
+}
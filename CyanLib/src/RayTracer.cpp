@@ -1,15 +1,22 @@
 #include <thread>
 #include <queue>
 #include <atomic>
+#include <chrono>
+#include <fstream>
 
 #include "Ray.h"
 #include "RayTracer.h"
 #include "Texture.h"
 #include "MathUtils.h"
 #include "CyanAPI.h"
+#include "ThreadPool.h"
+#include "RayPacket.h"
+#include "TriangleBlock.h"
+#include "IrradianceCache.h"
+#include "WavefrontPathTracer.h"
 
 /* 
-    * todo: (Feature) integrate intel's open image denoiser
+    * note: external denoisers such as intel's open image denoiser plug in through IDenoiser, see Denoiser.h
 */
 
 // shared caching pipelineState
@@ -32,47 +39,14 @@
 
 namespace Cyan
 {
-    static glm::vec3 shade(const RayTracingScene& rtxScene, const RayHit& hit);
+    static glm::vec3 shade(const RayTracingScene& rtxScene, const Ray& ray, const glm::vec3& albedo, const RayHit& hit, IrradianceCache* irradianceCache);
 
-    // taken from https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
     static f32 intersect(const Ray& ray, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
     {
-        const float EPSILON = 0.0000001;
-        glm::vec3 edge1 = v1 - v0;
-        glm::vec3 edge2 = v2 - v0;
-        glm::vec3 h, s, q;
-        float a,f,u,v;
-        h = glm::cross(ray.rd, edge2);
-        // a = glm::dot(edge1, h);
-        a = edge1.x * h.x + edge1.y * h.y + edge1.z * h.z;
-        if (fabs(a) < EPSILON)
-        {
-            return -1.0f;
-        }
-        f = 1.0f / a;
-        s = ray.ro - v0;
-        // u = f * dot(s, h);
-        u = f * (s.x*h.x + s.y*h.y + s.z*h.z);
-        if (u < 0.0 || u > 1.0)
-        {
-            return -1.0;
-        }
-        q = glm::cross(s, edge1);
-        v = f * (ray.rd.x*q.x + ray.rd.y*q.y + ray.rd.z*q.z);
-        if (v < 0.0 || u + v > 1.0)
-        {
-            return -1.0;
-        }
-        float t = f * glm::dot(edge2, q);
-        // hit
-        if (t > EPSILON)
-        {
-            return t;
-        }
-        return -1.0f;
+        return intersectTriangle(ray.ro, ray.rd, v0, v1, v2);
     }
 
-    static Ray generateRay(const PerspectiveCamera& camera, const glm::vec2& pixelCoords)
+    Ray generateRay(const PerspectiveCamera& camera, const glm::vec2& pixelCoords)
     {
         glm::vec2 uv = pixelCoords * 2.f - 1.f;
         uv.x *= camera.aspectRatio;
@@ -85,61 +59,831 @@ namespace Cyan
         return Ray{ ro, rd };
     }
 
+    RayDifferential generateRayDifferential(const PerspectiveCamera& camera, const glm::vec2& pixelCoords, const glm::uvec2& imageSize)
+    {
+        // all primary rays share the camera position, so only the directions differ
+        glm::vec3 rd = generateRay(camera, pixelCoords).rd;
+        RayDifferential differential;
+        differential.dddx = generateRay(camera, pixelCoords + glm::vec2(1.f / imageSize.x, 0.f)).rd - rd;
+        differential.dddy = generateRay(camera, pixelCoords + glm::vec2(0.f, 1.f / imageSize.y)).rd - rd;
+        return differential;
+    }
+
+    RayTracer::RayTracer()
+        : m_wavefront(new WavefrontPathTracer())
+    {
+    }
+
+    RayTracer::~RayTracer()
+    {
+    }
+
+    std::shared_ptr<RayTracer::RenderTracker> RayTracer::renderSceneAsync(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const std::function<void()>& finishCallback)
+    {
+        glm::uvec2 numTiles = (outImage.size + glm::uvec2(kTileSize - 1u)) / kTileSize;
+
+        auto tracker = std::make_shared<RenderTracker>();
+        tracker->outImage = &outImage;
+        tracker->numTiles = numTiles.x * numTiles.y;
+        tracker->future = tracker->promise.get_future().share();
+        m_renderTracker = tracker;
+
+        if (tracker->numTiles == 0)
+        {
+            finishCallback();
+            tracker->promise.set_value();
+            return tracker;
+        }
+
+        ThreadPool* threadPool = ThreadPool::get();
+        if (renderMode == RenderMode::kWavefront)
+        {
+            // every stage of the wavefront tracer is spread over the pool already, so the whole image is a single task
+            tracker->numTiles = 1u;
+            threadPool->submit([this, &rtxScene, camera, &outImage, tracker, finishCallback]() {
+                if (!tracker->cancelled())
+                {
+                    renderWavefront(rtxScene, camera, outImage);
+                }
+                tracker->numFinishedTiles.fetch_add(1);
+                finishCallback();
+                tracker->promise.set_value();
+            });
+            return tracker;
+        }
+
+        for (u32 tile = 0; tile < tracker->numTiles; ++tile)
+        {
+            glm::uvec2 tileStart(tile % numTiles.x, tile / numTiles.x);
+            tileStart *= kTileSize;
+            glm::uvec2 tileEnd = glm::uvec2(Min(tileStart.x + kTileSize, outImage.size.x), Min(tileStart.y + kTileSize, outImage.size.y));
+
+            // camera is copied as the caller's camera may keep moving while the render is in flight
+            threadPool->submit([this, &rtxScene, camera, &outImage, tileStart, tileEnd, tracker, finishCallback]() {
+                if (!tracker->cancelled())
+                {
+                    renderTile(rtxScene, camera, outImage, tileStart, tileEnd, *tracker);
+                }
+                if (tracker->numFinishedTiles.fetch_add(1) + 1 == tracker->numTiles)
+                {
+                    finishCallback();
+                    tracker->promise.set_value();
+                }
+            });
+        }
+        return tracker;
+    }
+
     void RayTracer::renderScene(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const std::function<void()>& finishCallback)
     {
-        onRenderStart(outImage);
+        renderSceneAsync(rtxScene, camera, outImage, finishCallback)->wait();
+    }
+
+    void RayTracer::renderWavefront(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage)
+    {
+        AccumulationBuffer accumulation(outImage.size);
+        m_wavefront->render(rtxScene, camera, accumulation, aovs);
+        accumulation.resolve(outImage);
+    }
+
+    void RayTracer::renderTile(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const glm::uvec2& tileStart, const glm::uvec2& tileEnd, const RenderTracker& tracker)
+    {
+        u32 packetWidth = getPacketWidth(getSIMDLevel());
+        if (bPacketTracing && !bBruteForceTracing && packetWidth > 1u)
+        {
+            renderTilePackets(rtxScene, camera, outImage, tileStart, tileEnd, tracker, packetWidth);
+            return;
+        }
+
+        for (u32 y = tileStart.y; y < tileEnd.y; ++y)
         {
-            for (u32 y = 0; y < outImage.size.y; ++y)
+            // check for cancellation once per row to stay responsive on expensive tiles
+            if (tracker.cancelled())
             {
-                for (u32 x = 0; x < outImage.size.x; ++x)
+                return;
+            }
+            for (u32 x = tileStart.x; x < tileEnd.x; ++x)
+            {
+                glm::vec2 pixelCoords((f32)x / outImage.size.x, (f32)y / outImage.size.y);
+                Ray ray = generateRay(camera, pixelCoords);
+                RayHit hit = trace(rtxScene, ray);
+
+                glm::vec3 radiance = shadePrimary(rtxScene, camera, outImage.size, pixelCoords, ray, hit, y * outImage.size.x + x);
+                if (hit.tri >= 0)
                 {
-                    glm::vec2 pixelCoords((f32)x / outImage.size.x, (f32)y / outImage.size.y);
-                    Ray ray = generateRay(camera, pixelCoords);
-                    RayHit hit = trace(rtxScene, ray);
+                    outImage.setPixel(glm::uvec2(x, y), radiance);
+                }
+            }
+        }
+    }
 
-                    if (hit.tri >= 0)
+    /**
+    * Primary rays of a small block of neighboring pixels are coherent, so trace them as one packet. 4-wide packets
+    * cover 2x2 pixels and 8-wide packets cover 4x2 pixels.
+    */
+    void RayTracer::renderTilePackets(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, Image& outImage, const glm::uvec2& tileStart, const glm::uvec2& tileEnd, const RenderTracker& tracker, u32 packetWidth)
+    {
+        const glm::uvec2 blockSize(packetWidth / 2u, 2u);
+        Ray rays[8];
+        RayHit hits[8];
+        glm::uvec2 pixels[8];
+        for (u32 blockY = tileStart.y; blockY < tileEnd.y; blockY += blockSize.y)
+        {
+            if (tracker.cancelled())
+            {
+                return;
+            }
+            for (u32 blockX = tileStart.x; blockX < tileEnd.x; blockX += blockSize.x)
+            {
+                u32 numRays = 0u;
+                for (u32 y = blockY; y < Min(blockY + blockSize.y, tileEnd.y); ++y)
+                {
+                    for (u32 x = blockX; x < Min(blockX + blockSize.x, tileEnd.x); ++x)
                     {
-                        outImage.setPixel(glm::uvec2(x, y), shade(rtxScene, hit));
+                        glm::vec2 pixelCoords((f32)x / outImage.size.x, (f32)y / outImage.size.y);
+                        rays[numRays] = generateRay(camera, pixelCoords);
+                        pixels[numRays] = glm::uvec2(x, y);
+                        numRays++;
                     }
+                }
 
-                    m_renderTracker.progress = (f32)(y * outImage.size.x + x) / (outImage.size.x * outImage.size.y);
+                if (packetWidth == 8u)
+                {
+                    tracePacket8(rtxScene, rays, numRays, hits);
+                }
+                else
+                {
+                    tracePacket4(rtxScene, rays, numRays, hits);
+                }
+
+                for (u32 i = 0; i < numRays; ++i)
+                {
+                    glm::vec2 pixelCoords((f32)pixels[i].x / outImage.size.x, (f32)pixels[i].y / outImage.size.y);
+                    glm::vec3 radiance = shadePrimary(rtxScene, camera, outImage.size, pixelCoords, rays[i], hits[i], pixels[i].y * outImage.size.x + pixels[i].x);
+                    if (hits[i].tri >= 0)
+                    {
+                        outImage.setPixel(pixels[i], radiance);
+                    }
                 }
             }
         }
-        onRenderFinish(finishCallback);
     }
 
-    RayHit RayTracer::trace(const RayTracingScene& rtxScene, const Ray& ray)
+    // relative errors are measured against at least this much luminance so that black pixels can converge
+    static const f32 kMinConvergenceLuminance = 1e-3f;
+
+    static f32 calcSampleLuminance(const glm::vec3& rgb)
+    {
+        return 0.2126f * rgb.r + 0.7152f * rgb.g + 0.0722f * rgb.b;
+    }
+
+    void AccumulationBuffer::clear()
+    {
+        std::fill(radiance.begin(), radiance.end(), glm::vec3(0.f));
+        std::fill(luminanceSquared.begin(), luminanceSquared.end(), 0.f);
+        std::fill(sampleCounts.begin(), sampleCounts.end(), 0u);
+    }
+
+    void AccumulationBuffer::addSample(u32 pixelIndex, const glm::vec3& sample)
+    {
+        f32 luminance = calcSampleLuminance(sample);
+        radiance[pixelIndex] += sample;
+        luminanceSquared[pixelIndex] += luminance * luminance;
+        sampleCounts[pixelIndex]++;
+    }
+
+    f32 AccumulationBuffer::getRelativeError(u32 pixelIndex) const
+    {
+        u32 n = sampleCounts[pixelIndex];
+        if (n < 2u)
+        {
+            return FLT_MAX;
+        }
+        f32 mean = calcSampleLuminance(radiance[pixelIndex]) / (f32)n;
+        // unbiased sample variance, clamped since the difference of the two sums can round below zero
+        f32 variance = Max((luminanceSquared[pixelIndex] - mean * mean * (f32)n) / (f32)(n - 1u), 0.f);
+        return sqrtf(variance / (f32)n) / Max(mean, kMinConvergenceLuminance);
+    }
+
+    void AccumulationBuffer::resolveConvergence(Image& outImage, f32 targetError) const
+    {
+        for (u32 y = 0; y < size.y; ++y)
+        {
+            for (u32 x = 0; x < size.x; ++x)
+            {
+                u32 index = y * size.x + x;
+                f32 error = Min(getRelativeError(index) / Max(targetError, FLT_EPSILON), 1.f);
+                outImage.setPixel(glm::uvec2(x, y), glm::vec3(error));
+            }
+        }
+    }
+
+    u32 AccumulationBuffer::getMinSampleCount() const
+    {
+        u32 minCount = 0xFFFFFFFF;
+        for (u32 count : sampleCounts)
+        {
+            minCount = Min(minCount, count);
+        }
+        return sampleCounts.empty() ? 0u : minCount;
+    }
+
+    void AccumulationBuffer::resolve(Image& outImage) const
+    {
+        for (u32 y = 0; y < size.y; ++y)
+        {
+            for (u32 x = 0; x < size.x; ++x)
+            {
+                u32 index = y * size.x + x;
+                if (sampleCounts[index] > 0u)
+                {
+                    outImage.setPixel(glm::uvec2(x, y), radiance[index] / (f32)sampleCounts[index]);
+                }
+            }
+        }
+    }
+
+    void AOVBuffer::clear()
+    {
+        std::fill(albedo.begin(), albedo.end(), glm::vec3(0.f));
+        std::fill(normals.begin(), normals.end(), glm::vec3(0.f));
+        std::fill(depth.begin(), depth.end(), 0.f);
+        std::fill(sampleCounts.begin(), sampleCounts.end(), 0u);
+    }
+
+    void AOVBuffer::addSample(u32 pixelIndex, const glm::vec3& inAlbedo, const glm::vec3& inNormal, f32 inDepth)
+    {
+        f32 w = 1.f / (f32)(++sampleCounts[pixelIndex]);
+        albedo[pixelIndex] += (inAlbedo - albedo[pixelIndex]) * w;
+        normals[pixelIndex] += (inNormal - normals[pixelIndex]) * w;
+        depth[pixelIndex] += (inDepth - depth[pixelIndex]) * w;
+    }
+
+    bool AccumulationBuffer::save(const char* filename) const
+    {
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            cyanError("Failed to open %s for writing accumulation checkpoint", filename);
+            return false;
+        }
+        u32 header[4] = { kFileMagic, kFileVersion, size.x, size.y };
+        file.write(reinterpret_cast<const char*>(header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(radiance.data()), radiance.size() * sizeof(radiance[0]));
+        file.write(reinterpret_cast<const char*>(luminanceSquared.data()), luminanceSquared.size() * sizeof(luminanceSquared[0]));
+        file.write(reinterpret_cast<const char*>(sampleCounts.data()), sampleCounts.size() * sizeof(sampleCounts[0]));
+        return file.good();
+    }
+
+    bool AccumulationBuffer::load(const char* filename)
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file.is_open())
+        {
+            return false;
+        }
+        u32 header[4] = { };
+        file.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!file.good() || header[0] != kFileMagic || header[1] != kFileVersion || header[2] != size.x || header[3] != size.y)
+        {
+            cyanError("Accumulation checkpoint %s doesn't match a %ux%u image", filename, size.x, size.y);
+            return false;
+        }
+        // read into temporaries first so that a truncated file doesn't leave the buffer half overwritten
+        std::vector<glm::vec3> loadedRadiance(radiance.size());
+        std::vector<f32> loadedLuminanceSquared(luminanceSquared.size());
+        std::vector<u32> loadedSampleCounts(sampleCounts.size());
+        file.read(reinterpret_cast<char*>(loadedRadiance.data()), loadedRadiance.size() * sizeof(loadedRadiance[0]));
+        file.read(reinterpret_cast<char*>(loadedLuminanceSquared.data()), loadedLuminanceSquared.size() * sizeof(loadedLuminanceSquared[0]));
+        file.read(reinterpret_cast<char*>(loadedSampleCounts.data()), loadedSampleCounts.size() * sizeof(loadedSampleCounts[0]));
+        if (!file.good())
+        {
+            cyanError("Accumulation checkpoint %s is truncated", filename);
+            return false;
+        }
+        radiance.swap(loadedRadiance);
+        luminanceSquared.swap(loadedLuminanceSquared);
+        sampleCounts.swap(loadedSampleCounts);
+        return true;
+    }
+
+    void RayTracer::beginProgressiveRender(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, AccumulationBuffer& accumulation, u32 maxSamplesPerPixel)
+    {
+        m_progressive.scene = &rtxScene;
+        m_progressive.camera = camera;
+        m_progressive.accumulation = &accumulation;
+        m_progressive.maxSamplesPerPixel = maxSamplesPerPixel;
+        // pixels that already have more samples from a checkpoint simply keep accumulating past the others
+        m_progressive.pass = accumulation.getMinSampleCount();
+        m_progressive.nextTile.store(0u);
+        m_progressive.bPaused = false;
+        glm::uvec2 numTiles = (accumulation.size + glm::uvec2(kTileSize - 1u)) / kTileSize;
+        m_progressive.tileConverged.assign(numTiles.x * numTiles.y, 0u);
+        m_progressive.numConvergedTiles.store(0u);
+    }
+
+    bool RayTracer::renderProgressive(f32 timeBudgetMs)
     {
-        f32 closestT = FLT_MAX;
-        i32 hitTri = -1;
-        i32 material = -1;
+        if (m_progressive.bPaused || isProgressiveRenderFinished())
+        {
+            return isProgressiveRenderFinished();
+        }
+
+        using Clock = std::chrono::high_resolution_clock;
+        auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<f32, std::milli>(timeBudgetMs));
+
+        const glm::uvec2 imageSize = m_progressive.accumulation->size;
+        glm::uvec2 numTiles = (imageSize + glm::uvec2(kTileSize - 1u)) / kTileSize;
+        u32 numTilesPerPass = numTiles.x * numTiles.y;
+        if (numTilesPerPass == 0u)
+        {
+            m_progressive.pass = m_progressive.maxSamplesPerPixel;
+            return true;
+        }
 
-        // brute force tracing
+        if (renderMode == RenderMode::kWavefront)
         {
-            for (u32 tri = 0; tri < rtxScene.surfaces.numTriangles(); ++tri)
+            while (Clock::now() < deadline && !isProgressiveRenderFinished())
+            {
+                // converged tiles drop out of the wave the same way tiled passes skip them
+                std::vector<u32>& pixels = m_progressive.wavefrontPixels;
+                pixels.clear();
+                for (u32 tile = 0; tile < numTilesPerPass; ++tile)
+                {
+                    if (m_progressive.tileConverged[tile])
+                    {
+                        continue;
+                    }
+                    glm::uvec2 tileStart = glm::uvec2(tile % numTiles.x, tile / numTiles.x) * kTileSize;
+                    glm::uvec2 tileEnd = glm::uvec2(Min(tileStart.x + kTileSize, imageSize.x), Min(tileStart.y + kTileSize, imageSize.y));
+                    for (u32 y = tileStart.y; y < tileEnd.y; ++y)
+                    {
+                        for (u32 x = tileStart.x; x < tileEnd.x; ++x)
+                        {
+                            pixels.push_back(y * imageSize.x + x);
+                        }
+                    }
+                }
+                m_wavefront->render(*m_progressive.scene, m_progressive.camera, *m_progressive.accumulation, aovs, &pixels);
+
+                if (adaptiveErrorTarget > 0.f && m_progressive.pass + 1u >= kMinAdaptiveSamples)
+                {
+                    for (u32 tile = 0; tile < numTilesPerPass; ++tile)
+                    {
+                        glm::uvec2 tileStart = glm::uvec2(tile % numTiles.x, tile / numTiles.x) * kTileSize;
+                        glm::uvec2 tileEnd = glm::uvec2(Min(tileStart.x + kTileSize, imageSize.x), Min(tileStart.y + kTileSize, imageSize.y));
+                        if (!m_progressive.tileConverged[tile] && isTileConverged(tileStart, tileEnd))
+                        {
+                            m_progressive.tileConverged[tile] = 1u;
+                            m_progressive.numConvergedTiles.fetch_add(1);
+                        }
+                    }
+                }
+                m_progressive.pass++;
+            }
+            return isProgressiveRenderFinished();
+        }
+
+        ThreadPool* threadPool = ThreadPool::get();
+        u32 numTasks = Min(threadPool->getNumWorkers(), numTilesPerPass);
+        /**
+        * Workers keep claiming tiles of the current pass until the budget runs out. A tile is never handed out twice within
+        * a pass and passes are separated by the join of parallelFor, so no two threads ever write the same pixel.
+        */
+        auto work = [this, deadline, numTiles, numTilesPerPass, imageSize](u32) {
+            while (Clock::now() < deadline)
+            {
+                u32 tile = m_progressive.nextTile.fetch_add(1);
+                if (tile >= numTilesPerPass)
+                {
+                    break;
+                }
+                if (m_progressive.tileConverged[tile])
+                {
+                    continue;
+                }
+                glm::uvec2 tileStart = glm::uvec2(tile % numTiles.x, tile / numTiles.x) * kTileSize;
+                glm::uvec2 tileEnd = glm::uvec2(Min(tileStart.x + kTileSize, imageSize.x), Min(tileStart.y + kTileSize, imageSize.y));
+                accumulateTile(tileStart, tileEnd);
+                if (adaptiveErrorTarget > 0.f && m_progressive.pass + 1u >= kMinAdaptiveSamples && isTileConverged(tileStart, tileEnd))
+                {
+                    m_progressive.tileConverged[tile] = 1u;
+                    m_progressive.numConvergedTiles.fetch_add(1);
+                }
+            }
+        };
+
+        while (Clock::now() < deadline && !isProgressiveRenderFinished())
+        {
+            threadPool->parallelFor(numTasks, work);
+            // claims past the end of the pass or after the deadline didn't render anything
+            if (m_progressive.nextTile.load() >= numTilesPerPass)
+            {
+                m_progressive.pass++;
+                m_progressive.nextTile.store(0u);
+            }
+        }
+        return isProgressiveRenderFinished();
+    }
+
+    void RayTracer::accumulateTile(const glm::uvec2& tileStart, const glm::uvec2& tileEnd)
+    {
+        const RayTracingScene& rtxScene = *m_progressive.scene;
+        AccumulationBuffer& accumulation = *m_progressive.accumulation;
+
+        u32 packetWidth = getPacketWidth(getSIMDLevel());
+        bool bPackets = bPacketTracing && !bBruteForceTracing && packetWidth > 1u;
+        const glm::uvec2 blockSize = bPackets ? glm::uvec2(packetWidth / 2u, 2u) : glm::uvec2(1u);
+        Ray rays[8];
+        RayHit hits[8];
+        glm::vec2 pixelCoords[8];
+        u32 pixelIndices[8];
+        for (u32 blockY = tileStart.y; blockY < tileEnd.y; blockY += blockSize.y)
+        {
+            for (u32 blockX = tileStart.x; blockX < tileEnd.x; blockX += blockSize.x)
+            {
+                u32 numRays = 0u;
+                for (u32 y = blockY; y < Min(blockY + blockSize.y, tileEnd.y); ++y)
+                {
+                    for (u32 x = blockX; x < Min(blockX + blockSize.x, tileEnd.x); ++x)
+                    {
+                        // jitter within the pixel along a halton sequence indexed by the pixel's own sample count
+                        u32 pixelIndex = y * accumulation.size.x + x;
+                        u32 sampleIndex = accumulation.sampleCounts[pixelIndex] + 1u;
+                        glm::vec2 jitter(radicalInverse(2u, sampleIndex), radicalInverse(3u, sampleIndex));
+                        pixelCoords[numRays] = glm::vec2(((f32)x + jitter.x) / accumulation.size.x, ((f32)y + jitter.y) / accumulation.size.y);
+                        rays[numRays] = generateRay(m_progressive.camera, pixelCoords[numRays]);
+                        pixelIndices[numRays] = pixelIndex;
+                        numRays++;
+                    }
+                }
+
+                if (!bPackets)
+                {
+                    hits[0] = trace(rtxScene, rays[0]);
+                }
+                else if (packetWidth == 8u)
+                {
+                    tracePacket8(rtxScene, rays, numRays, hits);
+                }
+                else
+                {
+                    tracePacket4(rtxScene, rays, numRays, hits);
+                }
+
+                for (u32 i = 0; i < numRays; ++i)
+                {
+                    accumulation.addSample(pixelIndices[i], shadePrimary(rtxScene, m_progressive.camera, accumulation.size, pixelCoords[i], rays[i], hits[i], pixelIndices[i]));
+                }
+            }
+        }
+    }
+
+    bool RayTracer::isTileConverged(const glm::uvec2& tileStart, const glm::uvec2& tileEnd) const
+    {
+        const AccumulationBuffer& accumulation = *m_progressive.accumulation;
+        for (u32 y = tileStart.y; y < tileEnd.y; ++y)
+        {
+            for (u32 x = tileStart.x; x < tileEnd.x; ++x)
+            {
+                if (accumulation.getRelativeError(y * accumulation.size.x + x) > adaptiveErrorTarget)
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    /**
+    * Slab test, returns distance to the entry point of the box or FLT_MAX on a miss
+    */
+    static f32 intersect(const Ray& ray, const glm::vec3& invRd, const glm::vec3& aabbMin, const glm::vec3& aabbMax, f32 tMax)
+    {
+        glm::vec3 t0 = (aabbMin - ray.ro) * invRd;
+        glm::vec3 t1 = (aabbMax - ray.ro) * invRd;
+        glm::vec3 tNear = vec3Min(t0, t1);
+        glm::vec3 tFar = vec3Max(t0, t1);
+        f32 tEnter = max(max(tNear.x, tNear.y), tNear.z);
+        f32 tExit = min(min(tFar.x, tFar.y), tFar.z);
+        if (tExit >= tEnter && tExit > 0.f && tEnter < tMax)
+        {
+            return tEnter;
+        }
+        return FLT_MAX;
+    }
+
+    Ray transformRay(const glm::mat4& transform, const Ray& ray)
+    {
+        Ray outRay;
+        outRay.ro = vec4ToVec3(transform * glm::vec4(ray.ro, 1.f));
+        outRay.rd = glm::mat3(transform) * ray.rd;
+        return outRay;
+    }
+
+    static void traceBruteForce(const RayTracingScene& rtxScene, const Ray& ray, RayHit& hit)
+    {
+        for (u32 instance = 0; instance < rtxScene.meshInstances.size(); ++instance)
+        {
+            const RayTracingMeshInstance& meshInst = rtxScene.meshInstances[instance];
+            const TriangleArray& triangles = rtxScene.meshes[meshInst.parent].triangles;
+            Ray rayOS = transformRay(meshInst.worldToObject, ray);
+            for (u32 tri = 0; tri < triangles.numTriangles(); ++tri)
             {
                 f32 t = intersect(
-                    ray,
-                    rtxScene.surfaces.positions[tri * 3 + 0],
-                    rtxScene.surfaces.positions[tri * 3 + 1],
-                    rtxScene.surfaces.positions[tri * 3 + 2]
+                    rayOS,
+                    triangles.positions[tri * 3 + 0],
+                    triangles.positions[tri * 3 + 1],
+                    triangles.positions[tri * 3 + 2]
                 );
 
-                if (t > 0.f && t < closestT)
+                if (t > 0.f && t < hit.t)
                 {
-                    closestT = t;
-                    hitTri = tri;
-                    material = rtxScene.surfaces.materials[tri];
+                    hit.t = t;
+                    hit.instance = instance;
+                    hit.tri = tri;
+                    hit.material = rtxScene.getMaterial(instance, tri);
                 }
             }
         }
-        // bvh tracing
+    }
+
+    /**
+    * Iterative stack based closest hit traversal shared by the tlas and blas, always visiting the nearer child first 
+    * so that 'hit.t' shrinks as early as possible and culls more of the tree. 'intersectLeaf' is called for every
+    * visited leaf and is responsible for updating 'hit'.
+    */
+    template <typename IntersectLeaf>
+    static void traverseBVH(const BVH& bvh, const Ray& ray, RayHit& hit, u32 rootNodeIndex, const IntersectLeaf& intersectLeaf)
+    {
+        if (bvh.empty())
         {
+            return;
+        }
 
+        glm::vec3 invRd = 1.f / ray.rd;
+        const BVHNode* node = &bvh.nodes[rootNodeIndex];
+        if (intersect(ray, invRd, node->aabbMin, node->aabbMax, hit.t) == FLT_MAX)
+        {
+            return;
         }
 
-        return RayHit{ closestT, hitTri, material };
+        const BVHNode* stack[BVH::kMaxDepth];
+        u32 stackSize = 0u;
+        while (true)
+        {
+            if (node->isLeaf())
+            {
+                intersectLeaf(*node);
+                if (stackSize == 0)
+                {
+                    break;
+                }
+                node = stack[--stackSize];
+                continue;
+            }
+
+            const BVHNode* nearChild = &bvh.nodes[node->leftFirst];
+            const BVHNode* farChild = &bvh.nodes[node->leftFirst + 1];
+            f32 tNear = intersect(ray, invRd, nearChild->aabbMin, nearChild->aabbMax, hit.t);
+            f32 tFar = intersect(ray, invRd, farChild->aabbMin, farChild->aabbMax, hit.t);
+            if (tNear > tFar)
+            {
+                std::swap(tNear, tFar);
+                std::swap(nearChild, farChild);
+            }
+            if (tNear == FLT_MAX)
+            {
+                if (stackSize == 0)
+                {
+                    break;
+                }
+                node = stack[--stackSize];
+            }
+            else
+            {
+                node = nearChild;
+                if (tFar != FLT_MAX)
+                {
+                    stack[stackSize++] = farChild;
+                }
+            }
+        }
+    }
+
+    void traceBLAS(const RayTracingScene& rtxScene, u32 instance, const Ray& rayOS, RayHit& hit, u32 rootNodeIndex)
+    {
+        const RayTracingMesh& mesh = rtxScene.meshes[rtxScene.meshInstances[instance].parent];
+        const std::vector<glm::vec3>& positions = mesh.triangles.positions;
+        const TriangleBlockArray& triangleBlocks = mesh.triangleBlocks;
+        traverseBVH(mesh.blas, rayOS, hit, rootNodeIndex, [&](const BVHNode& leaf) {
+            i32 closestTri = -1;
+            if (!triangleBlocks.empty())
+            {
+                u32 firstBlock = triangleBlocks.leafBlocks[&leaf - mesh.blas.nodes.data()];
+                for (u32 b = 0; b < TriangleBlockArray::getNumBlocks(leaf); ++b)
+                {
+                    u32 tri;
+                    f32 t = intersectTriangleBlock(triangleBlocks.blocks[firstBlock + b], rayOS.ro, rayOS.rd, hit.t, tri);
+                    if (t < hit.t)
+                    {
+                        hit.t = t;
+                        closestTri = tri;
+                    }
+                }
+            }
+            else
+            {
+                for (u32 i = 0; i < leaf.count; ++i)
+                {
+                    u32 tri = mesh.blas.primitiveIndices[leaf.leftFirst + i];
+                    f32 t = intersect(rayOS, positions[tri * 3 + 0], positions[tri * 3 + 1], positions[tri * 3 + 2]);
+                    if (t > 0.f && t < hit.t)
+                    {
+                        hit.t = t;
+                        closestTri = tri;
+                    }
+                }
+            }
+            if (closestTri >= 0)
+            {
+                hit.instance = instance;
+                hit.tri = closestTri;
+                hit.material = rtxScene.getMaterial(instance, closestTri);
+            }
+        });
+    }
+
+    void traceTLAS(const RayTracingScene& rtxScene, const Ray& ray, RayHit& hit, u32 rootNodeIndex)
+    {
+        traverseBVH(rtxScene.tlas, ray, hit, rootNodeIndex, [&rtxScene, &ray, &hit](const BVHNode& leaf) {
+            for (u32 i = 0; i < leaf.count; ++i)
+            {
+                u32 instance = rtxScene.tlas.primitiveIndices[leaf.leftFirst + i];
+                // the ray direction isn't normalized after the transform so 'hit.t' stays valid in object space
+                Ray rayOS = transformRay(rtxScene.meshInstances[instance].worldToObject, ray);
+                traceBLAS(rtxScene, instance, rayOS, hit);
+            }
+        });
+    }
+
+    /**
+    * Any hit traversal, unlike traverseBVH() children are not sorted by distance. The left child is visited first as 
+    * the builder places the child with the larger surface area, and thus the higher chance of being hit, on the left.
+    * 'intersectLeaf' returns true on a hit within 'tMax', which ends the traversal.
+    */
+    template <typename IntersectLeaf>
+    static bool traverseBVHAnyHit(const BVH& bvh, const Ray& ray, f32 tMax, u32 rootNodeIndex, const IntersectLeaf& intersectLeaf)
+    {
+        if (bvh.empty())
+        {
+            return false;
+        }
+
+        glm::vec3 invRd = 1.f / ray.rd;
+        const BVHNode* node = &bvh.nodes[rootNodeIndex];
+        if (intersect(ray, invRd, node->aabbMin, node->aabbMax, tMax) == FLT_MAX)
+        {
+            return false;
+        }
+
+        const BVHNode* stack[BVH::kMaxDepth];
+        u32 stackSize = 0u;
+        while (true)
+        {
+            if (node->isLeaf())
+            {
+                if (intersectLeaf(*node))
+                {
+                    return true;
+                }
+                if (stackSize == 0)
+                {
+                    return false;
+                }
+                node = stack[--stackSize];
+                continue;
+            }
+
+            const BVHNode* left = &bvh.nodes[node->leftFirst];
+            const BVHNode* right = &bvh.nodes[node->leftFirst + 1];
+            bool bHitLeft = intersect(ray, invRd, left->aabbMin, left->aabbMax, tMax) != FLT_MAX;
+            bool bHitRight = intersect(ray, invRd, right->aabbMin, right->aabbMax, tMax) != FLT_MAX;
+            if (bHitLeft)
+            {
+                node = left;
+                if (bHitRight)
+                {
+                    stack[stackSize++] = right;
+                }
+            }
+            else if (bHitRight)
+            {
+                node = right;
+            }
+            else
+            {
+                if (stackSize == 0)
+                {
+                    return false;
+                }
+                node = stack[--stackSize];
+            }
+        }
+    }
+
+    bool occludedBLAS(const RayTracingScene& rtxScene, u32 instance, const Ray& rayOS, f32 tMax, u32 rootNodeIndex)
+    {
+        const RayTracingMesh& mesh = rtxScene.meshes[rtxScene.meshInstances[instance].parent];
+        const std::vector<glm::vec3>& positions = mesh.triangles.positions;
+        const TriangleBlockArray& triangleBlocks = mesh.triangleBlocks;
+        return traverseBVHAnyHit(mesh.blas, rayOS, tMax, rootNodeIndex, [&](const BVHNode& leaf) {
+            if (!triangleBlocks.empty())
+            {
+                u32 firstBlock = triangleBlocks.leafBlocks[&leaf - mesh.blas.nodes.data()];
+                for (u32 b = 0; b < TriangleBlockArray::getNumBlocks(leaf); ++b)
+                {
+                    u32 tri;
+                    if (intersectTriangleBlock(triangleBlocks.blocks[firstBlock + b], rayOS.ro, rayOS.rd, tMax, tri) < tMax)
+                    {
+                        return true;
+                    }
+                }
+                return false;
+            }
+            for (u32 i = 0; i < leaf.count; ++i)
+            {
+                u32 tri = mesh.blas.primitiveIndices[leaf.leftFirst + i];
+                f32 t = intersect(rayOS, positions[tri * 3 + 0], positions[tri * 3 + 1], positions[tri * 3 + 2]);
+                if (t > 0.f && t < tMax)
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    bool occludedTLAS(const RayTracingScene& rtxScene, const Ray& ray, f32 tMax, u32 rootNodeIndex)
+    {
+        return traverseBVHAnyHit(rtxScene.tlas, ray, tMax, rootNodeIndex, [&rtxScene, &ray, tMax](const BVHNode& leaf) {
+            for (u32 i = 0; i < leaf.count; ++i)
+            {
+                u32 instance = rtxScene.tlas.primitiveIndices[leaf.leftFirst + i];
+                Ray rayOS = transformRay(rtxScene.meshInstances[instance].worldToObject, ray);
+                if (occludedBLAS(rtxScene, instance, rayOS, tMax))
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+
+    RayHit RayTracer::trace(const RayTracingScene& rtxScene, const Ray& ray)
+    {
+        RayHit hit = { };
+        if (bBruteForceTracing)
+        {
+            traceBruteForce(rtxScene, ray, hit);
+        }
+        else
+        {
+            traceTLAS(rtxScene, ray, hit);
+        }
+        return hit;
+    }
+
+    bool RayTracer::occluded(const RayTracingScene& rtxScene, const Ray& ray, f32 tMax)
+    {
+        if (bBruteForceTracing)
+        {
+            RayHit hit = { };
+            traceBruteForce(rtxScene, ray, hit);
+            return hit.t < tMax;
+        }
+        return occludedTLAS(rtxScene, ray, tMax);
+    }
+
+    void RayTracer::occluded(const RayTracingScene& rtxScene, const Ray* rays, const f32* tMax, u32 numRays, bool* outOccluded)
+    {
+        u32 numBatches = (numRays + kRayBatchSize - 1u) / kRayBatchSize;
+        auto traceBatch = [this, &rtxScene, rays, tMax, numRays, outOccluded](u32 batch) {
+            u32 end = Min((batch + 1u) * kRayBatchSize, numRays);
+            for (u32 i = batch * kRayBatchSize; i < end; ++i)
+            {
+                outOccluded[i] = occluded(rtxScene, rays[i], tMax[i]);
+            }
+        };
+
+        if (numBatches > 1u)
+        {
+            ThreadPool::get()->parallelFor(numBatches, traceBatch);
+        }
+        else if (numBatches == 1u)
+        {
+            traceBatch(0u);
+        }
     }
 
     glm::vec3 calcBarycentricCoords(const glm::vec3& p, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
@@ -152,29 +896,164 @@ namespace Cyan
         return glm::vec3(u, v, w);
     }
 
-    static glm::vec3 shade(const RayTracingScene& rtxScene, const RayHit& hit)
+    // the scene has no lights yet, so shade with a fixed directional light and constant ambient irradiance
+    static const glm::vec3 kSunDirection(1.f, 0.f, 0.f);
+    static const glm::vec3 kAmbientIrradiance(.2f);
+
+    glm::vec3 calcHitNormal(const RayTracingScene& rtxScene, const RayHit& hit)
+    {
+        const RayTracingMeshInstance& meshInst = rtxScene.meshInstances[hit.instance];
+        const TriangleArray& triangles = rtxScene.meshes[meshInst.parent].triangles;
+        glm::vec3 normalOS = triangles.normals[hit.tri * 3 + 0] + triangles.normals[hit.tri * 3 + 1] + triangles.normals[hit.tri * 3 + 2];
+        // inverse transpose of the world transform
+        glm::mat3 normalTransform = glm::transpose(glm::mat3(meshInst.worldToObject));
+        return glm::normalize(normalTransform * normalOS);
+    }
+
+    /**
+    * Barycentric coordinates of 'p' on the plane of the triangle, linear in 'p' so that offsets between points on the plane
+    * can be mapped with the same formula
+    */
+    static glm::vec2 calcPlaneBarycentrics(const glm::vec3& p, const glm::vec3& e1, const glm::vec3& e2)
+    {
+        f32 d11 = glm::dot(e1, e1), d12 = glm::dot(e1, e2), d22 = glm::dot(e2, e2);
+        f32 dp1 = glm::dot(p, e1), dp2 = glm::dot(p, e2);
+        f32 denom = d11 * d22 - d12 * d12;
+        if (denom == 0.f)
+        {
+            return glm::vec2(0.f);
+        }
+        return glm::vec2(d22 * dp1 - d12 * dp2, d11 * dp2 - d12 * dp1) / denom;
+    }
+
+    glm::vec3 calcHitAlbedo(const RayTracingScene& rtxScene, const Ray& ray, const RayDifferential& differential, const RayHit& hit)
     {
-        glm::vec3 outRadiance(0.f);
         const auto& material = rtxScene.materials[hit.material];
-#if 0 
-        glm::vec3 barycentrics = calcBarycentricCoords();
-        glm::vec3 n = barycentricLerp(
-            barycentrics, 
-            rtxScene.surfaces.positions[hit.tri * 3 + 0],
-            rtxScene.surfaces.positions[hit.tri * 3 + 1],
-            rtxScene.surfaces.positions[hit.tri * 3 + 2]
-        );
-#else
-        glm::vec3 n = glm::normalize(
-            rtxScene.surfaces.normals[hit.tri * 3 + 0]
-          + rtxScene.surfaces.normals[hit.tri * 3 + 1]
-          + rtxScene.surfaces.normals[hit.tri * 3 + 2]
-        );
-        f32 ndotl = max(glm::dot(n, glm::vec3(1.f, 0.f, 0.f)), 0.f);
-        outRadiance += glm::vec3(0.2) * material.albedo;
-        outRadiance += ndotl * glm::vec3(1.f) * material.albedo;
-#endif
-        return outRadiance;
+        if (material.albedoMap < 0)
+        {
+            return material.albedo;
+        }
+
+        // everything happens in object space where the triangle is stored, hit distances are the same in both spaces
+        const RayTracingMeshInstance& meshInst = rtxScene.meshInstances[hit.instance];
+        const TriangleArray& triangles = rtxScene.meshes[meshInst.parent].triangles;
+        const glm::vec3* v = &triangles.positions[hit.tri * 3];
+        const glm::vec2* uv = &triangles.texCoords[hit.tri * 3];
+        glm::mat3 worldToObject(meshInst.worldToObject);
+        Ray rayOS = transformRay(meshInst.worldToObject, ray);
+        glm::vec3 p = rayOS.ro + rayOS.rd * hit.t;
+        glm::vec3 e1 = v[1] - v[0], e2 = v[2] - v[0];
+        glm::vec3 n = glm::cross(e1, e2);
+
+        // intersect the offset rays with the plane of the triangle (Igehy, "Tracing Ray Differentials")
+        auto transfer = [&p, &n, &rayOS](const glm::vec3& dodx, const glm::vec3& dddx) {
+            glm::vec3 ro = rayOS.ro + dodx, rd = rayOS.rd + dddx;
+            f32 ndotd = glm::dot(n, rd);
+            if (ndotd == 0.f)
+            {
+                return glm::vec3(0.f);
+            }
+            return ro + rd * (glm::dot(n, p - ro) / ndotd) - p;
+        };
+        glm::vec3 dpdx = transfer(worldToObject * differential.dodx, worldToObject * differential.dddx);
+        glm::vec3 dpdy = transfer(worldToObject * differential.dody, worldToObject * differential.dddy);
+
+        glm::vec2 b = calcPlaneBarycentrics(p - v[0], e1, e2);
+        glm::vec2 dbdx = calcPlaneBarycentrics(dpdx, e1, e2), dbdy = calcPlaneBarycentrics(dpdy, e1, e2);
+        glm::vec2 duv1 = uv[1] - uv[0], duv2 = uv[2] - uv[0];
+        glm::vec2 texCoord = uv[0] + duv1 * b.x + duv2 * b.y;
+        glm::vec2 duvdx = duv1 * dbdx.x + duv2 * dbdx.y;
+        glm::vec2 duvdy = duv1 * dbdy.x + duv2 * dbdy.y;
+        return glm::vec3(rtxScene.textures[material.albedoMap].sampleGrad(texCoord, duvdx, duvdy));
+    }
+
+    glm::vec3 calcHitAlbedo(const RayTracingScene& rtxScene, const RayHit& hit)
+    {
+        const auto& material = rtxScene.materials[hit.material];
+        if (material.albedoMap < 0)
+        {
+            return material.albedo;
+        }
+        return glm::vec3(rtxScene.textures[material.albedoMap].getAverage());
+    }
+
+    glm::vec3 calcDirectRadiance(const RayTracingScene& rtxScene, const RayHit& hit)
+    {
+        glm::vec3 n = calcHitNormal(rtxScene, hit);
+        f32 ndotl = max(glm::dot(n, kSunDirection), 0.f);
+        return ndotl * glm::vec3(1.f) * calcHitAlbedo(rtxScene, hit);
+    }
+
+    static glm::vec3 shade(const RayTracingScene& rtxScene, const Ray& ray, const glm::vec3& albedo, const RayHit& hit, IrradianceCache* irradianceCache)
+    {
+        glm::vec3 n = calcHitNormal(rtxScene, hit);
+        f32 ndotl = max(glm::dot(n, kSunDirection), 0.f);
+        glm::vec3 irradiance = kAmbientIrradiance;
+        if (irradianceCache)
+        {
+            // gather on the side of the surface facing the viewer
+            if (glm::dot(n, ray.rd) > 0.f)
+            {
+                n = -n;
+            }
+            glm::vec3 p = ray.ro + ray.rd * hit.t;
+            const IrradianceCache::Settings& settings = irradianceCache->settings;
+            irradiance = irradianceCache->getIrradiance(rtxScene, p, n, settings.error * settings.smoothing);
+        }
+        return (glm::vec3(ndotl) + irradiance) * albedo;
+    }
+
+    glm::vec3 RayTracer::shadePrimary(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, const glm::uvec2& imageSize, const glm::vec2& pixelCoords, const Ray& ray, const RayHit& hit, u32 pixelIndex)
+    {
+        if (hit.tri < 0)
+        {
+            if (aovs)
+            {
+                aovs->addSample(pixelIndex, glm::vec3(0.f), glm::vec3(0.f), 0.f);
+            }
+            return glm::vec3(0.f);
+        }
+        RayDifferential differential = generateRayDifferential(camera, pixelCoords, imageSize);
+        glm::vec3 albedo = calcHitAlbedo(rtxScene, ray, differential, hit);
+        if (aovs)
+        {
+            glm::vec3 n = calcHitNormal(rtxScene, hit);
+            aovs->addSample(pixelIndex, albedo, glm::dot(n, ray.rd) > 0.f ? -n : n, hit.t);
+        }
+        return shade(rtxScene, ray, albedo, hit, irradianceCache);
+    }
+
+    void RayTracer::fillIrradianceCache(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, const glm::uvec2& imageSize, u32 pixelStride)
+    {
+        if (!irradianceCache)
+        {
+            return;
+        }
+        pixelStride = Max(pixelStride, 1u);
+        glm::uvec2 numTiles = (imageSize + glm::uvec2(kTileSize - 1u)) / kTileSize;
+        ThreadPool::get()->parallelFor(numTiles.x * numTiles.y, [this, &rtxScene, &camera, imageSize, numTiles, pixelStride](u32 tile) {
+            glm::uvec2 tileStart = glm::uvec2(tile % numTiles.x, tile / numTiles.x) * kTileSize;
+            glm::uvec2 tileEnd = glm::uvec2(Min(tileStart.x + kTileSize, imageSize.x), Min(tileStart.y + kTileSize, imageSize.y));
+            for (u32 y = tileStart.y; y < tileEnd.y; y += pixelStride)
+            {
+                for (u32 x = tileStart.x; x < tileEnd.x; x += pixelStride)
+                {
+                    glm::vec2 pixelCoords((f32)x / imageSize.x, (f32)y / imageSize.y);
+                    Ray ray = generateRay(camera, pixelCoords);
+                    RayHit hit = trace(rtxScene, ray);
+                    if (hit.tri >= 0)
+                    {
+                        glm::vec3 n = calcHitNormal(rtxScene, hit);
+                        if (glm::dot(n, ray.rd) > 0.f)
+                        {
+                            n = -n;
+                        }
+                        // the prepass uses the strict error threshold, shading relaxes it
+                        irradianceCache->getIrradiance(rtxScene, ray.ro + ray.rd * hit.t, n, irradianceCache->settings.error);
+                    }
+                }
+            }
+        });
     }
 
 #if 0
@@ -1454,131 +2333,5 @@ namespace Cyan
         }
         return irradiance;
     }
-
-    Octree::Octree()
-        : m_numAllocatedNodes(0), m_root(nullptr)
-    {
-        m_nodePool.resize(maxNodeCount);
-    }
-
-    void Octree::init(const glm::vec3& center, f32 sideLength)
-    {
-        m_root = allocNode();
-        m_root->center = center;
-        m_root->sideLength = sideLength;
-    }
-
-    u32 Octree::getChildIndexEnclosingSurfel(OctreeNode* node, const glm::vec3& position)
-    {
-        glm::vec3 vv = position - node->center;
-        u32 k = (vv.z <= 0.f) ? 1 : 0;
-        u32 i = (vv.y <= 0.f) ? 1 : 0;
-        u32 j = (vv.x >= 0.f) ? 1 : 0;
-        return k * 4 + i * 2 + j;
-    }
-
-    OctreeNode* Octree::allocNode()
-    {
-        CYAN_ASSERT(m_numAllocatedNodes < maxNodeCount, "Too many OctreeNode allocated!"); return &m_nodePool[m_numAllocatedNodes++];
-    }
-
-    void Octree::traverse(const std::function<void(std::queue<OctreeNode*>&, OctreeNode*)>& callback)
-    {
-        std::queue<OctreeNode*> nodes;
-        nodes.push(m_root);
-
-        // breadth first search, loop termination is determined by 'callback'
-        while (!nodes.empty())
-        {
-            OctreeNode* node = nodes.front();
-            nodes.pop();
-
-            callback(nodes, node);
-        }
-    }
-
-    const static glm::vec3 childOffsets[8] = {
-        glm::vec3(-.5f,  .5f,  .5f),  // 0
-        glm::vec3( .5f,  .5f,  .5f),  // 1
-        glm::vec3(-.5f, -.5f,  .5f),  // 2
-        glm::vec3( .5f, -.5f,  .5f),  // 3
-        glm::vec3(-.5f,  .5f, -.5f),  // 4
-        glm::vec3( .5f,  .5f, -.5f),  // 5
-        glm::vec3(-.5f, -.5f, -.5f),  // 6
-        glm::vec3( .5f, -.5f, -.5f),  // 7
-    };
-
-    void Octree::insert(const IrradianceRecord& newRecord, u32 recordIndex)
-    {
-        traverse([this, &newRecord, recordIndex](std::queue<OctreeNode*>& nodes, OctreeNode* node) {
-            // current node is too big for this new record, recurse into child and subdivide
-            if ((node->sideLength > (4.f * newRecord.r)))
-            {
-                // compute which octant that current point belongs to
-                u32 childIndex = getChildIndexEnclosingSurfel(node, newRecord.position);
-                if (!node->childs[childIndex])
-                {
-                    node->childs[childIndex] = allocNode();
-                    node->childs[childIndex]->sideLength = node->sideLength * .5f;
-                    node->childs[childIndex]->center = node->center + childOffsets[childIndex] * node->childs[childIndex]->sideLength;
-                }
-                nodes.push(node->childs[childIndex]);
-            }
-            else if (node->sideLength >= (2.f * newRecord.r))
-            {
-                node->records.push_back(recordIndex);
-            }
-            else
-                cyanError("Invalid record insertion into octree!");
-        });
-    }
- 
-    IrradianceCache::IrradianceCache()
-        : m_numRecords(0u), m_octree(nullptr)
-    {
-        m_records.resize(cacheSize);
-        m_numRecords = 0u;
-        m_octree = new Octree();
-    }
-
-    void IrradianceCache::init(std::vector<SceneNode*>& nodes)
-    {
-        BoundingBox3D aabb;
-        for (u32 i = 0; i < nodes.size(); ++i)
-        {
-            if (nodes[i]->m_meshInstance)
-            {
-                auto& objectSpaceAABB = nodes[i]->m_meshInstance->getAABB();
-                glm::mat4 model = nodes[i]->getWorldTransform().toMatrix();
-                BoundingBox3D worldSpaceAABB;
-                worldSpaceAABB.pmin = model * objectSpaceAABB.pmin;
-                worldSpaceAABB.pmax = model * objectSpaceAABB.pmax;
-                aabb.bound(worldSpaceAABB);
-            }
-        }
-        f32 length = aabb.pmax.x - aabb.pmin.x;
-        length = max(length, aabb.pmax.y - aabb.pmin.y);
-        length = max(length, aabb.pmax.z - aabb.pmin.z);
-        m_octree->init((aabb.pmin + aabb.pmax) * .5f, length);
-    }
-
-    const IrradianceRecord& IrradianceCache::addIrradianceRecord(const glm::vec3& p, const glm::vec3& pn, const glm::vec3& irradiance, f32 r, const glm::vec3* rotationalGradient, const glm::vec3* translationalGradient)
-    {
-        CYAN_ASSERT(m_numRecords < cacheSize, "Too many irradiance records inserted!");
-        IrradianceRecord& newRecord = m_records[m_numRecords];
-        newRecord.position = p;
-        newRecord.normal = pn;
-        newRecord.irradiance = irradiance;
-        newRecord.r = r;
-        newRecord.gradient_r[0] = rotationalGradient[0];
-        newRecord.gradient_r[1] = rotationalGradient[1];
-        newRecord.gradient_r[2] = rotationalGradient[2];
-        newRecord.gradient_t[0] = translationalGradient[0];
-        newRecord.gradient_t[1] = translationalGradient[1];
-        newRecord.gradient_t[2] = translationalGradient[2];
-        // insert into the octree
-        m_octree->insert(newRecord, m_numRecords++);
-        return newRecord;
-    }
 #endif
 };
@@ -1,12 +1,48 @@
 
 #include "RayTracingScene.h"
+#include "CyanAPI.h"
+#include "MathUtils.h"
+#include "ThreadPool.h"
+#include "RayPacket.h"
+#include "BVHCache.h"
 
 namespace Cyan
 {
-    RayTracingScene::RayTracingScene(const Scene& scene)
-        : positionBuffer("PositionBuffer")
-        , normalBuffer("NormalBuffer")
-        , materialBuffer("MaterialBuffer")
+    /**
+    * World space bounds of an instance computed by transforming the corners of its mesh's blas root
+    */
+    static BVHPrimitive calcInstanceBounds(const RayTracingMeshInstance& meshInst, const RayTracingMesh& mesh)
+    {
+        BVHPrimitive primitive = { };
+        glm::vec3 translation = vec4ToVec3(meshInst.worldTransform[3]);
+        if (mesh.blas.empty())
+        {
+            // degenerate box at the instance's origin, keeps instances and tlas primitives one to one
+            primitive.aabbMin = translation;
+            primitive.aabbMax = translation;
+            primitive.centroid = translation;
+            return primitive;
+        }
+
+        const BVHNode& root = mesh.blas.getRoot();
+        primitive.aabbMin = glm::vec3(FLT_MAX);
+        primitive.aabbMax = glm::vec3(-FLT_MAX);
+        for (u32 corner = 0; corner < 8; ++corner)
+        {
+            glm::vec3 p(
+                (corner & 1) ? root.aabbMax.x : root.aabbMin.x,
+                (corner & 2) ? root.aabbMax.y : root.aabbMin.y,
+                (corner & 4) ? root.aabbMax.z : root.aabbMin.z
+            );
+            glm::vec3 pWS = vec4ToVec3(meshInst.worldTransform * glm::vec4(p, 1.f));
+            primitive.aabbMin = vec3Min(primitive.aabbMin, pWS);
+            primitive.aabbMax = vec3Max(primitive.aabbMax, pWS);
+        }
+        primitive.centroid = (primitive.aabbMin + primitive.aabbMax) * .5f;
+        return primitive;
+    }
+
+    RayTracingScene::RayTracingScene(const Scene& scene, const char* bvhCacheDirectory)
     {
         if (auto perspectiveCamera = dynamic_cast<PerspectiveCamera*>(scene.camera->getCamera()))
         {
@@ -15,6 +51,7 @@ namespace Cyan
 
         std::unordered_map<std::string, u32> meshMap;
         std::unordered_map<std::string, u32> materialMap;
+        std::unordered_map<Texture2DRenderable*, u32> textureMap;
 
         // reserve a default material at index 0
         materials.emplace_back();
@@ -27,6 +64,11 @@ namespace Cyan
                 meshInstances.emplace_back();
                 auto& rtxMeshInst = meshInstances.back();
                 rtxMeshInst.worldTransform = staticMesh->getWorldTransformMatrix();
+                rtxMeshInst.worldToObject = glm::inverse(rtxMeshInst.worldTransform);
+                if (staticMesh->getProperties() & EntityFlag_kDynamic)
+                {
+                    m_dynamicInstances.push_back({ staticMesh, (u32)meshInstances.size() - 1 });
+                }
 
                 MeshInstance* meshInst = staticMesh->getMeshInstance();
                 Mesh* mesh = meshInst->parent;
@@ -36,14 +78,13 @@ namespace Cyan
                     meshes.emplace_back();
                     auto& rtxMesh = meshes.back();
                     
-                    // convert geometry data
+                    // convert geometry data, all submeshes are concatenated so that one blas covers the whole mesh
+                    rtxMesh.numSubmeshes = mesh->numSubmeshes();
+                    TriangleArray& triangles = rtxMesh.triangles;
                     for (u32 i = 0; i < mesh->numSubmeshes(); ++i)
                     {
                         if (Mesh::Submesh<Triangles>* submesh = dynamic_cast<Mesh::Submesh<Triangles>*>(mesh->getSubmesh(i)))
                         {
-                            rtxMesh.submeshes.emplace_back();
-                            TriangleArray& triangles = rtxMesh.submeshes.back();
-
                             const auto& vertices = submesh->getVertices();
                             const auto& indices = submesh->getIndices();
                             u32 numTriangles = indices.size() / 3;
@@ -63,6 +104,7 @@ namespace Cyan
                                     triangles.tangents.push_back(vertices[indices[f * 3 + v]].tangent);
                                     triangles.texCoords.push_back(vertices[indices[f * 3 + v]].texCoord0);
                                 }
+                                rtxMesh.submeshIndices.push_back(i);
                             }
                         }
                     }
@@ -88,6 +130,20 @@ namespace Cyan
                             rtxMaterial.roughness = matl->roughness;
                             rtxMaterial.metallic = matl->metallic;
                             rtxMaterial.emissive = glm::vec3(matl->emissive * 100.f);
+                            if (matl->albedoMap)
+                            {
+                                auto textureEntry = textureMap.find(matl->albedoMap);
+                                if (textureEntry == textureMap.end())
+                                {
+                                    // albedo maps are sRGB encoded
+                                    textures.emplace_back(*matl->albedoMap, true);
+                                    textureEntry = textureMap.insert({ matl->albedoMap, (u32)textures.size() - 1 }).first;
+                                }
+                                if (!textures[textureEntry->second].empty())
+                                {
+                                    rtxMaterial.albedoMap = textureEntry->second;
+                                }
+                            }
 
                             materialMap.insert({ matl->name, materials.size() - 1 });
                             material = materials.size() - 1;
@@ -102,47 +158,160 @@ namespace Cyan
             }
         }
 
-        /** merge everything into one big triangle array with transform applied, basically converting 
-        * mesh instance to a mesh with material applied
-        */
-        for (auto& meshInst : meshInstances)
         {
-            const glm::mat4& model = meshInst.worldTransform;
-            const auto& rtxMesh = meshes[meshInst.parent];
-            for (u32 sm = 0; sm < rtxMesh.submeshes.size(); ++sm)
+            ScopedTimer timer("Building RayTracingScene BVH", true);
+            // with 8-wide triangle tests, a leaf of 8 triangles costs about as much as 2 single triangle tests
+            bool bTriangleBlocks = (getSIMDLevel() == SIMDLevel::kAVX2);
+            std::unique_ptr<BVHCache> bvhCache(bvhCacheDirectory ? new BVHCache(bvhCacheDirectory) : nullptr);
+            u32 numCachedMeshes = 0u;
+            for (auto& rtxMesh : meshes)
             {
-                const TriangleArray& submesh = rtxMesh.submeshes[sm];
-                const RayTracingMaterial& material = materials[meshInst.materials[sm]];
-                for (u32 v = 0; v < submesh.numVerts(); ++v)
+                if (bTriangleBlocks)
+                {
+                    rtxMesh.blas.maxLeafSize = TriangleBlock::kWidth;
+                    rtxMesh.blas.intersectionCost = .25f;
+                }
+                // binned sah builds of large meshes take seconds, the linear build is parallel and close in quality once optimized
+                if (rtxMesh.triangles.positions.size() / 3 >= kLinearBuildMinTriangles)
                 {
-                    glm::vec4 positionWS = model * glm::vec4(submesh.positions[v], 1.f);
-                    glm::vec4 normalWS = glm::inverse(glm::transpose(model)) * glm::vec4(submesh.normals[v], 1.f);
-                    glm::vec4 tangentWS = model * submesh.tangents[v];
+                    rtxMesh.blas.buildMethod = BVHBuildMethod::kLinear;
+                    rtxMesh.blas.numTreeletPasses = 1u;
+                }
+                bool bCached = false;
+                u64 geometryHash = 0u;
+                if (bvhCache && rtxMesh.triangles.numTriangles() > 0)
+                {
+                    geometryHash = BVHCache::calcGeometryHash(rtxMesh.triangles.positions);
+                    bCached = bvhCache->load(geometryHash, rtxMesh.triangles.numTriangles(), rtxMesh.blas);
+                }
+                if (bCached)
+                {
+                    numCachedMeshes++;
+                }
+                else
+                {
+                    rtxMesh.blas.build(rtxMesh.triangles.positions);
+                    if (bvhCache && !rtxMesh.blas.empty())
+                    {
+                        bvhCache->save(geometryHash, rtxMesh.blas);
+                    }
+                }
+                if (bTriangleBlocks)
+                {
+                    rtxMesh.triangleBlocks.build(rtxMesh.blas, rtxMesh.triangles.positions);
+                }
+            }
+
+            m_instanceBounds.resize(meshInstances.size());
+            for (u32 i = 0; i < meshInstances.size(); ++i)
+            {
+                m_instanceBounds[i] = calcInstanceBounds(meshInstances[i], meshes[meshInstances[i].parent]);
+            }
+            tlas.build(m_instanceBounds);
+            if (bvhCache)
+            {
+                cyanInfo("Loaded %u of %u blas from the BVH cache", numCachedMeshes, (u32)meshes.size());
+            }
+        }
+        m_deformedMeshes.resize(meshes.size(), false);
+        m_blasRebuilds.resize(meshes.size());
+    }
 
-                    surfaces.positions.push_back(vec4ToVec3(positionWS));
-                    surfaces.normals.push_back(vec4ToVec3(normalWS));
-                    surfaces.tangents.push_back(tangentWS);
-                    surfaces.texCoords.push_back(submesh.texCoords[v]);
+    void RayTracingScene::markMeshDeformed(u32 meshIndex)
+    {
+        m_deformedMeshes[meshIndex] = true;
+    }
 
-                    positionBuffer.addElement(positionWS);
-                    normalBuffer.addElement(normalWS);
+    void RayTracingScene::rebuildInBackground(std::shared_ptr<BackgroundRebuild>& outRebuild, const BVH& bvh, const std::vector<BVHPrimitive>& primitives)
+    {
+        auto rebuild = std::make_shared<BackgroundRebuild>();
+        rebuild->bvh.maxLeafSize = bvh.maxLeafSize;
+        rebuild->bvh.intersectionCost = bvh.intersectionCost;
+        rebuild->bvh.buildMethod = bvh.buildMethod;
+        rebuild->bvh.numTreeletPasses = bvh.numTreeletPasses;
+        rebuild->bvh.minTreeletPrimitives = bvh.minTreeletPrimitives;
+        outRebuild = rebuild;
+        ThreadPool::get()->submit([rebuild, primitives]() {
+            rebuild->bvh.build(primitives);
+            rebuild->bFinished.store(true);
+        });
+    }
 
-                    if (v % 3 == 0)
-                    {
-                        surfaces.materials.push_back(meshInst.materials[sm]);
-                        GPURayTracingMaterial material = { };
-                        material.albedo = glm::vec4(materials[meshInst.materials[sm]].albedo, 1.f);
-                        material.emissive = glm::vec4(materials[meshInst.materials[sm]].emissive, 1.f);
-                        material.roughness = glm::vec4(materials[meshInst.materials[sm]].roughness);
-                        material.metallic = glm::vec4(materials[meshInst.materials[sm]].metallic);
-                        materialBuffer.addElement(material);
-                    }
+    bool RayTracingScene::finishRebuild(BVH& bvh, std::shared_ptr<BackgroundRebuild>& rebuild)
+    {
+        if (rebuild && rebuild->bFinished.load())
+        {
+            bvh = std::move(rebuild->bvh);
+            rebuild.reset();
+            return true;
+        }
+        return false;
+    }
+
+    void RayTracingScene::update()
+    {
+        std::vector<u32> changedInstances;
+        std::vector<BVHPrimitive> primitives;
+
+        for (u32 m = 0; m < meshes.size(); ++m)
+        {
+            RayTracingMesh& mesh = meshes[m];
+            // a rebuilt blas reflects the positions at the time the rebuild started, refitting it catches up with any deformation since
+            bool bRebuilt = finishRebuild(mesh.blas, m_blasRebuilds[m]);
+            if (!bRebuilt && !m_deformedMeshes[m])
+            {
+                continue;
+            }
+            calcTrianglePrimitives(mesh.triangles.positions, primitives);
+            mesh.blas.refit(primitives);
+            if (!mesh.triangleBlocks.empty())
+            {
+                mesh.triangleBlocks.build(mesh.blas, mesh.triangles.positions);
+            }
+            m_deformedMeshes[m] = false;
+
+            if (!m_blasRebuilds[m] && mesh.blas.getSAHCostGrowth() > kMaxSAHCostGrowth)
+            {
+                rebuildInBackground(m_blasRebuilds[m], mesh.blas, primitives);
+            }
+            for (u32 i = 0; i < meshInstances.size(); ++i)
+            {
+                if (meshInstances[i].parent == m)
+                {
+                    changedInstances.push_back(i);
                 }
             }
         }
 
-        positionBuffer.upload();
-        normalBuffer.upload();
-        materialBuffer.upload();
+        for (const auto& dynamicInstance : m_dynamicInstances)
+        {
+            RayTracingMeshInstance& meshInst = meshInstances[dynamicInstance.instance];
+            const glm::mat4& worldTransform = dynamicInstance.entity->getWorldTransformMatrix();
+            if (worldTransform != meshInst.worldTransform)
+            {
+                meshInst.worldTransform = worldTransform;
+                meshInst.worldToObject = glm::inverse(worldTransform);
+                changedInstances.push_back(dynamicInstance.instance);
+            }
+        }
+        for (u32 instance : changedInstances)
+        {
+            m_instanceBounds[instance] = calcInstanceBounds(meshInstances[instance], meshes[meshInstances[instance].parent]);
+        }
+
+        if (finishRebuild(tlas, m_tlasRebuild))
+        {
+            // instances may have kept moving while the rebuild was running
+            tlas.refit(m_instanceBounds);
+        }
+        else if (!changedInstances.empty())
+        {
+            tlas.refit(m_instanceBounds, changedInstances);
+        }
+
+        if (!m_tlasRebuild && tlas.getSAHCostGrowth() > kMaxSAHCostGrowth)
+        {
+            rebuildInBackground(m_tlasRebuild, tlas, m_instanceBounds);
+        }
     }
 }
@@ -0,0 +1,267 @@
+#include <cmath>
+
+#include "RayTracingTexture.h"
+#include "TextureCompressor.h"
+#include "TextureStreamer.h"
+#include "ThreadPool.h"
+
+namespace Cyan
+{
+    static_assert(RayTracingTexture::kTexelsPerTile * sizeof(u32) == 64, "A tile of texels has to fill exactly one cache line");
+
+    // same gamma as the rasterizer's material shaders use for decoding albedo maps
+    static const f32 kGamma = 2.2f;
+
+    static const f32* getSRGBToLinearTable()
+    {
+        struct Table
+        {
+            Table()
+            {
+                for (u32 i = 0; i < 256; ++i)
+                {
+                    values[i] = powf(i / 255.f, kGamma);
+                }
+            }
+            f32 values[256];
+        };
+        static const Table table;
+        return table.values;
+    }
+
+    // position of a texel inside its tile, interleaves the two low bits of x and y
+    static u32 calcMortonIndexInTile(u32 x, u32 y)
+    {
+        return (x & 1u) | ((y & 1u) << 1) | ((x & 2u) << 1) | ((y & 2u) << 2);
+    }
+
+    static u32 wrapCoord(i32 coord, u32 size, bool bWrap)
+    {
+        if (bWrap)
+        {
+            i32 wrapped = coord % (i32)size;
+            return (u32)(wrapped < 0 ? wrapped + (i32)size : wrapped);
+        }
+        return (u32)Min(Max(coord, 0), (i32)size - 1);
+    }
+
+    RayTracingTexture::RayTracingTexture(Texture2DRenderable& texture, bool bInSRGB)
+        : bSRGB(bInSRGB)
+    {
+        using PixelFormat = ITextureRenderable::Spec::PixelFormat;
+        bWrapS = (texture.parameter.wrap_s == ITextureRenderable::Parameter::WrapMode::WRAP);
+        bWrapT = (texture.parameter.wrap_t == ITextureRenderable::Parameter::WrapMode::WRAP);
+
+        u32 numChannels = 0u;
+        bool bFloat = false;
+        const u8* pixels = texture.pixelData;
+        // block compressed textures are decoded once up front
+        std::vector<u8> decompressed;
+        switch (texture.pixelFormat)
+        {
+        case PixelFormat::RGB8: numChannels = 3u; break;
+        case PixelFormat::RGBA8: numChannels = 4u; break;
+        case PixelFormat::RGB32F: numChannels = 3u; bFloat = true; break;
+        case PixelFormat::RGBA32F: numChannels = 4u; bFloat = true; break;
+        case PixelFormat::BC1:
+        case PixelFormat::BC3:
+        case PixelFormat::BC5:
+        case PixelFormat::BC7:
+        {
+            // streamed textures only keep their mip tail around, their first mip is read back from the source file
+            std::vector<u8> blocks;
+            if (texture.firstMip > 0u)
+            {
+                pixels = (TextureStreamer::get() && TextureStreamer::get()->readMip(&texture, 0u, blocks)) ? blocks.data() : nullptr;
+            }
+            if (pixels && TextureCompressor::decompress(texture.pixelFormat, pixels, texture.width, texture.height, decompressed))
+            {
+                numChannels = 4u;
+                pixels = decompressed.data();
+            }
+            break;
+        }
+        default: break;
+        }
+        if (numChannels == 0u || pixels == nullptr || texture.width == 0u || texture.height == 0u)
+        {
+            cyanInfo("Texture %s has no pixel data in a format supported by the ray tracer", texture.name);
+            return;
+        }
+
+        addMip(texture.width, texture.height);
+        const Mip& base = m_mips[0];
+        u32 numTileRows = (base.height + kTileSize - 1u) / kTileSize;
+        ThreadPool::get()->parallelFor(numTileRows, [this, &base, pixels, numChannels, bFloat](u32 tileRow) {
+            u32 yEnd = Min((tileRow + 1u) * kTileSize, base.height);
+            for (u32 y = tileRow * kTileSize; y < yEnd; ++y)
+            {
+                for (u32 x = 0; x < base.width; ++x)
+                {
+                    u32 pixel = (y * base.width + x) * numChannels;
+                    u32 texel;
+                    if (bFloat)
+                    {
+                        const f32* src = reinterpret_cast<const f32*>(pixels) + pixel;
+                        texel = 0u;
+                        for (u32 c = 0; c < 4u; ++c)
+                        {
+                            f32 value = (c < numChannels) ? Min(Max(src[c], 0.f), 1.f) : 1.f;
+                            texel |= (u32)(value * 255.f + .5f) << (c * 8u);
+                        }
+                    }
+                    else
+                    {
+                        const u8* src = pixels + pixel;
+                        texel = src[0] | (src[1] << 8u) | (src[2] << 16u) | ((numChannels == 4u ? src[3] : 255u) << 24u);
+                    }
+                    m_texels[getTexelIndex(base, x, y)] = texel;
+                }
+            }
+        });
+
+        while (m_mips.back().width > 1u || m_mips.back().height > 1u)
+        {
+            downsample((u32)m_mips.size() - 1u);
+        }
+        m_average = decode(m_texels[m_mips.back().offset]);
+    }
+
+    void RayTracingTexture::addMip(u32 width, u32 height)
+    {
+        Mip mip = { };
+        mip.width = width;
+        mip.height = height;
+        mip.numTilesX = (width + kTileSize - 1u) / kTileSize;
+        mip.offset = (u32)m_texels.size();
+        u32 numTilesY = (height + kTileSize - 1u) / kTileSize;
+        m_texels.resize(m_texels.size() + mip.numTilesX * numTilesY * kTexelsPerTile, 0u);
+        m_mips.push_back(mip);
+    }
+
+    /**
+    * 2x2 box filter in linear space, the last row / column of odd sized mips is folded into the previous texel
+    */
+    void RayTracingTexture::downsample(u32 srcMip)
+    {
+        addMip(Max(m_mips[srcMip].width / 2u, 1u), Max(m_mips[srcMip].height / 2u, 1u));
+        const Mip& src = m_mips[srcMip];
+        const Mip& dst = m_mips[srcMip + 1u];
+        u32 numTileRows = (dst.height + kTileSize - 1u) / kTileSize;
+        ThreadPool::get()->parallelFor(numTileRows, [this, &src, &dst](u32 tileRow) {
+            u32 yEnd = Min((tileRow + 1u) * kTileSize, dst.height);
+            for (u32 y = tileRow * kTileSize; y < yEnd; ++y)
+            {
+                u32 y0 = Min(y * 2u, src.height - 1u), y1 = Min(y * 2u + 1u, src.height - 1u);
+                for (u32 x = 0; x < dst.width; ++x)
+                {
+                    u32 x0 = Min(x * 2u, src.width - 1u), x1 = Min(x * 2u + 1u, src.width - 1u);
+                    glm::vec4 sum = decode(m_texels[getTexelIndex(src, x0, y0)]) + decode(m_texels[getTexelIndex(src, x1, y0)])
+                        + decode(m_texels[getTexelIndex(src, x0, y1)]) + decode(m_texels[getTexelIndex(src, x1, y1)]);
+                    m_texels[getTexelIndex(dst, x, y)] = encode(sum * .25f);
+                }
+            }
+        });
+    }
+
+    u32 RayTracingTexture::getTexelIndex(const Mip& mip, u32 x, u32 y) const
+    {
+        u32 tile = (y / kTileSize) * mip.numTilesX + x / kTileSize;
+        return mip.offset + tile * kTexelsPerTile + calcMortonIndexInTile(x, y);
+    }
+
+    glm::vec4 RayTracingTexture::decode(u32 texel) const
+    {
+        f32 alpha = (texel >> 24u) / 255.f;
+        if (bSRGB)
+        {
+            const f32* table = getSRGBToLinearTable();
+            return glm::vec4(table[texel & 0xFFu], table[(texel >> 8u) & 0xFFu], table[(texel >> 16u) & 0xFFu], alpha);
+        }
+        return glm::vec4((texel & 0xFFu) / 255.f, ((texel >> 8u) & 0xFFu) / 255.f, ((texel >> 16u) & 0xFFu) / 255.f, alpha);
+    }
+
+    u32 RayTracingTexture::encode(const glm::vec4& color) const
+    {
+        u32 texel = 0u;
+        for (u32 c = 0; c < 4u; ++c)
+        {
+            f32 value = Min(Max(color[c], 0.f), 1.f);
+            // alpha is never gamma encoded
+            if (bSRGB && c < 3u)
+            {
+                value = powf(value, 1.f / kGamma);
+            }
+            texel |= (u32)(value * 255.f + .5f) << (c * 8u);
+        }
+        return texel;
+    }
+
+    glm::vec4 RayTracingTexture::fetch(u32 mip, i32 x, i32 y) const
+    {
+        const Mip& m = m_mips[mip];
+        return decode(m_texels[getTexelIndex(m, wrapCoord(x, m.width, bWrapS), wrapCoord(y, m.height, bWrapT))]);
+    }
+
+    glm::vec4 RayTracingTexture::sampleNearest(u32 mip, const glm::vec2& uv) const
+    {
+        const Mip& m = m_mips[mip];
+        return fetch(mip, (i32)floorf(uv.x * m.width), (i32)floorf(uv.y * m.height));
+    }
+
+    glm::vec4 RayTracingTexture::sampleBilinear(u32 mip, const glm::vec2& uv) const
+    {
+        const Mip& m = m_mips[mip];
+        glm::vec2 st = uv * glm::vec2(m.width, m.height) - .5f;
+        glm::vec2 st0(floorf(st.x), floorf(st.y));
+        glm::vec2 w = st - st0;
+        i32 x = (i32)st0.x, y = (i32)st0.y;
+        glm::vec4 top = fetch(mip, x, y) * (1.f - w.x) + fetch(mip, x + 1, y) * w.x;
+        glm::vec4 bottom = fetch(mip, x, y + 1) * (1.f - w.x) + fetch(mip, x + 1, y + 1) * w.x;
+        return top * (1.f - w.y) + bottom * w.y;
+    }
+
+    f32 RayTracingTexture::calcLod(const glm::vec2& duvdx, const glm::vec2& duvdy) const
+    {
+        glm::vec2 size(getSize());
+        glm::vec2 dx = duvdx * size, dy = duvdy * size;
+        f32 footprint = Max(glm::dot(dx, dx), glm::dot(dy, dy));
+        // log2 of the longer axis of the footprint in texels
+        return footprint > 1.f ? .5f * log2f(footprint) : 0.f;
+    }
+
+    glm::vec4 RayTracingTexture::sample(const glm::vec2& uv, f32 lod, Filtering filtering) const
+    {
+        if (empty())
+        {
+            return glm::vec4(1.f);
+        }
+        // keep texture coordinates small for repeating textures so that tiling doesn't eat into float precision
+        glm::vec2 st(bWrapS ? uv.x - floorf(uv.x) : uv.x, bWrapT ? uv.y - floorf(uv.y) : uv.y);
+        lod = Min(Max(lod, 0.f), (f32)(getNumMips() - 1u));
+        switch (filtering)
+        {
+        case Filtering::kNearest:
+            return sampleNearest((u32)(lod + .5f), st);
+        case Filtering::kBilinear:
+            return sampleBilinear((u32)(lod + .5f), st);
+        case Filtering::kTrilinear:
+        default:
+        {
+            u32 mip = (u32)lod;
+            f32 w = lod - (f32)mip;
+            glm::vec4 color = sampleBilinear(mip, st);
+            if (w > 0.f && mip + 1u < getNumMips())
+            {
+                color = color * (1.f - w) + sampleBilinear(mip + 1u, st) * w;
+            }
+            return color;
+        }
+        }
+    }
+
+    glm::vec4 RayTracingTexture::sampleGrad(const glm::vec2& uv, const glm::vec2& duvdx, const glm::vec2& duvdy, Filtering filtering) const
+    {
+        return sample(uv, calcLod(duvdx, duvdy), filtering);
+    }
+}
@@ -1,5 +1,7 @@
 #include <unordered_map>
 
+#include "gtc/packing.hpp"
+
 #include "Lights.h"
 #include "RenderableScene.h"
 #include "Camera.h"
@@ -7,71 +9,181 @@
 #include "CyanRenderer.h"
 #include "LightComponents.h"
 #include "GpuLights.h"
+#include "MathUtils.h"
+#include "TextureStreamer.h"
 
 namespace Cyan
 {
     PackedGeometry* RenderableScene::packedGeometry = nullptr;
 
-    PackedGeometry::PackedGeometry(const Scene& scene) 
-        : vertexBuffer("VertexBuffer")
+    static_assert(sizeof(PackedGeometry::SubmeshDesc) == 48, "SubmeshDesc has to match its std430 layout in the shaders");
+
+    // maps a unit vector onto the octahedron unfolded into [-1, 1]^2, stored as two 16 bit snorms
+    static u32 encodeOctahedral(const glm::vec3& v)
+    {
+        f32 l1 = fabsf(v.x) + fabsf(v.y) + fabsf(v.z);
+        if (l1 <= 0.f)
+        {
+            return glm::packSnorm2x16(glm::vec2(0.f));
+        }
+        glm::vec2 e = glm::vec2(v.x, v.y) / l1;
+        if (v.z < 0.f)
+        {
+            e = glm::vec2((1.f - fabsf(e.y)) * (e.x >= 0.f ? 1.f : -1.f), (1.f - fabsf(e.x)) * (e.y >= 0.f ? 1.f : -1.f));
+        }
+        return glm::packSnorm2x16(e);
+    }
+
+    static PackedGeometry::QuantizedVertex quantizeVertex(const Triangles::Vertex& vertex, const glm::vec3& positionMin, const glm::vec3& positionScale)
+    {
+        u32 position[3];
+        for (u32 i = 0; i < 3; ++i)
+        {
+            f32 q = (positionScale[i] > 0.f) ? (vertex.pos[i] - positionMin[i]) / positionScale[i] : 0.f;
+            position[i] = (u32)Min(Max(q + .5f, 0.f), 65535.f);
+        }
+        PackedGeometry::QuantizedVertex quantized = { };
+        quantized.posXY = position[0] | (position[1] << 16);
+        quantized.posZ = position[2] | ((vertex.tangent.w < 0.f) ? (1u << 16) : 0u);
+        quantized.normal = encodeOctahedral(vertex.normal);
+        quantized.tangent = encodeOctahedral(glm::vec3(vertex.tangent));
+        quantized.texCoord0 = glm::packHalf2x16(vertex.texCoord0);
+        quantized.texCoord1 = glm::packHalf2x16(vertex.texCoord1);
+        return quantized;
+    }
+
+    template <typename T>
+    static void appendWords(std::vector<u32>& words, const T& data)
+    {
+        static_assert(sizeof(T) % sizeof(u32) == 0, "Vertices have to be made of whole words");
+        const u32* first = reinterpret_cast<const u32*>(&data);
+        words.insert(words.end(), first, first + sizeof(T) / sizeof(u32));
+    }
+
+    // square root of the ratio between the texture space and the object space area of a triangle mesh
+    static f32 calcTexCoordScale(const std::vector<Triangles::Vertex>& vertices, const std::vector<u32>& indices)
+    {
+        f32 objectSpaceArea = 0.f, texCoordArea = 0.f;
+        for (u32 i = 0; i + 2u < (u32)indices.size(); i += 3u)
+        {
+            const Triangles::Vertex& v0 = vertices[indices[i]];
+            const Triangles::Vertex& v1 = vertices[indices[i + 1u]];
+            const Triangles::Vertex& v2 = vertices[indices[i + 2u]];
+            objectSpaceArea += glm::length(glm::cross(v1.pos - v0.pos, v2.pos - v0.pos));
+            glm::vec2 e0 = v1.texCoord0 - v0.texCoord0, e1 = v2.texCoord0 - v0.texCoord0;
+            texCoordArea += fabsf(e0.x * e1.y - e0.y * e1.x);
+        }
+        return (objectSpaceArea > 0.f) ? sqrtf(texCoordArea / objectSpaceArea) : 0.f;
+    }
+
+    PackedGeometry::PackedGeometry(VertexFormat inVertexFormat)
+        : vertexFormat(inVertexFormat)
+        , vertexBuffer("VertexBuffer")
         , indexBuffer("IndexBuffer") 
         , submeshes("SubmeshBuffer") 
     {
+    }
+
+    void PackedGeometry::update(const Scene& scene)
+    {
+        u32 firstVertexWord = (u32)vertexBuffer.data.array.size();
+        u32 firstIndex = (u32)indexBuffer.data.array.size();
+        u32 firstSubmesh = (u32)submeshes.data.array.size();
+        u32 numPackedMeshes = 0u;
         for (auto meshInst : scene.meshInstances)
         {
             Mesh* mesh = meshInst->parent;
-            auto entry = meshMap.find(mesh->name);
-            if (entry == meshMap.end())
+            auto entry = numSubmeshesMap.find(mesh->name);
+            if (entry != numSubmeshesMap.end() && entry->second == mesh->numSubmeshes())
+            {
+                continue;
+            }
+            if (meshMap.find(mesh->name) == meshMap.end())
             {
                 meshMap.insert({ mesh->name, mesh });
                 meshes.push_back(mesh);
             }
+            // a mesh whose submeshes changed is packed again, its old geometry stays unused until the next full repack
+            submeshMap[mesh->name] = (u32)lodChains.size();
+            numSubmeshesMap[mesh->name] = mesh->numSubmeshes();
+            pack(mesh);
+            numPackedMeshes++;
         }
-
-        // build unified vertex buffer and index buffer
-        for (auto mesh : meshes)
+        if (numPackedMeshes == 0u)
         {
-            auto entry = submeshMap.find(mesh->name);
-            if (entry == submeshMap.end())
-                submeshMap.insert({ mesh->name, submeshes.data.array.size()});
+            return;
+        }
+
+        vertexBuffer.uploadAppended(firstVertexWord);
+        indexBuffer.uploadAppended(firstIndex);
+        submeshes.uploadAppended(firstSubmesh);
+        cyanInfo("Packed %u meshes, %u vertices in %.2f MB in total", numPackedMeshes, numVertices, (f32)vertexBuffer.data.getDynamicDataSizeInBytes() / (1024.f * 1024.f));
+    }
 
-            for (u32 i = 0; i < mesh->numSubmeshes(); ++i)
+    void PackedGeometry::pack(Mesh* mesh)
+    {
+        for (u32 i = 0; i < mesh->numSubmeshes(); ++i)
+        {
+            auto sm = mesh->getSubmesh(i);
+            if (auto triSubmesh = dynamic_cast<Mesh::Submesh<Triangles>*>(sm))
             {
-                auto sm = mesh->getSubmesh(i);
-                if (auto triSubmesh = dynamic_cast<Mesh::Submesh<Triangles>*>(sm))
+                auto& vertices = triSubmesh->getVertices();
+                u32 baseVertex = numVertices;
+                numVertices += (u32)vertices.size();
+
+                // quantized positions cover the submesh's aabb with 16 bits per axis
+                glm::vec3 positionMin(FLT_MAX), positionMax(-FLT_MAX);
+                for (const auto& vertex : vertices)
                 {
-                    auto& vertices = triSubmesh->getVertices();
-                    auto& indices = triSubmesh->getIndices();
-
-                    submeshes.data.array.push_back(
-                        {
-                            /*baseVertex=*/(u32)vertexBuffer.data.array.size(),
-                            /*baseIndex=*/(u32)indexBuffer.data.array.size(),
-                            /*numVertices=*/(u32)vertices.size(),
-                            /*numIndices=*/(u32)indices.size()
-                        }
-                    );
+                    positionMin = vec3Min(positionMin, vertex.pos);
+                    positionMax = vec3Max(positionMax, vertex.pos);
+                }
+                glm::vec3 positionScale = vertices.empty() ? glm::vec3(0.f) : (positionMax - positionMin) / 65535.f;
+
+                // every lod indexes into the same vertices
+                lodChains.emplace_back();
+                LodChain& lodChain = lodChains.back();
+                lodChain.baseSubmesh = (u32)submeshes.data.array.size();
+                lodChain.center = (triSubmesh->getMin() + triSubmesh->getMax()) * .5f;
+                lodChain.radius = glm::length(triSubmesh->getMax() - triSubmesh->getMin()) * .5f;
+                lodChain.texCoordScale = calcTexCoordScale(vertices, triSubmesh->getLodIndices(0));
+                for (u32 lod = 0; lod < triSubmesh->numLods(); ++lod)
+                {
+                    auto& indices = triSubmesh->getLodIndices(lod);
+                    SubmeshDesc desc = { };
+                    desc.baseVertex = baseVertex;
+                    desc.baseIndex = (u32)indexBuffer.data.array.size();
+                    desc.numVertices = (u32)vertices.size();
+                    desc.numIndices = (u32)indices.size();
+                    desc.positionMin = positionMin;
+                    desc.vertexFormat = (u32)vertexFormat;
+                    desc.positionScale = positionScale;
+                    submeshes.addElement(desc);
+                    for (u32 ii = 0; ii < indices.size(); ++ii)
+                    {
+                        indexBuffer.addElement(indices[ii]);
+                    }
+                    lodChain.errors.push_back(triSubmesh->getLodError(lod));
+                }
 
-                    for (u32 v = 0; v < vertices.size(); ++v)
+                for (u32 v = 0; v < vertices.size(); ++v)
+                {
+                    if (vertexFormat == VertexFormat::kQuantized)
+                    {
+                        appendWords(vertexBuffer.data.array, quantizeVertex(vertices[v], positionMin, positionScale));
+                    }
+                    else
                     {
-                        vertexBuffer.data.array.emplace_back();
-                        Vertex& vertex = vertexBuffer.data.array.back();
+                        Vertex vertex = { };
                         vertex.pos = glm::vec4(vertices[v].pos, 1.f);
                         vertex.normal = glm::vec4(vertices[v].normal, 0.f);
                         vertex.tangent = vertices[v].tangent;
                         vertex.texCoord = glm::vec4(vertices[v].texCoord0, vertices[v].texCoord1);
-                    }
-                    for (u32 ii = 0; ii < indices.size(); ++ii)
-                    {
-                        indexBuffer.addElement(indices[ii]);
+                        appendWords(vertexBuffer.data.array, vertex);
                     }
                 }
             }
         }
-
-        vertexBuffer.upload();
-        indexBuffer.upload();
-        submeshes.upload();
     }
 
     RenderableScene::Camera::Camera(const PerspectiveCamera& inCamera)
@@ -103,6 +215,7 @@ namespace Cyan
                 if (matlEntry == materialMap.end()) {
                     materialMap.insert({ matl->name, materialBuffer->getNumElements() });
                     materialBuffer->addElement(matl->buildGpuMaterial());
+                    materials.push_back(matl);
                     return materialBuffer->getNumElements() - 1;
                 }
                 else {
@@ -120,8 +233,19 @@ namespace Cyan
         materialBuffer = std::make_unique<MaterialBuffer>("MaterialBuffer");
         directionalLightBuffer = std::make_unique<DirectionalLightBuffer>("DirectionalLightBuffer");
 
+        /**
+        * repack everything when switching vertex formats at runtime, otherwise only meshes that show up or get filled in
+        * after packing, as they do while a scene is imported asynchronously, are appended
+        */
+        auto vertexFormat = Renderer::get()->m_settings.bQuantizedVertices ? PackedGeometry::VertexFormat::kQuantized : PackedGeometry::VertexFormat::kFull;
+        if (packedGeometry && packedGeometry->vertexFormat != vertexFormat)
+        {
+            delete packedGeometry;
+            packedGeometry = nullptr;
+        }
         if (!packedGeometry)
-            packedGeometry = new PackedGeometry(*inScene);
+            packedGeometry = new PackedGeometry(vertexFormat);
+        packedGeometry->update(*inScene);
 
         aabb = inScene->aabb;
 
@@ -180,13 +304,102 @@ namespace Cyan
                 assert(0);
             }
             for (u32 sm = 0; sm < mesh->numSubmeshes(); ++sm) {
-                InstanceDesc desc = { };
-                desc.submesh = baseSubmesh + sm;
-                desc.transform = i;
-                desc.material = getMaterialID(meshInstances[i], sm);
-                instanceBuffer->addElement(desc);
+                SubmeshInstance submeshInstance = { };
+                submeshInstance.lodChain = baseSubmesh + sm;
+                submeshInstance.transform = i;
+                submeshInstance.material = getMaterialID(meshInstances[i], sm);
+                submeshInstances.push_back(submeshInstance);
             }
         }
+        // lods are picked per view in upload(), start out at full resolution
+        selectLods(camera.view, camera.projection, 0.f);
+
+        // build lighting data
+        skybox = inScene->skybox;
+        skyLight = inScene->skyLight;
+    }
+
+    /**
+    * Pixels covered by one object space unit of a submesh instance at the point of its bounding sphere closest to the camera,
+    * FLT_MAX when the camera is inside the sphere. 'pixelsPerUnit' is for a distance of one, or for any distance with
+    * orthographic projections.
+    */
+    static f32 calcPixelsPerObjectUnit(const glm::mat4& view, const glm::mat4& transform, const PackedGeometry::LodChain& lodChain, f32 pixelsPerUnit, bool bPerspective)
+    {
+        f32 scale = Max(Max(glm::length(glm::vec3(transform[0])), glm::length(glm::vec3(transform[1]))), glm::length(glm::vec3(transform[2])));
+        f32 pixelsPerObjectUnit = pixelsPerUnit * scale;
+        if (bPerspective)
+        {
+            glm::vec3 viewSpaceCenter = glm::vec3(view * transform * glm::vec4(lodChain.center, 1.f));
+            f32 distance = -viewSpaceCenter.z - lodChain.radius * scale;
+            pixelsPerObjectUnit = (distance > 0.f) ? pixelsPerObjectUnit / distance : FLT_MAX;
+        }
+        return pixelsPerObjectUnit;
+    }
+
+    void RenderableScene::selectLods(const glm::mat4& view, const glm::mat4& projection, f32 viewportHeight)
+    {
+        f32 pixelsPerUnit = projection[1][1] * .5f * viewportHeight;
+        bool bPerspective = (projection[3][3] == 0.f);
+
+        instanceBuffer->data.array.clear();
+        for (const auto& submeshInstance : submeshInstances)
+        {
+            const PackedGeometry::LodChain& lodChain = packedGeometry->lodChains[submeshInstance.lodChain];
+            u32 lod = 0u;
+            if (viewportHeight > 0.f && maxLodScreenError > 0.f)
+            {
+                f32 pixelsPerObjectUnit = calcPixelsPerObjectUnit(view, (*transformBuffer)[submeshInstance.transform], lodChain, pixelsPerUnit, bPerspective);
+                while (lod + 1u < (u32)lodChain.errors.size() && lodChain.errors[lod + 1u] * pixelsPerObjectUnit <= maxLodScreenError)
+                {
+                    lod++;
+                }
+            }
+            InstanceDesc desc = { };
+            desc.submesh = lodChain.baseSubmesh + lod;
+            desc.material = submeshInstance.material;
+            desc.transform = submeshInstance.transform;
+            instanceBuffer->addElement(desc);
+        }
+        buildDrawCalls();
+    }
+
+    void RenderableScene::requestTextureMips(const glm::mat4& view, const glm::mat4& projection, f32 viewportHeight)
+    {
+        TextureStreamer* streamer = TextureStreamer::get();
+        if (streamer == nullptr || streamer->getNumTextures() == 0u || viewportHeight <= 0.f)
+        {
+            return;
+        }
+        f32 pixelsPerUnit = projection[1][1] * .5f * viewportHeight;
+        bool bPerspective = (projection[3][3] == 0.f);
+        for (const auto& submeshInstance : submeshInstances)
+        {
+            const PackedGeometry::LodChain& lodChain = packedGeometry->lodChains[submeshInstance.lodChain];
+            if (submeshInstance.material >= (u32)materials.size() || lodChain.texCoordScale <= 0.f)
+            {
+                continue;
+            }
+            f32 pixelsPerObjectUnit = calcPixelsPerObjectUnit(view, (*transformBuffer)[submeshInstance.transform], lodChain, pixelsPerUnit, bPerspective);
+            f32 texCoordsPerPixel = lodChain.texCoordScale / pixelsPerObjectUnit;
+            auto requestMip = [streamer, texCoordsPerPixel](Texture2DRenderable* texture) {
+                if (texture)
+                {
+                    f32 texelsPerPixel = texCoordsPerPixel * (f32)Max(texture->width, texture->height);
+                    streamer->requestMip(texture, (texelsPerPixel > 1.f) ? log2f(texelsPerPixel) : 0.f);
+                }
+            };
+            Material* material = materials[submeshInstance.material];
+            requestMip(material->albedoMap);
+            requestMip(material->normalMap);
+            requestMip(material->metallicRoughnessMap);
+            requestMip(material->occlusionMap);
+        }
+    }
+
+    void RenderableScene::buildDrawCalls()
+    {
+        drawCallBuffer->data.array.clear();
 
         // organize instance descriptors
         if (instanceBuffer->getNumElements() > 0) {
@@ -212,10 +425,6 @@ namespace Cyan
             }
             drawCallBuffer->addElement(instanceBuffer->getNumElements());
         }
-
-        // build lighting data
-        skybox = inScene->skybox;
-        skyLight = inScene->skyLight;
     }
 
     void RenderableScene::clone(RenderableScene& dst, const RenderableScene& src) 
@@ -223,11 +432,14 @@ namespace Cyan
         dst.aabb = src.aabb;
         dst.camera = src.camera;
         dst.meshInstances = src.meshInstances;
+        dst.submeshInstances = src.submeshInstances;
+        dst.maxLodScreenError = src.maxLodScreenError;
         dst.viewBuffer = std::unique_ptr<ViewBuffer>(src.viewBuffer->clone());
         dst.transformBuffer = std::unique_ptr<TransformBuffer>(src.transformBuffer->clone());
         dst.instanceBuffer = std::unique_ptr<InstanceBuffer>(src.instanceBuffer->clone());
         dst.drawCallBuffer = std::unique_ptr<DrawCallBuffer>(src.drawCallBuffer->clone());
         dst.materialBuffer = std::unique_ptr<MaterialBuffer>(src.materialBuffer->clone());
+        dst.materials = src.materials;
         dst.skybox = src.skybox;
         dst.skyLight = src.skyLight;
         dst.directionalLights = src.directionalLights;
@@ -253,7 +465,7 @@ namespace Cyan
     void RenderableScene::upload() 
     {
         auto gfxc = Renderer::get()->getGfxCtx();
-        gfxc->setShaderStorageBuffer<DynamicSsboData<PackedGeometry::Vertex>>(&packedGeometry->vertexBuffer);
+        gfxc->setShaderStorageBuffer<DynamicSsboData<u32>>(&packedGeometry->vertexBuffer);
         gfxc->setShaderStorageBuffer<DynamicSsboData<u32>>(&packedGeometry->indexBuffer);
         gfxc->setShaderStorageBuffer<DynamicSsboData<PackedGeometry::SubmeshDesc>>(&packedGeometry->submeshes);
         // view
@@ -262,6 +474,8 @@ namespace Cyan
         viewBuffer->upload();
         gfxc->setShaderStorageBuffer<StaticSsboData<View>>(viewBuffer.get());
 
+        selectLods(camera.view, camera.projection, (f32)gfxc->getViewport().height);
+
         transformBuffer->upload();
         gfxc->setShaderStorageBuffer<DynamicSsboData<glm::mat4>>(transformBuffer.get());
 
@@ -270,6 +484,10 @@ namespace Cyan
 
         materialBuffer->upload();
         gfxc->setShaderStorageBuffer<DynamicSsboData<GpuMaterial>>(materialBuffer.get());
+        if (TextureStreamer* streamer = TextureStreamer::get())
+        {
+            gfxc->setShaderStorageBuffer<DynamicSsboData<f32>>(&streamer->getResidencyBuffer());
+        }
 
         drawCallBuffer->upload();
         gfxc->setShaderStorageBuffer<DynamicSsboData<u32>>(drawCallBuffer.get());
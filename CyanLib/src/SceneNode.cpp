@@ -88,6 +88,12 @@ namespace Cyan
         return m_scene->globalTransformMatrixPool.getObject(globalTransform);
     }
 
+    void SceneComponent::setLocalTransform(const Transform& transform)
+    {
+        m_scene->localTransformPool.getObject(localTransform) = transform;
+        m_scene->localTransformMatrixPool.getObject(localTransform) = transform.toMatrix();
+    }
+
 #if 0
     // basic depth first traversal
     void SceneNode::updateWorldTransform()
@@ -0,0 +1,387 @@
+#include <fstream>
+#include <vector>
+
+#include "TextureCache.h"
+#include "Hash.h"
+#include "MappedFile.h"
+
+namespace Cyan
+{
+    using PixelFormat = ITextureRenderable::Spec::PixelFormat;
+
+    static const u8 kKtx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+    struct Ktx2Header
+    {
+        u8 identifier[12];
+        u32 vkFormat;
+        u32 typeSize;
+        u32 pixelWidth;
+        u32 pixelHeight;
+        u32 pixelDepth;
+        u32 layerCount;
+        u32 faceCount;
+        u32 levelCount;
+        u32 supercompressionScheme;
+        u32 dfdByteOffset;
+        u32 dfdByteLength;
+        u32 kvdByteOffset;
+        u32 kvdByteLength;
+        u64 sgdByteOffset;
+        u64 sgdByteLength;
+    };
+
+    struct Ktx2Level
+    {
+        u64 byteOffset;
+        u64 byteLength;
+        u64 uncompressedByteLength;
+    };
+
+    static_assert(sizeof(Ktx2Header) == 80, "KTX2 header has to be 80 bytes");
+    static_assert(sizeof(Ktx2Level) == 24, "KTX2 level index entries have to be 24 bytes");
+
+    // one sample of a data format descriptor, 'bitLength' and the channel are written down as the spec wants them
+    struct Ktx2Sample
+    {
+        u16 bitOffset;
+        u8 bitLength;
+        u8 channelType;
+        u32 sampleLower;
+        u32 sampleUpper;
+    };
+
+    struct Ktx2Format
+    {
+        PixelFormat pixelFormat;
+        u32 vkFormat;
+        // 0 when the format has no srgb variant
+        u32 vkFormatSRGB;
+        u8 colorModel;
+        u32 numSamples;
+        Ktx2Sample samples[2];
+    };
+
+    static const Ktx2Format kKtx2Formats[] = {
+        { PixelFormat::BC1, 131u, 132u, 128u, 1u, { { 0u, 63u, 0u, 0u, 0xFFFFFFFFu } } },
+        { PixelFormat::BC3, 137u, 138u, 130u, 2u, { { 0u, 63u, 15u, 0u, 0xFFFFFFFFu }, { 64u, 63u, 0u, 0u, 0xFFFFFFFFu } } },
+        { PixelFormat::BC5, 141u, 0u, 132u, 2u, { { 0u, 63u, 0u, 0u, 0xFFFFFFFFu }, { 64u, 63u, 1u, 0u, 0xFFFFFFFFu } } },
+        // unsigned float, from 0.f to 1.f
+        { PixelFormat::BC6H, 143u, 0u, 133u, 1u, { { 0u, 127u, 0x80u, 0u, 0x3F800000u } } },
+        { PixelFormat::BC7, 145u, 146u, 134u, 1u, { { 0u, 127u, 0u, 0u, 0xFFFFFFFFu } } },
+    };
+
+    static const Ktx2Format* findKtx2Format(u32 vkFormat)
+    {
+        for (const Ktx2Format& format : kKtx2Formats)
+        {
+            if (format.vkFormat == vkFormat || (format.vkFormatSRGB != 0u && format.vkFormatSRGB == vkFormat))
+            {
+                return &format;
+            }
+        }
+        return nullptr;
+    }
+
+    static const Ktx2Format* findKtx2Format(PixelFormat pixelFormat)
+    {
+        for (const Ktx2Format& format : kKtx2Formats)
+        {
+            if (format.pixelFormat == pixelFormat)
+            {
+                return &format;
+            }
+        }
+        return nullptr;
+    }
+
+    template <typename T>
+    static void appendValue(std::vector<u8>& out, const T& value)
+    {
+        const u8* bytes = reinterpret_cast<const u8*>(&value);
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    static void appendKeyValue(std::vector<u8>& out, const char* key, const void* value, u32 valueSize)
+    {
+        u32 keySize = (u32)strlen(key) + 1u;
+        appendValue(out, keySize + valueSize);
+        out.insert(out.end(), key, key + keySize);
+        out.insert(out.end(), reinterpret_cast<const u8*>(value), reinterpret_cast<const u8*>(value) + valueSize);
+        out.resize((out.size() + 3u) & ~(size_t)3u, 0u);
+    }
+
+    static u64 alignOffset(u64 offset, u64 alignment)
+    {
+        return (offset + alignment - 1u) / alignment * alignment;
+    }
+
+    TextureCache::TextureCache(const char* directory)
+        : m_directory(directory)
+    {
+        if (!m_directory.empty() && m_directory.back() != '/' && m_directory.back() != '\\')
+        {
+            m_directory.push_back('/');
+        }
+    }
+
+    std::string TextureCache::getFilename(const char* key, TextureCompressor::Role role) const
+    {
+        std::string fullKey = std::string(key) + '#' + std::to_string((u32)role);
+        char name[32];
+        sprintf_s(name, "%016llx.ktx2", (unsigned long long)hashBytes(fullKey.data(), fullKey.size()));
+        return m_directory + name;
+    }
+
+    bool TextureCache::isKtx2(const u8* data, u64 size)
+    {
+        return size >= sizeof(kKtx2Identifier) && memcmp(data, kKtx2Identifier, sizeof(kKtx2Identifier)) == 0;
+    }
+
+    u32 TextureCache::findMipTail(u32 width, u32 height, u32 numMips, u32 maxMipSize)
+    {
+        if (maxMipSize == 0u)
+        {
+            return 0u;
+        }
+        u32 mip = 0u;
+        while (mip + 1u < numMips && Max(width >> mip, height >> mip) > maxMipSize)
+        {
+            ++mip;
+        }
+        return mip;
+    }
+
+    bool TextureCache::load(const char* key, TextureCompressor::Role role, u64 sourceSize, u64 sourceHash, ITextureRenderable::Spec& outSpec, u32 maxMipSize) const
+    {
+        std::string filename = getFilename(key, role);
+        MappedFile file;
+        if (!file.open(filename.c_str()))
+        {
+            return false;
+        }
+        ITextureRenderable::Spec spec = outSpec;
+        SourceInfo source = { };
+        if (!readKtx2(file.getData(), file.getSize(), spec, &source, maxMipSize))
+        {
+            cyanError("Texture cache file %s is corrupted", filename.c_str());
+            return false;
+        }
+        if (source.version != kCacheVersion || source.role != (u32)role || source.sourceSize != sourceSize || source.sourceHash != sourceHash)
+        {
+            delete[] spec.pixelData;
+            return false;
+        }
+        outSpec = spec;
+        return true;
+    }
+
+    bool TextureCache::save(const char* key, TextureCompressor::Role role, u64 sourceSize, u64 sourceHash, const ITextureRenderable::Spec& spec) const
+    {
+        SourceInfo source = { };
+        source.version = kCacheVersion;
+        source.role = (u32)role;
+        source.sourceSize = sourceSize;
+        source.sourceHash = sourceHash;
+        createDirectories(m_directory.c_str());
+        return writeKtx2(getFilename(key, role).c_str(), spec, role == TextureCompressor::Role::kAlbedo, &source);
+    }
+
+    // validates the header and the level index of a KTX2 file that readKtx2() can load
+    static const Ktx2Format* parseKtx2(const u8* data, u64 size, Ktx2Header& outHeader, std::vector<Ktx2Level>& outLevels)
+    {
+        if (!TextureCache::isKtx2(data, size) || size < sizeof(Ktx2Header))
+        {
+            return nullptr;
+        }
+        memcpy(&outHeader, data, sizeof(outHeader));
+        const Ktx2Format* format = findKtx2Format(outHeader.vkFormat);
+        // plain 2d textures only, with every level present and nothing supercompressed
+        if (format == nullptr || outHeader.supercompressionScheme != 0u || outHeader.pixelWidth == 0u || outHeader.pixelHeight == 0u
+            || outHeader.pixelDepth > 1u || outHeader.layerCount > 1u || outHeader.faceCount != 1u || outHeader.levelCount == 0u)
+        {
+            return nullptr;
+        }
+        if (sizeof(Ktx2Header) + (u64)outHeader.levelCount * sizeof(Ktx2Level) > size)
+        {
+            return nullptr;
+        }
+        outLevels.resize(outHeader.levelCount);
+        memcpy(outLevels.data(), data + sizeof(Ktx2Header), outLevels.size() * sizeof(Ktx2Level));
+        for (u32 l = 0, width = outHeader.pixelWidth, height = outHeader.pixelHeight; l < outHeader.levelCount; ++l)
+        {
+            u64 expectedSize = ITextureRenderable::getBlockCompressedSize(format->pixelFormat, width, height);
+            if (outLevels[l].byteLength != expectedSize || outLevels[l].byteOffset + outLevels[l].byteLength > size)
+            {
+                return nullptr;
+            }
+            width = Max(width / 2u, 1u);
+            height = Max(height / 2u, 1u);
+        }
+        return format;
+    }
+
+    bool TextureCache::readKtx2(const u8* data, u64 size, ITextureRenderable::Spec& outSpec, SourceInfo* outSource, u32 maxMipSize)
+    {
+        Ktx2Header header;
+        std::vector<Ktx2Level> levels;
+        const Ktx2Format* format = parseKtx2(data, size, header, levels);
+        if (format == nullptr)
+        {
+            return false;
+        }
+        u32 firstMip = findMipTail(header.pixelWidth, header.pixelHeight, header.levelCount, maxMipSize);
+        u64 totalSize = 0u;
+        for (u32 l = firstMip; l < header.levelCount; ++l)
+        {
+            totalSize += levels[l].byteLength;
+        }
+
+        if (outSource)
+        {
+            *outSource = { };
+            u64 kvdEnd = (u64)header.kvdByteOffset + header.kvdByteLength;
+            for (u64 offset = header.kvdByteOffset; kvdEnd <= size && offset + sizeof(u32) <= kvdEnd; )
+            {
+                u32 entrySize;
+                memcpy(&entrySize, data + offset, sizeof(u32));
+                const char* key = reinterpret_cast<const char*>(data + offset + sizeof(u32));
+                if (offset + sizeof(u32) + entrySize > kvdEnd)
+                {
+                    break;
+                }
+                u32 keySize = (u32)strnlen(key, entrySize) + 1u;
+                if (strcmp(key, "CyanSource") == 0 && entrySize - keySize == sizeof(SourceInfo))
+                {
+                    memcpy(outSource, key + keySize, sizeof(SourceInfo));
+                }
+                offset = alignOffset(offset + sizeof(u32) + entrySize, 4u);
+            }
+        }
+
+        u8* pixelData = new u8[totalSize];
+        u8* levelData = pixelData;
+        for (u32 l = firstMip; l < header.levelCount; ++l)
+        {
+            memcpy(levelData, data + levels[l].byteOffset, levels[l].byteLength);
+            levelData += levels[l].byteLength;
+        }
+        outSpec.type = ITextureRenderable::Spec::Type::kTex2D;
+        outSpec.width = header.pixelWidth;
+        outSpec.height = header.pixelHeight;
+        outSpec.depth = 1u;
+        outSpec.numMips = header.levelCount;
+        outSpec.pixelFormat = format->pixelFormat;
+        outSpec.pixelData = pixelData;
+        outSpec.firstMip = firstMip;
+        return true;
+    }
+
+    bool TextureCache::readKtx2Level(const u8* data, u64 size, u32 level, std::vector<u8>& outBlocks)
+    {
+        Ktx2Header header;
+        std::vector<Ktx2Level> levels;
+        if (parseKtx2(data, size, header, levels) == nullptr || level >= header.levelCount)
+        {
+            return false;
+        }
+        outBlocks.assign(data + levels[level].byteOffset, data + levels[level].byteOffset + levels[level].byteLength);
+        return true;
+    }
+
+    bool TextureCache::writeKtx2(const char* filename, const ITextureRenderable::Spec& spec, bool bSRGB, const SourceInfo* source)
+    {
+        const Ktx2Format* format = findKtx2Format(spec.pixelFormat);
+        // only whole mip chains are written out
+        if (format == nullptr || spec.pixelData == nullptr || spec.firstMip != 0u)
+        {
+            return false;
+        }
+        u32 blockSize = (spec.pixelFormat == PixelFormat::BC1) ? 8u : 16u;
+        bool bWriteSRGB = bSRGB && format->vkFormatSRGB != 0u;
+
+        Ktx2Header header = { };
+        memcpy(header.identifier, kKtx2Identifier, sizeof(kKtx2Identifier));
+        header.vkFormat = bWriteSRGB ? format->vkFormatSRGB : format->vkFormat;
+        header.typeSize = 1u;
+        header.pixelWidth = spec.width;
+        header.pixelHeight = spec.height;
+        header.faceCount = 1u;
+        header.levelCount = spec.numMips;
+
+        // data format descriptor, a single basic block
+        std::vector<u8> dfd;
+        appendValue(dfd, (u32)(sizeof(u32) + 24u + 16u * format->numSamples));
+        appendValue(dfd, 0u);
+        appendValue(dfd, (u32)(2u | ((24u + 16u * format->numSamples) << 16)));
+        // color model, bt709 primaries, transfer function and straight alpha
+        const u8 model[4] = { format->colorModel, 1u, (u8)(bWriteSRGB ? 2u : 1u), 0u };
+        const u8 blockDimensions[4] = { 3u, 3u, 0u, 0u };
+        const u8 bytesPlanes[8] = { (u8)blockSize };
+        dfd.insert(dfd.end(), model, model + 4);
+        dfd.insert(dfd.end(), blockDimensions, blockDimensions + 4);
+        dfd.insert(dfd.end(), bytesPlanes, bytesPlanes + 8);
+        for (u32 s = 0; s < format->numSamples; ++s)
+        {
+            const Ktx2Sample& sample = format->samples[s];
+            appendValue(dfd, (u32)(sample.bitOffset | (sample.bitLength << 16) | (sample.channelType << 24)));
+            appendValue(dfd, 0u);
+            appendValue(dfd, sample.sampleLower);
+            appendValue(dfd, sample.sampleUpper);
+        }
+
+        // key/value pairs sorted by key
+        std::vector<u8> kvd;
+        if (source)
+        {
+            appendKeyValue(kvd, "CyanSource", source, sizeof(SourceInfo));
+        }
+        appendKeyValue(kvd, "KTXorientation", "ru", 3u);
+        appendKeyValue(kvd, "KTXwriter", "Cyan TextureCache", 18u);
+
+        std::vector<Ktx2Level> levels(spec.numMips);
+        header.dfdByteOffset = (u32)(sizeof(Ktx2Header) + levels.size() * sizeof(Ktx2Level));
+        header.dfdByteLength = (u32)dfd.size();
+        header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+        header.kvdByteLength = (u32)kvd.size();
+
+        // levels are stored smallest first, each aligned to a block
+        std::vector<u64> mipOffsets(spec.numMips);
+        u64 mipOffset = 0u;
+        for (u32 l = 0, width = spec.width, height = spec.height; l < spec.numMips; ++l)
+        {
+            mipOffsets[l] = mipOffset;
+            levels[l].byteLength = ITextureRenderable::getBlockCompressedSize(spec.pixelFormat, width, height);
+            levels[l].uncompressedByteLength = levels[l].byteLength;
+            mipOffset += levels[l].byteLength;
+            width = Max(width / 2u, 1u);
+            height = Max(height / 2u, 1u);
+        }
+        u64 offset = (u64)header.kvdByteOffset + header.kvdByteLength;
+        for (i32 l = (i32)spec.numMips - 1; l >= 0; --l)
+        {
+            levels[l].byteOffset = alignOffset(offset, blockSize);
+            offset = levels[l].byteOffset + levels[l].byteLength;
+        }
+
+        std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+        if (!file.is_open())
+        {
+            cyanError("Failed to open %s for writing texture cache", filename);
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(Ktx2Level));
+        file.write(reinterpret_cast<const char*>(dfd.data()), dfd.size());
+        file.write(reinterpret_cast<const char*>(kvd.data()), kvd.size());
+        const char padding[16] = { };
+        u64 written = (u64)header.kvdByteOffset + header.kvdByteLength;
+        for (i32 l = (i32)spec.numMips - 1; l >= 0; --l)
+        {
+            file.write(padding, levels[l].byteOffset - written);
+            file.write(reinterpret_cast<const char*>(spec.pixelData + mipOffsets[l]), levels[l].byteLength);
+            written = levels[l].byteOffset + levels[l].byteLength;
+        }
+        return file.good();
+    }
+}
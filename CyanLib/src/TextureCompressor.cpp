@@ -0,0 +1,918 @@
+#include <array>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+#include "gtc/packing.hpp"
+
+#include "TextureCompressor.h"
+#include "ThreadPool.h"
+
+namespace Cyan
+{
+    // interpolation weights out of 64 shared by BC7 and BC6H for 4 bit indices
+    static const u32 kBptcWeights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+    // writes and reads little endian bit streams of up to 128 bits, least significant bit first
+    struct BlockBitWriter
+    {
+        BlockBitWriter(u8* inBytes, u32 numBytes)
+            : bytes(inBytes)
+        {
+            memset(bytes, 0, numBytes);
+        }
+
+        void write(u32 value, u32 numBits)
+        {
+            for (u32 i = 0; i < numBits; ++i, ++bit)
+            {
+                bytes[bit / 8u] |= (u8)(((value >> i) & 1u) << (bit % 8u));
+            }
+        }
+
+        u8* bytes;
+        u32 bit = 0u;
+    };
+
+    struct BlockBitReader
+    {
+        explicit BlockBitReader(const u8* inBytes)
+            : bytes(inBytes)
+        {
+        }
+
+        u32 read(u32 numBits)
+        {
+            u32 value = 0u;
+            for (u32 i = 0; i < numBits; ++i, ++bit)
+            {
+                value |= ((bytes[bit / 8u] >> (bit % 8u)) & 1u) << i;
+            }
+            return value;
+        }
+
+        const u8* bytes;
+        u32 bit = 0u;
+    };
+
+    /**
+    * Direction of largest variance of 'numValues' points with 'numDims' components, found by power iteration on their
+    * covariance matrix. Falls back to the diagonal for blocks of a single color.
+    */
+    static void calcPrincipalAxis(const f32* values, u32 numValues, u32 numDims, f32* outMean, f32* outAxis)
+    {
+        f32 covariance[4][4] = { };
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            outMean[d] = 0.f;
+            for (u32 i = 0; i < numValues; ++i)
+            {
+                outMean[d] += values[i * numDims + d];
+            }
+            outMean[d] /= (f32)numValues;
+        }
+        for (u32 i = 0; i < numValues; ++i)
+        {
+            for (u32 r = 0; r < numDims; ++r)
+            {
+                for (u32 c = 0; c < numDims; ++c)
+                {
+                    covariance[r][c] += (values[i * numDims + r] - outMean[r]) * (values[i * numDims + c] - outMean[c]);
+                }
+            }
+        }
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            outAxis[d] = 1.f;
+        }
+        for (u32 iteration = 0; iteration < 8u; ++iteration)
+        {
+            f32 next[4] = { };
+            f32 length = 0.f;
+            for (u32 r = 0; r < numDims; ++r)
+            {
+                for (u32 c = 0; c < numDims; ++c)
+                {
+                    next[r] += covariance[r][c] * outAxis[c];
+                }
+                length += next[r] * next[r];
+            }
+            if (length <= 1e-12f)
+            {
+                break;
+            }
+            length = sqrtf(length);
+            for (u32 d = 0; d < numDims; ++d)
+            {
+                outAxis[d] = next[d] / length;
+            }
+        }
+        f32 length = 0.f;
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            length += outAxis[d] * outAxis[d];
+        }
+        length = sqrtf(length);
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            outAxis[d] /= length;
+        }
+    }
+
+    /**
+    * Endpoints of the segment along the principal axis that covers every value, 'outEnd0' at the low end
+    */
+    static void fitEndpoints(const f32* values, u32 numValues, u32 numDims, f32* outEnd0, f32* outEnd1)
+    {
+        f32 mean[4], axis[4];
+        calcPrincipalAxis(values, numValues, numDims, mean, axis);
+        f32 minT = FLT_MAX, maxT = -FLT_MAX;
+        for (u32 i = 0; i < numValues; ++i)
+        {
+            f32 t = 0.f;
+            for (u32 d = 0; d < numDims; ++d)
+            {
+                t += (values[i * numDims + d] - mean[d]) * axis[d];
+            }
+            minT = Min(minT, t);
+            maxT = Max(maxT, t);
+        }
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            outEnd0[d] = mean[d] + axis[d] * minT;
+            outEnd1[d] = mean[d] + axis[d] * maxT;
+        }
+    }
+
+    /**
+    * Least squares endpoints for fixed interpolation weights, 'weights' being how far each value sits from 'outEnd0'
+    * towards 'outEnd1'. Fails when every value uses the same weight.
+    */
+    static bool refineEndpoints(const f32* values, const f32* weights, u32 numValues, u32 numDims, f32* outEnd0, f32* outEnd1)
+    {
+        f32 a00 = 0.f, a01 = 0.f, a11 = 0.f;
+        f32 b0[4] = { }, b1[4] = { };
+        for (u32 i = 0; i < numValues; ++i)
+        {
+            f32 w1 = weights[i], w0 = 1.f - w1;
+            a00 += w0 * w0;
+            a01 += w0 * w1;
+            a11 += w1 * w1;
+            for (u32 d = 0; d < numDims; ++d)
+            {
+                b0[d] += w0 * values[i * numDims + d];
+                b1[d] += w1 * values[i * numDims + d];
+            }
+        }
+        f32 determinant = a00 * a11 - a01 * a01;
+        if (fabsf(determinant) < 1e-6f)
+        {
+            return false;
+        }
+        for (u32 d = 0; d < numDims; ++d)
+        {
+            outEnd0[d] = (a11 * b0[d] - a01 * b1[d]) / determinant;
+            outEnd1[d] = (a00 * b1[d] - a01 * b0[d]) / determinant;
+        }
+        return true;
+    }
+
+    static u32 quantize(f32 value, u32 maxValue)
+    {
+        return (u32)Min(Max(value * (f32)maxValue / 255.f + .5f, 0.f), (f32)maxValue);
+    }
+
+    static u16 packRGB565(const f32* color)
+    {
+        return (u16)((quantize(color[0], 31u) << 11) | (quantize(color[1], 63u) << 5) | quantize(color[2], 31u));
+    }
+
+    static void unpackRGB565(u16 packed, f32* outColor)
+    {
+        u32 r = (packed >> 11) & 31u, g = (packed >> 5) & 63u, b = packed & 31u;
+        outColor[0] = (f32)((r << 3) | (r >> 2));
+        outColor[1] = (f32)((g << 2) | (g >> 4));
+        outColor[2] = (f32)((b << 3) | (b >> 2));
+    }
+
+    // picks the closest of the four colors BC1 interpolates between c0 and c1, returns the total squared error
+    static f32 fitBC1Indices(const f32* colors, u16 c0, u16 c1, u32* outIndices)
+    {
+        f32 palette[4][3];
+        unpackRGB565(c0, palette[0]);
+        unpackRGB565(c1, palette[1]);
+        for (u32 d = 0; d < 3; ++d)
+        {
+            palette[2][d] = (2.f * palette[0][d] + palette[1][d]) / 3.f;
+            palette[3][d] = (palette[0][d] + 2.f * palette[1][d]) / 3.f;
+        }
+        f32 totalError = 0.f;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            f32 bestError = FLT_MAX;
+            for (u32 p = 0; p < 4; ++p)
+            {
+                f32 error = 0.f;
+                for (u32 d = 0; d < 3; ++d)
+                {
+                    f32 delta = colors[i * 3 + d] - palette[p][d];
+                    error += delta * delta;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    outIndices[i] = p;
+                }
+            }
+            totalError += bestError;
+        }
+        return totalError;
+    }
+
+    void TextureCompressor::encodeBC1(const u8 rgba[64], u8 outBlock[8])
+    {
+        f32 colors[48];
+        for (u32 i = 0; i < 16; ++i)
+        {
+            for (u32 d = 0; d < 3; ++d)
+            {
+                colors[i * 3 + d] = (f32)rgba[i * 4 + d];
+            }
+        }
+        f32 end0[3], end1[3];
+        fitEndpoints(colors, 16u, 3u, end0, end1);
+        u16 c0 = packRGB565(end1), c1 = packRGB565(end0);
+        u32 indices[16];
+        f32 error = fitBC1Indices(colors, c0, c1, indices);
+
+        // one round of least squares usually recovers most of what quantizing the endpoints lost
+        const f32 kIndexWeights[4] = { 0.f, 1.f, 1.f / 3.f, 2.f / 3.f };
+        f32 weights[16];
+        for (u32 i = 0; i < 16; ++i)
+        {
+            weights[i] = kIndexWeights[indices[i]];
+        }
+        if (refineEndpoints(colors, weights, 16u, 3u, end0, end1))
+        {
+            u32 refinedIndices[16];
+            u16 refined0 = packRGB565(end0), refined1 = packRGB565(end1);
+            f32 refinedError = fitBC1Indices(colors, refined0, refined1, refinedIndices);
+            if (refinedError < error)
+            {
+                c0 = refined0;
+                c1 = refined1;
+                memcpy(indices, refinedIndices, sizeof(indices));
+            }
+        }
+
+        // c0 > c1 selects four colors, equal endpoints would select three colors and black so they use index 0 only
+        if (c0 < c1)
+        {
+            std::swap(c0, c1);
+            for (u32 i = 0; i < 16; ++i)
+            {
+                indices[i] ^= 1u;
+            }
+        }
+        u32 packedIndices = 0u;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            packedIndices |= ((c0 == c1) ? 0u : indices[i]) << (i * 2u);
+        }
+        memcpy(outBlock, &c0, 2);
+        memcpy(outBlock + 2, &c1, 2);
+        memcpy(outBlock + 4, &packedIndices, 4);
+    }
+
+    // single channel block shared by BC3's alpha and both channels of BC5, interpolates eight values between min and max
+    static void encodeBC4(const u8 rgba[64], u32 channel, u8 outBlock[8])
+    {
+        u8 values[16];
+        u8 minValue = 255u, maxValue = 0u;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            values[i] = rgba[i * 4 + channel];
+            minValue = Min(minValue, values[i]);
+            maxValue = Max(maxValue, values[i]);
+        }
+        outBlock[0] = maxValue;
+        outBlock[1] = minValue;
+        f32 palette[8] = { (f32)maxValue, (f32)minValue };
+        for (u32 p = 2; p < 8; ++p)
+        {
+            palette[p] = ((f32)(8u - p) * maxValue + (f32)(p - 1u) * minValue) / 7.f;
+        }
+        u64 packedIndices = 0u;
+        if (maxValue > minValue)
+        {
+            for (u32 i = 0; i < 16; ++i)
+            {
+                u32 bestIndex = 0u;
+                f32 bestError = FLT_MAX;
+                for (u32 p = 0; p < 8; ++p)
+                {
+                    f32 error = fabsf((f32)values[i] - palette[p]);
+                    if (error < bestError)
+                    {
+                        bestError = error;
+                        bestIndex = p;
+                    }
+                }
+                packedIndices |= (u64)bestIndex << (i * 3u);
+            }
+        }
+        for (u32 b = 0; b < 6; ++b)
+        {
+            outBlock[2 + b] = (u8)(packedIndices >> (b * 8u));
+        }
+    }
+
+    void TextureCompressor::encodeBC3(const u8 rgba[64], u8 outBlock[16])
+    {
+        encodeBC4(rgba, 3u, outBlock);
+        encodeBC1(rgba, outBlock + 8);
+    }
+
+    void TextureCompressor::encodeBC5(const u8 rgba[64], u8 outBlock[16])
+    {
+        encodeBC4(rgba, 0u, outBlock);
+        encodeBC4(rgba, 1u, outBlock + 8);
+    }
+
+    /**
+    * BC7 mode 6, one subset with 7 bit rgba endpoints, a shared lowest bit per endpoint and 4 bit indices. Returns the
+    * total squared error of the endpoints quantized with the given p bits.
+    */
+    static f32 fitBC7Mode6(const f32* values, const f32* end0, const f32* end1, u32 p0, u32 p1, u32* outEndpoints, u32* outIndices)
+    {
+        u32 endpoints[2][4];
+        for (u32 d = 0; d < 4; ++d)
+        {
+            endpoints[0][d] = (u32)Min(Max((end0[d] - (f32)p0) * .5f + .5f, 0.f), 127.f);
+            endpoints[1][d] = (u32)Min(Max((end1[d] - (f32)p1) * .5f + .5f, 0.f), 127.f);
+        }
+        f32 palette[16][4];
+        for (u32 p = 0; p < 16; ++p)
+        {
+            for (u32 d = 0; d < 4; ++d)
+            {
+                u32 e0 = (endpoints[0][d] << 1) | p0, e1 = (endpoints[1][d] << 1) | p1;
+                palette[p][d] = (f32)(((64u - kBptcWeights4[p]) * e0 + kBptcWeights4[p] * e1 + 32u) >> 6);
+            }
+        }
+        f32 totalError = 0.f;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            f32 bestError = FLT_MAX;
+            for (u32 p = 0; p < 16; ++p)
+            {
+                f32 error = 0.f;
+                for (u32 d = 0; d < 4; ++d)
+                {
+                    f32 delta = values[i * 4 + d] - palette[p][d];
+                    error += delta * delta;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    outIndices[i] = p;
+                }
+            }
+            totalError += bestError;
+        }
+        memcpy(outEndpoints, endpoints, sizeof(endpoints));
+        return totalError;
+    }
+
+    void TextureCompressor::encodeBC7(const u8 rgba[64], u8 outBlock[16])
+    {
+        f32 values[64];
+        for (u32 i = 0; i < 64; ++i)
+        {
+            values[i] = (f32)rgba[i];
+        }
+        f32 end0[4], end1[4];
+        fitEndpoints(values, 16u, 4u, end0, end1);
+
+        f32 bestError = FLT_MAX;
+        u32 bestEndpoints[8], bestIndices[16], bestP0 = 0u, bestP1 = 0u;
+        for (u32 pass = 0; pass < 2u; ++pass)
+        {
+            for (u32 pbits = 0; pbits < 4u; ++pbits)
+            {
+                u32 endpoints[8], indices[16];
+                f32 error = fitBC7Mode6(values, end0, end1, pbits & 1u, pbits >> 1, endpoints, indices);
+                if (error < bestError)
+                {
+                    bestError = error;
+                    bestP0 = pbits & 1u;
+                    bestP1 = pbits >> 1;
+                    memcpy(bestEndpoints, endpoints, sizeof(endpoints));
+                    memcpy(bestIndices, indices, sizeof(indices));
+                }
+            }
+            f32 weights[16];
+            for (u32 i = 0; i < 16; ++i)
+            {
+                weights[i] = (f32)kBptcWeights4[bestIndices[i]] / 64.f;
+            }
+            if (!refineEndpoints(values, weights, 16u, 4u, end0, end1))
+            {
+                break;
+            }
+        }
+
+        // the first texel's index drops its highest bit, which has to be 0
+        if (bestIndices[0] >= 8u)
+        {
+            for (u32 d = 0; d < 4; ++d)
+            {
+                std::swap(bestEndpoints[d], bestEndpoints[4 + d]);
+            }
+            std::swap(bestP0, bestP1);
+            for (u32 i = 0; i < 16; ++i)
+            {
+                bestIndices[i] = 15u - bestIndices[i];
+            }
+        }
+        BlockBitWriter writer(outBlock, 16u);
+        writer.write(1u << 6, 7u);
+        for (u32 d = 0; d < 4; ++d)
+        {
+            writer.write(bestEndpoints[d], 7u);
+            writer.write(bestEndpoints[4 + d], 7u);
+        }
+        writer.write(bestP0, 1u);
+        writer.write(bestP1, 1u);
+        for (u32 i = 0; i < 16; ++i)
+        {
+            writer.write(bestIndices[i], (i == 0u) ? 3u : 4u);
+        }
+    }
+
+    // BC6H unsigned endpoints are 10 bits, unquantized to 16 bits and finally scaled down into half float bits
+    static u32 unquantizeBC6H(u32 endpoint)
+    {
+        if (endpoint == 0u)
+        {
+            return 0u;
+        }
+        if (endpoint == 1023u)
+        {
+            return 0xFFFFu;
+        }
+        return ((endpoint << 16) + 0x8000u) >> 10;
+    }
+
+    static f32 fitBC6HMode11(const f32* values, const f32* end0, const f32* end1, u32* outEndpoints, u32* outIndices)
+    {
+        u32 endpoints[2][3];
+        for (u32 d = 0; d < 3; ++d)
+        {
+            endpoints[0][d] = (u32)Min(Max((end0[d] - 32.f) / 64.f + .5f, 0.f), 1023.f);
+            endpoints[1][d] = (u32)Min(Max((end1[d] - 32.f) / 64.f + .5f, 0.f), 1023.f);
+        }
+        f32 palette[16][3];
+        for (u32 p = 0; p < 16; ++p)
+        {
+            for (u32 d = 0; d < 3; ++d)
+            {
+                u32 interpolated = ((64u - kBptcWeights4[p]) * unquantizeBC6H(endpoints[0][d]) + kBptcWeights4[p] * unquantizeBC6H(endpoints[1][d]) + 32u) >> 6;
+                palette[p][d] = (f32)interpolated;
+            }
+        }
+        f32 totalError = 0.f;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            f32 bestError = FLT_MAX;
+            for (u32 p = 0; p < 16; ++p)
+            {
+                f32 error = 0.f;
+                for (u32 d = 0; d < 3; ++d)
+                {
+                    f32 delta = values[i * 3 + d] - palette[p][d];
+                    error += delta * delta;
+                }
+                if (error < bestError)
+                {
+                    bestError = error;
+                    outIndices[i] = p;
+                }
+            }
+            totalError += bestError;
+        }
+        memcpy(outEndpoints, endpoints, sizeof(endpoints));
+        return totalError;
+    }
+
+    /**
+    * BC6H mode 11, one region with 10 bit endpoints and 4 bit indices. Endpoints are fitted to the half float bit
+    * patterns of the texels, which are close to logarithmic, scaled up to the 16 bit range the decoder interpolates in.
+    */
+    void TextureCompressor::encodeBC6H(const f32 rgb[48], u8 outBlock[16])
+    {
+        f32 values[48];
+        for (u32 i = 0; i < 48; ++i)
+        {
+            f32 value = (rgb[i] > 0.f) ? Min(rgb[i], 65504.f) : 0.f;
+            values[i] = (f32)glm::packHalf1x16(value) * 64.f / 31.f;
+        }
+        f32 end0[3], end1[3];
+        fitEndpoints(values, 16u, 3u, end0, end1);
+        u32 endpoints[6], indices[16];
+        f32 error = fitBC6HMode11(values, end0, end1, endpoints, indices);
+        f32 weights[16];
+        for (u32 i = 0; i < 16; ++i)
+        {
+            weights[i] = (f32)kBptcWeights4[indices[i]] / 64.f;
+        }
+        if (refineEndpoints(values, weights, 16u, 3u, end0, end1))
+        {
+            u32 refinedEndpoints[6], refinedIndices[16];
+            f32 refinedError = fitBC6HMode11(values, end0, end1, refinedEndpoints, refinedIndices);
+            if (refinedError < error)
+            {
+                memcpy(endpoints, refinedEndpoints, sizeof(endpoints));
+                memcpy(indices, refinedIndices, sizeof(indices));
+            }
+        }
+
+        if (indices[0] >= 8u)
+        {
+            for (u32 d = 0; d < 3; ++d)
+            {
+                std::swap(endpoints[d], endpoints[3 + d]);
+            }
+            for (u32 i = 0; i < 16; ++i)
+            {
+                indices[i] = 15u - indices[i];
+            }
+        }
+        BlockBitWriter writer(outBlock, 16u);
+        writer.write(0x03u, 5u);
+        for (u32 e = 0; e < 6; ++e)
+        {
+            writer.write(endpoints[e], 10u);
+        }
+        for (u32 i = 0; i < 16; ++i)
+        {
+            writer.write(indices[i], (i == 0u) ? 3u : 4u);
+        }
+    }
+
+    void TextureCompressor::decodeBC1(const u8 block[8], u8 outRGBA[64])
+    {
+        u16 c0, c1;
+        u32 packedIndices;
+        memcpy(&c0, block, 2);
+        memcpy(&c1, block + 2, 2);
+        memcpy(&packedIndices, block + 4, 4);
+        f32 palette[4][4];
+        unpackRGB565(c0, palette[0]);
+        unpackRGB565(c1, palette[1]);
+        palette[0][3] = palette[1][3] = 255.f;
+        for (u32 d = 0; d < 4; ++d)
+        {
+            if (c0 > c1)
+            {
+                palette[2][d] = (2.f * palette[0][d] + palette[1][d]) / 3.f;
+                palette[3][d] = (palette[0][d] + 2.f * palette[1][d]) / 3.f;
+            }
+            else
+            {
+                palette[2][d] = (palette[0][d] + palette[1][d]) * .5f;
+                palette[3][d] = 0.f;
+            }
+        }
+        for (u32 i = 0; i < 16; ++i)
+        {
+            u32 index = (packedIndices >> (i * 2u)) & 3u;
+            for (u32 d = 0; d < 4; ++d)
+            {
+                outRGBA[i * 4 + d] = (u8)(palette[index][d] + .5f);
+            }
+        }
+    }
+
+    static void decodeBC4(const u8 block[8], u32 channel, u8 outRGBA[64])
+    {
+        f32 palette[8] = { (f32)block[0], (f32)block[1] };
+        for (u32 p = 2; p < 8; ++p)
+        {
+            if (block[0] > block[1])
+            {
+                palette[p] = ((f32)(8u - p) * block[0] + (f32)(p - 1u) * block[1]) / 7.f;
+            }
+            else
+            {
+                palette[p] = (p < 6u) ? ((f32)(6u - p) * block[0] + (f32)(p - 1u) * block[1]) / 5.f : ((p == 6u) ? 0.f : 255.f);
+            }
+        }
+        u64 packedIndices = 0u;
+        for (u32 b = 0; b < 6; ++b)
+        {
+            packedIndices |= (u64)block[2 + b] << (b * 8u);
+        }
+        for (u32 i = 0; i < 16; ++i)
+        {
+            outRGBA[i * 4 + channel] = (u8)(palette[(packedIndices >> (i * 3u)) & 7u] + .5f);
+        }
+    }
+
+    void TextureCompressor::decodeBC3(const u8 block[16], u8 outRGBA[64])
+    {
+        decodeBC1(block + 8, outRGBA);
+        decodeBC4(block, 3u, outRGBA);
+    }
+
+    void TextureCompressor::decodeBC5(const u8 block[16], u8 outRGBA[64])
+    {
+        for (u32 i = 0; i < 16; ++i)
+        {
+            outRGBA[i * 4 + 2] = 0u;
+            outRGBA[i * 4 + 3] = 255u;
+        }
+        decodeBC4(block, 0u, outRGBA);
+        decodeBC4(block + 8, 1u, outRGBA);
+    }
+
+    bool TextureCompressor::decodeBC7(const u8 block[16], u8 outRGBA[64])
+    {
+        BlockBitReader reader(block);
+        if (reader.read(7u) != (1u << 6))
+        {
+            return false;
+        }
+        u32 endpoints[2][4];
+        for (u32 d = 0; d < 4; ++d)
+        {
+            endpoints[0][d] = reader.read(7u) << 1;
+            endpoints[1][d] = reader.read(7u) << 1;
+        }
+        u32 p0 = reader.read(1u), p1 = reader.read(1u);
+        for (u32 d = 0; d < 4; ++d)
+        {
+            endpoints[0][d] |= p0;
+            endpoints[1][d] |= p1;
+        }
+        for (u32 i = 0; i < 16; ++i)
+        {
+            u32 index = reader.read((i == 0u) ? 3u : 4u);
+            for (u32 d = 0; d < 4; ++d)
+            {
+                outRGBA[i * 4 + d] = (u8)(((64u - kBptcWeights4[index]) * endpoints[0][d] + kBptcWeights4[index] * endpoints[1][d] + 32u) >> 6);
+            }
+        }
+        return true;
+    }
+
+    TextureCompressor::PixelFormat TextureCompressor::selectFormat(Role role, const u8* rgba, u32 numPixels)
+    {
+        switch (role)
+        {
+        case Role::kAlbedo:
+            for (u32 i = 0; i < numPixels; ++i)
+            {
+                if (rgba[i * 4 + 3] < 255u)
+                {
+                    return PixelFormat::BC3;
+                }
+            }
+            return PixelFormat::BC1;
+        case Role::kNormal:
+            return PixelFormat::BC5;
+        case Role::kMaterial:
+            return PixelFormat::BC7;
+        case Role::kHDR:
+            return PixelFormat::BC6H;
+        default:
+            return PixelFormat::kInvalid;
+        }
+    }
+
+    u32 TextureCompressor::getNumMips(u32 width, u32 height)
+    {
+        u32 numMips = 1u;
+        while (width > 1u || height > 1u)
+        {
+            width = Max(width / 2u, 1u);
+            height = Max(height / 2u, 1u);
+            numMips++;
+        }
+        return numMips;
+    }
+
+    /**
+    * 2x2 box filter, odd sized mips repeat their last row or column. Albedo is averaged in linear space and normals
+    * are renormalized.
+    */
+    static void downsampleLDR(const std::vector<u8>& src, u32 width, u32 height, TextureCompressor::Role role, std::vector<u8>& dst)
+    {
+        // compress() runs on several decode workers at once, initializing a local static is thread safe
+        static const std::array<f32, 256> s_linearTable = []() {
+            std::array<f32, 256> table;
+            for (u32 i = 0; i < 256; ++i)
+            {
+                table[i] = powf((f32)i / 255.f, 2.2f);
+            }
+            return table;
+        }();
+        u32 dstWidth = Max(width / 2u, 1u), dstHeight = Max(height / 2u, 1u);
+        dst.resize(dstWidth * dstHeight * 4u);
+        for (u32 y = 0; y < dstHeight; ++y)
+        {
+            for (u32 x = 0; x < dstWidth; ++x)
+            {
+                u32 xs[2] = { Min(x * 2u, width - 1u), Min(x * 2u + 1u, width - 1u) };
+                u32 ys[2] = { Min(y * 2u, height - 1u), Min(y * 2u + 1u, height - 1u) };
+                f32 sum[4] = { };
+                for (u32 s = 0; s < 4; ++s)
+                {
+                    const u8* texel = &src[(ys[s >> 1] * width + xs[s & 1u]) * 4u];
+                    for (u32 c = 0; c < 4; ++c)
+                    {
+                        bool bLinearize = (role == TextureCompressor::Role::kAlbedo && c < 3u);
+                        sum[c] += bLinearize ? s_linearTable[texel[c]] : (f32)texel[c] / 255.f;
+                    }
+                }
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    sum[c] *= .25f;
+                }
+                if (role == TextureCompressor::Role::kAlbedo)
+                {
+                    for (u32 c = 0; c < 3; ++c)
+                    {
+                        sum[c] = powf(sum[c], 1.f / 2.2f);
+                    }
+                }
+                else if (role == TextureCompressor::Role::kNormal)
+                {
+                    f32 normal[3] = { sum[0] * 2.f - 1.f, sum[1] * 2.f - 1.f, sum[2] * 2.f - 1.f };
+                    f32 length = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+                    if (length > 0.f)
+                    {
+                        for (u32 c = 0; c < 3; ++c)
+                        {
+                            sum[c] = normal[c] / length * .5f + .5f;
+                        }
+                    }
+                }
+                u8* texel = &dst[(y * dstWidth + x) * 4u];
+                for (u32 c = 0; c < 4; ++c)
+                {
+                    texel[c] = (u8)Min(Max(sum[c] * 255.f + .5f, 0.f), 255.f);
+                }
+            }
+        }
+    }
+
+    static void downsampleHDR(const std::vector<f32>& src, u32 width, u32 height, std::vector<f32>& dst)
+    {
+        u32 dstWidth = Max(width / 2u, 1u), dstHeight = Max(height / 2u, 1u);
+        dst.resize(dstWidth * dstHeight * 3u);
+        for (u32 y = 0; y < dstHeight; ++y)
+        {
+            for (u32 x = 0; x < dstWidth; ++x)
+            {
+                u32 xs[2] = { Min(x * 2u, width - 1u), Min(x * 2u + 1u, width - 1u) };
+                u32 ys[2] = { Min(y * 2u, height - 1u), Min(y * 2u + 1u, height - 1u) };
+                for (u32 c = 0; c < 3; ++c)
+                {
+                    f32 sum = 0.f;
+                    for (u32 s = 0; s < 4; ++s)
+                    {
+                        sum += src[(ys[s >> 1] * width + xs[s & 1u]) * 3u + c];
+                    }
+                    dst[(y * dstWidth + x) * 3u + c] = sum * .25f;
+                }
+            }
+        }
+    }
+
+    /**
+    * Encodes one mip, blocks hanging over the edges of the mip repeat its last row and column
+    */
+    template <typename Texel, u32 kNumChannels, typename Encoder>
+    static void encodeMip(const Texel* texels, u32 width, u32 height, u32 blockSize, u8* outBlocks, const Encoder& encoder)
+    {
+        u32 numBlocksX = (width + 3u) / 4u, numBlocksY = (height + 3u) / 4u;
+        ThreadPool::get()->parallelFor(numBlocksY, [&](u32 blockY) {
+            for (u32 blockX = 0; blockX < numBlocksX; ++blockX)
+            {
+                Texel block[16 * kNumChannels];
+                for (u32 i = 0; i < 16; ++i)
+                {
+                    u32 x = Min(blockX * 4u + (i & 3u), width - 1u);
+                    u32 y = Min(blockY * 4u + (i >> 2), height - 1u);
+                    memcpy(&block[i * kNumChannels], &texels[(y * width + x) * kNumChannels], sizeof(Texel) * kNumChannels);
+                }
+                encoder(block, outBlocks + (blockY * numBlocksX + blockX) * blockSize);
+            }
+        });
+    }
+
+    bool TextureCompressor::compress(Role role, const void* pixels, u32 width, u32 height, ITextureRenderable::Spec& outSpec)
+    {
+        if (role == Role::kNone || role >= Role::kCount || pixels == nullptr || width == 0u || height == 0u)
+        {
+            return false;
+        }
+        PixelFormat format = (role == Role::kHDR) ? PixelFormat::BC6H : selectFormat(role, reinterpret_cast<const u8*>(pixels), width * height);
+        u32 numMips = getNumMips(width, height);
+        u32 blockSize = (format == PixelFormat::BC1) ? 8u : 16u;
+        u64 totalSize = 0u;
+        for (u32 mip = 0, mipWidth = width, mipHeight = height; mip < numMips; ++mip)
+        {
+            totalSize += ITextureRenderable::getBlockCompressedSize(format, mipWidth, mipHeight);
+            mipWidth = Max(mipWidth / 2u, 1u);
+            mipHeight = Max(mipHeight / 2u, 1u);
+        }
+        u8* blocks = new u8[totalSize];
+
+        u8* mipBlocks = blocks;
+        if (role == Role::kHDR)
+        {
+            std::vector<f32> mip(reinterpret_cast<const f32*>(pixels), reinterpret_cast<const f32*>(pixels) + width * height * 3u), nextMip;
+            for (u32 m = 0, mipWidth = width, mipHeight = height; m < numMips; ++m)
+            {
+                encodeMip<f32, 3u>(mip.data(), mipWidth, mipHeight, blockSize, mipBlocks, [](const f32* block, u8* outBlock) { encodeBC6H(block, outBlock); });
+                mipBlocks += ITextureRenderable::getBlockCompressedSize(format, mipWidth, mipHeight);
+                downsampleHDR(mip, mipWidth, mipHeight, nextMip);
+                mip.swap(nextMip);
+                mipWidth = Max(mipWidth / 2u, 1u);
+                mipHeight = Max(mipHeight / 2u, 1u);
+            }
+        }
+        else
+        {
+            void (*encodeBlock)(const u8*, u8*) = nullptr;
+            switch (format)
+            {
+            case PixelFormat::BC1: encodeBlock = [](const u8* block, u8* outBlock) { encodeBC1(block, outBlock); }; break;
+            case PixelFormat::BC3: encodeBlock = [](const u8* block, u8* outBlock) { encodeBC3(block, outBlock); }; break;
+            case PixelFormat::BC5: encodeBlock = [](const u8* block, u8* outBlock) { encodeBC5(block, outBlock); }; break;
+            default: encodeBlock = [](const u8* block, u8* outBlock) { encodeBC7(block, outBlock); }; break;
+            }
+            std::vector<u8> mip(reinterpret_cast<const u8*>(pixels), reinterpret_cast<const u8*>(pixels) + width * height * 4u), nextMip;
+            for (u32 m = 0, mipWidth = width, mipHeight = height; m < numMips; ++m)
+            {
+                encodeMip<u8, 4u>(mip.data(), mipWidth, mipHeight, blockSize, mipBlocks, encodeBlock);
+                mipBlocks += ITextureRenderable::getBlockCompressedSize(format, mipWidth, mipHeight);
+                downsampleLDR(mip, mipWidth, mipHeight, role, nextMip);
+                mip.swap(nextMip);
+                mipWidth = Max(mipWidth / 2u, 1u);
+                mipHeight = Max(mipHeight / 2u, 1u);
+            }
+        }
+
+        outSpec.type = ITextureRenderable::Spec::Type::kTex2D;
+        outSpec.width = width;
+        outSpec.height = height;
+        outSpec.depth = 1u;
+        outSpec.numMips = numMips;
+        outSpec.pixelFormat = format;
+        outSpec.pixelData = blocks;
+        return true;
+    }
+
+    bool TextureCompressor::decompress(PixelFormat format, const u8* blocks, u32 width, u32 height, std::vector<u8>& outRGBA)
+    {
+        if (format != PixelFormat::BC1 && format != PixelFormat::BC3 && format != PixelFormat::BC5 && format != PixelFormat::BC7)
+        {
+            return false;
+        }
+        u32 blockSize = (format == PixelFormat::BC1) ? 8u : 16u;
+        u32 numBlocksX = (width + 3u) / 4u, numBlocksY = (height + 3u) / 4u;
+        outRGBA.resize(width * height * 4u);
+        for (u32 blockY = 0; blockY < numBlocksY; ++blockY)
+        {
+            for (u32 blockX = 0; blockX < numBlocksX; ++blockX)
+            {
+                const u8* block = blocks + (blockY * numBlocksX + blockX) * blockSize;
+                u8 texels[64];
+                switch (format)
+                {
+                case PixelFormat::BC1: decodeBC1(block, texels); break;
+                case PixelFormat::BC3: decodeBC3(block, texels); break;
+                case PixelFormat::BC5: decodeBC5(block, texels); break;
+                default:
+                    if (!decodeBC7(block, texels))
+                    {
+                        return false;
+                    }
+                    break;
+                }
+                for (u32 i = 0; i < 16; ++i)
+                {
+                    u32 x = blockX * 4u + (i & 3u), y = blockY * 4u + (i >> 2);
+                    if (x < width && y < height)
+                    {
+                        memcpy(&outRGBA[(y * width + x) * 4u], &texels[i * 4u], 4u);
+                    }
+                }
+            }
+        }
+        return true;
+    }
+}
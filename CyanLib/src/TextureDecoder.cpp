@@ -0,0 +1,167 @@
+#include <mutex>
+
+#include "stb_image.h"
+
+#include "TextureDecoder.h"
+#include "MappedFile.h"
+#include "Hash.h"
+
+namespace Cyan
+{
+    /**
+    * Images are always flipped so that the first row ends up at the bottom as gl expects. The flag is global in stb_image,
+    * so it is only ever set once, before the first image is decoded on whichever thread that happens.
+    */
+    static void setDecodeFlip()
+    {
+        static std::once_flag flag;
+        std::call_once(flag, []() { stbi_set_flip_vertically_on_load(1); });
+    }
+
+    bool TextureDecoder::decode(Request& request)
+    {
+        setDecodeFlip();
+        return decodeImage(request);
+    }
+
+    static bool hasKtx2Extension(const std::string& filename)
+    {
+        const char* extension = ".ktx2";
+        return filename.size() >= strlen(extension) && filename.compare(filename.size() - strlen(extension), strlen(extension), extension) == 0;
+    }
+
+    // drops the mips before the mip tail of a whole block compressed mip chain
+    static void trimToMipTail(ITextureRenderable::Spec& spec, u32 maxMipSize)
+    {
+        u32 firstMip = TextureCache::findMipTail(spec.width, spec.height, spec.numMips, maxMipSize);
+        if (firstMip == 0u)
+        {
+            return;
+        }
+        u64 offset = 0u, totalSize = 0u;
+        for (u32 mip = 0; mip < spec.numMips; ++mip)
+        {
+            u64 mipSize = ITextureRenderable::getBlockCompressedSize(spec.pixelFormat, Max(spec.width >> mip, 1u), Max(spec.height >> mip, 1u));
+            if (mip < firstMip)
+            {
+                offset += mipSize;
+            }
+            totalSize += mipSize;
+        }
+        u8* pixelData = new u8[totalSize - offset];
+        memcpy(pixelData, spec.pixelData + offset, totalSize - offset);
+        delete[] spec.pixelData;
+        spec.pixelData = pixelData;
+        spec.firstMip = firstMip;
+    }
+
+    bool TextureDecoder::decodeImage(Request& request)
+    {
+        using PixelFormat = ITextureRenderable::Spec::PixelFormat;
+        using Role = TextureCompressor::Role;
+        request.spec.pixelData = nullptr;
+        request.spec.firstMip = 0u;
+        request.streamingSource.clear();
+        bool bCompress = (request.role != Role::kNone) && ((request.role == Role::kHDR) == request.bHDR);
+        bool bKtx2 = request.encodedData ? TextureCache::isKtx2(request.encodedData, request.encodedSize) : hasKtx2Extension(request.filename);
+
+        // image files are mapped when their encoded bytes are needed for anything besides decoding
+        MappedFile file;
+        const u8* encodedData = request.encodedData;
+        u64 encodedSize = request.encodedSize;
+        if (encodedData == nullptr && (bKtx2 || (bCompress && request.cache)))
+        {
+            if (!file.open(request.filename.c_str()))
+            {
+                cyanError("Failed to open image %s", request.filename.c_str());
+                return false;
+            }
+            encodedData = file.getData();
+            encodedSize = file.getSize();
+        }
+        if (bKtx2)
+        {
+            // embedded images have no file to stream the rest of their mips from
+            u32 maxMipSize = request.encodedData ? 0u : request.streamingMipTailSize;
+            if (!TextureCache::readKtx2(encodedData, encodedSize, request.spec, nullptr, maxMipSize))
+            {
+                cyanError("Failed to load KTX2 image %s, only BC1, BC3, BC5, BC6H and BC7 without supercompression are supported", request.name.c_str());
+                return false;
+            }
+            if (request.spec.firstMip > 0u)
+            {
+                request.streamingSource = request.filename;
+            }
+            return true;
+        }
+        u64 sourceHash = 0u;
+        if (bCompress && request.cache)
+        {
+            sourceHash = hashBytes(encodedData, encodedSize);
+            if (request.cache->load(request.cacheKey.c_str(), request.role, encodedSize, sourceHash, request.spec, request.streamingMipTailSize))
+            {
+                if (request.spec.firstMip > 0u)
+                {
+                    request.streamingSource = request.cache->getFilename(request.cacheKey.c_str(), request.role);
+                }
+                return true;
+            }
+        }
+
+        // the compressor takes rgba8 or rgb32f
+        int numChannelsToDecode = bCompress ? (request.bHDR ? 3 : 4) : (int)request.numChannels;
+        int width = 0, height = 0, numChannels = 0;
+        void* pixels = nullptr;
+        if (encodedData != nullptr)
+        {
+            pixels = request.bHDR ? (void*)stbi_loadf_from_memory(encodedData, (int)encodedSize, &width, &height, &numChannels, numChannelsToDecode)
+                : (void*)stbi_load_from_memory(encodedData, (int)encodedSize, &width, &height, &numChannels, numChannelsToDecode);
+        }
+        else
+        {
+            pixels = request.bHDR ? (void*)stbi_loadf(request.filename.c_str(), &width, &height, &numChannels, numChannelsToDecode)
+                : (void*)stbi_load(request.filename.c_str(), &width, &height, &numChannels, numChannelsToDecode);
+        }
+        request.spec.pixelData = reinterpret_cast<u8*>(pixels);
+        if (pixels == nullptr)
+        {
+            cyanError("Failed to decode image %s: %s", request.name.c_str(), stbi_failure_reason());
+            return false;
+        }
+        if (numChannelsToDecode > 0)
+        {
+            numChannels = numChannelsToDecode;
+        }
+
+        // todo: pixel format is hard coded for now
+        if (numChannels == 3)
+        {
+            request.spec.pixelFormat = request.bHDR ? PixelFormat::RGB16F : PixelFormat::RGB8;
+        }
+        else if (numChannels == 4)
+        {
+            request.spec.pixelFormat = request.bHDR ? PixelFormat::RGBA16F : PixelFormat::RGBA8;
+        }
+        request.spec.width = (u32)width;
+        request.spec.height = (u32)height;
+
+        // a failed compression leaves the decoded image as it is
+        ITextureRenderable::Spec compressedSpec = request.spec;
+        if (bCompress && TextureCompressor::compress(request.role, pixels, (u32)width, (u32)height, compressedSpec))
+        {
+            stbi_image_free(pixels);
+            request.spec = compressedSpec;
+            // freshly compressed images can only be streamed once their cache file is written
+            if (request.cache && request.cache->save(request.cacheKey.c_str(), request.role, encodedSize, sourceHash, request.spec)
+                && request.streamingMipTailSize > 0u)
+            {
+                trimToMipTail(request.spec, request.streamingMipTailSize);
+                if (request.spec.firstMip > 0u)
+                {
+                    request.streamingSource = request.cache->getFilename(request.cacheKey.c_str(), request.role);
+                }
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cmath>
+
+#include "TextureStreamer.h"
+#include "TextureCache.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+
+namespace Cyan
+{
+    TextureStreamer* Singleton<TextureStreamer>::singleton = nullptr;
+
+    TextureStreamer::TextureStreamer()
+        : Singleton<TextureStreamer>()
+    {
+        // slot 0 is shared by every texture that isn't streamed and never clamps anything
+        m_residencyBuffer = std::make_unique<ResidencyBuffer>("TextureResidencyBuffer", 1u);
+        (*m_residencyBuffer)[0] = 0.f;
+        m_residencyBuffer->upload();
+    }
+
+    TextureStreamer::~TextureStreamer()
+    {
+        // workers write into this streamer, so wait for every load in flight to finish
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_loadedCondition.wait(lock, [this]() { return m_numPendingLoads == 0u; });
+    }
+
+    u64 TextureStreamer::getMipSize(const Texture2DRenderable* texture, u32 mip)
+    {
+        return ITextureRenderable::getBlockCompressedSize(texture->pixelFormat, texture->getMipWidth(mip), texture->getMipHeight(mip));
+    }
+
+    u64 TextureStreamer::getChargedMipSize(const Texture2DRenderable* texture, u32 mip)
+    {
+        return (texture->bSparse && mip < texture->sparseMipTail) ? getMipSize(texture, mip) : 0u;
+    }
+
+    void TextureStreamer::addTexture(Texture2DRenderable* texture, const char* sourceFilename)
+    {
+        if (texture == nullptr || texture->firstMip == 0u || m_textureMap.find(texture) != m_textureMap.end())
+        {
+            return;
+        }
+        StreamedTexture streamed = { };
+        streamed.texture = texture;
+        streamed.sourceFilename = sourceFilename;
+        streamed.residentMip = texture->firstMip;
+        streamed.requestedMip = texture->firstMip;
+        m_textureMap.insert({ texture, (u32)m_textures.size() });
+        m_textures.push_back(streamed);
+        // storage of textures that aren't sparse covers the whole mip chain from the start, the sparse mip tail is
+        // committed as a whole at creation even where it reaches past the mips that came with the texture
+        u32 firstCommittedMip = texture->bSparse ? Min(texture->firstMip, texture->sparseMipTail) : 0u;
+        for (u32 mip = firstCommittedMip; mip < texture->numMips; ++mip)
+        {
+            m_residentBytes += getMipSize(texture, mip);
+        }
+        m_residencyBuffer->addElement((f32)texture->firstMip);
+        m_bResidencyDirty = true;
+    }
+
+    u32 TextureStreamer::getResidencySlot(Texture2DRenderable* texture) const
+    {
+        auto entry = m_textureMap.find(texture);
+        return (entry == m_textureMap.end()) ? 0u : entry->second + 1u;
+    }
+
+    void TextureStreamer::requestMip(Texture2DRenderable* texture, f32 mip)
+    {
+        auto entry = m_textureMap.find(texture);
+        if (entry == m_textureMap.end())
+        {
+            return;
+        }
+        StreamedTexture& streamed = m_textures[entry->second];
+        f32 biasedMip = floorf(mip + m_settings.mipBias);
+        u32 requestedMip = (biasedMip > 0.f) ? Min((u32)biasedMip, streamed.texture->firstMip) : 0u;
+        if (streamed.lastRequestedFrame != m_frame)
+        {
+            streamed.lastRequestedFrame = m_frame;
+            streamed.requestedMip = requestedMip;
+        }
+        else
+        {
+            streamed.requestedMip = Min(streamed.requestedMip, requestedMip);
+        }
+    }
+
+    bool TextureStreamer::readMip(Texture2DRenderable* texture, u32 mip, std::vector<u8>& outBlocks) const
+    {
+        if (mip >= texture->numMips)
+        {
+            return false;
+        }
+        // the mip tail is still around in the texture's pixel data
+        if (mip >= texture->firstMip)
+        {
+            if (texture->pixelData == nullptr)
+            {
+                return false;
+            }
+            u64 offset = 0u;
+            for (u32 m = texture->firstMip; m < mip; ++m)
+            {
+                offset += getMipSize(texture, m);
+            }
+            outBlocks.assign(texture->pixelData + offset, texture->pixelData + offset + getMipSize(texture, mip));
+            return true;
+        }
+        auto entry = m_textureMap.find(texture);
+        if (entry == m_textureMap.end())
+        {
+            return false;
+        }
+        MappedFile file;
+        const std::string& filename = m_textures[entry->second].sourceFilename;
+        return file.open(filename.c_str()) && TextureCache::readKtx2Level(file.getData(), file.getSize(), mip, outBlocks);
+    }
+
+    void TextureStreamer::setResidentMip(u32 textureIndex, u32 mip)
+    {
+        m_textures[textureIndex].residentMip = mip;
+        (*m_residencyBuffer)[textureIndex + 1u] = (f32)mip;
+        m_bResidencyDirty = true;
+    }
+
+    void TextureStreamer::update()
+    {
+        uploadLoadedMips();
+        if (m_residentBytes > m_settings.budgetInBytes)
+        {
+            evict(m_residentBytes - m_settings.budgetInBytes);
+        }
+        loadRequestedMips();
+        if (m_bResidencyDirty)
+        {
+            m_residencyBuffer->upload();
+            m_bResidencyDirty = false;
+        }
+        // requests made from here on count towards the next update
+        m_frame++;
+    }
+
+    void TextureStreamer::uploadLoadedMips()
+    {
+        std::vector<LoadedMip> loadedMips;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            loadedMips.swap(m_loadedMips);
+        }
+        // coarser mips first so that a capped frame still improves as many textures as possible
+        std::stable_sort(loadedMips.begin(), loadedMips.end(), [](const LoadedMip& a, const LoadedMip& b) { return a.mip > b.mip; });
+
+        u64 uploadedBytes = 0u;
+        u32 numUploaded = 0u;
+        for (; numUploaded < (u32)loadedMips.size(); ++numUploaded)
+        {
+            LoadedMip& loaded = loadedMips[numUploaded];
+            StreamedTexture& streamed = m_textures[loaded.textureIndex];
+            u64 mipSize = getMipSize(streamed.texture, loaded.mip);
+            // at least one mip goes through every frame no matter how large it is
+            if (numUploaded > 0u && uploadedBytes + mipSize > m_settings.maxUploadBytesPerFrame)
+            {
+                break;
+            }
+            streamed.pendingMip = kInvalidMip;
+            m_pendingBytes -= getChargedMipSize(streamed.texture, loaded.mip);
+            if (loaded.blocks.size() != mipSize)
+            {
+                cyanError("Failed to stream mip %u of texture %s from %s", loaded.mip, streamed.texture->name, streamed.sourceFilename.c_str());
+                // keeps the texture from being requested again
+                streamed.sourceFilename.clear();
+                continue;
+            }
+            streamed.texture->commitMip(loaded.mip, true);
+            streamed.texture->uploadMip(loaded.mip, loaded.blocks.data());
+            setResidentMip(loaded.textureIndex, loaded.mip);
+            m_residentBytes += getChargedMipSize(streamed.texture, loaded.mip);
+            uploadedBytes += mipSize;
+        }
+
+        // whatever didn't fit waits for the next frame
+        if (numUploaded < (u32)loadedMips.size())
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (u32 i = numUploaded; i < (u32)loadedMips.size(); ++i)
+            {
+                m_loadedMips.push_back(std::move(loadedMips[i]));
+            }
+        }
+    }
+
+    u64 TextureStreamer::evict(u64 bytesToFree)
+    {
+        // only sparse textures can give memory back, and never their mip tail
+        std::vector<u32> candidates;
+        for (u32 i = 0; i < (u32)m_textures.size(); ++i)
+        {
+            const StreamedTexture& streamed = m_textures[i];
+            u32 neededMip = (streamed.lastRequestedFrame == m_frame) ? streamed.requestedMip : streamed.texture->firstMip;
+            if (streamed.texture->bSparse && streamed.pendingMip == kInvalidMip && streamed.residentMip < Min(neededMip, streamed.texture->sparseMipTail))
+            {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [this](u32 a, u32 b) {
+            return m_textures[a].lastRequestedFrame < m_textures[b].lastRequestedFrame;
+        });
+
+        u64 freedBytes = 0u;
+        for (u32 index : candidates)
+        {
+            StreamedTexture& streamed = m_textures[index];
+            u32 neededMip = (streamed.lastRequestedFrame == m_frame) ? streamed.requestedMip : streamed.texture->firstMip;
+            u32 lastEvictableMip = Min(neededMip, streamed.texture->sparseMipTail);
+            // finest mips go first
+            u32 mip = streamed.residentMip;
+            for (; mip < lastEvictableMip && freedBytes < bytesToFree; ++mip)
+            {
+                streamed.texture->commitMip(mip, false);
+                freedBytes += getMipSize(streamed.texture, mip);
+            }
+            if (mip != streamed.residentMip)
+            {
+                setResidentMip(index, mip);
+            }
+            if (freedBytes >= bytesToFree)
+            {
+                break;
+            }
+        }
+        m_residentBytes -= freedBytes;
+        return freedBytes;
+    }
+
+    void TextureStreamer::loadRequestedMips()
+    {
+        // textures missing the most mips first
+        std::vector<u32> requested;
+        for (u32 i = 0; i < (u32)m_textures.size(); ++i)
+        {
+            const StreamedTexture& streamed = m_textures[i];
+            if (streamed.lastRequestedFrame == m_frame && streamed.requestedMip < streamed.residentMip
+                && streamed.pendingMip == kInvalidMip && !streamed.sourceFilename.empty())
+            {
+                requested.push_back(i);
+            }
+        }
+        std::sort(requested.begin(), requested.end(), [this](u32 a, u32 b) {
+            return (m_textures[a].residentMip - m_textures[a].requestedMip) > (m_textures[b].residentMip - m_textures[b].requestedMip);
+        });
+
+        ThreadPool* threadPool = ThreadPool::get();
+        for (u32 index : requested)
+        {
+            StreamedTexture& streamed = m_textures[index];
+            // one mip at a time, the next one is loaded once this one is uploaded
+            u32 mip = streamed.residentMip - 1u;
+            u64 mipSize = getChargedMipSize(streamed.texture, mip);
+            u64 neededBytes = m_residentBytes + m_pendingBytes + mipSize;
+            if (neededBytes > m_settings.budgetInBytes && evict(neededBytes - m_settings.budgetInBytes) < neededBytes - m_settings.budgetInBytes)
+            {
+                continue;
+            }
+            streamed.pendingMip = mip;
+            m_pendingBytes += mipSize;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_numPendingLoads++;
+            }
+            std::string filename = streamed.sourceFilename;
+            threadPool->submit([this, index, mip, filename]() {
+                LoadedMip loaded = { index, mip };
+                MappedFile file;
+                if (file.open(filename.c_str()))
+                {
+                    TextureCache::readKtx2Level(file.getData(), file.getSize(), mip, loaded.blocks);
+                }
+                // notifying under the lock keeps the streamer alive until this task is done touching it
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_loadedMips.push_back(std::move(loaded));
+                m_numPendingLoads--;
+                m_loadedCondition.notify_all();
+            });
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#include "ThreadPool.h"
+
+namespace Cyan
+{
+    // used to identify which pool and which worker the current thread belongs to
+    static thread_local ThreadPool* tls_pool = nullptr;
+    static thread_local u32 tls_workerIndex = ThreadPool::kInvalidWorkerIndex;
+
+    ThreadPool::ThreadPool(u32 numWorkers)
+        : m_nextQueue(0u), m_numPendingTasks(0u)
+    {
+        if (numWorkers == 0u)
+        {
+            numWorkers = Max(std::thread::hardware_concurrency(), 1u);
+        }
+        for (u32 i = 0; i < numWorkers; ++i)
+        {
+            m_queues.emplace_back(new WorkerQueue());
+        }
+        for (u32 i = 0; i < numWorkers; ++i)
+        {
+            m_workers.emplace_back(&ThreadPool::workerLoop, this, i);
+        }
+    }
+
+    ThreadPool::~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_bShutdown = true;
+        }
+        m_wakeCondition.notify_all();
+        for (auto& worker : m_workers)
+        {
+            worker.join();
+        }
+    }
+
+    ThreadPool* ThreadPool::get()
+    {
+        static ThreadPool pool;
+        return &pool;
+    }
+
+    u32 ThreadPool::getCurrentWorkerIndex()
+    {
+        return tls_workerIndex;
+    }
+
+    void ThreadPool::submit(const Task& task)
+    {
+        // keep tasks spawned by a worker local to that worker for better cache locality
+        u32 queueIndex = (tls_pool == this) ? tls_workerIndex : (m_nextQueue.fetch_add(1) % getNumWorkers());
+        {
+            /** 
+            * count the task before it becomes visible to workers so that the counter never underflows, also increment 
+            * under the lock so that a worker going to sleep can't miss the notification
+            */
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_numPendingTasks.fetch_add(1);
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queues[queueIndex]->mutex);
+            m_queues[queueIndex]->tasks.push_back(task);
+        }
+        m_wakeCondition.notify_one();
+    }
+
+    bool ThreadPool::popTask(u32 workerIndex, Task& outTask)
+    {
+        {
+            WorkerQueue& queue = *m_queues[workerIndex];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty())
+            {
+                outTask = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                return true;
+            }
+        }
+
+        // steal from other workers
+        u32 numWorkers = getNumWorkers();
+        for (u32 i = 1; i < numWorkers; ++i)
+        {
+            WorkerQueue& victim = *m_queues[(workerIndex + i) % numWorkers];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty())
+            {
+                outTask = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void ThreadPool::workerLoop(u32 workerIndex)
+    {
+        tls_pool = this;
+        tls_workerIndex = workerIndex;
+
+        while (true)
+        {
+            Task task;
+            if (popTask(workerIndex, task))
+            {
+                m_numPendingTasks.fetch_sub(1);
+                task();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wakeCondition.wait(lock, [this]() {
+                return m_bShutdown || m_numPendingTasks.load() > 0;
+            });
+            if (m_bShutdown)
+            {
+                break;
+            }
+        }
+    }
+
+    void ThreadPool::parallelFor(u32 count, const std::function<void(u32)>& func)
+    {
+        if (count == 0u)
+        {
+            return;
+        }
+
+        struct ParallelForState
+        {
+            std::atomic<u32> nextIndex;
+            std::atomic<u32> numFinished;
+        };
+        // helper tasks may still be sitting in a queue after this function returns, so the shared state is ref counted
+        auto state = std::make_shared<ParallelForState>();
+        state->nextIndex = 0u;
+        state->numFinished = 0u;
+        const std::function<void(u32)>* funcPtr = &func;
+
+        auto work = [state, funcPtr, count]() {
+            u32 index;
+            while ((index = state->nextIndex.fetch_add(1)) < count)
+            {
+                (*funcPtr)(index);
+                state->numFinished.fetch_add(1);
+            }
+        };
+
+        u32 numHelpers = Min(count, getNumWorkers()) - 1u;
+        for (u32 i = 0; i < numHelpers; ++i)
+        {
+            submit(work);
+        }
+        work();
+
+        // all indices are claimed at this point, wait for the ones still in flight on other threads
+        while (state->numFinished.load() < count)
+        {
+            std::this_thread::yield();
+        }
+    }
+}
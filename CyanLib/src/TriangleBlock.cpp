@@ -0,0 +1,146 @@
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <immintrin.h>
+
+#include "TriangleBlock.h"
+
+namespace Cyan
+{
+    // taken from https://en.wikipedia.org/wiki/M%C3%B6ller%E2%80%93Trumbore_intersection_algorithm
+    f32 intersectTriangle(const glm::vec3& ro, const glm::vec3& rd, const glm::vec3& v0, const glm::vec3& v1, const glm::vec3& v2)
+    {
+        const float EPSILON = 0.0000001;
+        glm::vec3 edge1 = v1 - v0;
+        glm::vec3 edge2 = v2 - v0;
+        glm::vec3 h, s, q;
+        float a,f,u,v;
+        h = glm::cross(rd, edge2);
+        // a = glm::dot(edge1, h);
+        a = edge1.x * h.x + edge1.y * h.y + edge1.z * h.z;
+        if (std::fabs(a) < EPSILON)
+        {
+            return -1.0f;
+        }
+        f = 1.0f / a;
+        s = ro - v0;
+        // u = f * dot(s, h);
+        u = f * (s.x*h.x + s.y*h.y + s.z*h.z);
+        if (u < 0.0 || u > 1.0)
+        {
+            return -1.0;
+        }
+        q = glm::cross(s, edge1);
+        v = f * (rd.x*q.x + rd.y*q.y + rd.z*q.z);
+        if (v < 0.0 || u + v > 1.0)
+        {
+            return -1.0;
+        }
+        float t = f * glm::dot(edge2, q);
+        // hit
+        if (t > EPSILON)
+        {
+            return t;
+        }
+        return -1.0f;
+    }
+
+    void TriangleBlockArray::clear()
+    {
+        blocks.clear();
+        leafBlocks.clear();
+    }
+
+    void TriangleBlockArray::build(const BVH& bvh, const std::vector<glm::vec3>& trianglePositions)
+    {
+        clear();
+        leafBlocks.resize(bvh.getNumNodes(), 0u);
+        for (u32 nodeIndex = 0; nodeIndex < bvh.getNumNodes(); ++nodeIndex)
+        {
+            const BVHNode& node = bvh.nodes[nodeIndex];
+            // skip the padding node
+            if (nodeIndex == 1 || !node.isLeaf())
+            {
+                continue;
+            }
+
+            leafBlocks[nodeIndex] = (u32)blocks.size();
+            for (u32 first = 0; first < node.count; first += TriangleBlock::kWidth)
+            {
+                blocks.emplace_back();
+                TriangleBlock& block = blocks.back();
+                memset(&block, 0, sizeof(TriangleBlock));
+                for (u32 lane = 0; lane < TriangleBlock::kWidth && first + lane < node.count; ++lane)
+                {
+                    u32 tri = bvh.primitiveIndices[node.leftFirst + first + lane];
+                    const glm::vec3& v0 = trianglePositions[tri * 3 + 0];
+                    glm::vec3 edge1 = trianglePositions[tri * 3 + 1] - v0;
+                    glm::vec3 edge2 = trianglePositions[tri * 3 + 2] - v0;
+                    for (i32 axis = 0; axis < 3; ++axis)
+                    {
+                        block.v0[axis][lane] = v0[axis];
+                        block.edge1[axis][lane] = edge1[axis];
+                        block.edge2[axis][lane] = edge2[axis];
+                    }
+                    block.triangles[lane] = tri;
+                }
+            }
+        }
+    }
+
+    f32 intersectTriangleBlock(const TriangleBlock& block, const glm::vec3& ro, const glm::vec3& rd, f32 tMax, u32& outTriangle)
+    {
+        const __m256 epsilon = _mm256_set1_ps(0.0000001f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+
+        __m256 dx = _mm256_set1_ps(rd.x), dy = _mm256_set1_ps(rd.y), dz = _mm256_set1_ps(rd.z);
+        __m256 e1x = _mm256_load_ps(block.edge1[0]), e1y = _mm256_load_ps(block.edge1[1]), e1z = _mm256_load_ps(block.edge1[2]);
+        __m256 e2x = _mm256_load_ps(block.edge2[0]), e2y = _mm256_load_ps(block.edge2[1]), e2z = _mm256_load_ps(block.edge2[2]);
+
+        // h = cross(rd, edge2)
+        __m256 hx = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+        __m256 hy = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+        __m256 hz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+        __m256 a = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, hx), _mm256_mul_ps(e1y, hy)), _mm256_mul_ps(e1z, hz));
+        __m256 f = _mm256_div_ps(one, a);
+
+        // s = ro - v0
+        __m256 sx = _mm256_sub_ps(_mm256_set1_ps(ro.x), _mm256_load_ps(block.v0[0]));
+        __m256 sy = _mm256_sub_ps(_mm256_set1_ps(ro.y), _mm256_load_ps(block.v0[1]));
+        __m256 sz = _mm256_sub_ps(_mm256_set1_ps(ro.z), _mm256_load_ps(block.v0[2]));
+        __m256 u = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, hx), _mm256_mul_ps(sy, hy)), _mm256_mul_ps(sz, hz)));
+
+        // q = cross(s, edge1)
+        __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+        __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+        __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+        __m256 v = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)));
+        __m256 t = _mm256_mul_ps(f, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)));
+
+        __m256 absA = _mm256_andnot_ps(_mm256_set1_ps(-0.f), a);
+        __m256 hit = _mm256_cmp_ps(absA, epsilon, _CMP_GE_OQ);
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, epsilon, _CMP_GT_OQ));
+        hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, _mm256_set1_ps(tMax), _CMP_LT_OQ));
+        if (_mm256_movemask_ps(hit) == 0)
+        {
+            return FLT_MAX;
+        }
+
+        // horizontal min over the lanes that hit
+        __m256 tHit = _mm256_blendv_ps(_mm256_set1_ps(FLT_MAX), t, hit);
+        __m256 tMin = _mm256_min_ps(tHit, _mm256_permute2f128_ps(tHit, tHit, 0x01));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(1, 0, 3, 2)));
+        tMin = _mm256_min_ps(tMin, _mm256_shuffle_ps(tMin, tMin, _MM_SHUFFLE(2, 3, 0, 1)));
+
+        u32 nearestMask = (u32)_mm256_movemask_ps(_mm256_and_ps(hit, _mm256_cmp_ps(tHit, tMin, _CMP_EQ_OQ)));
+        unsigned long lane = 0;
+        _BitScanForward(&lane, nearestMask);
+        outTriangle = block.triangles[lane];
+        return _mm256_cvtss_f32(tMin);
+    }
+}
@@ -0,0 +1,429 @@
+#include <chrono>
+#include <cstring>
+
+#include "WavefrontPathTracer.h"
+#include "MathUtils.h"
+#include "ThreadPool.h"
+#include "RayPacket.h"
+#include "Hash.h"
+
+namespace Cyan
+{
+    // offset of continuation ray origins along the surface normal, relative to the scene extent
+    static const f32 kRayOffsetScale = 1e-4f;
+    // morton codes use 9 bits per axis so that the octant fits into the top bits of a 32 bit sort key
+    static const u32 kMortonBitsPerAxis = 9u;
+    static const u32 kRadixBits = 10u;
+
+    // random numbers are derived from (pixel, sample, bounce, dimension) so that results don't depend on which thread shades which ray
+    static f32 random(u32 pixel, u32 sample, u32 bounce, u32 dimension)
+    {
+        u32 seed = pcgHash(pixel ^ pcgHash(sample ^ pcgHash(bounce * 16u + dimension)));
+        return (seed >> 8) * (1.f / 16777216.f);
+    }
+
+    // spreads the lower 10 bits of 'x' out to every third bit
+    static u32 expandBits(u32 x)
+    {
+        x = (x * 0x00010001u) & 0xFF0000FFu;
+        x = (x * 0x00000101u) & 0x0F00F00Fu;
+        x = (x * 0x00000011u) & 0xC30C30C3u;
+        x = (x * 0x00000005u) & 0x49249249u;
+        return x;
+    }
+
+    template <typename Func>
+    static void parallelForBatches(u32 count, const Func& func)
+    {
+        u32 numBatches = (count + WavefrontPathTracer::kBatchSize - 1u) / WavefrontPathTracer::kBatchSize;
+        ThreadPool::get()->parallelFor(numBatches, [count, &func](u32 batch) {
+            u32 first = batch * WavefrontPathTracer::kBatchSize;
+            func(first, Min(first + WavefrontPathTracer::kBatchSize, count));
+        });
+    }
+
+    /**
+    * Stable counting sort of 'count' elements into 'numBuckets' buckets in chunks of kSortChunkSize, the same way
+    * BVH::buildLinear sorts its morton codes. Every chunk counts its buckets into its own histogram, the histograms are
+    * prefix summed bucket major so that every chunk scatters into its own sub range of each bucket without any
+    * synchronization between chunks. 'scatter(src, dst)' moves element src to dst. Returns the first element of every
+    * bucket followed by 'count' in 'outBucketOffsets' when it is given.
+    */
+    template <typename GetBucket, typename Scatter>
+    static void countingSort(u32 count, u32 numBuckets, std::vector<u32>& histograms, const GetBucket& getBucket, const Scatter& scatter, std::vector<u32>* outBucketOffsets = nullptr)
+    {
+        ThreadPool* threadPool = ThreadPool::get();
+        u32 numChunks = (count + WavefrontPathTracer::kSortChunkSize - 1u) / WavefrontPathTracer::kSortChunkSize;
+        histograms.resize(numChunks * numBuckets);
+        threadPool->parallelFor(numChunks, [&](u32 chunk) {
+            u32* histogram = &histograms[chunk * numBuckets];
+            memset(histogram, 0, sizeof(u32) * numBuckets);
+            u32 end = Min(count, (chunk + 1u) * WavefrontPathTracer::kSortChunkSize);
+            for (u32 i = chunk * WavefrontPathTracer::kSortChunkSize; i < end; ++i)
+            {
+                histogram[getBucket(i)]++;
+            }
+        });
+        if (outBucketOffsets)
+        {
+            outBucketOffsets->resize(numBuckets + 1u);
+        }
+        u32 offset = 0u;
+        for (u32 bucket = 0; bucket < numBuckets; ++bucket)
+        {
+            if (outBucketOffsets)
+            {
+                (*outBucketOffsets)[bucket] = offset;
+            }
+            for (u32 chunk = 0; chunk < numChunks; ++chunk)
+            {
+                u32 bucketCount = histograms[chunk * numBuckets + bucket];
+                histograms[chunk * numBuckets + bucket] = offset;
+                offset += bucketCount;
+            }
+        }
+        if (outBucketOffsets)
+        {
+            (*outBucketOffsets)[numBuckets] = count;
+        }
+        threadPool->parallelFor(numChunks, [&](u32 chunk) {
+            u32* offsets = &histograms[chunk * numBuckets];
+            u32 end = Min(count, (chunk + 1u) * WavefrontPathTracer::kSortChunkSize);
+            for (u32 i = chunk * WavefrontPathTracer::kSortChunkSize; i < end; ++i)
+            {
+                scatter(i, offsets[getBucket(i)]++);
+            }
+        });
+    }
+
+    using Clock = std::chrono::high_resolution_clock;
+
+    static f64 getElapsedMs(const Clock::time_point& start)
+    {
+        return std::chrono::duration<f64, std::milli>(Clock::now() - start).count();
+    }
+
+    void WavefrontPathTracer::RayQueue::resize(u32 capacity)
+    {
+        if (origins.size() < capacity)
+        {
+            origins.resize(capacity);
+            directions.resize(capacity);
+            throughputs.resize(capacity);
+            radiance.resize(capacity);
+            pixels.resize(capacity);
+        }
+    }
+
+    void WavefrontPathTracer::render(const RayTracingScene& rtxScene, const PerspectiveCamera& camera, AccumulationBuffer& accumulation, AOVBuffer* aovs, const std::vector<u32>* pixels)
+    {
+        m_stats = Stats();
+        m_sceneMin = glm::vec3(0.f);
+        m_sceneMax = glm::vec3(0.f);
+        if (!rtxScene.tlas.empty())
+        {
+            m_sceneMin = rtxScene.tlas.getRoot().aabbMin;
+            m_sceneMax = rtxScene.tlas.getRoot().aabbMax;
+        }
+
+        generatePrimaryRays(camera, accumulation, pixels);
+        for (u32 bounce = 0; bounce <= maxBounces && m_queues[0].size > 0u; ++bounce)
+        {
+            m_stats.numRays += m_queues[0].size;
+            m_stats.numWaves++;
+
+            // primary rays are generated in coherent pixel order already
+            auto start = Clock::now();
+            if (bSortRays && bounce > 0u)
+            {
+                sortRays(rtxScene);
+            }
+            m_stats.sortMs += getElapsedMs(start);
+
+            start = Clock::now();
+            traceRays(rtxScene);
+            m_stats.traceMs += getElapsedMs(start);
+
+            start = Clock::now();
+            sortHitsByMaterial(rtxScene);
+            // only primary hits are recorded as aovs
+            shade(rtxScene, accumulation, (bounce == 0u) ? aovs : nullptr, bounce);
+            m_stats.shadeMs += getElapsedMs(start);
+        }
+        m_queues[0].size = 0u;
+    }
+
+    void WavefrontPathTracer::generatePrimaryRays(const PerspectiveCamera& camera, const AccumulationBuffer& accumulation, const std::vector<u32>* pixels)
+    {
+        const glm::uvec2 imageSize = accumulation.size;
+        u32 numRays = pixels ? (u32)pixels->size() : imageSize.x * imageSize.y;
+        RayQueue& queue = m_queues[0];
+        queue.resize(numRays);
+        queue.size = numRays;
+
+        parallelForBatches(numRays, [this, &camera, &accumulation, &queue, imageSize, pixels](u32 first, u32 last) {
+            for (u32 i = first; i < last; ++i)
+            {
+                // jitter within the pixel the same way progressive rendering does, the sample is only counted once the path ends
+                u32 pixel = pixels ? (*pixels)[i] : i;
+                u32 sampleIndex = accumulation.sampleCounts[pixel] + 1u;
+                glm::vec2 jitter(radicalInverse(2u, sampleIndex), radicalInverse(3u, sampleIndex));
+                glm::vec2 pixelCoords(((f32)(pixel % imageSize.x) + jitter.x) / imageSize.x, ((f32)(pixel / imageSize.x) + jitter.y) / imageSize.y);
+                Ray ray = generateRay(camera, pixelCoords);
+                queue.origins[i] = ray.ro;
+                queue.directions[i] = ray.rd;
+                queue.throughputs[i] = glm::vec3(1.f);
+                queue.radiance[i] = glm::vec3(0.f);
+                queue.pixels[i] = pixel;
+            }
+        });
+    }
+
+    /**
+    * Sort key is the direction octant in the top 3 bits followed by the morton code of the origin within the scene
+    * bounds, so rays that start close to each other and head in a similar direction end up next to each other
+    */
+    void WavefrontPathTracer::sortRays(const RayTracingScene& rtxScene)
+    {
+        RayQueue& queue = m_queues[0];
+        const u32 numRays = queue.size;
+        m_sortKeys.resize(numRays);
+        m_sortIndices.resize(numRays);
+        m_sortScratchKeys.resize(numRays);
+        m_sortScratchIndices.resize(numRays);
+
+        const f32 kGridSize = (f32)((1u << kMortonBitsPerAxis) - 1u);
+        glm::vec3 extent = m_sceneMax - m_sceneMin;
+        glm::vec3 scale = kGridSize / vec3Max(extent, glm::vec3(1e-6f));
+        parallelForBatches(numRays, [this, &queue, scale, kGridSize](u32 first, u32 last) {
+            for (u32 i = first; i < last; ++i)
+            {
+                glm::vec3 cell = glm::clamp((queue.origins[i] - m_sceneMin) * scale, glm::vec3(0.f), glm::vec3(kGridSize));
+                u32 morton = expandBits((u32)cell.x) | (expandBits((u32)cell.y) << 1) | (expandBits((u32)cell.z) << 2);
+                const glm::vec3& rd = queue.directions[i];
+                u32 octant = (rd.x < 0.f ? 1u : 0u) | (rd.y < 0.f ? 2u : 0u) | (rd.z < 0.f ? 4u : 0u);
+                m_sortKeys[i] = (octant << (kMortonBitsPerAxis * 3u)) | morton;
+                m_sortIndices[i] = i;
+            }
+        });
+
+        // lsd radix sort of the 30 bit keys
+        const u32 kNumBuckets = 1u << kRadixBits;
+        for (u32 shift = 0; shift < kMortonBitsPerAxis * 3u + 3u; shift += kRadixBits)
+        {
+            auto getDigit = [this, shift, kNumBuckets](u32 i) {
+                return (m_sortKeys[i] >> shift) & (kNumBuckets - 1u);
+            };
+            countingSort(numRays, kNumBuckets, m_sortHistograms, getDigit, [this](u32 src, u32 dst) {
+                m_sortScratchKeys[dst] = m_sortKeys[src];
+                m_sortScratchIndices[dst] = m_sortIndices[src];
+            });
+            m_sortKeys.swap(m_sortScratchKeys);
+            m_sortIndices.swap(m_sortScratchIndices);
+        }
+
+        // gather the ray state into sorted order
+        m_sortScratch.resize(numRays);
+        parallelForBatches(numRays, [this, &queue](u32 first, u32 last) {
+            for (u32 i = first; i < last; ++i)
+            {
+                u32 src = m_sortIndices[i];
+                m_sortScratch.origins[i] = queue.origins[src];
+                m_sortScratch.directions[i] = queue.directions[src];
+                m_sortScratch.throughputs[i] = queue.throughputs[src];
+                m_sortScratch.radiance[i] = queue.radiance[src];
+                m_sortScratch.pixels[i] = queue.pixels[src];
+            }
+        });
+        m_sortScratch.size = numRays;
+        std::swap(m_queues[0], m_sortScratch);
+    }
+
+    void WavefrontPathTracer::traceRays(const RayTracingScene& rtxScene)
+    {
+        const RayQueue& queue = m_queues[0];
+        m_hits.resize(queue.size);
+        u32 packetWidth = bPacketTracing ? getPacketWidth(getSIMDLevel()) : 1u;
+
+        parallelForBatches(queue.size, [this, &rtxScene, &queue, packetWidth](u32 first, u32 last) {
+            if (packetWidth > 1u)
+            {
+                Ray rays[8];
+                for (u32 i = first; i < last; i += packetWidth)
+                {
+                    u32 numRays = Min(packetWidth, last - i);
+                    for (u32 lane = 0; lane < numRays; ++lane)
+                    {
+                        rays[lane] = Ray{ queue.origins[i + lane], queue.directions[i + lane] };
+                    }
+                    if (packetWidth == 8u)
+                    {
+                        tracePacket8(rtxScene, rays, numRays, &m_hits[i]);
+                    }
+                    else
+                    {
+                        tracePacket4(rtxScene, rays, numRays, &m_hits[i]);
+                    }
+                }
+            }
+            else
+            {
+                for (u32 i = first; i < last; ++i)
+                {
+                    m_hits[i] = RayHit();
+                    traceTLAS(rtxScene, Ray{ queue.origins[i], queue.directions[i] }, m_hits[i]);
+                }
+            }
+        });
+    }
+
+    /**
+    * Counting sort of the wave by hit material with misses first, then cut every material's range into batches
+    */
+    void WavefrontPathTracer::sortHitsByMaterial(const RayTracingScene& rtxScene)
+    {
+        const u32 numRays = m_queues[0].size;
+        const u32 numBuckets = (u32)rtxScene.materials.size() + 1u;
+        auto getBucket = [this](u32 ray) {
+            return (m_hits[ray].tri >= 0) ? (u32)m_hits[ray].material + 1u : 0u;
+        };
+        std::vector<u32> bucketOffsets;
+        m_shadingOrder.resize(numRays);
+        countingSort(numRays, numBuckets, m_sortHistograms, getBucket, [this](u32 src, u32 dst) {
+            m_shadingOrder[dst] = src;
+        }, &bucketOffsets);
+
+        m_shadingBatches.clear();
+        for (u32 bucket = 0; bucket < numBuckets; ++bucket)
+        {
+            for (u32 first = bucketOffsets[bucket]; first < bucketOffsets[bucket + 1u]; first += kBatchSize)
+            {
+                ShadingBatch batch;
+                batch.material = (bucket == 0u) ? ShadingBatch::kInvalidMaterial : bucket - 1u;
+                batch.first = first;
+                batch.count = Min(kBatchSize, bucketOffsets[bucket + 1u] - first);
+                m_shadingBatches.push_back(batch);
+            }
+        }
+    }
+
+    void WavefrontPathTracer::shade(const RayTracingScene& rtxScene, AccumulationBuffer& accumulation, AOVBuffer* aovs, u32 bounce)
+    {
+        m_queues[1].resize(m_queues[0].size);
+        m_numContinuations.store(0u);
+
+        ThreadPool::get()->parallelFor((u32)m_shadingBatches.size(), [this, &rtxScene, &accumulation, aovs, bounce](u32 batchIndex) {
+            const ShadingBatch& batch = m_shadingBatches[batchIndex];
+            if (batch.material == ShadingBatch::kInvalidMaterial)
+            {
+                const RayQueue& queue = m_queues[0];
+                for (u32 i = batch.first; i < batch.first + batch.count; ++i)
+                {
+                    u32 ray = m_shadingOrder[i];
+                    accumulation.addSample(queue.pixels[ray], queue.radiance[ray] + queue.throughputs[ray] * skyRadiance);
+                    if (aovs)
+                    {
+                        aovs->addSample(queue.pixels[ray], glm::vec3(0.f), glm::vec3(0.f), 0.f);
+                    }
+                }
+            }
+            else
+            {
+                shadeMaterial(rtxScene, accumulation, aovs, batch, bounce);
+            }
+        });
+
+        m_queues[1].size = m_numContinuations.load();
+        std::swap(m_queues[0], m_queues[1]);
+    }
+
+    /**
+    * Lambertian shading kernel, adds the direct light at the hit and spawns a cosine weighted continuation ray. The
+    * cosine term and the pdf cancel out, so the throughput is only scaled by the albedo.
+    */
+    void WavefrontPathTracer::shadeMaterial(const RayTracingScene& rtxScene, AccumulationBuffer& accumulation, AOVBuffer* aovs, const ShadingBatch& batch, u32 bounce)
+    {
+        const RayQueue& queue = m_queues[0];
+        const f32 rayOffset = kRayOffsetScale * glm::length(m_sceneMax - m_sceneMin);
+
+        // continuations are written to the next queue once per batch to keep contention on the counter low
+        struct Continuation
+        {
+            glm::vec3 ro;
+            glm::vec3 rd;
+            glm::vec3 throughput;
+            glm::vec3 radiance;
+            u32 pixel;
+        };
+        Continuation continuations[kBatchSize];
+        u32 numContinuations = 0u;
+
+        for (u32 i = batch.first; i < batch.first + batch.count; ++i)
+        {
+            u32 ray = m_shadingOrder[i];
+            const RayHit& hit = m_hits[ray];
+            u32 pixel = queue.pixels[ray];
+            const glm::vec3& throughput = queue.throughputs[ray];
+            glm::vec3 pathRadiance = queue.radiance[ray] + throughput * calcDirectRadiance(rtxScene, hit);
+
+            const glm::vec3& rd = queue.directions[ray];
+            glm::vec3 n = calcHitNormal(rtxScene, hit);
+            if (glm::dot(n, rd) > 0.f)
+            {
+                n = -n;
+            }
+            glm::vec3 albedo = calcHitAlbedo(rtxScene, hit);
+            if (aovs)
+            {
+                aovs->addSample(pixel, albedo, n, hit.t);
+            }
+
+            // every pixel has a single path in flight, so its sample count stays put until the path ends here
+            if (bounce >= maxBounces)
+            {
+                accumulation.addSample(pixel, pathRadiance);
+                continue;
+            }
+            u32 sample = accumulation.sampleCounts[pixel] + 1u;
+            glm::vec3 nextThroughput = throughput * albedo;
+            if (bounce >= kMinBouncesBeforeRoulette)
+            {
+                f32 survival = Min(Max(Max(nextThroughput.x, nextThroughput.y), nextThroughput.z), .95f);
+                if (random(pixel, sample, bounce, 0u) >= survival)
+                {
+                    accumulation.addSample(pixel, pathRadiance);
+                    continue;
+                }
+                nextThroughput /= survival;
+            }
+
+            glm::vec3 tangent, bitangent;
+            calcOrthonormalBasis(n, tangent, bitangent);
+            f32 phi = 2.f * M_PI * random(pixel, sample, bounce, 1u);
+            f32 sinThetaSq = random(pixel, sample, bounce, 2u);
+            f32 sinTheta = sqrt(sinThetaSq);
+            f32 cosTheta = sqrt(1.f - sinThetaSq);
+
+            Continuation& continuation = continuations[numContinuations++];
+            continuation.ro = queue.origins[ray] + rd * hit.t + n * rayOffset;
+            continuation.rd = (tangent * glm::cos(phi) + bitangent * glm::sin(phi)) * sinTheta + n * cosTheta;
+            continuation.throughput = nextThroughput;
+            continuation.radiance = pathRadiance;
+            continuation.pixel = pixel;
+        }
+
+        if (numContinuations > 0u)
+        {
+            RayQueue& nextQueue = m_queues[1];
+            u32 first = m_numContinuations.fetch_add(numContinuations);
+            for (u32 i = 0; i < numContinuations; ++i)
+            {
+                nextQueue.origins[first + i] = continuations[i].ro;
+                nextQueue.directions[first + i] = continuations[i].rd;
+                nextQueue.throughputs[first + i] = continuations[i].throughput;
+                nextQueue.radiance[first + i] = continuations[i].radiance;
+                nextQueue.pixels[first + i] = continuations[i].pixel;
+            }
+        }
+    }
+}
@@ -14,6 +14,7 @@
 #include "camera.h"
 #include "mathUtils.h"
 #include "cyanEngine.h"
+#include "TextureStreamer.h"
 
 
 namespace Cyan
@@ -392,6 +393,22 @@ namespace Cyan
                 ImGui::Text("Indirect Lighting");
                 ImGui::Checkbox("Many View GI", &renderer->m_settings.bManyViewGIEnabled);
             }
+            if (ImGui::CollapsingHeader("Geometry"))
+            {
+                ImGui::Checkbox("Quantized Vertices", &renderer->m_settings.bQuantizedVertices);
+            }
+            if (ImGui::CollapsingHeader("Texture Streaming"))
+            {
+                if (TextureStreamer* streamer = TextureStreamer::get())
+                {
+                    ImGui::Text("Streamed Textures: %u", streamer->getNumTextures());
+                    ImGui::Text("Resident: %.2f MB", (f32)streamer->getResidentBytes() / (1024.f * 1024.f));
+                    i32 budgetInMB = (i32)(streamer->m_settings.budgetInBytes / (1024ull * 1024ull));
+                    ImGui::SliderInt("Budget (MB)", &budgetInMB, 64, 4096);
+                    streamer->m_settings.budgetInBytes = (u64)budgetInMB * 1024ull * 1024ull;
+                    ImGui::SliderFloat("Mip Bias", &streamer->m_settings.mipBias, -1.f, 4.f);
+                }
+            }
             if (ImGui::CollapsingHeader("Post Processing"))
             {
                 ImGui::TextUnformatted("Color Temperature"); ImGui::SameLine();
@@ -259,6 +259,8 @@ namespace Cyan {
 
             // convert Scene instance to RenderableScene instance for rendering
             RenderableScene renderableScene(scene, sceneView, m_frameAllocator);
+            // mips the main view needs, picked up by the texture streamer next frame
+            renderableScene.requestTextureMips(renderableScene.camera.view, renderableScene.camera.projection, (f32)renderResolution.y);
 
             // shadow
             renderShadowMaps(renderableScene);
@@ -511,4 +511,25 @@ namespace Cyan
         delete[] float2;
         return result;
     }
-}
\ No newline at end of file
+
+    f32 radicalInverse(u32 base, u32 index)
+    {
+        f32 invBase = 1.f / base;
+        f32 fraction = invBase;
+        f32 result = 0.f;
+        while (index > 0u)
+        {
+            result += (index % base) * fraction;
+            index /= base;
+            fraction *= invBase;
+        }
+        return result;
+    }
+
+    void calcOrthonormalBasis(const glm::vec3& n, glm::vec3& outTangent, glm::vec3& outBitangent)
+    {
+        glm::vec3 up = abs(n.y) < .95f ? glm::vec3(0.f, 1.f, 0.f) : glm::vec3(0.f, 0.f, 1.f);
+        outTangent = glm::normalize(glm::cross(up, n));
+        outBitangent = glm::cross(n, outTangent);
+    }
+}
@@ -2,6 +2,7 @@
 
 #extension GL_NV_bindless_texture : require
 #extension GL_ARB_gpu_shader_int64 : enable 
+#extension GL_ARB_sparse_texture_clamp : enable
 
 // header block, each shader file should only have one header block
 // = begin headers =
@@ -40,6 +41,7 @@ struct MaterialDesc
     float roughness;
     float emissive;
     uint flag;
+    uvec4 residencySlots;
 };
 
 in VSOutput 
@@ -212,21 +214,41 @@ vec4 tangentSpaceToWorldSpace(vec3 tangent, vec3 bitangent, vec3 worldSpaceNorma
     return tbn * vec4(tangentSpaceNormal, 0.f);
 }
 
+/**
+* Finest resident mip of every streamed texture indexed by its residency slot, slot 0 is shared by textures that aren't streamed
+*/
+layout(std430) buffer TextureResidencyBuffer {
+    float textureMinLods[];
+};
+
+// lookups into streamed textures are clamped to their resident mips, the bindless handle itself spans the whole mip chain
+vec4 sampleMaterialMap(uint64_t handle, uint residencySlot, vec2 texCoord) {
+    float minLod = textureMinLods[residencySlot];
+#ifdef GL_ARB_sparse_texture_clamp
+    return textureClampARB(sampler2D(handle), texCoord, minLod);
+#else
+    // scaling the gradients moves the lod picked by the hardware up to the clamp
+    float lod = textureQueryLod(sampler2D(handle), texCoord).y;
+    float gradientScale = exp2(max(minLod - lod, 0.f));
+    return textureGrad(sampler2D(handle), texCoord, dFdx(texCoord) * gradientScale, dFdy(texCoord) * gradientScale);
+#endif
+}
+
 Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpaceTangent, vec3 worldSpaceBitangent, vec2 texCoord) {
     Material outMaterial;
     
     outMaterial.normal = worldSpaceNormal;
     if ((desc.flag & kHasNormalMap) != 0u) {
-        vec3 tangentSpaceNormal = texture(sampler2D(desc.normalMap), texCoord).xyz;
-        // Convert from [0, 1] to [-1.0, 1.0] and renomalize if texture filtering changes the length
-        tangentSpaceNormal = normalize(tangentSpaceNormal * 2.f - 1.f);
+        // BC5 compressed normal maps only keep x and y, z is rebuilt assuming a unit length normal
+        vec2 normalXY = sampleMaterialMap(desc.normalMap, desc.residencySlots.y, texCoord).xy * 2.f - 1.f;
+        vec3 tangentSpaceNormal = normalize(vec3(normalXY, sqrt(max(1.f - dot(normalXY, normalXY), 0.f))));
         // Covert normal from tangent frame to camera space
         outMaterial.normal = normalize(tangentSpaceToWorldSpace(worldSpaceTangent, worldSpaceBitangent, worldSpaceNormal, tangentSpaceNormal).xyz);
     }
 
     outMaterial.albedo = desc.albedo.rgb;
     if ((desc.flag & kHasAlbedoMap) != 0u) {
-        outMaterial.albedo = texture(sampler2D(desc.albedoMap), texCoord).rgb;
+        outMaterial.albedo = sampleMaterialMap(desc.albedoMap, desc.residencySlots.x, texCoord).rgb;
 		// from sRGB to linear space if using a texture
 		outMaterial.albedo = vec3(pow(outMaterial.albedo.r, 2.2f), pow(outMaterial.albedo.g, 2.2f), pow(outMaterial.albedo.b, 2.2f));
     }
@@ -235,7 +257,7 @@ Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpac
     float roughness = desc.roughness, metallic = desc.metallic;
     if ((desc.flag & kHasMetallicRoughnessMap) != 0u)
     {
-        vec2 metallicRoughness = texture(sampler2D(desc.metallicRoughnessMap), texCoord).gb;
+        vec2 metallicRoughness = sampleMaterialMap(desc.metallicRoughnessMap, desc.residencySlots.z, texCoord).gb;
         roughness = metallicRoughness.x;
         roughness = roughness * roughness;
         metallic = metallicRoughness.y; 
@@ -245,7 +267,7 @@ Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpac
 
     outMaterial.occlusion = 1.f;
     if ((desc.flag & kHasOcclusionMap) != 0u) {
-        outMaterial.occlusion = texture(sampler2D(desc.occlusionMap), texCoord).r;
+        outMaterial.occlusion = sampleMaterialMap(desc.occlusionMap, desc.residencySlots.w, texCoord).r;
 		outMaterial.occlusion = pow(outMaterial.occlusion, 3.0f);
     }
 	return outMaterial;
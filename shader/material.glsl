@@ -1,5 +1,6 @@
 #extension GL_NV_bindless_texture : require
 #extension GL_ARB_gpu_shader_int64 : enable 
+#extension GL_ARB_sparse_texture_clamp : enable
 
 /**
 * Shared material definitions
@@ -21,6 +22,7 @@ const uint kHasOcclusionMap         = 1 << 3;
         f32 roughness = .5f;
         f32 emissive = 1.f;
         u32 flag = 0u;
+        glm::uvec4 residencySlots = glm::uvec4(0u);
     };
 */
 struct MaterialDesc {
@@ -33,6 +35,7 @@ struct MaterialDesc {
     float roughness;
     float emissive;
     uint flag;
+    uvec4 residencySlots;
 };
 
 /**
@@ -67,18 +70,39 @@ vec4 tangentSpaceToWorldSpace(vec3 tangent, vec3 bitangent, vec3 worldSpaceNorma
     return tbn * vec4(tangentSpaceNormal, 0.f);
 }
 
+/**
+* Finest resident mip of every streamed texture indexed by its residency slot, slot 0 is shared by textures that aren't streamed
+*/
+layout(std430) buffer TextureResidencyBuffer {
+    float textureMinLods[];
+};
+
+// lookups into streamed textures are clamped to their resident mips, the bindless handle itself spans the whole mip chain
+vec4 sampleMaterialMap(uint64_t handle, uint residencySlot, vec2 texCoord) {
+    float minLod = textureMinLods[residencySlot];
+#ifdef GL_ARB_sparse_texture_clamp
+    return textureClampARB(sampler2D(handle), texCoord, minLod);
+#else
+    // scaling the gradients moves the lod picked by the hardware up to the clamp
+    float lod = textureQueryLod(sampler2D(handle), texCoord).y;
+    float gradientScale = exp2(max(minLod - lod, 0.f));
+    return textureGrad(sampler2D(handle), texCoord, dFdx(texCoord) * gradientScale, dFdy(texCoord) * gradientScale);
+#endif
+}
+
 Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpaceTangent, vec3 worldSpaceBitangent, vec2 texCoord) {
     Material outMaterial;
 
     if ((desc.flag & kHasNormalMap) != 0u) {
-        vec3 tangentSpaceNormal = texture(sampler2D(desc.normalMap), texCoord).xyz;
-        tangentSpaceNormal = normalize(tangentSpaceNormal * 2.f - 1.f);
+        // BC5 compressed normal maps only keep x and y, z is rebuilt assuming a unit length normal
+        vec2 normalXY = sampleMaterialMap(desc.normalMap, desc.residencySlots.y, texCoord).xy * 2.f - 1.f;
+        vec3 tangentSpaceNormal = normalize(vec3(normalXY, sqrt(max(1.f - dot(normalXY, normalXY), 0.f))));
         outMaterial.normal = normalize(tangentSpaceToWorldSpace(worldSpaceTangent, worldSpaceBitangent, worldSpaceNormal, tangentSpaceNormal).xyz);
     }
 
     outMaterial.albedo = desc.albedo.rgb;
     if ((desc.flag & kHasAlbedoMap) != 0u) {
-        outMaterial.albedo = texture(sampler2D(desc.albedoMap), texCoord).rgb;
+        outMaterial.albedo = sampleMaterialMap(desc.albedoMap, desc.residencySlots.x, texCoord).rgb;
 		// from sRGB to linear space if using a texture
 		outMaterial.albedo = vec3(pow(outMaterial.albedo.r, 2.2f), pow(outMaterial.albedo.g, 2.2f), pow(outMaterial.albedo.b, 2.2f));
     }
@@ -87,7 +111,7 @@ Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpac
     float roughness = desc.roughness, metallic = desc.metallic;
     if ((desc.flag & kHasMetallicRoughnessMap) != 0u)
     {
-        vec2 metallicRoughness = texture(sampler2D(desc.metallicRoughnessMap), texCoord).gb;
+        vec2 metallicRoughness = sampleMaterialMap(desc.metallicRoughnessMap, desc.residencySlots.z, texCoord).gb;
         roughness = metallicRoughness.x;
         roughness = roughness * roughness;
         metallic = metallicRoughness.y; 
@@ -97,7 +121,7 @@ Material getMaterial(in MaterialDesc desc, vec3 worldSpaceNormal, vec3 worldSpac
 
     outMaterial.occlusion = 1.f;
     if ((desc.flag & kHasOcclusionMap) != 0u) {
-        outMaterial.occlusion = texture(sampler2D(desc.occlusionMap), texCoord).r;
+        outMaterial.occlusion = sampleMaterialMap(desc.occlusionMap, desc.residencySlots.w, texCoord).r;
 		outMaterial.occlusion = pow(outMaterial.occlusion, 3.0f);
     }
 	return outMaterial;
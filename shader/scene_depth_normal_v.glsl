@@ -30,7 +30,7 @@ struct Vertex
 
 layout(std430) buffer VertexBuffer 
 {
-	Vertex vertices[];
+	uint vertexData[];
 };
 
 layout(std430) buffer IndexBuffer 
@@ -57,6 +57,10 @@ struct SubmeshDesc
 	uint baseIndex;
 	uint numVertices;
 	uint numIndices;
+	vec3 positionMin;
+	uint vertexFormat;
+	vec3 positionScale;
+	uint padding;
 };
 
 layout(std430) buffer SubmeshBuffer 
@@ -64,6 +68,46 @@ layout(std430) buffer SubmeshBuffer
 	SubmeshDesc submeshDescs[];
 };
 
+/**
+* vertices are stored as raw words in either PackedGeometry::VertexFormat
+*/
+#define VERTEX_FORMAT_FULL 0
+#define VERTEX_FORMAT_QUANTIZED 1
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 v = vec3(e, 1.f - abs(e.x) - abs(e.y));
+	if (v.z < 0.f)
+	{
+		v.xy = (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+	}
+	return normalize(v);
+}
+
+Vertex fetchVertex(SubmeshDesc submesh, uint index)
+{
+	Vertex vertex;
+	if (submesh.vertexFormat == VERTEX_FORMAT_QUANTIZED)
+	{
+		uint base = (submesh.baseVertex + index) * 6u;
+		uvec3 position = uvec3(vertexData[base] & 0xffffu, vertexData[base] >> 16, vertexData[base + 1] & 0xffffu);
+		float handedness = (vertexData[base + 1] >> 16) != 0u ? -1.f : 1.f;
+		vertex.pos = vec4(submesh.positionMin + vec3(position) * submesh.positionScale, 1.f);
+		vertex.normal = vec4(decodeOctahedral(unpackSnorm2x16(vertexData[base + 2])), 0.f);
+		vertex.tangent = vec4(decodeOctahedral(unpackSnorm2x16(vertexData[base + 3])), handedness);
+		vertex.texCoord = vec4(unpackHalf2x16(vertexData[base + 4]), unpackHalf2x16(vertexData[base + 5]));
+	}
+	else
+	{
+		uint base = (submesh.baseVertex + index) * 16u;
+		vertex.pos = uintBitsToFloat(uvec4(vertexData[base], vertexData[base + 1], vertexData[base + 2], vertexData[base + 3]));
+		vertex.normal = uintBitsToFloat(uvec4(vertexData[base + 4], vertexData[base + 5], vertexData[base + 6], vertexData[base + 7]));
+		vertex.tangent = uintBitsToFloat(uvec4(vertexData[base + 8], vertexData[base + 9], vertexData[base + 10], vertexData[base + 11]));
+		vertex.texCoord = uintBitsToFloat(uvec4(vertexData[base + 12], vertexData[base + 13], vertexData[base + 14], vertexData[base + 15]));
+	}
+	return vertex;
+}
+
 /**
 	mirror's the material definition on application side
     struct GpuMaterial {
@@ -88,6 +132,7 @@ struct MaterialDesc {
     float roughness;
     float emissive;
     uint flag;
+    uvec4 residencySlots;
 };
 
 layout(std430) buffer MaterialBuffer
@@ -113,10 +158,9 @@ void main()
 {
 	uint instanceIndex = drawCalls[gl_DrawIDARB] + gl_InstanceID;
 	InstanceDesc instance = instanceDescs[instanceIndex];
-	uint baseVertex = submeshDescs[instance.submesh].baseVertex;
 	uint baseIndex = submeshDescs[instance.submesh].baseIndex;
 	uint index = indices[baseIndex + gl_VertexID];
-	Vertex vertex = vertices[baseVertex + index];
+	Vertex vertex = fetchVertex(submeshDescs[instance.submesh], index);
 	gl_Position = projection * view * transforms[instance.transform] * vertex.pos;
 
 	worldSpaceNormal = normalize((inverse(transpose(transforms[instance.transform])) * vertex.normal).xyz);